@@ -62,6 +62,10 @@ private:
   bool replacePrivateLoadsStores(Loop *loop);
   bool replaceReduxStores(Loop *loop, BasicBlock *bb);
   bool replaceReduxStores(Loop *loop);
+  bool needsThreadView(Loop *loop, Value *ptr);
+  Value *insertThreadView(Instruction *gravity, InstInsertPt where, Value *ptr);
+  bool translateThreadViews(Loop *loop, BasicBlock *bb);
+  bool translateThreadViews(Loop *loop);
   bool initFiniFcns();
   bool startInitializationFunction();
   bool startFinalizationFunction();
@@ -236,8 +236,17 @@ private:
   MDNode *prodConsCorrespondenceTag(
     Loop *loop, unsigned srcStage, unsigned dstStage,
     BasicBlock *block, unsigned posInBlock);
-  void insertProduce(Api &api, BasicBlock *atEnd, Value *q, Value *v, MDNode *tag, bool toReplicatedStage);
-  Value *insertConsume(Api &api, BasicBlock *atEnd, Value *q, Type *ty, MDNode *tag, bool toReplicatedStage);
+
+  // All values which one block sends over one queue
+  // travel as a single record: a queue, and whether
+  // it feeds/is read by a replicated stage.
+  typedef std::pair<Value*, bool> Channel;
+  typedef std::vector<Channel> Channels;
+
+  Value *insertRecordBuffer(Api &api, BasicBlock *atEnd, unsigned n);
+  void insertProduce(Api &api, BasicBlock *atEnd, Value *q, ArrayRef<Value*> vs, MDNode *tag, bool toReplicatedStage);
+  void insertConsume(Api &api, BasicBlock *atEnd, Value *q, ArrayRef<Type*> tys, MDNode *tag, bool toReplicatedStage,
+                     std::vector<Value*> &vs);
 
   typedef std::map<BasicBlock*, ControlSpeculation::LoopBlock > BB2LB;
 
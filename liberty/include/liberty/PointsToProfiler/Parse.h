@@ -11,6 +11,9 @@
 
 #include <map>
 #include <list>
+#include <vector>
+
+struct BinaryProfile;
 
 namespace liberty
 {
@@ -62,8 +65,23 @@ private:
   typedef std::list<std::string> TokList;
   TokList prev_tokens, next_tokens;
   unsigned lineno;
+  void tokenize(char *buffer);
   bool parse_line(char *line);
 
+  // Loader for the binary, mergeable form written by the
+  // runtime and by specpriv-profile-merge.  Records refer to
+  // values, AUs and contexts by string id, and each distinct
+  // string is parsed once and cached here.
+  bool parse_binary(const char *filename);
+  bool parse_binary_records(const BinaryProfile &profile, unsigned *nbad);
+  bool tokenize_string(const std::string &str);
+  bool binary_au(const BinaryProfile &profile, unsigned id, AU **au);
+  bool binary_ctx(const BinaryProfile &profile, unsigned id, Ctx **ctx);
+  bool binary_value(const BinaryProfile &profile, unsigned id, Value **value);
+  std::vector<AU*> binaryAUs;
+  std::vector<Ctx*> binaryCtxs;
+  std::vector<Value*> binaryValues;
+
   // Is the profile information complete w.r.t.
   //  - Allocation coverage?
   bool isAllocationCoverageComplete;
@@ -109,6 +109,12 @@ struct Api
     formals.push_back(u64);
     fqi2v = FunctionType::get(voidty, formals, false);
 
+    formals.clear();
+    formals.push_back(queueTyPtr);
+    formals.push_back( PointerType::getUnqual(u64) );
+    formals.push_back(u32);
+    fqpi2v = FunctionType::get(voidty, formals, false);
+
     formals.clear();
     formals.push_back(voidptr);
     formals.push_back(u64);
@@ -287,6 +293,18 @@ struct Api
     return cast<Constant>(wrapper.getCallee());
   }
 
+  Constant *getOwnsIter()
+  {
+    std::vector<Type*> formals(2);
+    formals[0] = u32; // replica id
+    formals[1] = u32; // replication factor
+    FunctionType *fty = FunctionType::get(u32, formals, false);
+
+    std::string name = (Twine(personality) + "_owns_iter").str();
+    FunctionCallee wrapper = mod->getOrInsertFunction(name,fty);
+    return cast<Constant>(wrapper.getCallee());
+  }
+
   Constant *getAlloc(HeapAssignment::Type heap)
   {
     if( heap == HeapAssignment::Redux )
@@ -362,6 +380,16 @@ struct Api
     FunctionCallee wrapper = mod->getOrInsertFunction(name,fty);
     return cast<Constant>(wrapper.getCallee());
   }
+  Constant *getThreadView()
+  {
+    std::vector<Type*> formals(1);
+    formals[0] = voidptr;
+    FunctionType *fty = FunctionType::get(voidptr, formals, false);
+
+    std::string name = (Twine(personality) + "_thread_view").str();
+    FunctionCallee wrapper = mod->getOrInsertFunction(name,fty);
+    return cast<Constant>(wrapper.getCallee());
+  }
   Constant *getReduxWriteRange()
   {
     std::vector<Type*> formals(2);
@@ -474,6 +502,14 @@ struct Api
     return cast<Constant>(wrapper.getCallee());
   }
 
+  // A u32 which the code sets when a min/max redux (with
+  // dependent reductions) changes; see __specpriv_end_iter.
+  Constant *getReduxUpdated()
+  {
+    std::string name = (Twine(personality) + "_redux_updated").str();
+    return mod->getOrInsertGlobal(name,u32);
+  }
+
   Constant *getNumLocals()
   {
     std::string name = (Twine(personality) + "_num_local").str();
@@ -597,6 +633,35 @@ struct Api
     return cast<Constant>(wrapper.getCallee());
   }
 
+  // Send/receive many values as one record.
+  Constant *getProduceRecord()
+  {
+    std::string name = (Twine(personality) + "_produce_record").str();
+    FunctionCallee wrapper = mod->getOrInsertFunction(name,fqpi2v);
+    return cast<Constant>(wrapper.getCallee());
+  }
+
+  Constant *getProduceRecordToReplicated()
+  {
+    std::string name = (Twine(personality) + "_produce_record_replicated").str();
+    FunctionCallee wrapper = mod->getOrInsertFunction(name,fqpi2v);
+    return cast<Constant>(wrapper.getCallee());
+  }
+
+  Constant *getConsumeRecord()
+  {
+    std::string name = (Twine(personality) + "_consume_record").str();
+    FunctionCallee wrapper = mod->getOrInsertFunction(name,fqpi2v);
+    return cast<Constant>(wrapper.getCallee());
+  }
+
+  Constant *getConsumeRecordInReplicated()
+  {
+    std::string name = (Twine(personality) + "_consume_record_replicated").str();
+    FunctionCallee wrapper = mod->getOrInsertFunction(name,fqpi2v);
+    return cast<Constant>(wrapper.getCallee());
+  }
+
   Constant *getCreateQueue()
   {
     std::string name = (Twine(personality) + "_create_queue").str();
@@ -1231,7 +1296,7 @@ private:
   PointerType *queueTyPtr;
   IntegerType *u1, *u8, *u16, *u32, *u64;
   FunctionType *fv2v, *fv2i, *fi2i, *fi2v, *fii2v;
-  FunctionType *fqi2v, *fq2i, *fq2v, *fii2q, *f4i2v, *f2i2v;
+  FunctionType *fqi2v, *fqpi2v, *fq2i, *fq2v, *fii2q, *f4i2v, *f2i2v;
   FunctionType *ficvp2i;
   FunctionType *fvp2v, *fvpi2v, *fvpii2v, *fvpivp2v;
   FunctionType *fi2i64, *fi642v;
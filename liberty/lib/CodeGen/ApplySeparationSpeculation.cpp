@@ -46,11 +46,17 @@ STATISTIC(numUOTests,     "UO tests inserted");
 STATISTIC(numPrivRead,    "Private reads instrumented");
 STATISTIC(numPrivWrite,   "Private writes instrumented");
 STATISTIC(numReduxWrite,  "Redux writes instrumented");
+STATISTIC(numThreadViews, "Accesses routed through thread views");
 
 static cl::opt<bool> DontCheckPrivacy(
   "evil-dont-check-privacy", cl::init(false), cl::Hidden,
   cl::desc("Do not insert checks for private reads/writes"));
 
+static cl::opt<bool> ThreadBackend(
+  "specpriv-thread-backend", cl::init(false),
+  cl::desc("Route accesses to private, killprivate and redux objects "
+           "through __specpriv_thread_view, for the thread-based runtime"));
+
 const Selector &ApplySeparationSpec::getSelector() const
 {
   return getAnalysis< Selector >();
@@ -211,6 +217,12 @@ bool ApplySeparationSpec::manageMemOps(Loop *loop)
   if( ! DontCheckPrivacy )
     modified |= replacePrivateLoadsStores(loop);
 
+  // Workers of the thread-based runtime share one address
+  // space, and see those heaps at addresses of their own.
+  // The checks above keep the natural addresses.
+  if( ThreadBackend )
+    modified |= translateThreadViews(loop);
+
   // Report footprint of reduction operators
   // replaceReduxStores is now deprecated since runtime does not require
   // instrumentation of redux stores
@@ -615,6 +627,122 @@ bool ApplySeparationSpec::replacePrivateLoadsStores(Loop *loop)
 
   return modified;
 }
+bool ApplySeparationSpec::needsThreadView(Loop *loop, Value *ptr)
+{
+  switch( selectHeap(ptr,loop) )
+  {
+    case HeapAssignment::Private:
+    case HeapAssignment::KillPrivate:
+    case HeapAssignment::Redux:
+      return true;
+    default:
+      return false;
+  }
+}
+
+Value *ApplySeparationSpec::insertThreadView(Instruction *gravity, InstInsertPt where, Value *ptr)
+{
+  ++numThreadViews;
+
+  Preprocess &preprocess = getAnalysis< Preprocess >();
+
+  // Maybe cast to void*
+  Value *base = ptr;
+  if( base->getType() != voidptr )
+  {
+    Instruction *cast = new BitCastInst(ptr, voidptr);
+    where << cast;
+    preprocess.addToLPS(cast, gravity);
+    base = cast;
+  }
+
+  Constant *threadview = Api(mod).getThreadView();
+  Value *actuals[] = { base };
+  Instruction *view = CallInst::Create(threadview, ArrayRef<Value*>(&actuals[0], &actuals[1]) );
+  where << view;
+  preprocess.addToLPS(view, gravity);
+
+  // And back again
+  if( ptr->getType() == voidptr )
+    return view;
+
+  Instruction *cast = new BitCastInst(view, ptr->getType());
+  where << cast;
+  preprocess.addToLPS(cast, gravity);
+  return cast;
+}
+
+bool ApplySeparationSpec::translateThreadViews(Loop *loop, BasicBlock *bb)
+{
+  bool modified = false;
+  for(BasicBlock::iterator i=bb->begin(), e=bb->end(); i!=e; ++i)
+  {
+    Instruction *inst = &*i;
+
+    // Which operands are pointers that the
+    // instruction dereferences?
+    std::vector<unsigned> operands;
+    if( LoadInst *load = dyn_cast< LoadInst >(inst) )
+      operands.push_back( load->getPointerOperandIndex() );
+    else if( StoreInst *store = dyn_cast< StoreInst >(inst) )
+      operands.push_back( store->getPointerOperandIndex() );
+    // dest is argument 0, source argument 1
+    else if( isa< MemTransferInst >(inst) )
+    {
+      operands.push_back(0);
+      operands.push_back(1);
+    }
+    else if( isa< MemSetInst >(inst) )
+      operands.push_back(0);
+    else if( CallBase *call = dyn_cast< CallBase >(inst) )
+    {
+      // Calls into the RoI have their own accesses
+      // translated; library calls do not.
+      Function *callee = call->getCalledFunction();
+      if( !callee || !callee->isDeclaration() || callee->isIntrinsic() )
+        continue;
+      if( callee->getName().startswith("__specpriv_") )
+        continue;
+
+      for(unsigned a=0, n=call->arg_size(); a<n; ++a)
+        if( call->getArgOperand(a)->getType()->isPointerTy() )
+          operands.push_back(a);
+    }
+
+    for(unsigned k=0; k<operands.size(); ++k)
+    {
+      Value *ptr = inst->getOperand( operands[k] );
+      if( !needsThreadView(loop,ptr) )
+        continue;
+
+      const GlobalVariable *gv = dyn_cast<GlobalVariable>(ptr);
+      if (gv && gv->hasExternalLinkage()) {
+        // externally defined objects such as stdout or stderr stay put
+        continue;
+      }
+
+      LLVM_DEBUG(errs() << "Routing through thread view: " << *inst << '\n');
+
+      Value *view = insertThreadView(inst, InstInsertPt::Before(inst), ptr);
+      inst->setOperand( operands[k], view );
+      modified = true;
+    }
+  }
+
+  return modified;
+}
+
+bool ApplySeparationSpec::translateThreadViews(Loop *loop)
+{
+  bool modified = false;
+  Preprocess &preprocess = getAnalysis< Preprocess >();
+  const RoI &roi = preprocess.getRoI();
+  for(RoI::BBSet::iterator i=roi.bbs.begin(), e=roi.bbs.end(); i!=e; ++i)
+    modified |= translateThreadViews(loop,*i);
+
+  return modified;
+}
+
 bool ApplySeparationSpec::replaceReduxStores(Loop *loop)
 {
   bool modified = false;
@@ -31,6 +31,7 @@ STATISTIC(numProduce, "Produces inserted (normal)");
 STATISTIC(numProduceReplicated, "Produces inserted (to a replicated stage)");
 STATISTIC(numConsume, "Consumes inserted (normal)");
 STATISTIC(numConsumeReplicated, "Consumes inserted (in a replicated stage)");
+STATISTIC(numRecordsProduced, "Records produced (one per block and queue)");
 
 cl::opt<bool> WriteStageCFGs(
   "mtcg-write-cfgs", cl::init(false), cl::Hidden,
@@ -488,10 +489,13 @@ BasicBlock *MTCG::stitchLoops(
   replaceIncomingEdgesExcept(header_off,preheader_off,newHeader);
 
   // Alternate between the ON and OFF iterations.
-  Constant *getIterNum = api.getCurrentIter();
-  Value *iter = CallInst::Create(getIterNum, "current.iteration", newHeader);
-  Value *phase  = BinaryOperator::Create(Instruction::URem, iter, repFactor, "phase", newHeader);
-  Value *cmp  = CmpInst::Create(Instruction::ICmp, ICmpInst::ICMP_EQ, phase, repId, "on/off", newHeader);
+  // The runtime decides which iterations this replica
+  // owns (round-robin, or claimed dynamically).
+  Constant *ownsIter = api.getOwnsIter();
+  Value *ownsArgs[] = { repId, repFactor };
+  Value *owns = CallInst::Create(ownsIter, ownsArgs, "owns.iteration", newHeader);
+  Value *zero = ConstantInt::get(api.getU32(), 0);
+  Value *cmp  = CmpInst::Create(Instruction::ICmp, ICmpInst::ICMP_NE, owns, zero, "on/off", newHeader);
   BranchInst::Create(preheader_on,preheader_off,cmp, newHeader);
 
   preheader_on->setName( "ON." + preheader_on->getName() );
@@ -795,6 +799,40 @@ BasicBlock *MTCG::copyInstructions(
 
       unsigned positionInBlock = 0;
 
+      // Which values does this block receive over each queue?
+      Channels consumeChannels;
+      std::vector< std::vector<Instruction*> > consumed;
+      for(BasicBlock::iterator i=bb->begin(), e=bb->end(); i!=e; ++i)
+      {
+        PreparedStrategy::ConsumeFrom::const_iterator zz = cons.find(&*i);
+        if( zz == cons.end() )
+          continue;
+
+        const Channel ch( stage2queue[ zz->second.first ], zz->second.second );
+        const unsigned k = std::find(consumeChannels.begin(), consumeChannels.end(), ch) - consumeChannels.begin();
+        if( k == consumeChannels.size() )
+        {
+          consumeChannels.push_back(ch);
+          consumed.resize(k+1);
+        }
+        consumed[k].push_back( &*i );
+      }
+
+      // Values which this block sends over each queue; they are
+      // produced together before the terminator.
+      Channels produceChannels;
+      std::vector< std::vector<Value*> > produced;
+      std::vector< MDNode* > produceTags;
+      bool producedRecords = false;
+      auto insertProduces = [&]()
+      {
+        if( producedRecords )
+          return;
+        producedRecords = true;
+        for(unsigned k=0, K=produceChannels.size(); k<K; ++k)
+          insertProduce(api, cloneBB, produceChannels[k].first, produced[k], produceTags[k], produceChannels[k].second);
+      };
+
       // Foreach instruction in this block:
       //  - possibly consume its value from an earlier stage.
       //  - possibly copy the instruction.
@@ -803,10 +841,18 @@ BasicBlock *MTCG::copyInstructions(
       {
         Instruction *inst = &*i;
 
+        if( inst->isTerminator() )
+          insertProduces();
+
         // Do we need to consume its value from an earlier stage?
+        // The first such value of each queue receives the
+        // whole record of this block.
         PreparedStrategy::ConsumeFrom::const_iterator zz = cons.find(inst);
         if( zz != cons.end() )
         {
+          if( vmap.count(inst) )
+            continue;
+
           const PreparedStrategy::ConsumeStartPoint &consumeFrom = zz->second;
           unsigned consumeFromStage = consumeFrom.first;
           bool     consumeWithinReplicable = consumeFrom.second;
@@ -815,9 +861,21 @@ BasicBlock *MTCG::copyInstructions(
             loop, consumeFromStage, stageno, bb, positionInBlock);
 
           Value *consumeFromQueue = stage2queue[ consumeFromStage ];
-          Value *v = insertConsume(api, cloneBB, consumeFromQueue, inst->getType(), tag, consumeWithinReplicable);
-          v->setName( inst->getName() );
-          vmap[ inst ] = v;
+          const Channel ch(consumeFromQueue, consumeWithinReplicable);
+          const std::vector<Instruction*> &record = consumed[
+            std::find(consumeChannels.begin(), consumeChannels.end(), ch) - consumeChannels.begin() ];
+
+          std::vector<Type*> tys;
+          for(unsigned k=0, K=record.size(); k<K; ++k)
+            tys.push_back( record[k]->getType() );
+
+          std::vector<Value*> vs;
+          insertConsume(api, cloneBB, consumeFromQueue, tys, tag, consumeWithinReplicable, vs);
+          for(unsigned k=0, K=record.size(); k<K; ++k)
+          {
+            vs[k]->setName( record[k]->getName() );
+            vmap[ record[k] ] = vs[k];
+          }
         }
 
         // Should we copy this instruction to this thread?
@@ -835,6 +893,11 @@ BasicBlock *MTCG::copyInstructions(
           PreparedStrategy::ProduceTo::const_iterator zz = prods.find(inst);
           if( zz != prods.end() )
           {
+            // The record is produced before the terminator, where
+            // the value of an invoke is not yet defined.
+            assert( !inst->isTerminator()
+            && "Cannot produce the value of a terminator (e.g. invoke)");
+
             const PreparedStrategy::ProduceEndPoints &endPoints = zz->second;
             for(PreparedStrategy::ProduceEndPoints::const_iterator j=endPoints.begin(), z=endPoints.end(); j!=z; ++j)
             {
@@ -842,14 +905,21 @@ BasicBlock *MTCG::copyInstructions(
               unsigned produceToStage = endPoint.first;
               bool     produceToReplicated = endPoint.second;
 
-              MDNode *tag = prodConsCorrespondenceTag(
-                loop, stageno, produceToStage, bb, positionInBlock);
-              Value *produceToQueue = stage2queue[ produceToStage ];
-              insertProduce(api, cloneBB, produceToQueue, inst, tag, produceToReplicated);
+              const Channel ch( stage2queue[ produceToStage ], produceToReplicated );
+              const unsigned k = std::find(produceChannels.begin(), produceChannels.end(), ch) - produceChannels.begin();
+              if( k == produceChannels.size() )
+              {
+                produceChannels.push_back(ch);
+                produced.resize(k+1);
+                produceTags.push_back( prodConsCorrespondenceTag(
+                  loop, stageno, produceToStage, bb, positionInBlock) );
+              }
+              produced[k].push_back(inst);
             }
           }
         }
       }
+      insertProduces();
 
       //errs() << "BB:\n" << *bb << "\n     Clone:\n"  << *cloneBB << "\n";
 
@@ -1207,77 +1277,114 @@ BasicBlock *MTCG::copyInstructions(
   return preheader;
 }
 
-void MTCG::insertProduce(Api &api, BasicBlock *atEnd, Value *q, Value *v, MDNode *tag, bool toReplicatedStage)
+// A stack buffer of n u64s for a record, in the entry block.
+Value *MTCG::insertRecordBuffer(Api &api, BasicBlock *atEnd, unsigned n)
+{
+  IntegerType *u32 = api.getU32(), *u64 = api.getU64();
+  ArrayType *recordTy = ArrayType::get(u64, n);
+
+  BasicBlock &entry = atEnd->getParent()->getEntryBlock();
+  AllocaInst *buffer = entry.empty()
+    ? new AllocaInst(recordTy, 0, "record", &entry)
+    : new AllocaInst(recordTy, 0, "record", &entry.front());
+
+  Value *zero = ConstantInt::get(u32, 0);
+  Value *indices[] = { zero, zero };
+  return GetElementPtrInst::CreateInBounds(recordTy, buffer, ArrayRef<Value*>(indices), "", atEnd);
+}
+
+void MTCG::insertProduce(Api &api, BasicBlock *atEnd, Value *q, ArrayRef<Value*> vs, MDNode *tag, bool toReplicatedStage)
 {
   IntegerType *u32 = api.getU32(), *u64 = api.getU64();
-  if( v->getType()->isPointerTy() )
-    v = new PtrToIntInst(v,u64,"",atEnd);
-  if( v->getType()->isFloatTy() )
-    v = new BitCastInst(v,u32,"",atEnd);
-  if( v->getType()->isDoubleTy() )
-    v = new BitCastInst(v,u64,"",atEnd);
-  if( IntegerType *intty = dyn_cast<IntegerType>(v->getType()) )
-    if( intty->getBitWidth() < u64->getBitWidth() )
-      v = new ZExtInst(v,u64,"",atEnd);
-  assert( v->getType() == u64 && "Can't produce values of this type");
+  Value *buffer = insertRecordBuffer(api, atEnd, vs.size());
+
+  for(unsigned k=0, K=vs.size(); k<K; ++k)
+  {
+    Value *v = vs[k];
+    if( v->getType()->isPointerTy() )
+      v = new PtrToIntInst(v,u64,"",atEnd);
+    if( v->getType()->isFloatTy() )
+      v = new BitCastInst(v,u32,"",atEnd);
+    if( v->getType()->isDoubleTy() )
+      v = new BitCastInst(v,u64,"",atEnd);
+    if( IntegerType *intty = dyn_cast<IntegerType>(v->getType()) )
+      if( intty->getBitWidth() < u64->getBitWidth() )
+        v = new ZExtInst(v,u64,"",atEnd);
+    assert( v->getType() == u64 && "Can't produce values of this type");
+
+    Value *slot = k ? GetElementPtrInst::CreateInBounds(u64, buffer, ConstantInt::get(u32, k), "", atEnd) : buffer;
+    new StoreInst(v, slot, atEnd);
+  }
 
   Constant *prod = 0;
   if( toReplicatedStage )
   {
-    prod = api.getProduceToReplicated();
-    ++numProduceReplicated;
+    prod = api.getProduceRecordToReplicated();
+    numProduceReplicated += vs.size();
   }
   else
   {
-    prod = api.getProduce();
-    ++numProduce;
+    prod = api.getProduceRecord();
+    numProduce += vs.size();
   }
+  ++numRecordsProduced;
 
-  SmallVector<Value*,2> args(2);
+  SmallVector<Value*,3> args(3);
   args[0] = q;
-  args[1] = v;
+  args[1] = buffer;
+  args[2] = ConstantInt::get(u32, vs.size());
   Instruction *call = CallInst::Create( prod, ArrayRef<Value*>(args),"",atEnd);
 
   if( tag )
     call->setMetadata("mtcg.channel", tag);
 }
 
-Value *MTCG::insertConsume(Api &api, BasicBlock *atEnd, Value *q, Type *ty, MDNode *tag, bool toReplicatedStage)
+void MTCG::insertConsume(Api &api, BasicBlock *atEnd, Value *q, ArrayRef<Type*> tys, MDNode *tag, bool toReplicatedStage,
+                         std::vector<Value*> &vs)
 {
   Constant *cons = 0;
   if( toReplicatedStage )
   {
-    cons = api.getConsumeInReplicated();
-    ++numConsumeReplicated;
+    cons = api.getConsumeRecordInReplicated();
+    numConsumeReplicated += tys.size();
   }
   else
   {
-    cons = api.getConsume();
-    ++numConsume;
+    cons = api.getConsumeRecord();
+    numConsume += tys.size();
   }
 
-  IntegerType *u32 = api.getU32();
-  SmallVector<Value*,1> args(1);
+  IntegerType *u32 = api.getU32(), *u64 = api.getU64();
+  Value *buffer = insertRecordBuffer(api, atEnd, tys.size());
+
+  SmallVector<Value*,3> args(3);
   args[0] = q;
+  args[1] = buffer;
+  args[2] = ConstantInt::get(u32, tys.size());
   Instruction *call = CallInst::Create(cons, ArrayRef<Value*>(args), "", atEnd);
   if( tag )
     call->setMetadata("mtcg.channel", tag);
 
-  Value *v = call;
-  if( IntegerType *intty = dyn_cast<IntegerType>(ty) )
-    if( intty->getBitWidth() < cast<IntegerType>(v->getType())->getBitWidth() )
-      v = new TruncInst(v,ty,"",atEnd);
-  if( ty->isDoubleTy() )
-    v = new BitCastInst(v,ty,"",atEnd);
-  if( ty->isFloatTy() )
+  for(unsigned k=0, K=tys.size(); k<K; ++k)
   {
-    v = new TruncInst(v,u32,"",atEnd);
-    v = new BitCastInst(v,ty,"",atEnd);
+    Type *ty = tys[k];
+    Value *slot = k ? GetElementPtrInst::CreateInBounds(u64, buffer, ConstantInt::get(u32, k), "", atEnd) : buffer;
+    Value *v = new LoadInst(u64, slot, "", atEnd);
+    if( IntegerType *intty = dyn_cast<IntegerType>(ty) )
+      if( intty->getBitWidth() < cast<IntegerType>(v->getType())->getBitWidth() )
+        v = new TruncInst(v,ty,"",atEnd);
+    if( ty->isDoubleTy() )
+      v = new BitCastInst(v,ty,"",atEnd);
+    if( ty->isFloatTy() )
+    {
+      v = new TruncInst(v,u32,"",atEnd);
+      v = new BitCastInst(v,ty,"",atEnd);
+    }
+    if( ty->isPointerTy() )
+      v = new IntToPtrInst(v,ty,"",atEnd);
+    assert( v->getType() == ty && "Can't consume values of this type");
+    vs.push_back(v);
   }
-  if( ty->isPointerTy() )
-    v = new IntToPtrInst(v,ty,"",atEnd);
-  assert( v->getType() == ty && "Can't consume values of this type");
-  return v;
 }
 
 ControlSpeculation::LoopBlock MTCG::closestRelevantPostdom(BasicBlock *bb, const BBSet &rel, const LoopPostDom &pdt, MTCG::BB2LB &cache) const
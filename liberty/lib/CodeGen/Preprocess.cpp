@@ -1021,6 +1021,10 @@ bool Preprocess::demoteLiveOutsAndPhis(Loop *loop, LiveoutStructure &liveoutStru
       }
     }
   }
+  // Reducible live-outs stay in registers during the loop.  Their
+  // redux objects are written before the loop, at loop exits, and,
+  // if checkpoints are needed, in the save.redux.lc blocks, which
+  // MTCG runs only when a checkpoint is imminent.
   for (unsigned i = 0; i < K; ++i) {
     Instruction *reduxI = reduxLiveouts[i];
     PHINode *phi = dyn_cast<PHINode>(reduxI);
@@ -1029,6 +1033,11 @@ bool Preprocess::demoteLiveOutsAndPhis(Loop *loop, LiveoutStructure &liveoutStru
     for (unsigned j = 0; j < phi->getNumIncomingValues(); ++j) {
       BasicBlock *pred = phi->getIncomingBlock(j);
 
+      // Without checkpoints, nobody reads the redux object until
+      // the loop exits; do not write it on every iteration.
+      if (!checkpointNeeded.count(header) && loop->contains(pred))
+        continue;
+
       Value *vdef = phi->getIncomingValue(j);
       StoreInst *store = new StoreInst(vdef, liveoutStructure.reduxObjects[i]);
       InstInsertPt::End(pred) << store;
@@ -1043,10 +1052,12 @@ bool Preprocess::demoteLiveOutsAndPhis(Loop *loop, LiveoutStructure &liveoutStru
     }
   }
 
-  // add API call to update the last min/max iter change if we have a
-  // dependent min/max redux
+  // record the last min/max iter change if we have a dependent min/max
+  // redux.  Rather than call the runtime on every iteration, raise the
+  // runtime's __specpriv_redux_updated flag; __specpriv_end_iter turns
+  // it into the last-update iteration.
   if (reduxUpdateInst.count(header)) {
-    Constant *setLastReduxUpIter = Api(mod).getSetLastReduxUpIter();
+    Constant *reduxUpdated = Api(mod).getReduxUpdated();
     Instruction *updateInst =
         const_cast<Instruction *>(reduxUpdateInst[header]);
     SelectInst *updateInstS = dyn_cast<SelectInst>(updateInst);
@@ -1054,27 +1065,22 @@ bool Preprocess::demoteLiveOutsAndPhis(Loop *loop, LiveoutStructure &liveoutStru
     assert((updateInstS||updateInstB) && "Redux update inst with dependent redux is not a "
                           "select or branch.");
     // check if there was an update of min/max or not
-    if(updateInstS){
-        SelectInst *setBool = SelectInst::Create(
-          updateInstS->getCondition(), ConstantInt::get(u32, 1),
-          ConstantInt::get(u32, 0), "min.max.changed");
-        CallInst *callSetLastUpI = CallInst::Create(setLastReduxUpIter, setBool);
-        InstInsertPt::End(updateInst->getParent()) << setBool << callSetLastUpI;
-        addToLPS(setBool, updateInst);
-        addToLPS(callSetLastUpI, updateInst);
-    }
+    Value *changed = nullptr;
+    if(updateInstS)
+      changed = updateInstS->getCondition();
     else if(updateInstB){
-      Value *cmpInstVal = (Value*) reduxCmpInst[header];
-      assert(cmpInstVal && "No cmp instruction found?\n" );
-      SelectInst *setBool = SelectInst::Create(
-        cmpInstVal, ConstantInt::get(u32, 1),
-        ConstantInt::get(u32, 0), "min.max.changed");
-      CallInst *callSetLastUpI = CallInst::Create(setLastReduxUpIter, setBool);
-      InstInsertPt::End(updateInst->getParent()) << setBool << callSetLastUpI;
-      addToLPS(setBool, updateInst);
-      addToLPS(callSetLastUpI, updateInst);
-      errs() << "Redux about to be implemented\n";
+      changed = (Value*) reduxCmpInst[header];
+      assert(changed && "No cmp instruction found?\n" );
     }
+
+    LoadInst *flag = new LoadInst(reduxUpdated, "min.max.flag");
+    SelectInst *setFlag = SelectInst::Create(
+      changed, ConstantInt::get(u32, 1), flag, "min.max.changed");
+    StoreInst *storeFlag = new StoreInst(setFlag, reduxUpdated);
+    InstInsertPt::End(updateInst->getParent()) << flag << setFlag << storeFlag;
+    addToLPS(flag, updateInst);
+    addToLPS(setFlag, updateInst);
+    addToLPS(storeFlag, updateInst);
   }
 
   // TODO: replace loads from/stores to this structure with
@@ -6,6 +6,7 @@
 #include "llvm/Support/Debug.h"
 
 #include "liberty/PointsToProfiler/Parse.h"
+#include "binprofile.h"
 #include "scaf/Utilities/CallSiteFactory.h"
 #include "scaf/Utilities/FindUnderlyingObjects.h"
 #include "scaf/Utilities/GetMemOper.h"
@@ -20,6 +21,7 @@ namespace SpecPriv
 using namespace llvm;
 
 STATISTIC(numLines, "Lines read from SpecPriv profile");
+STATISTIC(numRecords, "Records read from binary SpecPriv profile");
 
 raw_ostream &Parse::error()
 {
@@ -807,6 +809,19 @@ bool Parse::parse_ptr_predictions(Value **valueout, Ctx **ctxout, Ptrs &ptrsout)
   return true;
 }
 
+void Parse::tokenize(char *buffer)
+{
+  prev_tokens.clear();
+  next_tokens.clear();
+  char *state=0;
+  if( const char *tok0 = strtok_r(buffer," \t\r\n",&state) )
+  {
+    next_tokens.push_back(tok0);
+    while( const char *toki = strtok_r(0," \t\r\n",&state) )
+      next_tokens.push_back(toki);
+  }
+}
+
 bool Parse::parse_line(char *buffer)
 {
   // Types of message:
@@ -847,16 +862,7 @@ bool Parse::parse_line(char *buffer)
   //  <p-value> ::= ( OFFSET <n> BASE <au> COUNT <m> )
   //  <r-value> ::= 0 | 1 | 2 | ... | 15
 
-  // Tokenize the string
-  prev_tokens.clear();
-  next_tokens.clear();
-  char *state=0;
-  if( const char *tok0 = strtok_r(buffer," \t\r\n",&state) )
-  {
-    next_tokens.push_back(tok0);
-    while( const char *toki = strtok_r(0," \t\r\n",&state) )
-      next_tokens.push_back(toki);
-  }
+  tokenize(buffer);
 
   // empty lines are ok
   if( next_tokens.empty() )
@@ -900,10 +906,228 @@ Parse::Parse(Module &mod) : module(mod), sema(0)
 {
 }
 
+bool Parse::tokenize_string(const std::string &str)
+{
+  std::vector<char> buffer(str.begin(), str.end());
+  buffer.push_back('\0');
+  tokenize(&buffer[0]);
+  return !next_tokens.empty();
+}
+
+bool Parse::binary_au(const BinaryProfile &profile, unsigned id, AU **auout)
+{
+  if( !binaryAUs[id] )
+  {
+    if( !tokenize_string( profile.str(id) ) || !parse_au(&binaryAUs[id]) )
+      return false;
+    if( !next_tokens.empty() )
+    {
+      error() << "trailing tokens after AU\n";
+      return false;
+    }
+  }
+
+  *auout = binaryAUs[id];
+  return true;
+}
+
+bool Parse::binary_ctx(const BinaryProfile &profile, unsigned id, Ctx **ctxout)
+{
+  if( !binaryCtxs[id] )
+  {
+    if( !tokenize_string( profile.str(id) ) || !parse_ctx(&binaryCtxs[id]) )
+      return false;
+    if( !next_tokens.empty() )
+    {
+      error() << "trailing tokens after context\n";
+      return false;
+    }
+  }
+
+  *ctxout = binaryCtxs[id];
+  return true;
+}
+
+bool Parse::binary_value(const BinaryProfile &profile, unsigned id, Value **valueout)
+{
+  if( !binaryValues[id] )
+  {
+    if( !tokenize_string( profile.str(id) ) || !parse_value(&binaryValues[id]) )
+      return false;
+    if( !next_tokens.empty() )
+    {
+      error() << "trailing tokens after value\n";
+      return false;
+    }
+  }
+
+  *valueout = binaryValues[id];
+  return true;
+}
+
+bool Parse::parse_binary_records(const BinaryProfile &profile, unsigned *nbad)
+{
+  typedef BinaryProfile::ObjectMap ObjectMap;
+  typedef BinaryProfile::IntSiteMap IntSiteMap;
+  typedef BinaryProfile::PtrSiteMap PtrSiteMap;
+  typedef BinaryProfile::ResidueMap ResidueMap;
+
+  // Allocation coverage must be known before any AU is parsed.
+  if( profile.incomplete.empty() )
+  {
+    tokenize_string("ALLOCATION INFO ;");
+    parse_complete();
+  }
+  for(std::set<unsigned>::const_iterator i=profile.incomplete.begin(), e=profile.incomplete.end(); i!=e; ++i)
+  {
+    ++lineno;
+    tokenize_string("ALLOCATION INFO " + profile.str(*i) + " ;");
+    if( !parse_incomplete() )
+      ++*nbad;
+  }
+
+  for(ObjectMap::const_iterator i=profile.escapes.begin(), e=profile.escapes.end(); i!=e; ++i)
+  {
+    ++lineno;
+    AU *au = 0;
+    Ctx *ctx = 0;
+    if( !binary_au(profile, i->first.item, &au)
+    ||  !binary_ctx(profile, i->first.ctx, &ctx)
+    ||  !sema->sem_escape_object(au, ctx, i->second) )
+      ++*nbad;
+  }
+
+  for(ObjectMap::const_iterator i=profile.locals.begin(), e=profile.locals.end(); i!=e; ++i)
+  {
+    if( profile.escapes.count(i->first) )
+      continue;
+
+    ++lineno;
+    AU *au = 0;
+    Ctx *ctx = 0;
+    if( !binary_au(profile, i->first.item, &au)
+    ||  !binary_ctx(profile, i->first.ctx, &ctx)
+    ||  !sema->sem_local_object(au, ctx, i->second) )
+      ++*nbad;
+  }
+
+  // Unpredictable sites are skipped, as they
+  // are commented-out in the textual profile.
+  for(IntSiteMap::const_iterator i=profile.ints.begin(), e=profile.ints.end(); i!=e; ++i)
+  {
+    const BinaryProfile::IntSamples &samples = i->second;
+    if( samples.bottom )
+      continue;
+
+    ++lineno;
+    Value *value = 0;
+    Ctx *ctx = 0;
+    if( !binary_value(profile, i->first.item, &value)
+    ||  !binary_ctx(profile, i->first.ctx, &ctx) )
+    {
+      ++*nbad;
+      continue;
+    }
+
+    Ints ints;
+    for(std::map<uint64_t,uint64_t>::const_iterator j=samples.values.begin(), z=samples.values.end(); j!=z; ++j)
+      ints.push_back( Int(j->first, j->second) );
+
+    if( !sema->sem_int_predict(value, ctx, ints) )
+      ++*nbad;
+  }
+
+  for(unsigned pass=0; pass<2; ++pass)
+  {
+    const PtrSiteMap &sites = (pass == 0) ? profile.ptrs : profile.objs;
+    for(PtrSiteMap::const_iterator i=sites.begin(), e=sites.end(); i!=e; ++i)
+    {
+      const BinaryProfile::PtrSamples &samples = i->second;
+      if( samples.bottom )
+        continue;
+
+      ++lineno;
+      Value *value = 0;
+      Ctx *ctx = 0;
+      if( !binary_value(profile, i->first.item, &value)
+      ||  !binary_ctx(profile, i->first.ctx, &ctx) )
+      {
+        ++*nbad;
+        continue;
+      }
+
+      Ptrs ptrs;
+      bool ok = true;
+      for(std::map<BinaryProfile::PtrSamples::Base,uint64_t>::const_iterator j=samples.values.begin(), z=samples.values.end(); j!=z && ok; ++j)
+      {
+        AU *au = 0;
+        ok = binary_au(profile, j->first.first, &au);
+        if( ok )
+          ptrs.push_back( Ptr(au, j->first.second, j->second) );
+      }
+
+      if( !ok )
+        ++*nbad;
+      else if( pass == 0 && !sema->sem_ptr_predict(value, ctx, ptrs) )
+        ++*nbad;
+      else if( pass == 1 && !sema->sem_obj_predict(value, ctx, ptrs) )
+        ++*nbad;
+    }
+  }
+
+  for(ResidueMap::const_iterator i=profile.residues.begin(), e=profile.residues.end(); i!=e; ++i)
+  {
+    ++lineno;
+    Value *value = 0;
+    Ctx *ctx = 0;
+    if( !binary_value(profile, i->first.item, &value)
+    ||  !binary_ctx(profile, i->first.ctx, &ctx)
+    ||  !sema->sem_pointer_residual(value, ctx, i->second.members) )
+      ++*nbad;
+  }
+
+  return *nbad == 0;
+}
+
+bool Parse::parse_binary(const char *filename)
+{
+  BinaryProfile profile;
+  if( !profile.read(filename) )
+  {
+    fprintf(stderr, "SpecPrivProfiler loader: Cannot read binary profile %s\n", filename);
+    return false;
+  }
+
+  binaryAUs.assign( profile.strings.size(), 0 );
+  binaryCtxs.assign( profile.strings.size(), 0 );
+  binaryValues.assign( profile.strings.size(), 0 );
+
+  lineno = 0;
+  unsigned numBad = 0;
+  parse_binary_records(profile, &numBad);
+  numRecords += lineno;
+
+  binaryAUs.clear();
+  binaryCtxs.clear();
+  binaryValues.clear();
+
+  fprintf(stderr, "SpecPrivProfiler loader: Binary profile of %lu runs, Read %u good records, %u bad records\n",
+    (unsigned long) profile.num_runs, lineno - numBad, numBad);
+
+  return numBad == 0;
+}
+
 void Parse::parse(const char *filename, SemanticAction *s)
 {
   sema = s;
 
+  if( BinaryProfile::is_binary(filename) )
+  {
+    sema->sem_set_valid( parse_binary(filename) );
+    sema = 0;
+    return;
+  }
+
   bool goodHeader = false, goodTailer = false;
   unsigned numBadLines = 0;
   unsigned numGoodLines = 0;
@@ -59,6 +59,9 @@
 #include "liberty/PointsToProfiler/Remat.h"
 #include "scaf/Utilities/ModuleLoops.h"
 
+// For PROF_MAX_SITES
+#include "sites.h"
+
 #include <sstream>
 
 namespace liberty
@@ -88,6 +91,7 @@ STATISTIC(numMalloc,   "Num mallocs instrumented");
 STATISTIC(numFree,     "Num frees instrumented");
 STATISTIC(numRealigned, "Num alloca instructions or global variables/constants with alignment changed");
 STATISTIC(lifetimeMarkersRemoved, "Num lifetime markers removed");
+STATISTIC(numGatedSites, "Num value-predictor sites guarded by a state byte");
 
 static cl::opt<unsigned> MaxAnalysisTimePerFunction(
     "specpriv-profile-max-analysis-per-fcn", cl::init(3*60), cl::Hidden,
@@ -95,6 +99,11 @@ static cl::opt<unsigned> MaxAnalysisTimePerFunction(
 static cl::opt<bool> DontTrackResidues(
   "specpriv-profile-dont-track-residues", cl::init(false), cl::NotHidden,
   cl::desc("Do NOT track pointer residues"));
+static cl::opt<bool> DontSaturate(
+  "specpriv-profile-dont-saturate", cl::init(false), cl::NotHidden,
+  cl::desc("Sample every execution of a value-prediction site"));
+
+static const unsigned MaxSites = PROF_MAX_SITES;
 
 /*
 static cl::opt<bool> NoUnsafe(
@@ -264,6 +273,7 @@ struct MallocProfiler : public ModulePass
     formals.clear();
     formals.push_back(charptr);
     formals.push_back(u64);
+    formals.push_back(u32);
     FunctionType *predictable_int_ty = FunctionType::get(voidty, formals, false);
     FunctionCallee wrapper_predictable_int_value = mod.getOrInsertFunction(
                                                   "__prof_predict_int", predictable_int_ty);
@@ -273,6 +283,7 @@ struct MallocProfiler : public ModulePass
     formals.push_back(charptr);
     formals.push_back(charptr);
     formals.push_back(u32);
+    formals.push_back(u32);
     FunctionType *load_and_pred_int_ty = FunctionType::get(voidty, formals, false);
     FunctionCallee wrapper_load_and_predict_int = mod.getOrInsertFunction(
                                         "__prof_predict_int_load", load_and_pred_int_ty);
@@ -281,17 +292,21 @@ struct MallocProfiler : public ModulePass
     formals.clear();
     formals.push_back(charptr);
     formals.push_back(charptr);
+    FunctionType *residue_ty = FunctionType::get(voidty, formals, false);
+    FunctionCallee wrapper_residue_fcn = mod.getOrInsertFunction(
+                                         "__prof_pointer_residue", residue_ty);
+    residue_fcn = cast<Constant>(wrapper_residue_fcn.getCallee());
+
+    formals.push_back(u32);
     FunctionType *predictable_ptr_ty = FunctionType::get(voidty, formals, false);
     FunctionCallee wrapper_predictable_ptr_value = mod.getOrInsertFunction(
                                                     "__prof_predict_ptr", predictable_ptr_ty);
     predictable_ptr_value = cast<Constant>(wrapper_predictable_ptr_value.getCallee());
-    FunctionCallee wrapper_residue_fcn = mod.getOrInsertFunction(
-                                         "__prof_pointer_residue", predictable_ptr_ty);
-    residue_fcn = cast<Constant>(wrapper_residue_fcn.getCallee());
 
     formals.clear();
     formals.push_back(charptr);
     formals.push_back(charptr);
+    formals.push_back(u32);
     FunctionType *load_and_pred_ptr_ty = FunctionType::get(voidty, formals, false);
     FunctionCallee wrapper_load_and_predict_ptr = mod.getOrInsertFunction(
                                               "__prof_predict_ptr_load", load_and_pred_ptr_ty);
@@ -349,11 +364,17 @@ struct MallocProfiler : public ModulePass
     realloc16 = cast<Constant>(wrapper_realloc16.getCallee());
 
 
+    site_states = cast<GlobalVariable>( mod.getOrInsertGlobal("__prof_site_states", charptr) );
+    numSites = 0;
+    sampledValues.clear();
+
     for(Module::iterator i=mod.begin(), e=mod.end(); i!=e; ++i)
       runOnFunction(&*i, mloops);
 
     LLVM_DEBUG(errs() << "Instrumented all functions\n");
 
+    gate_sampling_sites();
+
     do_init(mod, globals);
 
     realign_globals(globals);
@@ -370,6 +391,9 @@ private:
   Constant *manage_argv, *unmanage_argv, *assert_in_bounds, *possible_leak;
   Constant *find_underlying, *predictable_int_value, *predictable_ptr_value, *residue_fcn;
   Constant *load_and_predict_int, *load_and_predict_ptr;
+  GlobalVariable *site_states;
+  unsigned numSites;
+  std::vector<CallInst*> sampledValues;
   Constant *unmanaged_fopen_name, *unmanaged_library_constant_au_name;
   Constant *malloc16, *calloc16, *realloc16;
   std::map<Instruction*, std::string> Instruction2StringName;
@@ -739,6 +763,42 @@ private:
     return true;
   }
 
+  // Number the next value-prediction site, or
+  // return 0 for a site which is never skipped.
+  ConstantInt *next_site()
+  {
+    if( DontSaturate || numSites + 1 >= MaxSites )
+      return ConstantInt::get(u32, 0);
+    return ConstantInt::get(u32, ++numSites);
+  }
+
+  // Guard each value-prediction call with its site's state byte,
+  //   if( __prof_site_states[site] == 0 ) __prof_predict_*(..., site);
+  // so that the program stops paying for samples once the
+  // profiler has decided the site.  Done after all other
+  // instrumentation, since it splits blocks.
+  void gate_sampling_sites()
+  {
+    Type *i8 = Type::getInt8Ty( u32->getContext() );
+    for(std::vector<CallInst*>::iterator i=sampledValues.begin(), e=sampledValues.end(); i!=e; ++i)
+    {
+      CallInst *call = *i;
+      ConstantInt *site = cast<ConstantInt>( call->getArgOperand( call->getNumArgOperands() - 1 ) );
+      if( site->isZero() )
+        continue;
+
+      LoadInst *base = new LoadInst(site_states, "site.states", call);
+      Instruction *addr = GetElementPtrInst::Create(i8, base, site, "site.state.addr", call);
+      LoadInst *state = new LoadInst(addr, "site.state", call);
+      Instruction *live = new ICmpInst(call, ICmpInst::ICMP_EQ, state, ConstantInt::get(i8, 0), "site.live");
+
+      Instruction *then = SplitBlockAndInsertIfThen(live, call, false);
+      call->moveBefore(then);
+      ++numGatedSites;
+    }
+    sampledValues.clear();
+  }
+
   void loadAndPredictValue(Value *name, Value *ptr, InstInsertPt &where, BBSet &interesting)
   {
     PointerType *pty = cast<PointerType>( ptr->getType() );
@@ -753,8 +813,10 @@ private:
 
     if( elty->isPointerTy() )
     {
-      Value *actuals[] = { name, ptr };
-      where << CallInst::Create(load_and_predict_ptr, ArrayRef<Value*>(&actuals[0], &actuals[2]) );
+      Value *actuals[] = { name, ptr, next_site() };
+      CallInst *call = CallInst::Create(load_and_predict_ptr, ArrayRef<Value*>(&actuals[0], &actuals[3]) );
+      where << call;
+      sampledValues.push_back(call);
 
       interesting.insert( where.getBlock() );
       ++numValuePredictors;
@@ -762,8 +824,10 @@ private:
     else if( IntegerType *intty = dyn_cast< IntegerType >(elty) )
     {
       const unsigned sz = std::max( intty->getBitWidth() / 8, 1u );
-      Value *actuals[] = { name, ptr, ConstantInt::get(u32, sz) };
-      where << CallInst::Create(load_and_predict_int, ArrayRef<Value*>(&actuals[0], &actuals[3]) );
+      Value *actuals[] = { name, ptr, ConstantInt::get(u32, sz), next_site() };
+      CallInst *call = CallInst::Create(load_and_predict_int, ArrayRef<Value*>(&actuals[0], &actuals[4]) );
+      where << call;
+      sampledValues.push_back(call);
 
       interesting.insert( where.getBlock() );
       ++numValuePredictors;
@@ -791,8 +855,10 @@ private:
         value = cast;
       }
 
-      Value *actuals[] = { name, value };
-      where << CallInst::Create(predictable_int_value, ArrayRef<Value*>(&actuals[0], &actuals[2]) );
+      Value *actuals[] = { name, value, next_site() };
+      CallInst *call = CallInst::Create(predictable_int_value, ArrayRef<Value*>(&actuals[0], &actuals[3]) );
+      where << call;
+      sampledValues.push_back(call);
 
       interesting.insert( where.getBlock() );
       ++numValuePredictors;
@@ -800,8 +866,10 @@ private:
     else if( value->getType()->isPointerTy() )
     {
       Instruction *cast = new BitCastInst(value, charptr);
-      Value *actuals[] = { name, cast };
-      where << cast << CallInst::Create(predictable_ptr_value, ArrayRef<Value*>(&actuals[0], &actuals[2]) );
+      Value *actuals[] = { name, cast, next_site() };
+      CallInst *call = CallInst::Create(predictable_ptr_value, ArrayRef<Value*>(&actuals[0], &actuals[3]) );
+      where << cast << call;
+      sampledValues.push_back(call);
 
       interesting.insert( where.getBlock() );
       ++numValuePredictors;
@@ -319,52 +319,18 @@ bool findDependenceCycle(
 return false;
 } // namespace liberty
 
+// The runtime implements one kind of dependent reduction (see
+// __specpriv_reduce_u64_max): a pointer which follows the
+// maximum of an i32 or f32.  Anything else is not a reduction.
 Reduction::Type getDependentType(const Instruction *I,
                                  Reduction::Type depType) {
-  if (depType == Reduction::Max_f32 || depType == Reduction::Max_f64 ||
-      depType == Reduction::Max_i32 || depType == Reduction::Max_i64) {
-    if (I->getType()->isIntegerTy(8))
-      return Reduction::Max_i8;
-    else if( I->getType()->isIntegerTy(16) )
-      return Reduction::Max_i16;
-    else if( I->getType()->isIntegerTy(32) )
-      return Reduction::Max_i32;
-    else if( I->getType()->isIntegerTy(64) )
-      return Reduction::Max_i64;
-    else if( I->getType()->isFloatTy() )
-      return Reduction::Max_f32;
-    else if( I->getType()->isDoubleTy() )
-      return Reduction::Max_f64;
-    else if( I->getType()->isPointerTy() )
-      return Reduction::Max_u64;
-    else {
-      assert(0 && "Not yet implemented case for dependent type");
-      return Reduction::NotReduction;
-    }
-  } else if (depType == Reduction::Min_f32 || depType == Reduction::Min_f64 ||
-             depType == Reduction::Min_i32 || depType == Reduction::Min_i64) {
-    if (I->getType()->isIntegerTy(8))
-      return Reduction::Min_i8;
-    else if (I->getType()->isIntegerTy(16))
-      return Reduction::Min_i16;
-    else if (I->getType()->isIntegerTy(32))
-      return Reduction::Min_i32;
-    else if (I->getType()->isIntegerTy(64))
-      return Reduction::Min_i64;
-    else if (I->getType()->isFloatTy())
-      return Reduction::Min_f32;
-    else if (I->getType()->isDoubleTy())
-      return Reduction::Min_f64;
-    else if( I->getType()->isPointerTy() )
-      return Reduction::Min_u64;
-    else {
-      assert(0 && "Not yet implemented case for dependent type");
-      return Reduction::NotReduction;
-    }
-  } else {
-    assert(0 && "Not yet implemented case for dependent type");
+  if (!I->getType()->isPointerTy())
     return Reduction::NotReduction;
-  }
+
+  if (depType == Reduction::Max_i32 || depType == Reduction::Max_f32)
+    return Reduction::Max_u64;
+
+  return Reduction::NotReduction;
 }
 
 // This function should be called on all selects (could be extented for PHIs for
@@ -438,11 +404,17 @@ bool sameBBMinMaxRedux(
       info->depUpdateInst = nullptr;
       minMaxReductions[liveOutV] = info;
     } else {
+      const Reduction::Type type = getDependentType(liveOutV, info->type);
+      if (type == Reduction::NotReduction) {
+        LLVM_DEBUG(errs() << "Unsupported dependent redux " << *liveOutV << "\n");
+        return false;
+      }
+
       MinMaxReductionInfo *newinfo = new MinMaxReductionInfo;
       newinfo->depInst = info->minMaxInst;
       newinfo->depType = info->type;
       newinfo->cmpInst = info->cmpInst;
-      newinfo->type = getDependentType(liveOutV, newinfo->depType);
+      newinfo->type = type;
       const Instruction *depUpdateInst = dyn_cast<Instruction>(info->minMaxValue);
       assert(depUpdateInst);
       newinfo->depUpdateInst = depUpdateInst;
@@ -1,3 +1,6 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE     /* for sched_setaffinity */
+#endif
 #include <pthread.h>    /* for pthread */
 #include <stdio.h>      /* for perror */
 #include <errno.h>      /* for perror */
@@ -9,6 +12,7 @@
 
 #include "ppool_channel.h"  /* header */
 #include "ppool_log.h"      /* for LOG */
+#include "../topology/topology.h"  /* for topology_pin */
 
 #define STACK_SIZE 1024*1024
 
@@ -71,6 +75,10 @@ bool spawnProcess (chl_runnable fcn, chl_tid tid, int32_t arg, pid_t *pid_ptr) {
   if(fcn==NULL) return false;
   if(tid==NULL) return false;
 
+  // The parent reads the topology before forking,
+  // so that every child sees the same placement.
+  topology_num_cpus();
+
   if((*pid_ptr=fork())) {
 	  if (*pid_ptr < 0)
 	  {
@@ -79,6 +87,7 @@ bool spawnProcess (chl_runnable fcn, chl_tid tid, int32_t arg, pid_t *pid_ptr) {
     return true;
   } else {
     //LOG("Fork succeeded!\n");
+    topology_pin(arg + 1);
     fcn(arg);
     exit(0);
   }
@@ -0,0 +1,693 @@
+#include <stdlib.h>
+#include <assert.h>
+#include <stdio.h>
+#include <signal.h>
+#include <string.h>
+#include <pthread.h>
+#include <setjmp.h>
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <sched.h>
+
+#include "constants.h"
+#include "config.h"
+
+#include "heap.h"
+#include "fiveheaps.h"
+#include "redux.h"
+#include "api.h"
+#include "debug.h"
+#include "doorbell.h"
+#include "strategy.h"
+#include "topology.h"
+#include "threads.h"
+
+// Worker management
+static Wid numWorkers;
+static ThreadWorker workers[ MAX_WORKERS ];
+
+// The calling worker; null on the main thread.
+static _Thread_local ThreadWorker *self;
+
+// The global iteration number; maintained by
+// each thread.  Incremented by __specpriv_end_iter()
+static _Thread_local Iteration currentIter = 0;
+
+// Is this worker inside an invocation?
+static _Thread_local volatile sig_atomic_t inInvocation;
+
+// parallel stage replica id
+static _Thread_local Wid pstage_replica_id = NOT_A_PARALLEL_STAGE;
+
+// Under the DYNAMIC schedule, this worker's most
+// recent claim [claimBegin,claimEnd).
+static _Thread_local Iteration claimBegin, claimEnd;
+static _Thread_local Bool ownsLastIter;
+
+// The main thread's, outside of invocations.
+static Iteration mainLastReduxUpdateIter;
+
+// Set by the code when a min/max with dependent
+// reductions changes.  Such loops do not run in
+// parallel here; see unsupported_loop().
+uint32_t __specpriv_redux_updated;
+
+// Iteration schedule.
+static int schedule = SCHEDULE;
+static Iteration scheduleChunk = SCHEDULE_CHUNK;
+static Iteration nextUnclaimed;
+
+// loop ID for current invocation
+static int globalLoopID;
+
+// Old CPU affinity
+static cpu_set_t old_affinity;
+
+// The main thread rings dispatch to start an
+// invocation (or shut down); every worker signals
+// workersDone once it has finished or misspeculated.
+static Doorbell dispatch;
+static Completion workersDone;
+static volatile Bool shutdown;
+
+// The current invocation's arguments
+static struct
+{
+  Iteration firstIter;
+  void (*callback)(void *, int64_t, int64_t, int64_t);
+  void *user;
+  int64_t numCores;
+  int64_t chunkSize;
+} invocation;
+
+// Were the workers started for the current
+// invocation, or does it run by recovery only?
+static Bool triggered;
+
+// The earliest misspeculation, if any.
+static pthread_mutex_t misspecLock = PTHREAD_MUTEX_INITIALIZER;
+static volatile Bool misspecHappened;
+static Iteration misspecIter;
+static const char *misspecReason;
+
+static volatile Exit exitTaken;
+static Iteration lastCommitted;
+
+ThreadWorker *__specpriv_thread_self(void)
+{
+  return self;
+}
+
+ThreadWorker *__specpriv_thread_worker(Wid wid)
+{
+  return &workers[ wid ];
+}
+
+Iteration __specpriv_thread_first_iter(void)
+{
+  return invocation.firstIter;
+}
+
+// Record a misspeculation, unless an earlier
+// iteration has already misspeculated.  The other
+// workers notice it at the end of their iteration.
+static void record_misspec(Iteration iter, const char *reason)
+{
+  pthread_mutex_lock( &misspecLock );
+  if( !misspecHappened || iter < misspecIter )
+  {
+    misspecIter = iter;
+    misspecReason = reason;
+    __atomic_store_n( &misspecHappened, 1, __ATOMIC_RELEASE );
+  }
+  pthread_mutex_unlock( &misspecLock );
+}
+
+// Tell the main thread we have completed.  A worker
+// which misspeculates after finishing must not be
+// counted twice.
+static void worker_done(void)
+{
+  inInvocation = 0;
+  if( self->done )
+    return;
+
+  self->done = 1;
+  completion_signal( &workersDone );
+}
+
+// Leave the invocation because some worker
+// misspeculated, and go back to the doorbell.
+static void worker_abort(void)
+{
+  worker_done();
+  siglongjmp( self->jmpbuf, 43 );
+}
+
+static void sig_helper(int sig, siginfo_t *siginfo, void *dummy)
+{
+  if( self && inInvocation )
+    __specpriv_misspec("Segfault");
+
+  // Not speculative: crash as we would have.
+  signal(sig, SIG_DFL);
+}
+
+// Called by each worker at the beginning
+// of an invocation.
+static void worker_starts(ThreadWorker *w)
+{
+  DEBUG(printf("worker_starts, %u worker\n", w->wid));
+
+  currentIter = invocation.firstIter;
+
+  // Nothing claimed yet.
+  claimBegin = claimEnd = invocation.firstIter;
+  ownsLastIter = 0;
+
+  w->lastOnIter = invocation.firstIter - 1;
+  w->ranAny = 0;
+  w->lastReduxUpdateIter = 0;
+
+  __specpriv_reset_num_local();
+  __specpriv_thread_map_views(w);
+  __specpriv_thread_reset_io(w);
+
+  inInvocation = 1;
+}
+
+static void *worker_main(void *arg)
+{
+  ThreadWorker *w = (ThreadWorker*) arg;
+  self = w;
+
+#if (AFFINITY & (RRPUNT | RRPUNT0)) != 0
+  // Off the main thread's processor, if there
+  // are enough; see topology.h.
+  topology_pin( w->wid + 1 );
+#endif
+
+  int r = sigsetjmp( w->jmpbuf, 1 );
+#if DEBUG_MISSPEC || DEBUGGING
+  if ( r == 42 )
+    printf("Worker %d: Misspeculated somewhere\n", w->wid);
+  else if ( r == 43 )
+    printf("Worker %d: Misspeculated by other worker?!?!\n", w->wid);
+#else
+  (void) r;
+#endif
+
+  // wait for the doorbell until told to shut down
+  while (1) {
+    w->dispatchSeen = doorbell_wait( &dispatch, w->dispatchSeen );
+    if( shutdown )
+      return 0;
+
+    worker_starts(w);
+    invocation.callback(invocation.user, w->wid, invocation.numCores,
+                        invocation.chunkSize);
+
+    // In case it returned without
+    // __specpriv_worker_finishes().
+    worker_done();
+  }
+}
+
+// ---------------------------------------------------------
+// Scope management: program, parallel region, worker,
+// and iteration...
+
+// Called once on program startup by main thread
+void __parallel_begin(void)
+{
+  // Determine number of workers from environment
+  // variable.
+  numWorkers = 2;
+  const char *nw = getenv("NUM_WORKERS");
+  if( nw )
+  {
+    int n = atoi(nw);
+    assert( 1 <= n && n <= MAX_WORKERS );
+    numWorkers = (Wid) n;
+  }
+
+  init_debug(numWorkers);
+
+  DEBUG(printf("Available workers: %u\n", numWorkers));
+
+  // Save old affinity, and read the topology
+  // while we may still run anywhere in it.
+  sched_getaffinity(0, sizeof(cpu_set_t), &old_affinity);
+  topology_num_cpus();
+
+#if (AFFINITY & MP0STARTUP) != 0
+  topology_pin(0);
+#endif
+}
+
+// Called once on program startup by main thread
+// for separation speculation
+void __specpriv_begin(void)
+{
+  __specpriv_initialize_main_heaps();
+
+  const char *sched = getenv("SPECPRIV_SCHEDULE");
+  if( sched )
+  {
+    if( !strncmp(sched, "static", 6) )
+      schedule = STATIC;
+    else if( !strncmp(sched, "dynamic", 7) )
+    {
+      schedule = DYNAMIC;
+      if( sched[7] == ',' )
+      {
+        int n = atoi(sched + 8);
+        assert( 1 <= n );
+        scheduleChunk = (Iteration) n;
+      }
+    }
+    else
+      fprintf(stderr, "Unknown SPECPRIV_SCHEDULE \"%s\"; using default\n", sched);
+  }
+}
+
+// Called once on program startup by main thread,
+// last func call before main function
+void __spawn_workers_begin(void)
+{
+  DEBUG(fflush(stdout));
+
+  doorbell_init( &dispatch );
+  shutdown = 0;
+
+  // A segfault in a worker is a misspeculation;
+  // see sig_helper().
+  struct sigaction replacement;
+  replacement.sa_flags = SA_SIGINFO;
+  sigemptyset( &replacement.sa_mask );
+  replacement.sa_sigaction = &sig_helper;
+  sigaction( SIGSEGV, &replacement, 0 );
+
+  for(Wid wid=0; wid<numWorkers; ++wid)
+  {
+    ThreadWorker *w = &workers[ wid ];
+    memset(w, 0, sizeof(*w));
+    w->wid = wid;
+    w->delta = (wid + 1) * HEAP_SIZE;
+    w->dispatchSeen = dispatch.generation;
+
+    if( pthread_create(&w->thread, 0, &worker_main, w) )
+    {
+      perror("pthread_create");
+      exit(1);
+    }
+  }
+}
+
+// Called once by main thread on program shutdown
+void __parallel_end(void)
+{
+#if (AFFINITY & MP0STARTUP) != 0
+  // Reset affinity
+  sched_setaffinity(0, sizeof(cpu_set_t), &old_affinity);
+#endif
+}
+
+// Called once by main thread on program shutdown
+// for separation speculation
+void __specpriv_end(void)
+{
+  assert( !self );
+
+  DEBUG( printf("Telling workers to shut down\n") );
+  shutdown = 1;
+  doorbell_ring( &dispatch );
+
+  for(Wid wid=0; wid<numWorkers; ++wid)
+    pthread_join( workers[wid].thread, 0 );
+
+  __specpriv_destroy_main_heaps();
+}
+
+// Called when misspeculation is detected.
+// Triggers the recovery process.
+void __specpriv_misspec(const char *reason)
+{
+  __specpriv_misspec_at(currentIter, reason);
+}
+
+void __specpriv_misspec_at(Iteration iter, const char *reason)
+{
+  if( !self )
+  {
+    __specpriv_main_misspec_at(iter, reason);
+    return;
+  }
+
+#if DEBUG_MISSPEC || DEBUGGING
+  fprintf(stderr,"Misspeculation detected at iteration %d by worker %d\n", iter, self->wid);
+  if( reason )
+    fprintf(stderr,"Reason: %s\n", reason);
+#endif
+
+  record_misspec(iter, reason);
+
+  worker_done();
+  siglongjmp( self->jmpbuf, 42 );
+}
+
+void __specpriv_main_misspec_at(Iteration iter, const char *reason)
+{
+  assert( !self );
+
+#if DEBUG_MISSPEC || DEBUGGING
+  fprintf(stderr,"Misspeculation detected at iteration %d by the main thread\n", iter);
+  if( reason )
+    fprintf(stderr,"Reason: %s\n", reason);
+#endif
+
+  record_misspec(iter, reason);
+}
+
+// Called while a worker waits on a queue.
+void __specpriv_poll_abort(void)
+{
+  if( self && inInvocation && __atomic_load_n( &misspecHappened, __ATOMIC_ACQUIRE ) )
+    worker_abort();
+}
+
+// Called by a worker when it is done working.
+void __specpriv_worker_finishes(Exit exit)
+{
+  assert( self );
+
+  DEBUG(printf("Worker %u finishing with exitTaken:%u.\n", self->wid, exit));
+
+  if( __atomic_load_n( &misspecHappened, __ATOMIC_ACQUIRE ) )
+    worker_abort();
+
+  exitTaken = exit;
+  worker_done();
+}
+
+Bool __specpriv_is_on_iter(void)
+{
+  if( schedule == DYNAMIC )
+    return ownsLastIter;
+
+  return self && self->wid == __specpriv_current_iter() % numWorkers;
+}
+
+// Called by a worker at the top of every iteration.
+// Should this worker run the ON version of the
+// iteration (i.e. does it own it)?  The schedules
+// are those of specpriv-executive.
+uint32_t __specpriv_owns_iter(uint32_t repId, uint32_t repFactor)
+{
+  const Iteration iter = __specpriv_current_iter();
+
+  if( schedule == STATIC )
+    ownsLastIter = ((uint32_t) iter) % repFactor == repId;
+
+  else
+  {
+    if( iter >= claimEnd )
+    {
+      claimBegin = __sync_fetch_and_add( &nextUnclaimed, scheduleChunk );
+      claimEnd = claimBegin + scheduleChunk;
+      assert( claimBegin >= iter && "Skipped an unclaimed iteration" );
+    }
+    ownsLastIter = (claimBegin <= iter);
+  }
+
+  if( ownsLastIter )
+  {
+    self->lastOnIter = iter;
+    self->ranAny = 1;
+  }
+  return ownsLastIter;
+}
+
+Iteration __specpriv_current_iter(void)
+{
+  return currentIter;
+}
+
+Bool __specpriv_runOnEveryIter(void)
+{
+  return 1;
+}
+
+Wid __specpriv_my_worker_id(void)
+{
+  return self ? self->wid : MAIN_PROCESS;
+}
+
+Bool __specpriv_i_am_main_process(void)
+{
+  return !self;
+}
+
+Wid __specpriv_num_workers(void)
+{
+  return numWorkers;
+}
+
+void __specpriv_set_pstage_replica_id(Wid rep_id)
+{
+  pstage_replica_id = rep_id;
+}
+
+Iteration __specpriv_last_committed(void)
+{
+  return lastCommitted;
+}
+
+Iteration __specpriv_misspec_iter(void)
+{
+  assert( misspecHappened && "What? misspeculation didn't happen");
+
+  return misspecIter;
+}
+
+void __specpriv_recovery_finished(Exit e)
+{
+  Iteration mi = misspecIter;
+
+  misspecHappened = 0;
+  lastCommitted = mi;
+
+  if( e > 0 )
+    exitTaken = e;
+
+  if( mi < LAST_ITERATION )
+    currentIter = mi + 1;
+  fflush(stdout);
+#if DEBUG_MISSPEC || DEBUGGING
+  printf("Recovery finished.  should resume from %u\n", currentIter);
+#endif
+}
+
+uint32_t __specpriv_begin_invocation(void)
+{
+  assert( !self );
+
+  misspecHappened = 0;
+  exitTaken = 1;
+  lastCommitted = -1;
+
+  __specpriv_thread_begin_invocation();
+
+  currentIter = 0;
+
+  DEBUG(printf("At beginning of invocation, sizeof(priv)=%u, sizeof(redux)=%u, sizeof(local)=%u\n",
+    __specpriv_sizeof_private(), __specpriv_sizeof_redux(), __specpriv_sizeof_local() ));
+
+  return numWorkers;
+}
+
+// Why can't this invocation run in parallel here?
+static const char *unsupported_loop(void)
+{
+  if( GET_NUM_STAGES() > 1 )
+    return "Pipelines are not supported by the thread runtime";
+
+  for(ReductionInfo *info = __specpriv_first_reduction_info(); info; info = info->next)
+    if( info->depSize )
+      return "Dependent reductions are not supported by the thread runtime";
+
+  return 0;
+}
+
+// Start the workers; called from main thread.
+// A loop which this runtime cannot run in
+// parallel misspeculates at once, and so runs
+// sequentially by recovery.
+Wid __specpriv_spawn_workers_callback(
+    Iteration firstIter, void (*callback)(void *, int64_t, int64_t, int64_t),
+    void *user, int64_t numCores, int64_t chunkSize)
+{
+  assert( !self );
+
+  DEBUG(printf("spawn_workers_callback\n"));
+  DEBUG(printf("numCores:%lu, chunkSize:%lu\n", numCores, chunkSize));
+
+  lastCommitted = firstIter - 1;
+
+  const char *unsupported = unsupported_loop();
+  if( unsupported )
+  {
+    __specpriv_main_misspec_at(LAST_ITERATION, unsupported);
+    triggered = 0;
+    return MAIN_PROCESS;
+  }
+
+  invocation.firstIter = firstIter;
+  invocation.callback = callback;
+  invocation.user = user;
+  invocation.numCores = numCores;
+  invocation.chunkSize = chunkSize;
+  nextUnclaimed = firstIter;
+
+  for(Wid wid=0; wid<numWorkers; ++wid)
+    workers[wid].done = 0;
+  completion_reset( &workersDone );
+
+  DEBUG(fflush(stdout));
+
+  // One ring starts all workers
+  triggered = 1;
+  doorbell_ring( &dispatch );
+  return MAIN_PROCESS;
+}
+
+Wid __specpriv_spawn_workers(Iteration firstIter)
+{
+  return MAIN_PROCESS;
+}
+
+Exit __specpriv_join_children(void)
+{
+  assert( !self );
+
+  if( !triggered )
+    return 0;
+  triggered = 0;
+
+  // Every worker signals the completion exactly
+  // once, whether it finished or misspeculated.
+  completion_wait( &workersDone, numWorkers, 0 );
+  DEBUG(printf("All workers finished!\n"););
+
+  if( !misspecHappened )
+  {
+    const Iteration mi = __specpriv_thread_commit_heaps(numWorkers);
+    if( mi != LAST_ITERATION )
+      __specpriv_main_misspec_at(mi, "Private read of a value written by another worker");
+    else
+      __specpriv_thread_commit_io(numWorkers);
+  }
+
+  // Whatever was not committed is discarded.
+  for(Wid wid=0; wid<numWorkers; ++wid)
+  {
+    __specpriv_thread_discard_views( &workers[wid] );
+    __specpriv_thread_reset_io( &workers[wid] );
+  }
+
+  if( misspecHappened )
+    return 0;
+  else
+    return exitTaken;
+}
+
+Exit __specpriv_end_invocation(void)
+{
+  return exitTaken;
+}
+
+// Called by a worker at the beginning of an iteration.
+// A worker should call this during ALL iterations,
+// even during those it does not execute.
+void __specpriv_begin_iter(void)
+{
+  __specpriv_reset_local();
+}
+
+void __specpriv_set_loopID( int n )
+{
+  globalLoopID = n;
+}
+
+int __specpriv_get_loopID( void )
+{
+  return globalLoopID;
+}
+
+// Called by a worker at the end of an iteration.
+// A worker should call this during ALL iterations,
+// even during those it does not execute.  Nothing is
+// committed after a misspeculation, so every worker
+// stops at the end of its iteration.
+void __specpriv_end_iter(uint32_t ckptUsed)
+{
+  if( __specpriv_num_local() > 0 )
+    __specpriv_misspec("Object lifetime misspeculation");
+
+  if( __atomic_load_n( &misspecHappened, __ATOMIC_ACQUIRE ) )
+    worker_abort();
+
+  ++currentIter;
+}
+
+// There are no intermediate checkpoints.
+uint32_t __specpriv_ckpt_check(void)
+{
+  return 0;
+}
+
+uint32_t __specpriv_get_ckpt_check(void){
+  return 0;
+}
+
+void __specpriv_final_iter_ckpt_check(uint64_t rem, uint64_t chunkSize) {
+  uint64_t chunkedRem = rem / chunkSize;
+  if (rem % chunkSize)
+    ++chunkedRem;
+
+  if (self && self->wid >= chunkedRem) {
+    __specpriv_begin_iter();
+    __specpriv_end_iter(1);
+  }
+}
+
+void __specpriv_set_last_redux_update_iter(uint32_t set) {
+  if (set) {
+    if( self )
+      self->lastReduxUpdateIter = currentIter;
+    else
+      mainLastReduxUpdateIter = currentIter;
+  }
+}
+
+Iteration __specpriv_last_redux_update_iter(void) {
+  return self ? self->lastReduxUpdateIter : mainLastReduxUpdateIter;
+}
+
+void __specpriv_uo(void *ptr, uint64_t code, uint64_t subheap, const char *msg)
+{
+  if( ptr )
+    if( (POINTER_MASK & (uint64_t)ptr) != code )
+      __specpriv_misspec(msg);
+}
+
+// -----------------------------------------------------------------------
+// Value prediction
+
+void __specpriv_predict(uint64_t observed, uint64_t expected)
+{
+  if( observed != expected )
+    __specpriv_misspec("Value prediction failed");
+}
@@ -0,0 +1,617 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+#include "constants.h"
+#include "api.h"
+#include "fiveheaps.h"
+#include "redux.h"
+#include "threads.h"
+
+// The main thread's heaps.  Workers share shared,
+// ro and sharepriv with it; they see priv, killpriv
+// and redux through views of their own, and so
+// those three are named (shm) heaps.
+static Heap         priv, killpriv, redux;
+static MappedHeap   mshared, mro, mlocal, msharepriv;
+static MappedHeap   mpriv0, mkillpriv0, mredux0;
+
+// How many short-lived AUs has this thread allocated?
+// Should be zero at beginning/end of iteration
+static _Thread_local unsigned numLocalAUs;
+
+// Allow us to enumerate all reduction AUs at runtime.
+static ReductionInfo *first_reduction_info,
+                     *last_reduction_info;
+
+static Len sizeof_private, sizeof_killprivate, sizeof_shareprivate, sizeof_redux;
+static Len sizeof_ro;
+static Len sizeof_local;
+
+void __specpriv_reset_reduction()
+{
+  first_reduction_info = last_reduction_info = 0;
+}
+
+// There is no meta heap to share between processes.
+void *__specpriv_alloc_meta(Len len)
+{
+  return malloc(len);
+}
+
+void __specpriv_free_meta(void *ptr)
+{
+  free(ptr);
+}
+
+void __specpriv_initialize_main_heaps(void)
+{
+  DEBUG(printf("INITIALIZE MAIN HEAP\n"));
+
+  mapped_heap_init(&mshared);
+  mapped_heap_init(&mro);
+  mapped_heap_init(&mlocal);
+  mapped_heap_init(&msharepriv);
+  heap_map_anon(HEAP_SIZE, (void*) SHARED_ADDR, &mshared);
+  heap_map_anon(HEAP_SIZE, (void*) RO_ADDR, &mro);
+  heap_map_anon(HEAP_SIZE, (void*) LOCAL_ADDR, &mlocal);
+  heap_map_anon(HEAP_SIZE, (void*) SHAREPRIV_ADDR, &msharepriv);
+
+  // Every worker reads these; spread them out.
+  heap_set_numa(&mshared, NUMA_SHARED);
+  heap_set_numa(&mro, NUMA_SHARED);
+
+  heap_init(&priv,     "private",     HEAP_SIZE, (void*) PRIV_ADDR,     0);
+  heap_init(&killpriv, "killprivate", HEAP_SIZE, (void*) KILLPRIV_ADDR, 0);
+  heap_init(&redux,    "redux",       HEAP_SIZE, (void*) REDUX_ADDR,    0);
+
+  mapped_heap_init(&mpriv0);
+  mapped_heap_init(&mkillpriv0);
+  mapped_heap_init(&mredux0);
+  heap_map_shared(&priv, &mpriv0);
+  heap_map_shared(&killpriv, &mkillpriv0);
+  heap_map_shared(&redux, &mredux0);
+
+  sizeof_private = sizeof_killprivate = sizeof_shareprivate = 0;
+  sizeof_redux = sizeof_ro = sizeof_local = 0;
+
+  // Empty list of reduction aus.
+  first_reduction_info = last_reduction_info = 0;
+}
+
+void __specpriv_destroy_main_heaps(void)
+{
+  DEBUG(printf("DESTROY MAIN HEAP\n"));
+
+  // Clear the list.
+  while( first_reduction_info )
+  {
+    ReductionInfo *next = first_reduction_info->next;
+    __specpriv_free_meta(first_reduction_info);
+    first_reduction_info = next;
+  }
+  last_reduction_info = 0;
+
+  heap_unmap(&mshared);
+  heap_unmap(&mro);
+  heap_unmap(&mlocal);
+  heap_unmap(&msharepriv);
+
+  heap_unmap(&mpriv0);
+  heap_unmap(&mkillpriv0);
+  heap_unmap(&mredux0);
+  heap_fini(&priv);
+  heap_fini(&killpriv);
+  heap_fini(&redux);
+}
+
+void __specpriv_thread_begin_invocation(void)
+{
+  sizeof_private = heap_used( &mpriv0 );
+  sizeof_killprivate = heap_used( &mkillpriv0 );
+  sizeof_shareprivate = heap_used( &msharepriv );
+  sizeof_redux = heap_used( &mredux0 );
+  sizeof_ro = heap_used( &mro );
+  sizeof_local = heap_used( &mlocal );
+}
+
+// Map (or refresh) one view of a heap for worker w.
+static void map_view(Heap *h, MappedHeap *view, ThreadWorker *w, Len used)
+{
+  if( heap_remap_cow_at(h, w->delta + (char*) h->base, view) )
+    heap_set_numa(view, NUMA_PRIVATE);
+  if( used )
+    heap_reserve(view, used);
+}
+
+// Called by each worker at the beginning of an
+// invocation.  The views keep their mappings from
+// one invocation to the next.
+void __specpriv_thread_map_views(ThreadWorker *w)
+{
+  map_view(&priv, &w->priv, w, sizeof_private);
+  map_view(&killpriv, &w->killpriv, w, sizeof_killprivate);
+  map_view(&redux, &w->redux, w, sizeof_redux);
+
+  // Start each reduction from its identity; for
+  // min, mul, and, etc, that is not zero.
+  for(ReductionInfo *info = first_reduction_info; info; info = info->next)
+    __specpriv_initialize_reductions(heap_translate(info->au, &w->redux), info);
+
+  // My arena for short-lived objects.
+  if( !w->local.next )
+  {
+    mapped_heap_init(&w->local);
+    heap_map_anon(HEAP_SIZE, (void*) (LOCAL_ADDR + w->delta), &w->local);
+    heap_set_numa(&w->local, NUMA_PRIVATE);
+  }
+  else
+    heap_reset(&w->local);
+
+  // One stamp per private byte; grow it if the
+  // private heap has outgrown it.
+  const uint64_t need = ROUND_UP((uint64_t) sizeof_private * sizeof(Stamp) + 1, (uint64_t) MB);
+  if( w->stamps.next && w->stamps.size < need )
+    heap_unmap(&w->stamps);
+  if( !w->stamps.next )
+  {
+    mapped_heap_init(&w->stamps);
+    heap_map_anon(2 * need, 0, &w->stamps);
+    heap_set_numa(&w->stamps, NUMA_PRIVATE);
+  }
+  w->lo = sizeof_private;
+  w->hi = 0;
+}
+
+// Called by the main thread after each invocation:
+// give back the pages which the worker copied.
+void __specpriv_thread_discard_views(ThreadWorker *w)
+{
+  if( !w->stamps.next )
+    return;
+
+  MappedHeap *views[] = { &w->priv, &w->killpriv, &w->redux };
+  for(unsigned i=0; i<sizeof(views)/sizeof(views[0]); ++i)
+    if( views[i]->heap )
+      heap_remap_cow_at(views[i]->heap, views[i]->base, views[i]);
+  heap_discard(&w->stamps);
+}
+
+void *__specpriv_thread_view(void *ptr)
+{
+  ThreadWorker *w = __specpriv_thread_self();
+  if( !w )
+    return ptr;
+
+  // A view's pointer lies beyond the first
+  // HEAP_SIZE bytes of its code; leave it be.
+  const uint64_t p = (uint64_t) ptr;
+  const uint64_t code = p & POINTER_MASK;
+  if( p - code >= HEAP_SIZE )
+    return ptr;
+
+  if( code == PRIV_ADDR || code == KILLPRIV_ADDR || code == REDUX_ADDR )
+    return (void*) (p + w->delta);
+  return ptr;
+}
+
+//------------------------------------------------------------------
+// Private checks
+
+// The stamps of bytes [ptr,ptr+len) of the private
+// heap, and note that they were touched.
+static Stamp *touch(ThreadWorker *w, void *ptr, uint64_t len)
+{
+  const uint64_t offset = (uint64_t) ptr & (HEAP_SIZE - 1);
+  if( offset + len > sizeof_private )
+    __specpriv_misspec("Private access beyond the private heap");
+
+  if( offset < w->lo )
+    w->lo = offset;
+  if( offset + len > w->hi )
+    w->hi = offset + len;
+
+  return offset + (Stamp*) w->stamps.base;
+}
+
+static uint32_t stamp_now(void)
+{
+  return (uint32_t) (__specpriv_current_iter() - __specpriv_thread_first_iter()) + 1;
+}
+
+void __specpriv_private_write_range(void *ptr, uint64_t len)
+{
+  ThreadWorker *w = __specpriv_thread_self();
+  if( !w )
+    return;
+
+  const uint32_t now = stamp_now();
+  Stamp *s = touch(w, ptr, len);
+  for(uint64_t i=0; i<len; ++i)
+  {
+    if( !s[i].firstWrite )
+      s[i].firstWrite = now;
+    s[i].lastWrite = now;
+  }
+}
+
+// A read sees either this iteration's write, or the
+// live-in value; the latter is checked against the
+// other workers' writes at join.
+void __specpriv_private_read_range(void *ptr, uint64_t len, const char *name)
+{
+  ThreadWorker *w = __specpriv_thread_self();
+  if( !w )
+    return;
+
+  const uint32_t now = stamp_now();
+  Stamp *s = touch(w, ptr, len);
+  for(uint64_t i=0; i<len; ++i)
+  {
+    if( s[i].lastWrite == now )
+      continue;
+    if( s[i].lastWrite )
+      __specpriv_misspec(name);
+    s[i].lastLiveInRead = now;
+  }
+}
+
+void __specpriv_private_write_1b(void *ptr) { __specpriv_private_write_range(ptr, 1); }
+void __specpriv_private_write_2b(void *ptr) { __specpriv_private_write_range(ptr, 2); }
+void __specpriv_private_write_4b(void *ptr) { __specpriv_private_write_range(ptr, 4); }
+void __specpriv_private_write_8b(void *ptr) { __specpriv_private_write_range(ptr, 8); }
+
+void __specpriv_private_read_1b(void *ptr, const char *name) { __specpriv_private_read_range(ptr, 1, name); }
+void __specpriv_private_read_2b(void *ptr, const char *name) { __specpriv_private_read_range(ptr, 2, name); }
+void __specpriv_private_read_4b(void *ptr, const char *name) { __specpriv_private_read_range(ptr, 4, name); }
+void __specpriv_private_read_8b(void *ptr, const char *name) { __specpriv_private_read_range(ptr, 8, name); }
+
+void __specpriv_private_write_range_stride(void *base, uint64_t nStrides, uint64_t strideWidth, uint64_t lenPerStride)
+{
+  for(uint64_t i=0; i<nStrides; ++i)
+    __specpriv_private_write_range(i * strideWidth + (uint8_t*) base, lenPerStride);
+}
+
+void __specpriv_private_read_range_stride(void *base, uint64_t nStrides, uint64_t strideWidth, uint64_t lenPerStride, const char *message)
+{
+  for(uint64_t i=0; i<nStrides; ++i)
+    __specpriv_private_read_range(i * strideWidth + (uint8_t*) base, lenPerStride, message);
+}
+
+// Shareprivate objects need a merge at every
+// checkpoint; this runtime has no checkpoints.
+void __specpriv_shareprivate_write_range(void *ptr, uint64_t len)
+{
+  if( __specpriv_thread_self() )
+    __specpriv_misspec("Shareprivate objects are not supported by the thread runtime");
+}
+
+//------------------------------------------------------------------
+// Join
+
+static const Stamp *stamp_of(const ThreadWorker *w, uint64_t offset)
+{
+  if( offset < w->lo || offset >= w->hi )
+    return 0;
+  return offset + (const Stamp*) w->stamps.base;
+}
+
+Iteration __specpriv_thread_commit_heaps(Wid numWorkers)
+{
+  const Iteration firstIter = __specpriv_thread_first_iter();
+
+  uint64_t lo = sizeof_private, hi = 0;
+  for(Wid wid=0; wid<numWorkers; ++wid)
+  {
+    const ThreadWorker *w = __specpriv_thread_worker(wid);
+    if( w->lo < lo )
+      lo = w->lo;
+    if( w->hi > hi )
+      hi = w->hi;
+  }
+
+  // A live-in read by one worker of a byte which another
+  // wrote in an earlier iteration should have seen that
+  // write.  Re-execute up to the earliest such read.
+  uint32_t earliest = 0;
+  for(uint64_t offset=lo; offset<hi; ++offset)
+  {
+    uint32_t firstWrite = 0;
+    for(Wid wid=0; wid<numWorkers; ++wid)
+    {
+      const Stamp *s = stamp_of(__specpriv_thread_worker(wid), offset);
+      if( s && s->firstWrite && (!firstWrite || s->firstWrite < firstWrite) )
+        firstWrite = s->firstWrite;
+    }
+    if( !firstWrite )
+      continue;
+
+    for(Wid wid=0; wid<numWorkers; ++wid)
+    {
+      const Stamp *s = stamp_of(__specpriv_thread_worker(wid), offset);
+      if( s && s->lastLiveInRead > firstWrite && (!earliest || s->lastLiveInRead < earliest) )
+        earliest = s->lastLiveInRead;
+    }
+  }
+  if( earliest )
+    return firstIter + (Iteration) (earliest - 1);
+
+  // private: the last write of every byte.
+  uint8_t *main_priv = (uint8_t*) PRIV_ADDR;
+  for(uint64_t offset=lo; offset<hi; ++offset)
+  {
+    uint32_t lastWrite = 0;
+    const ThreadWorker *writer = 0;
+    for(Wid wid=0; wid<numWorkers; ++wid)
+    {
+      const ThreadWorker *w = __specpriv_thread_worker(wid);
+      const Stamp *s = stamp_of(w, offset);
+      if( s && s->lastWrite > lastWrite )
+      {
+        lastWrite = s->lastWrite;
+        writer = w;
+      }
+    }
+    if( writer )
+      main_priv[offset] = main_priv[offset + writer->delta];
+  }
+
+  // killprivate: as the last iteration left it.
+  const ThreadWorker *last = 0;
+  for(Wid wid=0; wid<numWorkers; ++wid)
+  {
+    const ThreadWorker *w = __specpriv_thread_worker(wid);
+    if( w->ranAny && (!last || w->lastOnIter > last->lastOnIter) )
+      last = w;
+  }
+  if( last && sizeof_killprivate )
+    memcpy((void*) KILLPRIV_ADDR, (void*) (KILLPRIV_ADDR + last->delta), sizeof_killprivate);
+
+  // redux: fold in every worker's partial result.
+  for(Wid wid=0; wid<numWorkers; ++wid)
+  {
+    ThreadWorker *w = __specpriv_thread_worker(wid);
+    if( w->ranAny )
+      __specpriv_distill_committed_redux_into_main(&w->redux, w->lastReduxUpdateIter);
+  }
+
+  return LAST_ITERATION;
+}
+
+//------------------------------------------------------------------
+// Heap allocation/deallocation routines
+
+void *__specpriv_alloc_shared(Len size, SubHeap subheap)
+{
+  assert( __specpriv_i_am_main_process() );
+  return heap_alloc(&mshared, size);
+}
+
+void __specpriv_free_shared(void *ptr)
+{
+  assert( __specpriv_i_am_main_process() );
+  heap_free(&mshared, ptr);
+}
+
+void *__specpriv_alloc_ro(Len size, SubHeap subheap)
+{
+  assert( __specpriv_i_am_main_process() );
+  return heap_alloc(&mro, size);
+}
+
+void __specpriv_free_ro(void *ptr)
+{
+  assert( __specpriv_i_am_main_process() );
+  heap_free(&mro, ptr);
+}
+
+void *__specpriv_alloc_local(Len size, SubHeap subheap)
+{
+  ThreadWorker *w = __specpriv_thread_self();
+  ++numLocalAUs;
+  return heap_alloc(w ? &w->local : &mlocal, size);
+}
+
+void __specpriv_free_local(void *ptr)
+{
+  ThreadWorker *w = __specpriv_thread_self();
+  --numLocalAUs;
+  heap_free(w ? &w->local : &mlocal, ptr);
+}
+
+void *__specpriv_alloc_priv(Len size, SubHeap subheap)
+{
+  assert( __specpriv_i_am_main_process() );
+  return heap_alloc(&mpriv0, size);
+}
+
+void __specpriv_free_priv(void *ptr)
+{
+  assert( __specpriv_i_am_main_process() );
+  heap_free(&mpriv0, ptr);
+}
+
+void *__specpriv_alloc_killpriv(Len size, SubHeap subheap)
+{
+  assert( __specpriv_i_am_main_process() );
+  return heap_alloc(&mkillpriv0, size);
+}
+
+void __specpriv_free_killpriv(void *ptr)
+{
+  assert( __specpriv_i_am_main_process() );
+  heap_free(&mkillpriv0, ptr);
+}
+
+void *__specpriv_alloc_sharepriv(Len size, SubHeap subheap)
+{
+  assert( __specpriv_i_am_main_process() );
+  return heap_alloc(&msharepriv, size);
+}
+
+void __specpriv_free_sharepriv(void *ptr)
+{
+  assert( __specpriv_i_am_main_process() );
+  heap_free(&msharepriv, ptr);
+}
+
+void *__specpriv_alloc_redux(Len size, SubHeap subheap, ReductionType type,
+                             uint8_t reg, void *depAU, Len depSize,
+                             uint8_t depType)
+{
+  assert( __specpriv_i_am_main_process() );
+
+  // Record info about this AU.
+  ReductionInfo *info = (ReductionInfo*)__specpriv_alloc_meta( sizeof(ReductionInfo) );
+  info->next = 0;
+  info->size = size;
+  info->type = type;
+  info->au = heap_alloc(&mredux0, size);
+  info->reg = reg;
+  info->depAU = depAU;
+  info->depSize = depSize;
+  info->depType = depType;
+
+  // Newest first, as in fiveheaps.c
+  info->next = first_reduction_info;
+  first_reduction_info = info;
+  if( !last_reduction_info )
+    last_reduction_info = info;
+
+  return info->au;
+}
+
+void *__specpriv_alloc_worker_redux(Len size)
+{
+  ThreadWorker *w = __specpriv_thread_self();
+  assert( w );
+  return heap_alloc(&w->redux, size);
+}
+
+void __specpriv_free_redux(void *ptr)
+{
+  assert( __specpriv_i_am_main_process() );
+
+  // Forget its info, lest the AU be recycled
+  // for another reduction and reduced twice.
+  ReductionInfo *prev = 0;
+  for(ReductionInfo *info = first_reduction_info; info; prev = info, info = info->next)
+    if( info->au == ptr )
+    {
+      if( prev )
+        prev->next = info->next;
+      else
+        first_reduction_info = info->next;
+      if( last_reduction_info == info )
+        last_reduction_info = prev;
+      __specpriv_free_meta(info);
+      break;
+    }
+
+  heap_free(&mredux0, ptr);
+}
+
+void *__specpriv_alloc_unclassified(Len size)
+{
+  assert( 0 && "Alloc unclassified?!");
+  return 0;
+}
+
+void __specpriv_free_unclassified(void *ptr)
+{
+}
+
+void __specpriv_reset_local(void)
+{
+  ThreadWorker *w = __specpriv_thread_self();
+  if( w )
+    heap_reset(&w->local);
+  numLocalAUs = 0;
+}
+
+void __specpriv_reset_num_local(void)
+{
+  numLocalAUs = 0;
+}
+
+int __specpriv_num_local(void)
+{
+  return numLocalAUs;
+}
+
+void __specpriv_add_num_local(int n)
+{
+  numLocalAUs += n;
+}
+
+ReductionInfo *__specpriv_first_reduction_info(void)
+{
+  return first_reduction_info;
+}
+
+void __specpriv_set_first_reduction_info(ReductionInfo *frI)
+{
+  first_reduction_info = frI;
+}
+
+Len __specpriv_sizeof_private(void)
+{
+  return sizeof_private;
+}
+
+Len __specpriv_sizeof_killprivate(void)
+{
+  return sizeof_killprivate;
+}
+
+Len __specpriv_sizeof_shareprivate(void)
+{
+  return sizeof_shareprivate;
+}
+
+Len __specpriv_sizeof_redux(void)
+{
+  return sizeof_redux;
+}
+
+Len __specpriv_sizeof_ro(void)
+{
+  return sizeof_ro;
+}
+
+Len __specpriv_sizeof_local(void)
+{
+  return sizeof_local;
+}
+
+void __specpriv_set_sizeof_private(Len sp)
+{
+  sizeof_private = sp;
+}
+
+void __specpriv_set_sizeof_killprivate(Len sp)
+{
+  sizeof_killprivate = sp;
+}
+
+void __specpriv_set_sizeof_shareprivate(Len sp)
+{
+  sizeof_shareprivate = sp;
+}
+
+void __specpriv_set_sizeof_redux(Len sr)
+{
+  sizeof_redux = sr;
+}
+
+void __specpriv_set_sizeof_ro(Len sr)
+{
+  sizeof_ro = sr;
+}
+
+void __specpriv_set_sizeof_local(Len sr)
+{
+  sizeof_local = sr;
+}
@@ -0,0 +1,196 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <assert.h>
+
+#include "config.h"
+#include "api.h"
+#include "io.h"
+#include "threads.h"
+
+// Deferred IO
+//
+// As in specpriv-executive, each worker formats its
+// output into one growing buffer, and records its
+// events as offsets into that buffer; here the main
+// thread reads those buffers directly at join.
+
+// Forget the worker's events, but keep
+// the buffers for next time.
+void __specpriv_thread_reset_io(ThreadWorker *w)
+{
+  w->numEvents = 0;
+  w->numBytes = 0;
+}
+
+// One worker's remaining events, during the merge.
+typedef struct s_io_cursor IOCursor;
+struct s_io_cursor
+{
+  const IOEvt * next;
+  const IOEvt * end;
+  const char *  bytes;
+};
+
+// Perform the deferred IO operations from each
+// worker, merged by iteration; ties go to the
+// lower worker id.
+void __specpriv_thread_commit_io(Wid numWorkers)
+{
+  IOCursor cursors[ MAX_WORKERS ];
+  for(Wid wid=0; wid<numWorkers; ++wid)
+  {
+    const ThreadWorker *w = __specpriv_thread_worker(wid);
+    cursors[wid].next = w->events;
+    cursors[wid].end = w->events + w->numEvents;
+    cursors[wid].bytes = w->bytes;
+  }
+
+  for(;;)
+  {
+    IOCursor *first = 0;
+    for(Wid wid=0; wid<numWorkers; ++wid)
+    {
+      IOCursor *c = &cursors[wid];
+      if( c->next < c->end && (!first || c->next->iter < first->next->iter) )
+        first = c;
+    }
+    if( !first )
+      break;
+
+    // Issue all of its events from this iteration.
+    const Iteration iter = first->next->iter;
+    do
+    {
+      const IOEvt *evt = first->next++;
+      size_t result = fwrite(first->bytes + evt->offset, 1, evt->len, evt->stream);
+      assert( result == evt->len && "Can't fix this");
+    } while( first->next < first->end && first->next->iter == iter );
+  }
+}
+
+// -----------------------------------------------------------------------
+// Deferred IO operations
+
+static IOEvt *grow_io(ThreadWorker *w)
+{
+  if( (w->numEvents + 1) > w->capEvents )
+  {
+    w->capEvents *= 2;
+    if( 64 > w->capEvents )
+      w->capEvents = 64;
+
+    w->events = (IOEvt*) realloc(w->events, w->capEvents*sizeof(IOEvt) );
+  }
+
+  return &w->events[ w->numEvents++ ];
+}
+
+// Room for len more bytes at the
+// end of the worker's buffer.
+static char *reserve_io_bytes(ThreadWorker *w, size_t len)
+{
+  if( w->numBytes + len > w->capBytes )
+  {
+    w->capBytes *= 2;
+    if( 4096 > w->capBytes )
+      w->capBytes = 4096;
+    while( w->numBytes + len > w->capBytes )
+      w->capBytes *= 2;
+
+    w->bytes = (char*) realloc(w->bytes, w->capBytes);
+  }
+
+  return &w->bytes[ w->numBytes ];
+}
+
+// The len bytes just reserved become an event.
+static void issue_io(ThreadWorker *w, size_t len, FILE *file)
+{
+  IOEvt *evt = grow_io(w);
+
+  evt->iter = __specpriv_current_iter();
+  evt->stream = file;
+  evt->len = len;
+  evt->offset = w->numBytes;
+
+  w->numBytes += len;
+}
+
+// The main thread does its IO immediately.
+int __specpriv_io_fwrite(void *buffer, size_t size, size_t nmemb, FILE *file)
+{
+  ThreadWorker *w = __specpriv_thread_self();
+  if( !w )
+    return fwrite(buffer, size, nmemb, file);
+
+  const size_t len = size * nmemb;
+  memcpy(reserve_io_bytes(w, len), buffer, len);
+  issue_io(w, len, file);
+  return nmemb;
+}
+
+int __specpriv_io_vfprintf(FILE *file, const char *fmt, va_list ap)
+{
+  ThreadWorker *w = __specpriv_thread_self();
+  if( !w )
+    return vfprintf(file, fmt, ap);
+
+  // Format directly into my buffer.
+  va_list again;
+  va_copy(again, ap);
+
+  char *buffer = reserve_io_bytes(w, BUFFER_SIZE);
+  int len = vsnprintf(buffer, BUFFER_SIZE, fmt, ap);
+  if( len >= BUFFER_SIZE )
+  {
+    buffer = reserve_io_bytes(w, len+1);
+    len = vsnprintf(buffer, len+1, fmt, again);
+  }
+  va_end(again);
+
+  if( len > 0 )
+    issue_io(w, len, file);
+
+  return len;
+}
+
+int __specpriv_io_printf(const char *fmt, ...)
+{
+  va_list ap;
+  va_start(ap,fmt);
+
+  int retval = __specpriv_io_vfprintf(stdout, fmt, ap);
+  va_end(ap);
+  return retval;
+}
+
+int __specpriv_io_fprintf(FILE *file, const char *fmt, ...)
+{
+  va_list ap;
+  va_start(ap,fmt);
+
+  int retval = __specpriv_io_vfprintf(file,fmt,ap);
+  va_end(ap);
+  return retval;
+}
+
+int __specpriv_io_puts(const char *str)
+{
+  __specpriv_io_printf("%s\n",str);
+  return 0;
+}
+
+int __specpriv_io_putchar(int c)
+{
+  __specpriv_io_printf("%c", c);
+  return c;
+}
+
+int __specpriv_io_fflush(FILE *stream)
+{
+  if( !__specpriv_thread_self() )
+    return fflush(stream);
+  return 0;
+}
@@ -0,0 +1,126 @@
+#ifndef LIBERTY_SPECPRIV_EXECUTIVE_THREADS_H
+#define LIBERTY_SPECPRIV_EXECUTIVE_THREADS_H
+
+#include <pthread.h>
+#include <setjmp.h>
+#include <stdint.h>
+
+#include "config.h"
+#include "constants.h"
+#include "heap.h"
+#include "io.h"
+#include "types.h"
+
+// A thread-based alternative to specpriv-executive.
+//
+// It exports the same __specpriv_* entry points, so a
+// program links against one or the other.  The workers
+// are threads of the main process rather than forked
+// processes, and so they share one address space:
+//
+//  - shared, ro and local objects of the main thread are
+//    simply shared; each worker allocates its own locals
+//    in an arena of its own, within the local heap's
+//    address range.
+//  - each worker sees the private, killprivate and redux
+//    heaps through a copy-on-write view of its own, at
+//    (worker+1) * HEAP_SIZE bytes above the heap.  The
+//    views stay within the heap's pointer code, so UO
+//    checks hold either way.  The code generator routes
+//    every access to those heaps in the parallel region
+//    through __specpriv_thread_view() (see
+//    -specpriv-thread-backend in ApplySeparationSpeculation).
+//  - each worker stamps the private bytes it touches with
+//    the iterations which wrote and read them; at join,
+//    the main thread checks the stamps of all workers, and
+//    then commits the last write of every byte, the redux
+//    views and the deferred IO, in iteration order.
+//
+// There are no intermediate checkpoints.  On misspeculation
+// everything the workers did is discarded, rather than
+// killing them: the main thread re-executes from the first
+// iteration of the invocation up to the misspeculated one.
+//
+// Only single-stage (DOALL) loops are run in parallel.
+// Pipelines, shareprivate objects and reductions which
+// depend on another reduction run sequentially, by
+// recovery, over the whole loop.
+
+// A worker thread, and what it did during the
+// current invocation.  Read by the main thread
+// once the workers have joined.
+typedef struct s_thread_worker ThreadWorker;
+struct s_thread_worker
+{
+  pthread_t   thread;
+  Wid         wid;
+
+  // This worker's views sit this many bytes
+  // above the natural heaps.
+  uint64_t    delta;
+
+  MappedHeap  priv, killpriv, redux, local;
+
+  // One Stamp per byte of the private heap,
+  // and the range [lo,hi) of touched offsets.
+  MappedHeap  stamps;
+  uint64_t    lo, hi;
+
+  // The last iteration it ran (ON), if any.
+  Iteration   lastOnIter;
+  Bool        ranAny;
+
+  Iteration   lastReduxUpdateIter;
+
+  // Deferred IO, in order of iteration.
+  IOEvt *     events;
+  unsigned    numEvents, capEvents;
+  char *      bytes;
+  size_t      numBytes, capBytes;
+
+  // Has it signalled the join?  Which
+  // doorbell generation did it see last?
+  Bool        done;
+  uint32_t    dispatchSeen;
+
+  sigjmp_buf  jmpbuf;
+};
+
+// Iterations are stamped relative to the first one of
+// the invocation, plus one; zero means never.
+typedef struct s_stamp Stamp;
+struct s_stamp
+{
+  uint32_t    firstWrite;
+  uint32_t    lastWrite;
+  uint32_t    lastLiveInRead;
+};
+
+// The calling worker, or null on the main thread.
+ThreadWorker *__specpriv_thread_self(void);
+ThreadWorker *__specpriv_thread_worker(Wid wid);
+
+Iteration __specpriv_thread_first_iter(void);
+
+// A pointer into the private, killprivate or redux heap,
+// as the calling thread should access it.  Other pointers,
+// and all pointers on the main thread, are unchanged.
+void *__specpriv_thread_view(void *ptr);
+
+// heaps.c; see also ../specpriv-executive/fiveheaps.h
+void __specpriv_thread_begin_invocation(void);
+void __specpriv_thread_map_views(ThreadWorker *w);
+void __specpriv_thread_discard_views(ThreadWorker *w);
+
+// Check the private stamps of all workers; if they are
+// consistent with a sequential execution, commit the
+// workers' private, killprivate and redux state into the
+// main heaps and return LAST_ITERATION.  Otherwise,
+// return the iteration to re-execute up to.
+Iteration __specpriv_thread_commit_heaps(Wid numWorkers);
+
+// io.c
+void __specpriv_thread_reset_io(ThreadWorker *w);
+void __specpriv_thread_commit_io(Wid numWorkers);
+
+#endif
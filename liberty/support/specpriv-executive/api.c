@@ -24,35 +24,14 @@
 #include "pcb.h"
 #include "private.h"
 #include "fiveheaps.h"
+#include "shadow.h"
 #include "checkpoint.h"
 #include "api.h"
 #include "debug.h"
 #include "strategy.h"
 #include "specpriv_queue.h"
-
-#if (AFFINITY & OS2PHYS) != 0
-// Map of linux cpu number to physical core number
-static const int oscpu2physcore[NUM_PROCS] =
-/*
-  // P0  P1  P2  P3
-  {   0,  1,  2,  3,
-      4,  9, 14, 19,
-      5, 10, 15, 20,
-      6, 11, 16, 21,
-      7, 12, 17, 22,
-      8, 13, 18, 23
-  };
-*/
-  {
-  /* P0: */ 0,  4,  5,  6,  7,  8,
-  /* P1: */ 1,  9, 10, 11, 12, 13,
-  /* P2: */ 2, 14, 15, 16, 17, 18,
-  /* P3: */ 3, 19, 20, 21, 22, 23
-  };
-#define CORE(n)     ( oscpu2physcore[n] )
-#else
-#define CORE(n)     ( n )
-#endif
+#include "topology.h"
+#include "trace.h"
 
 // Worker management
 static Wid numWorkers;
@@ -67,11 +46,25 @@ static Wid pstage_replica_id = NOT_A_PARALLEL_STAGE;
 // each worker.  Incremented by __specpriv_end_iter()
 static Iteration currentIter = 0;
 
-static Iteration checkpointGranularity;
-
 // used for min/max redux with dependent redux, as found in KS
 static Iteration lastReduxUpdateIter;
 
+// Set by the code when that min/max changes during
+// the current iteration; see fold_redux_update().
+uint32_t __specpriv_redux_updated;
+
+// If the min/max changed during the current
+// iteration, it is the last update.
+static void fold_redux_update(void)
+{
+  if( __specpriv_redux_updated )
+  {
+    DEBUG(printf("set_last_redux_update_iter to %u\n", currentIter));
+    lastReduxUpdateIter = currentIter;
+    __specpriv_redux_updated = 0;
+  }
+}
+
 static Bool ckpt_check;
 
 // Old CPU affinity
@@ -81,11 +74,24 @@ static cpu_set_t old_affinity;
 static pid_t workerPids[ MAX_WORKERS ];
 #endif
 
-static int (*pipefds)[2];
+// Iteration schedule, and this worker's most recent
+// claim [claimBegin,claimEnd) under the DYNAMIC schedule.
+static int schedule = SCHEDULE;
+static Iteration scheduleChunk = SCHEDULE_CHUNK;
+static Iteration claimBegin, claimEnd;
+static Bool ownsLastIter;
+
+// Last doorbell generation this worker has answered.
+static uint32_t dispatchSeen;
 
 // loop ID for current invocation
 static int globalLoopID;
 
+// When and where did the current invocation start?
+// Main process only.
+static uint64_t invocationStart;
+static Iteration invocationFirstIter;
+
 static jmp_buf jmpbuf;
 
 #if JOIN == SPIN
@@ -96,28 +102,102 @@ struct sigaction old_sigchld;
 static Iteration simulateMisspeculationEveryIter;
 #endif
 
-struct WorkerArgs {
-  Iteration firstIter;
-  void (*callback)(void *, int64_t, int64_t, int64_t);
-  void *user;
-  int64_t numCores;
-  int64_t chunkSize;
-  unsigned sizeof_private;
-  unsigned sizeof_killprivate;
-  unsigned sizeof_shareprivate;
-  unsigned sizeof_redux;
-  unsigned sizeof_ro;
-  unsigned sizeof_local;
-  ReductionInfo *first_reduction_info;
-} workerArgs;
+// Worker's copy of the current invocation's arguments
+static WorkerArgs workerArgs;
+
+// Is this worker inside an invocation?  Which
+// abort_epoch did it see when the invocation
+// started?  abortRequested is set by ABORT_SIGNAL.
+static volatile sig_atomic_t inInvocation;
+static volatile sig_atomic_t abortRequested;
+static uint32_t abortSeen;
 
 static void __specpriv_worker_starts(Iteration firstIter, Wid wid);
+static void __specpriv_worker_done(void);
 
 static void __specpriv_sig_helper(int sig, siginfo_t *siginfo, void *dummy)
 {
   __specpriv_misspec("Segfault");
 }
 
+// Leave the invocation because another worker
+// misspeculated, and go back to the doorbell.
+static void worker_abort(void)
+{
+  __specpriv_destroy_worker_heaps();
+  __specpriv_worker_done();
+  siglongjmp( jmpbuf, 43 );
+}
+
+// Must this worker stop?  Only if it is past the
+// misspeculated iteration; until then, it still
+// helps to fill the checkpoints before it.
+static Bool past_misspec(void)
+{
+  ParallelControlBlock *pcb = __specpriv_get_pcb();
+  return pcb->misspeculation_happened && currentIter > pcb->misspeculated_iteration;
+}
+
+// Another worker (or the main process) misspeculated.
+// Unwinding from here could leave malloc, stdio or
+// the heaps half-updated, so the handler only sets
+// a flag, which __specpriv_poll_abort() reads while
+// the worker waits on a queue.  __specpriv_end_iter()
+// reads the PCB itself.
+static void __specpriv_abort_helper(int sig)
+{
+  abortRequested = 1;
+}
+
+// Called where the worker holds no locks and
+// is between library calls: while it waits.
+void __specpriv_poll_abort(void)
+{
+  if( !abortRequested )
+    return;
+
+  abortRequested = 0;
+  if( inInvocation && __specpriv_get_pcb()->abort_epoch != abortSeen && past_misspec() )
+    worker_abort();
+}
+
+// Record a misspeculation, unless an earlier
+// iteration has already misspeculated, and tell
+// the workers.  Workers and the main process may
+// race here; the lock lets the earliest win.
+static void record_misspec(Wid wid, Iteration iter, const char *reason)
+{
+  ParallelControlBlock *pcb = __specpriv_get_pcb();
+  while( __sync_lock_test_and_set( &pcb->misspec_lock, 1 ) )
+    _mm_pause();
+
+  const Bool earliest = !pcb->misspeculation_happened || iter < pcb->misspeculated_iteration;
+  if( earliest )
+  {
+    pcb->misspeculated_worker = wid;
+    pcb->misspeculated_iteration = iter;
+    pcb->misspeculation_reason = reason;
+    pcb->misspeculation_happened = 1;
+  }
+
+  __sync_lock_release( &pcb->misspec_lock );
+  if( !earliest )
+    return;
+
+#if ABORT_BROADCAST != 0
+  // Publish before signalling; a worker which
+  // sees the new epoch sees the fields above.
+  __atomic_fetch_add( &pcb->abort_epoch, 1, __ATOMIC_SEQ_CST );
+  // A DOALL worker never waits on a queue; the
+  // signal would reach it no sooner than its
+  // next __specpriv_end_iter().
+  if( GET_NUM_STAGES() > 1 )
+    for(Wid w=0; w<numWorkers; ++w)
+      if( w != myWorkerId )
+        kill( pcb->workerPid[w], ABORT_SIGNAL );
+#endif
+}
+
 // Called by __specpriv_begin on each worker after spawned
 static void __specpriv_worker_setup(Wid wid)
 {
@@ -136,29 +216,22 @@ static void __specpriv_worker_setup(Wid wid)
   // true by default
   runOnEveryIter = 1;
 
-  checkpointGranularity = MAX_CHECKPOINT_GRANULARITY - (MAX_CHECKPOINT_GRANULARITY % numWorkers);
-
 #if (AFFINITY & RRPUNT) != 0
   // 'rrpunt'
-  // First, set affinity to a single processor != 0,
+  // First, set affinity to a single placement slot != 0,
   // selected uniformly according to wid.
   // This will punt this worker OFF of the
   // main-process' processor.
-  cpu_set_t affinity;
-  CPU_ZERO(&affinity);
-  CPU_SET( CORE( 1 + (myWorkerId % (NUM_PROCS-1) ) ), &affinity );
-  sched_setaffinity( 0, sizeof(cpu_set_t), &affinity );
+  const int slots = topology_num_cpus();
+  topology_pin( 1 + (myWorkerId % (slots > 1 ? slots-1 : 1)) );
 #endif
 #if (AFFINITY & RRPUNT0) != 0
   // 'rrpunt0'
-  // First, set affinity to a single processor
-  // selected uniformly according to wid.
-  // This will punt this worker OFF of the
-  // main-process' processor.
-  cpu_set_t affinity;
-  CPU_ZERO(&affinity);
-  CPU_SET( CORE( (myWorkerId+1) % NUM_PROCS ), &affinity );
-  sched_setaffinity( 0, sizeof(cpu_set_t), &affinity );
+  // First, set affinity to a single placement slot
+  // selected uniformly according to wid (see
+  // topology.h).  This will punt this worker OFF
+  // of the main-process' processor.
+  topology_pin( myWorkerId+1 );
 #endif
 
 #if (AFFINITY & ALLBUT1) != 0
@@ -168,9 +241,10 @@ static void __specpriv_worker_setup(Wid wid)
   // not force a migration.
   // The first N can run on any except proc 0.
   // The later ones can run on any processor.
+  cpu_set_t affinity;
   memcpy( &affinity, &old_affinity, sizeof(cpu_set_t) );
-  if( myWorkerId + 1 < NUM_PROCS )
-    CPU_CLR( CORE(0), &affinity );
+  if( myWorkerId + 1 < topology_num_cpus() && topology_cpu(0) >= 0 )
+    CPU_CLR( topology_cpu(0), &affinity );
   sched_setaffinity( 0, sizeof(cpu_set_t), &affinity );
 #endif
 #if (AFFINITY & ANY) != 0
@@ -190,10 +264,27 @@ static void __specpriv_worker_setup(Wid wid)
   replacement.sa_sigaction = &__specpriv_sig_helper;
   sigaction( SIGSEGV, &replacement, 0 );
 
+  ParallelControlBlock *pcb = __specpriv_get_pcb();
+  pcb->workerPid[ wid ] = getpid();
+
+#if ABORT_BROADCAST != 0
+  // capture ABORT_SIGNAL -> another worker misspeculated
+  struct sigaction abort_action;
+  abort_action.sa_flags = SA_RESTART;
+  sigemptyset( &abort_action.sa_mask );
+  abort_action.sa_handler = &__specpriv_abort_helper;
+  sigaction( ABORT_SIGNAL, &abort_action, 0 );
+#endif
+
+  __specpriv_trace_open(wid);
+
   TADD(worker_setup_time, start);
-  ssize_t workerArgsSize = sizeof(struct WorkerArgs);
 
   int r = sigsetjmp( jmpbuf, 1 );
+  if( r == 42 )
+    TRACE_EVENT(TRACE_MISSPEC, currentIter);
+  else if( r != 0 )
+    TRACE_EVENT(TRACE_ABORT, currentIter);
 #if DEBUG_MISSPEC || DEBUGGING
 #if DEBUGGING
   if (r == 0)
@@ -207,30 +298,23 @@ static void __specpriv_worker_setup(Wid wid)
     printf("Worker %d: Misspeculated for some other reason\n", myWorkerId);
 #endif
 
-  // wait and read from pipe until killed
+  // wait for the doorbell until told to shut down
   while (1) {
     TIME(start);
     DEBUG(fflush(stdout));
 
-    ssize_t bytesRead = 0;
-    while (bytesRead != workerArgsSize) {
-      ssize_t r = read(pipefds[myWorkerId][0], &workerArgs + bytesRead,
-               workerArgsSize - bytesRead);
-      if (r == -1) {
-        perror("child read from pipe!!!");
-        _exit(0);
-      }
-      else if (r == 0) {
-        // nothing to read, main process closed the pipe
-        // time to exit
-        DEBUG(printf("Nothing read from pipe; exiting\n"));
-        DEBUG(fflush(stdout));
-        _exit(0);
-      }
-      bytesRead += r;
-      DEBUG(printf("Read %ld bytes from pipe\n", r));
+    TRACE_EVENT(TRACE_DISPATCH_WAIT_BEGIN, 0);
+    dispatchSeen = doorbell_wait( &pcb->dispatch, dispatchSeen );
+    TRACE_EVENT(TRACE_DISPATCH_WAIT_END, 0);
+    if( pcb->shutdown )
+    {
+      DEBUG(printf("Worker %u shutting down\n", myWorkerId));
+      DEBUG(fflush(stdout));
+      __specpriv_trace_close();
+      _exit(0);
     }
-    TADD(worker_read_pipe_time, start);
+    workerArgs = pcb->invocation;
+    TADD(worker_wait_dispatch_time, start);
 
     TIME(start);
     __specpriv_set_sizeof_private(workerArgs.sizeof_private);
@@ -244,6 +328,7 @@ static void __specpriv_worker_setup(Wid wid)
     // DEBUG(printf("Read sizeof_local as %u\n", workerArgs.sizeof_local););
 
     __specpriv_worker_starts(workerArgs.firstIter, myWorkerId);
+    TRACE_EVENT(TRACE_INVOCATION_BEGIN, workerArgs.firstIter);
 
     DEBUG(printf(
         "calling callback with workerId %u, numCores: %ld, chunkSize: %ld \n",
@@ -287,15 +372,14 @@ void __parallel_begin(void)
 
   DEBUG(printf("Available workers: %u\n", numWorkers));
 
-  // Save old affinity
+  // Save old affinity, and read the topology
+  // while we may still run anywhere in it.
   sched_getaffinity(0, sizeof(cpu_set_t), &old_affinity);
+  topology_num_cpus();
 
-  // Set affinitiy: only processor zero
+  // Set affinitiy: only placement slot zero
 #if (AFFINITY & MP0STARTUP) != 0
-  cpu_set_t affinity;
-  CPU_ZERO( &affinity );
-  CPU_SET( CORE(0), &affinity );
-  sched_setaffinity(0, sizeof(cpu_set_t), &affinity );
+  topology_pin(0);
 #endif
 }
 
@@ -323,6 +407,32 @@ void __specpriv_begin(void)
 
   __specpriv_initialize_main_heaps();
   __specpriv_init_private();
+  __specpriv_trace_open(MAIN_PROCESS);
+
+  // Iteration schedule; inherited by the workers.
+  const char *sched = getenv("SPECPRIV_SCHEDULE");
+  if( sched )
+  {
+    if( !strncmp(sched, "static", 6) )
+      schedule = STATIC;
+    else if( !strncmp(sched, "dynamic", 7) )
+    {
+      schedule = DYNAMIC;
+      if( sched[7] == ',' )
+      {
+        int n = atoi(sched + 8);
+        assert( 1 <= n );
+        scheduleChunk = (Iteration) n;
+      }
+    }
+    else
+      fprintf(stderr, "Unknown SPECPRIV_SCHEDULE \"%s\"; using default\n", sched);
+  }
+
+#if SHADOW_MEM == VECTOR
+  // Shadow kernels; inherited by the workers.
+  __specpriv_select_shadow_kernels( getenv("SPECPRIV_SHADOW_ISA") );
+#endif
 
 #if JOIN == SPIN
   // Replace the SIGCHLD handler with SIG_IGN.
@@ -343,15 +453,13 @@ void __spawn_workers_begin(void) {
 
   DEBUG(fflush(stdout));
 
-  pipefds = (int(*)[2])malloc(numWorkers * sizeof(int[2]));
+  // Workers will wait for the next ring
+  ParallelControlBlock *pcb = __specpriv_get_pcb();
+  dispatchSeen = pcb->dispatch.generation;
 
   // spawn worker processes with fork
   for(Wid wid=0; wid<numWorkers; ++wid)
   {
-    if (pipe(pipefds[wid])) {
-      perror("create pipe");
-      _exit(0);
-    }
     pid_t pid = fork();
     if( pid == 0 )
     {
@@ -359,18 +467,10 @@ void __spawn_workers_begin(void) {
 
       DEBUG(printf("worker %u spawn\n", wid));
 
-      // close write ends of pipes of prior children and current wid
-      for(unsigned j=0; j<=wid; ++j) {
-        close(pipefds[j][1]);
-      }
-
       __specpriv_worker_setup(wid);
       return; // unreachable, __specpriv_worker_setup does not return
     }
 
-    // close read side of wid's pipe
-    close(pipefds[wid][0]);
-
     #if JOIN == WAITPID
     workerPids[ wid ] = pid;
     #endif
@@ -396,18 +496,17 @@ void __specpriv_end(void)
   TOUT( __specpriv_print_percentages());
   assert( myWorkerId == MAIN_PROCESS );
 
-  DEBUG( printf("Closing pipes from parent\n") );
-  for (Wid wid = 0; wid < numWorkers; ++wid) {
-    close(pipefds[wid][1]);
-  }
+  DEBUG( printf("Telling workers to shut down\n") );
+  ParallelControlBlock *pcb = __specpriv_get_pcb();
+  pcb->shutdown = 1;
+  doorbell_ring( &pcb->dispatch );
 
   for (Wid wid = 0; wid < numWorkers; ++wid) {
     wait(NULL);
   }
 
-  free(pipefds);
-
   __specpriv_destroy_main_heaps();
+  __specpriv_trace_close();
 }
 
 // Called when misspeculation is detected.
@@ -426,39 +525,52 @@ void __specpriv_misspec_at(Iteration iter, const char *reason)
     fprintf(stderr,"Reason: %s\n", reason);
 #endif
 
-  // wait for all workers to get to last committed checkpoint
-  // timeout for 1s -- if waiting for this long, assume that another worker misspeculated
-  // before this checkpoint
-  ParallelControlBlock *pcb = __specpriv_get_pcb();
-  Checkpoint *last = pcb->last_committed;
-  if ( !last )
-    DEBUG(printf("No previously committed checkpoint when misspec occurred\n"); fflush(stdout););
-  else
-  {
-    uint32_t num_waits = 0;
-    struct timespec wt;
-    wt.tv_sec = 0;
-    wt.tv_nsec = 1000; // 1 us
-    while ( last->num_workers != __specpriv_num_workers() && num_waits < 1000000 )
-    {
-      nanosleep(&wt,0);
-      num_waits++;
-    }
-  }
-
-  pcb->misspeculated_worker = myWorkerId;
-  pcb->misspeculated_iteration = iter;
-  pcb->misspeculation_reason = reason;
-  pcb->misspeculation_happened = 1;
+  // Workers behind us go on to their next
+  // checkpoint; those past us stop now.
+  record_misspec(myWorkerId, iter, reason);
 
   __specpriv_destroy_worker_heaps();
 
+  __specpriv_worker_done();
+
+  DEBUG(printf("Done with misspec -- returning to doorbell\n"); fflush(stdout););
+  siglongjmp( jmpbuf, 42 );
+}
+
+// The main process finds misspeculation only while
+// combining checkpoints.  It cannot unwind like a
+// worker; it records the misspeculation, and the
+// workers notice it at their next checkpoint, or
+// at once if they are past it.
+void __specpriv_main_misspec_at(Iteration iter, const char *reason)
+{
+  assert( myWorkerId == MAIN_PROCESS );
+
+#if DEBUG_MISSPEC || DEBUGGING
+  fprintf(stderr,"Misspeculation detected at iteration %d by the main process\n", iter);
+  if( reason )
+    fprintf(stderr,"Reason: %s\n", reason);
+#endif
+
+  TRACE_EVENT(TRACE_MISSPEC, iter);
+  record_misspec(MAIN_PROCESS, iter, reason);
+}
+
+// Tell main process we have completed
+// (they can see this long before waitpid()
+// would finish).  A worker which misspeculates
+// after finishing must not be counted twice.
+static void __specpriv_worker_done(void)
+{
+  inInvocation = 0;
 #if JOIN == SPIN
+  ParallelControlBlock *pcb = __specpriv_get_pcb();
+  if( pcb->workerDoneFlags[ myWorkerId ] )
+    return;
+
   pcb->workerDoneFlags[ myWorkerId ] = 1;
+  completion_signal( &pcb->workersDone );
 #endif
-
-  DEBUG(printf("Done with misspec -- returning to read()\n"); fflush(stdout););
-  siglongjmp( jmpbuf, 42 );
 }
 
 // Called by __specpriv_spawn_workers on each worker
@@ -473,11 +585,26 @@ static void __specpriv_worker_starts(Iteration firstIter, Wid wid)
 
   __specpriv_initialize_worker_heaps();
 
+  globalLoopID = workerArgs.loopID;
+  __specpriv_set_checkpoint_granularity(workerArgs.checkpointGranularity);
+
   currentIter = firstIter;
   __specpriv_set_first_iter(firstIter);
 
+  // Nothing claimed yet.
+  claimBegin = claimEnd = firstIter;
+  ownsLastIter = 0;
+
   // Initialize structure for deferred IO.
   __specpriv_reset_worker_io();
+
+  __specpriv_redux_updated = 0;
+
+  // Misspeculations before this invocation
+  // are not ours to answer.
+  abortRequested = 0;
+  abortSeen = __specpriv_get_pcb()->abort_epoch;
+  inInvocation = 1;
 }
 
 // Called by a worker when it is done working.
@@ -492,16 +619,12 @@ void __specpriv_worker_finishes(Exit exitTaken)
   __specpriv_destroy_worker_heaps();
 
   TIME(worker_exit_loop);
+  TRACE_EVENT(TRACE_INVOCATION_END, currentIter);
 
   __specpriv_get_pcb()->exit_taken = exitTaken;
+  __specpriv_get_pcb()->stats.last_iteration = currentIter;
 
-#if JOIN == SPIN
-  // Tell main process we have completed
-  // (they can read this long before waitpid()
-  // would finish)
-  ParallelControlBlock *pcb = __specpriv_get_pcb();
-  pcb->workerDoneFlags[ myWorkerId ] = 1;
-#endif
+  __specpriv_worker_done();
 
   TIME(worker_end_invocation);
   TOUT( __specpriv_print_worker_times() );
@@ -516,11 +639,50 @@ void __specpriv_worker_finishes(Exit exitTaken)
 
 Bool __specpriv_is_on_iter(void)
 {
+  if( schedule == DYNAMIC && GET_NUM_STAGES() == 1 )
+    return ownsLastIter;
+
   if ( myWorkerId == __specpriv_current_iter() % numWorkers )
     return 1;
   return 0;
 }
 
+// Called by a worker at the top of every iteration.
+// Should this worker run the ON version of the
+// iteration (i.e. does it own it)?
+//
+// Every worker still walks every iteration, running
+// the OFF version for iterations it does not own,
+// so checkpoint boundaries and misspeculation
+// ordering are the same under every schedule.
+//
+// Under the DYNAMIC schedule, a worker which reaches
+// the end of its claim takes the next scheduleChunk
+// iterations from a shared counter.  The counter is
+// never behind the claimant, since the claimant
+// reached the end of its last claim only now;
+// hence no iteration is left unowned.  Pipelines
+// route values by iteration number, so only
+// single-stage (DOALL) loops are scheduled dynamically.
+uint32_t __specpriv_owns_iter(uint32_t repId, uint32_t repFactor)
+{
+  const Iteration iter = __specpriv_current_iter();
+
+  if( schedule == STATIC || GET_NUM_STAGES() != 1 )
+    return ((uint32_t) iter) % repFactor == repId;
+
+  if( iter >= claimEnd )
+  {
+    ParallelControlBlock *pcb = __specpriv_get_pcb();
+    claimBegin = __sync_fetch_and_add( &pcb->nextUnclaimed, scheduleChunk );
+    claimEnd = claimBegin + scheduleChunk;
+    assert( claimBegin >= iter && "Skipped an unclaimed iteration" );
+  }
+
+  ownsLastIter = (claimBegin <= iter);
+  return ownsLastIter;
+}
+
 Iteration __specpriv_current_iter(void)
 {
   if (runOnEveryIter){
@@ -595,6 +757,7 @@ void __specpriv_recovery_finished(Exit e)
 #if DEBUG_MISSPEC || DEBUGGING
   printf("Recovery finished.  should resume from %u\n", currentIter);
 #endif
+  TRACE_EVENT(TRACE_RECOVERED, mi);
 }
 
 
@@ -603,11 +766,8 @@ uint32_t __specpriv_begin_invocation(void)
   assert( myWorkerId == MAIN_PROCESS );
 
 #if (AFFINITY & MP0INVOC) != 0
-  // Set affinitiy: only processor zero
-  cpu_set_t affinity;
-  CPU_ZERO( &affinity );
-  CPU_SET( CORE(0), &affinity );
-  sched_setaffinity(0, sizeof(cpu_set_t), &affinity );
+  // Set affinitiy: only placement slot zero
+  topology_pin(0);
 #endif
 
   ParallelControlBlock *pcb = __specpriv_get_pcb();
@@ -616,6 +776,7 @@ uint32_t __specpriv_begin_invocation(void)
   pcb->checkpoints.main_checkpoint->iteration = -1;
 
   __specpriv_fiveheaps_begin_invocation();
+  TRACE_EVENT(TRACE_INVOCATION_BEGIN, 0);
 
   currentIter = 0;
 
@@ -632,56 +793,52 @@ static void __specpriv_trigger_workers(Iteration firstIter, void (*callback)(voi
 {
   assert( myWorkerId == MAIN_PROCESS );
 
-#if JOIN == SPIN
   ParallelControlBlock *pcb = __specpriv_get_pcb();
-#endif
 
   Wid wid;
 
   // true by default
   runOnEveryIter = 1;
 
-  workerArgs.firstIter = firstIter;
-  workerArgs.callback = callback;
-  workerArgs.user = user;
-  workerArgs.numCores = numCores;
-  workerArgs.chunkSize = chunkSize;
-  workerArgs.sizeof_killprivate = __specpriv_sizeof_killprivate();
-  workerArgs.sizeof_shareprivate = __specpriv_sizeof_shareprivate();
-  workerArgs.sizeof_private = __specpriv_sizeof_private();
-  workerArgs.sizeof_redux = __specpriv_sizeof_redux();
-  workerArgs.sizeof_ro = __specpriv_sizeof_ro();
-  workerArgs.sizeof_local = __specpriv_sizeof_local();
-  workerArgs.first_reduction_info = __specpriv_first_reduction_info();
-  ssize_t workerArgsSize = sizeof(struct WorkerArgs);
+  WorkerArgs *args = &pcb->invocation;
+  args->firstIter = firstIter;
+  args->callback = callback;
+  args->user = user;
+  args->numCores = numCores;
+  args->chunkSize = chunkSize;
+  args->sizeof_killprivate = __specpriv_sizeof_killprivate();
+  args->sizeof_shareprivate = __specpriv_sizeof_shareprivate();
+  args->sizeof_private = __specpriv_sizeof_private();
+  args->sizeof_redux = __specpriv_sizeof_redux();
+  args->sizeof_ro = __specpriv_sizeof_ro();
+  args->sizeof_local = __specpriv_sizeof_local();
+  args->first_reduction_info = __specpriv_first_reduction_info();
+  args->loopID = globalLoopID;
+
+  // Learn from earlier invocations of this loop
+  args->checkpointGranularity = __specpriv_choose_granularity(globalLoopID, numWorkers);
+  __specpriv_set_checkpoint_granularity(args->checkpointGranularity);
+  __specpriv_reset_invocation_stats( &pcb->stats );
+  invocationFirstIter = firstIter;
+  invocationStart = rdtsc();
 
   DEBUG(fflush(stdout));
 
-  for(wid=0; wid<numWorkers; ++wid)
-  {
+  pcb->nextUnclaimed = firstIter;
+
 #if JOIN == SPIN
-    // Child is not done yet.
+  // Children are not done yet.
+  for(wid=0; wid<numWorkers; ++wid)
     pcb->workerDoneFlags[ wid ] = 0;
+  completion_reset( &pcb->workersDone );
 #endif
 
-    // write to workers to start work
-    ssize_t bytesWritten = 0;
-    uint64_t start;
-    while (bytesWritten != workerArgsSize) {
-      TIME(start);
-      ssize_t w = write(pipefds[wid][1], &workerArgs + bytesWritten,
-                        workerArgsSize - bytesWritten);
-      TADD(main_write_pipe_time, start);
-      if (w == -1) {
-        perror("parent write to pipe!!!");
-        _exit(0);
-      }
-      DEBUG(printf("Parent wrote %ld bytes to pipe %d\n", w, wid));
-      // DEBUG(printf("Should have gotten %u for sizeof_local\n", workerArgs.sizeof_local););
-      DEBUG(fflush(stdout));
-      bytesWritten += w;
-    }
-  }
+  // One ring starts all workers
+  uint64_t start;
+  TIME(start);
+  doorbell_ring( &pcb->dispatch );
+  TADD(main_dispatch_time, start);
+  DEBUG(printf("Parent rang doorbell for %u workers\n", numWorkers));
 }
 
 
@@ -733,6 +890,7 @@ Exit __specpriv_join_children(void)
   assert( myWorkerId == MAIN_PROCESS  );
 
   ParallelControlBlock *pcb = __specpriv_get_pcb();
+  TRACE_EVENT(TRACE_JOIN_BEGIN, 0);
 
 #if JOIN == WAITPID
   for(Wid wid=0; wid<numWorkers; ++wid)
@@ -740,60 +898,28 @@ Exit __specpriv_join_children(void)
 #endif
 
 #if JOIN == SPIN
-  // Wait until workers are almost done.
-  // I.e. the front checkpoint will be the final one.
-  struct timespec wt;
-  for(;;)
-  {
-    if( pcb->misspeculation_happened )
-    {
-      DEBUG(printf("Misspec happened before workers done ¯\\_(ツ)_/¯\n"););
-      break;
-    }
-
-    Checkpoint *front = pcb->checkpoints.used.first;
-    if( front && front->iteration == LAST_ITERATION )
-      break;
-
-    /* DEBUG(printf("Checkpoint not ready yet, sleeping for 1 ms\n");); */
-
-    // Sleep
-    wt.tv_sec = 0;
-    wt.tv_nsec = 1000000; // 1 millisecond
-    nanosleep(&wt,0);
-
-#if (WHO_DOES_CHECKPOINTS & FASTEST_WORKER) != 0
+  // Wait until all workers are done.
+  // Every worker signals the completion exactly
+  // once, whether it finished or misspeculated.
+#if (WHO_DOES_CHECKPOINTS & MAIN_COMMITTER) != 0
+  // Combine checkpoints as they complete.
+  while( !completion_wait( &pcb->workersDone, numWorkers, COMMITTER_POLL_NS ) )
     __specpriv_commit_zero_or_more_checkpoints( & pcb->checkpoints );
+#elif (WHO_DOES_CHECKPOINTS & FASTEST_WORKER) != 0
+  // Wake up every millisecond to help
+  // combine checkpoints in the meantime.
+  while( !completion_wait( &pcb->workersDone, numWorkers, 1000000 ) )
+    __specpriv_commit_zero_or_more_checkpoints( & pcb->checkpoints );
+#else
+  completion_wait( &pcb->workersDone, numWorkers, 0 );
 #endif
-  }
-
-  // Wait until all workers are done.
-  for(;;)
-  {
-    Bool allDone = 1;
-
-    /* if( pcb->misspeculation_happened ) */
-    /*   break; */
-
-    for(Wid wid=0; wid<numWorkers; ++wid)
-      if( !pcb->workerDoneFlags[wid] )
-      {
-        allDone = 0;
-        break;
-      }
-
-    if( allDone )
-    {
-      DEBUG(printf("All workers finished!\n"););
-      break;
-    }
-    /* DEBUG(printf("Not done yet, sleeping for 1 us\n");); */
-
-    wt.tv_sec = 0;
-    wt.tv_nsec = 1000; // 1 microsecond
-    nanosleep(&wt,0);
-  }
+  DEBUG(printf("All workers finished!\n"););
 #endif
+  TRACE_EVENT(TRACE_JOIN_END, 0);
+
+  __specpriv_update_granularity(globalLoopID, &pcb->stats, invocationFirstIter,
+    rdtsc() - invocationStart, numWorkers,
+    pcb->misspeculation_happened, pcb->misspeculated_iteration);
 
   TIME(worker_end_waitpid);
 
@@ -802,7 +928,9 @@ Exit __specpriv_join_children(void)
   // Ensure that I am currently mounting the
   // non-speculative version of the private
   // and redux heaps.
+  TRACE_EVENT(TRACE_DISTILL_BEGIN, 0);
   __specpriv_distill_checkpoints_into_liveout( &pcb->checkpoints );
+  TRACE_EVENT(TRACE_DISTILL_END, 0);
 
   // BGODALA:
   // redux allocation is called only once so commenting
@@ -825,6 +953,7 @@ Exit __specpriv_end_invocation(void)
 #endif
 
   TIME(main_end_invocation);
+  TRACE_EVENT(TRACE_INVOCATION_END, currentIter);
 
   /* TOUT(__specpriv_print_main_times()); */
   return __specpriv_get_pcb()->exit_taken;
@@ -848,6 +977,7 @@ void __specpriv_begin_iter(void)
       );
   TIME(worker_begin_iter_time);
   TIME(worker_pause_time);
+  TRACE_EVENT(TRACE_ITER_BEGIN, currentIter);
 
   /* DEBUG(printf("Worker %u starting iteration %d\n", myWorkerId, currentIter);); // XXX remove this later! */
 }
@@ -880,6 +1010,7 @@ void __specpriv_end_iter(uint32_t ckptUsed)
       );
   TIME(worker_end_iter_time);
   TIME(worker_pause_time);
+  TRACE_EVENT(TRACE_ITER_END, currentIter);
 
   // only misspec on locals if last stage
   if( __specpriv_num_local() > 0 && GET_MY_STAGE(myWorkerId) == GET_NUM_STAGES()-1 )
@@ -899,11 +1030,10 @@ void __specpriv_end_iter(uint32_t ckptUsed)
   }
 #endif
 
-  ParallelControlBlock *pcb = __specpriv_get_pcb();
-  if( pcb->misspeculation_happened && currentIter > pcb->misspeculated_iteration )
-  {
-    siglongjmp( jmpbuf, 43 );
-  }
+  if( past_misspec() )
+    worker_abort();
+
+  fold_redux_update();
 
   ++currentIter;
   Iteration globalCurIter = currentIter;
@@ -925,6 +1055,7 @@ uint32_t __specpriv_ckpt_check(void)
   TIME(start);
 
   Iteration firstIter = __specpriv_get_first_iter();
+  Iteration checkpointGranularity = __specpriv_checkpoint_granularity();
   Iteration i = currentIter + 1;
   if (!runOnEveryIter)
     i = myWorkerId + (currentIter * numWorkers);
@@ -981,6 +1112,7 @@ void __specpriv_set_last_redux_update_iter(uint32_t set) {
 }
 
 Iteration __specpriv_last_redux_update_iter(void) {
+  fold_redux_update();
   return lastReduxUpdateIter;
 }
 
@@ -7,11 +7,17 @@
 Wid __specpriv_num_workers(void);
 Wid __specpriv_my_worker_id(void);
 Bool __specpriv_is_on_iter(void);
+uint32_t __specpriv_owns_iter(uint32_t repId, uint32_t repFactor);
 
 Bool __specpriv_i_am_main_process(void);
 
 void __specpriv_misspec(const char *);
 void __specpriv_misspec_at(Iteration, const char *);
+void __specpriv_main_misspec_at(Iteration, const char *);
+
+// Leave the invocation if another worker's
+// misspeculation has signalled this one.
+void __specpriv_poll_abort(void);
 
 Iteration __specpriv_current_iter(void);
 
@@ -26,5 +32,9 @@ uint32_t __specpriv_get_ckpt_check(void);
 
 Iteration __specpriv_last_redux_update_iter(void);
 
+// Set by the code when a min/max reduction
+// with dependent reductions changes.
+extern uint32_t __specpriv_redux_updated;
+
 #endif
 
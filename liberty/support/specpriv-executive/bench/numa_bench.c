@@ -0,0 +1,196 @@
+// Microbenchmark for the NUMA placement of heaps
+// (heap_set_numa in ../heap.h).
+//
+// Each worker owns a heap, like its private or redux
+// data, and streams over it; then worker 0 combines all
+// of them into a heap of its own, like a checkpoint.
+// The policies differ in where the workers' pages go:
+//
+//   main        the main process touches them first
+//   first-touch each worker touches its own first
+//   local       each worker asks for NUMA_LOCAL, then
+//               the main process touches them first
+//   interleave  NUMA_INTERLEAVE, then the main process
+//               touches them first
+//
+// Reports GB/s of the workers' passes and of the combine,
+// for 1, 2, 4, ... workers.  On a single-node machine,
+// heap_set_numa does nothing and the policies are alike.
+//
+//   gcc -O3 -std=c11 -D_GNU_SOURCE -I.. -I../../topology numa_bench.c ../heap.c -o numa_bench
+//   ./numa_bench [MB per worker, default 64]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "heap.h"
+#include "constants.h"
+#include "topology.h"
+
+#define PASSES  (8)
+
+static const char *policies[] = { "main", "first-touch", "local", "interleave" };
+#define NUM_POLICIES  (sizeof(policies) / sizeof(policies[0]))
+
+static uint64_t bytes;
+
+// Shared between the processes.
+typedef struct
+{
+  volatile int ready, go, done;
+  double pass_seconds[ 1024 ];
+  double combine_seconds;
+} Results;
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void wait_for(volatile int *counter, int value)
+{
+  while( __atomic_load_n(counter, __ATOMIC_ACQUIRE) < value )
+    sched_yield();
+}
+
+static void worker(int w, int workers, int policy, MappedHeap *mine, Results *res)
+{
+  topology_pin(w + 1);
+
+  if( policy == 1 )
+    memset(mine[w].base, w, bytes);
+  else if( policy == 2 )
+    heap_set_numa(&mine[w], NUMA_LOCAL);
+
+  __atomic_fetch_add(&res->ready, 1, __ATOMIC_RELEASE);
+  wait_for(&res->go, 1);
+
+  uint64_t *p = (uint64_t*) mine[w].base;
+  const uint64_t n = bytes / sizeof(uint64_t);
+  const double start = now();
+  for(unsigned r=0; r<PASSES; ++r)
+    for(uint64_t i=0; i<n; ++i)
+      p[i] = p[i] * 3 + r;
+  res->pass_seconds[w] = now() - start;
+  __atomic_fetch_add(&res->done, 1, __ATOMIC_RELEASE);
+
+  // Worker 0 combines everyone's heap into its own.
+  if( w == 0 )
+  {
+    wait_for(&res->done, workers);
+
+    MappedHeap ckpt;
+    mapped_heap_init(&ckpt);
+    heap_map_anon(bytes, 0, &ckpt);
+    memset(ckpt.base, 0, bytes);
+
+    uint64_t *c = (uint64_t*) ckpt.base;
+    const double cstart = now();
+    for(int v=0; v<workers; ++v)
+    {
+      const uint64_t *q = (const uint64_t*) mine[v].base;
+      for(uint64_t i=0; i<n; ++i)
+        c[i] += q[i];
+    }
+    res->combine_seconds = now() - cstart;
+    heap_unmap(&ckpt);
+  }
+
+  _exit(0);
+}
+
+// Returns 0 on success.
+static int run(int workers, int policy, double *pass_gbs, double *combine_gbs)
+{
+  Results *res = (Results*) mmap(0, sizeof(Results), PROT_READ | PROT_WRITE,
+    MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  memset(res, 0, sizeof(Results));
+
+  Heap *heaps = (Heap*) calloc(workers, sizeof(Heap));
+  MappedHeap *mapped = (MappedHeap*) calloc(workers, sizeof(MappedHeap));
+  for(int w=0; w<workers; ++w)
+  {
+    heap_init(&heaps[w], "numa-bench", bytes, 0, w);
+    mapped_heap_init(&mapped[w]);
+    heap_map_anywhere(&heaps[w], &mapped[w]);
+  }
+
+  pid_t pids[ 1024 ];
+  for(int w=0; w<workers; ++w)
+    if( (pids[w] = fork()) == 0 )
+      worker(w, workers, policy, mapped, res);
+
+  wait_for(&res->ready, workers);
+  for(int w=0; w<workers; ++w)
+  {
+    if( policy == 3 )
+      heap_set_numa(&mapped[w], NUMA_INTERLEAVE);
+    if( policy != 1 )
+      memset(mapped[w].base, w, bytes);
+  }
+  __atomic_store_n(&res->go, 1, __ATOMIC_RELEASE);
+
+  int failed = 0;
+  for(int w=0; w<workers; ++w)
+  {
+    int status;
+    waitpid(pids[w], &status, 0);
+    failed |= !WIFEXITED(status) || WEXITSTATUS(status);
+  }
+
+  double slowest = 0;
+  for(int w=0; w<workers; ++w)
+    if( res->pass_seconds[w] > slowest )
+      slowest = res->pass_seconds[w];
+  *pass_gbs = (double) bytes * PASSES * workers / slowest / 1e9;
+  *combine_gbs = (double) bytes * workers / res->combine_seconds / 1e9;
+
+  for(int w=0; w<workers; ++w)
+  {
+    heap_unmap(&mapped[w]);
+    heap_fini(&heaps[w]);
+  }
+  free(mapped);
+  free(heaps);
+  munmap(res, sizeof(Results));
+  return failed;
+}
+
+int main(int argc, char **argv)
+{
+  const unsigned mb = (argc > 1) ? (unsigned) atoi(argv[1]) : 64;
+  bytes = (uint64_t) mb << 20;
+
+  // Leave slot 0 to this process.
+  int max_workers = topology_num_cpus() - 1;
+  if( max_workers < 1 )
+    max_workers = 1;
+  topology_pin(0);
+
+  printf("%-8s %-12s %14s %14s   (GB/s)\n", "workers", "policy", "passes", "combine");
+  int failed = 0;
+  for(int workers=1; ; workers *= 2)
+  {
+    if( workers > max_workers )
+      workers = max_workers;
+
+    for(unsigned p=0; p<NUM_POLICIES; ++p)
+    {
+      double pass_gbs, combine_gbs;
+      failed |= run(workers, (int) p, &pass_gbs, &combine_gbs);
+      printf("%-8d %-12s %14.2f %14.2f\n", workers, policies[p], pass_gbs, combine_gbs);
+    }
+
+    if( workers == max_workers )
+      break;
+  }
+
+  return failed;
+}
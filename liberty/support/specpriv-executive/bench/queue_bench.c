@@ -0,0 +1,220 @@
+// Microbenchmark for the pipeline queues (../sw_queue.h).
+//
+// Compares the Lamport ring of sw_queue, the flag-per-value
+// queue which it replaced, and the chunked queue of
+// support/nq.  Reports the throughput of one producer
+// and one consumer thread, and the one-way latency of a
+// value bounced between two threads.
+//
+//   gcc -O3 -std=c11 -D_GNU_SOURCE -I.. queue_bench.c ../sw_queue.c ../../nq/nq.c -lpthread -o queue_bench
+//   ./queue_bench [thousands of values, default 20000]
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include "sw_queue.h"
+#include "../../nq/nq.h"
+
+// sw_queue polls for aborts while it waits;
+// outside the runtime there are none.
+void __specpriv_poll_abort(void)
+{
+}
+
+static uint64_t N;
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// The old sw_queue: a flag and a value per
+// element, both in the shared data[].
+#define FLAG_SLOTS  (8192*2)
+
+typedef struct
+{
+  void * volatile *head;
+  char pad1[64 - sizeof(void*)];
+  void * volatile *tail;
+  char pad2[64 - sizeof(void*)];
+  void *data[FLAG_SLOTS];
+} FlagQueue;
+
+static FlagQueue *flag_create(void)
+{
+  FlagQueue *q = (FlagQueue*) mmap(0, sizeof(FlagQueue),
+    PROT_WRITE | PROT_READ, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  q->head = q->tail = &q->data[0];
+  memset(q->data, 0, sizeof(q->data));
+  return q;
+}
+
+static void flag_produce(FlagQueue *q, void *value)
+{
+  while( *q->head != 0 );
+  *(q->head+1) = value;
+  *q->head = (void*) 1;
+  q->head += 2;
+  if( q->head >= &q->data[FLAG_SLOTS] )
+    q->head = &q->data[0];
+}
+
+static void *flag_consume(FlagQueue *q)
+{
+  while( *q->tail == 0 );
+  void *value = *(q->tail+1);
+  *(q->tail+1) = 0;
+  *q->tail = 0;
+  q->tail += 2;
+  if( q->tail >= &q->data[FLAG_SLOTS] )
+    q->tail = &q->data[0];
+  return value;
+}
+
+// One interface over the three.
+typedef struct
+{
+  const char *name;
+  void *(*create)(void);
+  void (*produce)(void *q, uint64_t v);
+  uint64_t (*consume)(void *q);
+  void (*flush)(void *q);
+} Impl;
+
+static void *ring_create(void) { return __sw_queue_create(); }
+static void ring_produce(void *q, uint64_t v) { __sw_queue_produce((queue_t*) q, (void*) v); }
+static uint64_t ring_consume(void *q) { return (uint64_t) __sw_queue_consume((queue_t*) q); }
+static void ring_flush(void *q) { __sw_queue_flush((queue_t*) q); }
+
+static void *flagq_create(void) { return flag_create(); }
+static void flagq_produce(void *q, uint64_t v) { flag_produce((FlagQueue*) q, (void*) v); }
+static uint64_t flagq_consume(void *q) { return (uint64_t) flag_consume((FlagQueue*) q); }
+static void flagq_flush(void *q) { }
+
+// nq: the consumer end is created first; the
+// handle holds both ends.
+typedef struct { Consumer *cons; Producer *prod; } NQ;
+static void *nq_create(void)
+{
+  NQ *q = (NQ*) malloc(sizeof(NQ));
+  q->cons = nq_new_consumer();
+  q->prod = nq_new_producer(q->cons);
+  return q;
+}
+static void nqq_produce(void *q, uint64_t v) { nq_produce(((NQ*)q)->prod, v); }
+static uint64_t nqq_consume(void *q) { return nq_consume(((NQ*)q)->cons); }
+static void nqq_flush(void *q) { nq_flush(((NQ*)q)->prod); }
+
+static const Impl impls[] =
+{
+  { "ring",  ring_create,  ring_produce,  ring_consume,  ring_flush },
+  { "flags", flagq_create, flagq_produce, flagq_consume, flagq_flush },
+  { "nq",    nq_create,    nqq_produce,   nqq_consume,   nqq_flush },
+};
+#define NUM_IMPLS (sizeof(impls) / sizeof(impls[0]))
+
+typedef struct
+{
+  const Impl *impl;
+  void *in, *out;
+  uint64_t n;
+  int bounce;
+} Job;
+
+static void *producer(void *arg)
+{
+  const Job *job = (const Job*) arg;
+  for(uint64_t i=1; i<=job->n; ++i)
+  {
+    job->impl->produce(job->out, i);
+    if( job->bounce )
+    {
+      job->impl->flush(job->out);
+      job->impl->consume(job->in);
+    }
+  }
+  job->impl->flush(job->out);
+  return 0;
+}
+
+// Consumes, checks order, and (if bouncing) replies.
+static void *consumer(void *arg)
+{
+  const Job *job = (const Job*) arg;
+  uint64_t bad = 0;
+  for(uint64_t i=1; i<=job->n; ++i)
+  {
+    bad += ( job->impl->consume(job->in) != i );
+    if( job->bounce )
+    {
+      job->impl->produce(job->out, i);
+      job->impl->flush(job->out);
+    }
+  }
+  return (void*) bad;
+}
+
+// Returns seconds, or a negative number if
+// values arrived out of order.
+static double run(const Impl *impl, uint64_t n, int bounce)
+{
+  void *ab = impl->create(), *ba = impl->create();
+  Job p = { impl, ba, ab, n, bounce };
+  Job c = { impl, ab, ba, n, bounce };
+
+  pthread_t tp, tc;
+  const double start = now();
+  pthread_create(&tc, 0, consumer, &c);
+  pthread_create(&tp, 0, producer, &p);
+  void *bad;
+  pthread_join(tp, 0);
+  pthread_join(tc, &bad);
+  const double elapsed = now() - start;
+
+  return bad ? -1 : elapsed;
+}
+
+int main(int argc, char **argv)
+{
+  const unsigned thousands = (argc > 1) ? (unsigned) atoi(argv[1]) : 20000;
+  N = (uint64_t) thousands * 1000;
+  const uint64_t bounces = N / 100;
+
+  printf("%-8s %16s %20s\n", "queue", "Mvalues/s", "one-way latency (ns)");
+  int failed = 0;
+  for(unsigned i=0; i<NUM_IMPLS; ++i)
+  {
+    const Impl *impl = &impls[i];
+    printf("%-8s", impl->name);
+
+    const double t = run(impl, N, 0);
+    if( t < 0 )
+    {
+      printf(" %16s", "WRONG");
+      failed = 1;
+    }
+    else
+      printf(" %16.1f", N / t / 1e6);
+
+    // nq only sends whole chunks; each bounce
+    // flushes, so it is measured all the same.
+    const double l = run(impl, bounces, 1);
+    if( l < 0 )
+    {
+      printf(" %20s", "WRONG");
+      failed = 1;
+    }
+    else
+      printf(" %20.0f", l / bounces / 2 * 1e9);
+    printf("\n");
+  }
+
+  return failed;
+}
@@ -0,0 +1,213 @@
+// Microbenchmark for the shadow kernels (../shadow.h).
+//
+// Runs every kernel set which this CPU supports over
+// metadata patterns like those seen by the runtime,
+// checks each result against the scalar kernels, and
+// reports GB/s of shadow processed.
+//
+//   gcc -O3 -std=c11 -D_GNU_SOURCE -I.. shadow_bench.c ../shadow.c -o shadow_bench
+//   ./shadow_bench [MB per buffer, default 16]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "shadow.h"
+#include "constants.h"
+
+static const char *isas[] = { "scalar", "sse2", "avx2", "avx512" };
+#define NUM_ISAS  (sizeof(isas) / sizeof(isas[0]))
+
+static uint64_t N;
+static unsigned reps;
+
+static uint8_t *src_p, *src_s, *dst_p, *dst_s;
+static uint8_t *in_p, *in_s;
+static uint8_t *ref_p, *ref_s;
+
+static uint64_t seed = 88172645463325252ULL;
+static uint64_t rnd(void)
+{
+  seed ^= seed << 13;
+  seed ^= seed >> 7;
+  seed ^= seed << 17;
+  return seed;
+}
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Shadow patterns.  Objects are runs of 8..64 bytes; a
+// fraction 'density' of them are touched with 'code'.
+static void fill_objects(uint8_t *s, double density, uint8_t code, uint8_t other)
+{
+  memset(s, other, N);
+  for(uint64_t i=0; i<N; )
+  {
+    const uint64_t len = 8 + (rnd() % 8) * 8;
+    if( (rnd() % 1000) < density * 1000 )
+      memset(&s[i], code, (i + len <= N) ? len : N - i);
+    i += len;
+  }
+}
+
+typedef struct
+{
+  const char *name;
+  const char *pattern;
+
+  // Build the inputs into src_*, in_*.
+  void (*setup)(void);
+
+  // Run one kernel over dst_*; returns 1 if it reported a conflict.
+  Bool (*run)(const ShadowKernels *k);
+} Case;
+
+// Code of the current iteration.
+#define CODE  (NUM_RESERVED_SHADOW_VALUES + 7)
+
+static void setup_fresh(void) { memset(in_s, LIVE_IN, N); }
+static void setup_mine(void)  { memset(in_s, CODE, N); }
+static void setup_mixed(void) { fill_objects(in_s, 0.5, CODE, LIVE_IN); }
+
+static Bool run_read(const ShadowKernels *k)
+{
+  return k->read_range(dst_s, dst_s + N, CODE);
+}
+
+static Bool run_write(const ShadowKernels *k)
+{
+  return k->write_range(dst_s, dst_s + N, CODE);
+}
+
+// A worker's shadow, distilled into a partial
+// which another worker has already filled.
+static void setup_worker(double density)
+{
+  for(uint64_t i=0; i<N; ++i)
+    src_p[i] = (uint8_t) rnd();
+  fill_objects(src_s, density, CODE, LIVE_IN);
+  fill_objects(in_s, density, CODE - 1, LIVE_IN);
+  memset(in_p, 0, N);
+}
+static void setup_worker_sparse(void) { setup_worker(0.05); }
+static void setup_worker_dense(void)  { setup_worker(0.9); }
+
+static Bool run_worker(const ShadowKernels *k)
+{
+  return k->worker_into_partial(src_p, src_s, dst_p, dst_s, 0, N);
+}
+
+// A committed checkpoint, combined into a newer
+// partial which wrote (and did not read) some bytes.
+static void setup_committed(void)
+{
+  for(uint64_t i=0; i<N; ++i)
+    src_p[i] = (uint8_t) rnd();
+  fill_objects(src_s, 0.3, CODE, LIVE_IN);
+  fill_objects(in_s, 0.3, CODE + 1, LIVE_IN);
+  memset(in_p, 0, N);
+}
+
+static Bool run_committed(const ShadowKernels *k)
+{
+  return k->committed_into_partial(src_p, src_s, dst_p, dst_s, 0, N);
+}
+
+static Bool run_main(const ShadowKernels *k)
+{
+  k->committed_into_main(src_p, src_s, dst_p, 0, N);
+  return 0;
+}
+
+static const Case cases[] =
+{
+  { "read_range",             "all LIVE_IN (first read)",   setup_fresh,         run_read },
+  { "read_range",             "all current (re-read)",      setup_mine,          run_read },
+  { "read_range",             "50% current, 50% LIVE_IN",   setup_mixed,         run_read },
+  { "write_range",            "50% current, 50% LIVE_IN",   setup_mixed,         run_write },
+  { "worker_into_partial",    "5% of objects written",      setup_worker_sparse, run_worker },
+  { "worker_into_partial",    "90% of objects written",     setup_worker_dense,  run_worker },
+  { "committed_into_partial", "30% written in each",        setup_committed,     run_committed },
+  { "committed_into_main",    "30% written",                setup_committed,     run_main },
+};
+#define NUM_CASES (sizeof(cases) / sizeof(cases[0]))
+
+static void reset(void)
+{
+  memcpy(dst_p, in_p, N);
+  memcpy(dst_s, in_s, N);
+}
+
+int main(int argc, char **argv)
+{
+  const unsigned mb = (argc > 1) ? (unsigned) atoi(argv[1]) : 16;
+  N = (uint64_t) mb << 20;
+  reps = 20;
+
+  uint8_t **bufs[] = { &src_p, &src_s, &dst_p, &dst_s, &in_p, &in_s, &ref_p, &ref_s };
+  for(unsigned i=0; i<sizeof(bufs)/sizeof(bufs[0]); ++i)
+    if( !(*bufs[i] = (uint8_t*) aligned_alloc(64, N)) )
+    {
+      perror("aligned_alloc");
+      return 1;
+    }
+
+  printf("%-24s %-28s", "kernel", "pattern");
+  for(unsigned j=0; j<NUM_ISAS; ++j)
+    printf(" %10s", isas[j]);
+  printf("   (GB/s of shadow)\n");
+
+  int failed = 0;
+  for(unsigned c=0; c<NUM_CASES; ++c)
+  {
+    const Case *cs = &cases[c];
+    cs->setup();
+
+    // Reference result.
+    reset();
+    const Bool ref_conflict = cs->run( __specpriv_get_shadow_kernels("scalar") );
+    memcpy(ref_p, dst_p, N);
+    memcpy(ref_s, dst_s, N);
+
+    printf("%-24s %-28s", cs->name, cs->pattern);
+    for(unsigned j=0; j<NUM_ISAS; ++j)
+    {
+      const ShadowKernels *k = __specpriv_get_shadow_kernels(isas[j]);
+      if( !k )
+      {
+        printf(" %10s", "-");
+        continue;
+      }
+
+      reset();
+      if( cs->run(k) != ref_conflict || memcmp(dst_p, ref_p, N) || memcmp(dst_s, ref_s, N) )
+      {
+        printf(" %10s", "WRONG");
+        failed = 1;
+        continue;
+      }
+
+      // Time only the kernel: the first run changes
+      // the destination, so reset before each one.
+      double total = 0;
+      for(unsigned r=0; r<reps; ++r)
+      {
+        reset();
+        const double start = now();
+        cs->run(k);
+        total += now() - start;
+      }
+      printf(" %10.2f", (double) N * reps / total / 1e9);
+    }
+    printf("\n");
+  }
+
+  return failed;
+}
+
@@ -12,6 +12,9 @@
 #include "private.h"
 #include "timer.h"
 #include "fiveheaps.h"
+#include "dirty.h"
+#include "trace.h"
+#include "sw_queue.h"
 
 static Checkpoint *worker_last_committed = 0;
 
@@ -89,6 +92,56 @@ static void push_back(CheckpointList *list, Checkpoint *node)
     list->first = node;
 }
 
+// The head of the free stack holds a pointer into the
+// meta heap in its low bits, and a push counter above.
+#define STACK_POINTER_BITS  (POINTER_BITS + 1)
+#define STACK_POINTER_MASK  ((1ULL << STACK_POINTER_BITS) - 1)
+
+static Checkpoint *stack_top(uint64_t head)
+{
+  return (Checkpoint*) (head & STACK_POINTER_MASK);
+}
+
+static Bool stack_empty(CheckpointStack *stack)
+{
+  return stack_top(stack->head) == 0;
+}
+
+static void stack_push(CheckpointStack *stack, Checkpoint *node)
+{
+  node->prev = 0;
+  for(;;)
+  {
+    const uint64_t old = stack->head;
+    node->next = stack_top(old);
+
+    const uint64_t count = (old >> STACK_POINTER_BITS) + 1;
+    const uint64_t new = (count << STACK_POINTER_BITS) | (uint64_t) node;
+    if( __sync_bool_compare_and_swap( &stack->head, old, new ) )
+      return;
+  }
+}
+
+static Checkpoint *stack_pop(CheckpointStack *stack)
+{
+  for(;;)
+  {
+    const uint64_t old = stack->head;
+    Checkpoint *node = stack_top(old);
+    if( !node )
+      return 0;
+
+    // If node was popped and pushed again since we read
+    // the head, the counter has changed and we retry.
+    const uint64_t new = (old & ~STACK_POINTER_MASK) | (uint64_t) node->next;
+    if( __sync_bool_compare_and_swap( &stack->head, old, new ) )
+    {
+      node->next = 0;
+      return node;
+    }
+  }
+}
+
 // Assumes that the manager object is locked.
 static Bool __specpriv_is_saturated(CheckpointManager *mgr)
 {
@@ -114,9 +167,9 @@ Checkpoint *__specpriv_alloc_checkpoint(CheckpointManager *mgr)
   for(;;)
   {
     // If available, reuse an old checkpoint object.
-    if( !list_empty(&mgr->free) )
+    Checkpoint *chkpt = stack_pop( &mgr->free );
+    if( chkpt )
     {
-      Checkpoint *chkpt = pop_front( &mgr->free );
       chkpt->type = CL_Free;
       return chkpt;
     }
@@ -139,10 +192,17 @@ Checkpoint *__specpriv_alloc_checkpoint(CheckpointManager *mgr)
       currentIter -= currentIter % numWorkers;
     }
 
-    while( list_empty( &mgr->free ) && __specpriv_is_saturated(mgr) )
+    // The workers we wait for may be waiting for our values.
+    __sw_queue_flush_all();
+
+    TRACE_EVENT(TRACE_STALL_BEGIN, currentIter);
+    while( stack_empty( &mgr->free ) && __specpriv_is_saturated(mgr) )
     {
       if( pcb->misspeculation_happened && pcb->misspeculated_iteration <= currentIter )
+      {
+        TRACE_EVENT(TRACE_STALL_END, currentIter);
         return 0;
+      }
 
       struct timespec wt;
       wt.tv_sec = 0;
@@ -151,6 +211,7 @@ Checkpoint *__specpriv_alloc_checkpoint(CheckpointManager *mgr)
 
       __specpriv_commit_zero_or_more_checkpoints( mgr );
     }
+    TRACE_EVENT(TRACE_STALL_END, currentIter);
 
     acquire_lock( &mgr->lock );
   }
@@ -164,10 +225,16 @@ Checkpoint *__specpriv_alloc_checkpoint(CheckpointManager *mgr)
   chkpt->num_workers = 0;
   chkpt->prev = chkpt->next = 0;
 
+  // The new shadow heap is all LIVE_IN,
+  // and none of its pages are dirty.
+  chkpt->shadow_lowest_inclusive = (uint8_t*) (SHADOW_ADDR + (1UL<<POINTER_BITS));
+  chkpt->shadow_highest_exclusive = (uint8_t*) (SHADOW_ADDR);
+
   for(Wid wid=0; wid<MAX_WORKERS; ++wid)
   {
     chkpt->io_events.lists[ wid ] = 0;
     chkpt->io_events.num[ wid ] = 0;
+    chkpt->io_events.bytes[ wid ] = 0;
   }
 
   heap_init( &chkpt->heap_priv,     "chkpt-private",     HEAP_SIZE, (void*)PRIV_ADDR,   name);
@@ -209,9 +276,10 @@ void __specpriv_init_checkpoint_manager(CheckpointManager *mgr)
   acquire_lock( &mgr->lock );
 
   mgr->total_checkpoint_objects = 0;
+  mgr->committing = 0;
 
   __specpriv_init_checkpoint_list( &mgr->used );
-  __specpriv_init_checkpoint_list( &mgr->free );
+  mgr->free.head = 0;
 
   mgr->main_checkpoint = __specpriv_alloc_checkpoint(mgr);
   DEBUG(printf("Allocated checkpoint manager\n"););
@@ -235,7 +303,8 @@ void __specpriv_destroy_checkpoint_manager(CheckpointManager *mgr)
   assert( mgr->lock == 0 );
 
   __specpriv_destroy_checkpoint_list( &mgr->used );
-  __specpriv_destroy_checkpoint_list( &mgr->free );
+  for(Checkpoint *i; (i = stack_pop( &mgr->free )); )
+    __specpriv_destroy_checkpoint(i);
 
   __specpriv_destroy_checkpoint( mgr->main_checkpoint );
 
@@ -276,9 +345,26 @@ static void __specpriv_initialize_partial_checkpoint(Checkpoint *partial,
                                                      MappedHeap *shareshadow) {
   // Initialize shadow, redux.
 
+#if DIRTY_PAGES != 0
+  // Only the dirty pages within the range touched by
+  // this checkpoint object's last use differ from LIVE_IN.
+  if( partial->shadow_lowest_inclusive < partial->shadow_highest_exclusive )
+  {
+    uint64_t *dirty = dirty_map( (uint64_t)shadow->base );
+    const uint64_t low  = ROUND_DOWN( partial->shadow_lowest_inclusive - (uint8_t*)SHADOW_ADDR, DIRTY_PAGE_SIZE ),
+                   high = ROUND_UP( partial->shadow_highest_exclusive - (uint8_t*)SHADOW_ADDR, DIRTY_PAGE_SIZE );
+
+    uint64_t cursor = low, from, to;
+    while( dirty_next_range(dirty, &cursor, high, &from, &to) )
+      memset((uint8_t*)shadow->base + from, LIVE_IN, to - from);
+
+    dirty_clear(dirty, low, high);
+  }
+#else
   const Len priv_used = __specpriv_sizeof_private();
 
   memset((void*)shadow->base, LIVE_IN, priv_used);
+#endif
 
   partial->shadow_lowest_inclusive = (uint8_t*) (SHADOW_ADDR + (1UL<<POINTER_BITS));
   partial->shadow_highest_exclusive = (uint8_t*) (SHADOW_ADDR);
@@ -342,15 +428,15 @@ static Bool __specpriv_combine_private(Checkpoint *older, Checkpoint *newer)
   MappedHeap commit_priv, partial_priv;
   mapped_heap_init( &commit_priv );
   mapped_heap_init( &partial_priv );
-  heap_map_anywhere( &older->heap_priv, &commit_priv );
-  heap_map_anywhere( &newer->heap_priv, &partial_priv );
+  heap_map_cached( &older->heap_priv, &commit_priv );
+  heap_map_cached( &newer->heap_priv, &partial_priv );
 
   // Map the shadow heaps
   MappedHeap commit_shadow, partial_shadow;
   mapped_heap_init( &commit_shadow );
   mapped_heap_init( &partial_shadow );
-  heap_map_anywhere( &older->heap_shadow, &commit_shadow );
-  heap_map_anywhere( &newer->heap_shadow, &partial_shadow );
+  heap_map_cached( &older->heap_shadow, &commit_shadow );
+  heap_map_cached( &newer->heap_shadow, &partial_shadow );
 
   // Combine them
   misspec |= __specpriv_distill_committed_private_into_partial(
@@ -361,12 +447,12 @@ static Bool __specpriv_combine_private(Checkpoint *older, Checkpoint *newer)
     newer->type = CL_Broken;
 
   // Unmap
-  heap_unmap( &partial_shadow );
-  heap_unmap( &commit_shadow );
+  heap_release( &partial_shadow );
+  heap_release( &commit_shadow );
 
   // Unmap
-  heap_unmap( &partial_priv );
-  heap_unmap( &commit_priv );
+  heap_release( &partial_priv );
+  heap_release( &commit_priv );
 
   return misspec;
 }
@@ -376,15 +462,15 @@ static Bool __specpriv_combine_killprivate( Checkpoint *older, Checkpoint *newer
   MappedHeap commit_killpriv, partial_killpriv;
   mapped_heap_init( &commit_killpriv );
   mapped_heap_init( &partial_killpriv );
-  heap_map_anywhere( &older->heap_killpriv, &commit_killpriv );
-  heap_map_anywhere( &newer->heap_killpriv, &partial_killpriv );
+  heap_map_cached( &older->heap_killpriv, &commit_killpriv );
+  heap_map_cached( &newer->heap_killpriv, &partial_killpriv );
 
   // no need for shadow heaps
   __specpriv_distill_committed_killprivate_into_partial(
       older, &commit_killpriv, newer, &partial_killpriv );
 
-  heap_unmap( &partial_killpriv );
-  heap_unmap( &commit_killpriv );
+  heap_release( &partial_killpriv );
+  heap_release( &commit_killpriv );
 
   return 0; // never misspecs
 }
@@ -395,24 +481,24 @@ static Bool __specpriv_combine_shareprivate( Checkpoint *older, Checkpoint *newe
   MappedHeap commit_sharepriv, partial_sharepriv;
   mapped_heap_init( &commit_sharepriv );
   mapped_heap_init( &partial_sharepriv );
-  heap_map_anywhere( &older->heap_sharepriv, &commit_sharepriv );
-  heap_map_anywhere( &newer->heap_sharepriv, &partial_sharepriv );
+  heap_map_cached( &older->heap_sharepriv, &commit_sharepriv );
+  heap_map_cached( &newer->heap_sharepriv, &partial_sharepriv );
 
   MappedHeap commit_shareshadow, partial_shareshadow;
   mapped_heap_init( &commit_shareshadow );
   mapped_heap_init( &partial_shareshadow );
-  heap_map_anywhere( &older->heap_shareshadow, &commit_shareshadow );
-  heap_map_anywhere( &newer->heap_shareshadow, &partial_shareshadow );
+  heap_map_cached( &older->heap_shareshadow, &commit_shareshadow );
+  heap_map_cached( &newer->heap_shareshadow, &partial_shareshadow );
 
   // no need for shadow heaps
   __specpriv_distill_committed_shareprivate_into_partial(
       older, &commit_sharepriv, &commit_shareshadow, newer, &partial_sharepriv,
       &partial_shareshadow);
 
-  heap_unmap( &partial_sharepriv );
-  heap_unmap( &commit_sharepriv );
-  heap_unmap( &partial_shareshadow );
-  heap_unmap( &commit_shareshadow );
+  heap_release( &partial_sharepriv );
+  heap_release( &commit_sharepriv );
+  heap_release( &partial_shareshadow );
+  heap_release( &commit_shareshadow );
 
   return 0; // never misspecs
 }
@@ -426,8 +512,8 @@ static Bool __specpriv_combine_redux(Checkpoint *older, Checkpoint *newer)
   MappedHeap commit_redux, partial_redux;
   mapped_heap_init( &commit_redux );
   mapped_heap_init( &partial_redux );
-  heap_map_anywhere( &older->heap_redux, &commit_redux );
-  heap_map_anywhere( &newer->heap_redux, &partial_redux );
+  heap_map_cached( &older->heap_redux, &commit_redux );
+  heap_map_cached( &newer->heap_redux, &partial_redux );
 
   // newer checkpoint has the correct redux values
   // just initialize the old checkpoint redux with identity
@@ -444,8 +530,8 @@ static Bool __specpriv_combine_redux(Checkpoint *older, Checkpoint *newer)
   else
     __specpriv_commit_io( &older->io_events, &commit_redux);
 
-  heap_unmap( &partial_redux );
-  heap_unmap( &commit_redux );
+  heap_release( &partial_redux );
+  heap_release( &commit_redux );
 
   return misspec;
 }
@@ -461,10 +547,12 @@ static Bool __specpriv_combine_checkpoints(Checkpoint *older, Checkpoint *newer)
   // into the newer copy.  Misspeculation may occur
   // during this operation.
 
+  TRACE_EVENT(TRACE_COMBINE_BEGIN, newer->iteration);
   Bool misspec = __specpriv_combine_private(older,newer)
               || __specpriv_combine_killprivate(older, newer)
               || __specpriv_combine_shareprivate(older, newer)
               || __specpriv_combine_redux(older,newer);
+  TRACE_EVENT(TRACE_COMBINE_END, newer->iteration);
 
 
   DEBUG(printf("Done combining checkpoints (worker %u) for iterations %d and %d\n",
@@ -472,89 +560,85 @@ static Bool __specpriv_combine_checkpoints(Checkpoint *older, Checkpoint *newer)
   return misspec;
 }
 
+// Are the first two checkpoints in the used list complete?
+static Bool __specpriv_can_combine(CheckpointManager *mgr)
+{
+  Checkpoint *alpha = mgr->used.first;
+  if( !alpha || alpha->type != CL_Complete )
+    return 0;
+
+  Checkpoint *beta = alpha->next;
+  return beta && beta->type == CL_Complete;
+}
+
 // Assumes that I own NO locks -- not the checkpoints, nor the manager
 Bool __specpriv_commit_zero_or_more_checkpoints(CheckpointManager *mgr)
 {
   DEBUG(printf("Worker %u begins committing checkpoints...\n", __specpriv_my_worker_id() ));
 
-  // if we do this only once will it have any effect
-  /* for(;;) */
-  /* { */
-    // Do a quick test before locking to avoid
-    // contention.  We will check again after
-    // we have the lock...
-
-    // Is alpha complete?
-    Checkpoint *alpha = mgr->used.first;
-    if( !alpha || alpha->type != CL_Complete )
+  for(;;)
+  {
+    // Do a quick test before taking the
+    // token, to avoid contention.
+    if( !__specpriv_can_combine(mgr) )
       return 0;
 
-    // How about the second checkpoint?
-    Checkpoint *beta = alpha->next;
-    if( !beta || beta->type != CL_Complete )
+    // Someone else is combining; they will look
+    // again after they give up the token.
+    if( !__sync_bool_compare_and_swap( &mgr->committing, 0, 1 ) )
       return 0;
 
-    acquire_lock( &alpha->lock );
-    acquire_lock( &beta->lock );
-
-    DEBUG(
-        if ( alpha->type != CL_Complete )
-          printf("alpha not complete\n");
-        if ( beta->type != CL_Complete )
-          printf("beta not complete\n");
-        if ( alpha->next != beta )
-          printf("alpha->next != beta\n");
-      );
-
-    // ensure that my locking discipline isn't bullshit
-    if( alpha->type != CL_Complete
-    ||  alpha->next != beta
-    ||  beta->type  != CL_Complete )
+    // Only the holder of the token removes checkpoints
+    // from the front of the used list, and complete
+    // checkpoints are no longer touched by workers, so
+    // we need no checkpoint locks.
+    Checkpoint *broken = 0;
+    while( __specpriv_can_combine(mgr) )
     {
-      release_lock( &beta->lock );
-      release_lock( &alpha->lock );
-      DEBUG(printf("Locking discipline is indeed bullshit\n"););
-      return 0;
-    }
-
-    // Mark alpha as NOT complete;
-    // This will temporarily stop contention
-    // of other workers who are trying to
-    // commit stuff...
-    alpha->type = CL_Free;
+      Checkpoint *alpha = mgr->used.first;
+      Checkpoint *beta = alpha->next;
 
-    // First and next are both complete.
-    Bool misspec = __specpriv_combine_checkpoints(alpha, beta);
+      // Mark alpha as NOT complete, so that it is
+      // not adopted by the main process.
+      alpha->type = CL_Free;
 
-    if( misspec )
-    {
-      beta->type = CL_Broken;
+      // First and next are both complete.
+      if( __specpriv_combine_checkpoints(alpha, beta) )
+      {
+        beta->type = CL_Broken;
+        broken = beta;
+        break;
+      }
 
-      release_lock( &beta->lock );
-      release_lock( &alpha->lock );
+      // Remove the first checkpoint from
+      // the used list, put it in the free stack.
+      acquire_lock( &mgr->lock );
+      assert( alpha == mgr->used.first );
+      pop_front( &mgr->used );
+      release_lock( &mgr->lock );
 
-      __specpriv_misspec_at(beta->iteration,
-        "Misspeculation during checkpoint");
-      return 1;
+      stack_push( &mgr->free, alpha );
     }
 
-    // Remove the second checkpoint from
-    // the used list, put it in the free list.
-    acquire_lock( &mgr->lock );
-
-    assert( alpha == mgr->used.first );
-
-    pop_front( &mgr->used );
-    push_back( &mgr->free, alpha );
+    __sync_lock_release( &mgr->committing );
 
-    release_lock( &mgr->lock );
-    release_lock( &beta->lock );
-    release_lock( &alpha->lock );
+    if( broken )
+    {
+      if( __specpriv_i_am_main_process() )
+      {
+        __specpriv_main_misspec_at(broken->iteration,
+          "Misspeculation during checkpoint");
+        return 1;
+      }
 
-    // try to combine even more...
-  /* } */
+      __specpriv_misspec_at(broken->iteration,
+        "Misspeculation during checkpoint");
+    }
 
-  return 0;
+    // A checkpoint may have completed after our last
+    // look, while its worker found the token taken.
+    __sync_synchronize();
+  }
 }
 
 
@@ -578,19 +662,31 @@ static void __specpriv_worker_perform_checkpoint_locked(Checkpoint *chkpt, Itera
   mapped_heap_init( &partial_shareshadow );
   mapped_heap_init( &partial_redux );
 
-  heap_map_anywhere( &chkpt->heap_priv, &partial_priv );
-  heap_map_anywhere( &chkpt->heap_killpriv, &partial_killpriv );
-  heap_map_anywhere( &chkpt->heap_sharepriv, &partial_sharepriv );
-  heap_map_anywhere( &chkpt->heap_shadow, &partial_shadow );
-  heap_map_anywhere( &chkpt->heap_shareshadow, &partial_shareshadow );
-  heap_map_anywhere( &chkpt->heap_redux, &partial_redux );
+  heap_map_cached( &chkpt->heap_priv, &partial_priv );
+  heap_map_cached( &chkpt->heap_killpriv, &partial_killpriv );
+  heap_map_cached( &chkpt->heap_sharepriv, &partial_sharepriv );
+  heap_map_cached( &chkpt->heap_shadow, &partial_shadow );
+  heap_map_cached( &chkpt->heap_shareshadow, &partial_shareshadow );
+  heap_map_cached( &chkpt->heap_redux, &partial_redux );
 
-  heap_alloc( &partial_redux, chkpt->redux_used );
+  heap_reserve( &partial_redux, chkpt->redux_used );
 
   if( chkpt->num_workers == 0 )
+  {
+    // The first worker to write into a checkpoint
+    // places it on its node.  (Which worker will
+    // combine it, we cannot know yet.)
+    heap_set_numa( &partial_priv, NUMA_CHECKPOINT );
+    heap_set_numa( &partial_killpriv, NUMA_CHECKPOINT );
+    heap_set_numa( &partial_sharepriv, NUMA_CHECKPOINT );
+    heap_set_numa( &partial_shadow, NUMA_CHECKPOINT );
+    heap_set_numa( &partial_shareshadow, NUMA_CHECKPOINT );
+    heap_set_numa( &partial_redux, NUMA_CHECKPOINT );
+
     __specpriv_initialize_partial_checkpoint(chkpt, &partial_shadow,
                                              &partial_redux, &partial_sharepriv,
                                              &partial_shareshadow);
+  }
   TADD(worker_prepare_checkpointing_time, start);
 
   // Commit /my/ private values to the partial heap
@@ -623,12 +719,12 @@ static void __specpriv_worker_perform_checkpoint_locked(Checkpoint *chkpt, Itera
   chkpt->redux_used = heap_used( &partial_redux );
 
   TIME(start);
-  heap_unmap( &partial_redux );
-  heap_unmap( &partial_shadow );
-  heap_unmap( &partial_shareshadow );
-  heap_unmap( &partial_priv );
-  heap_unmap( &partial_killpriv );
-  heap_unmap( &partial_sharepriv );
+  heap_release( &partial_redux );
+  heap_release( &partial_shadow );
+  heap_release( &partial_shareshadow );
+  heap_release( &partial_priv );
+  heap_release( &partial_killpriv );
+  heap_release( &partial_sharepriv );
 
   ++chkpt->num_workers;
   DEBUG(printf("Finished distilling worker into partial %p\n", (void *)chkpt););
@@ -661,6 +757,8 @@ void __specpriv_worker_perform_checkpoint(int isFinalCheckpoint)
     __specpriv_misspec("Something before checkpointing!");
     /* _exit(0); */
 
+  TRACE_EVENT(TRACE_CHECKPOINT_BEGIN, effectiveIter);
+
   Checkpoint *chkpt = __specpriv_get_checkpoint_for_iter(&pcb->checkpoints, effectiveIter);
   if( !chkpt )
   {
@@ -669,9 +767,13 @@ void __specpriv_worker_perform_checkpoint(int isFinalCheckpoint)
     /* _exit(0); */
   }
 
+  const uint64_t cycles_start = rdtsc();
+
   uint64_t lock_start;
   TIME(lock_start);
+  TRACE_EVENT(TRACE_LOCK_WAIT_BEGIN, effectiveIter);
   acquire_lock( &chkpt->lock );
+  TRACE_EVENT(TRACE_LOCK_WAIT_END, effectiveIter);
   TADD(worker_acquire_lock_time, lock_start);
   {
     DEBUG( if (isFinalCheckpoint) printf("Worker %u's final checkpoint\n",
@@ -690,6 +792,9 @@ void __specpriv_worker_perform_checkpoint(int isFinalCheckpoint)
   __specpriv_commit_zero_or_more_checkpoints( &pcb->checkpoints );
 #endif
 
+  if( !isFinalCheckpoint )
+    __specpriv_record_checkpoint( &pcb->stats, rdtsc() - cycles_start );
+
   TOUT(
       if ( isFinalCheckpoint )
         TADD(worker_final_checkpoint_time, checkpoint_start);
@@ -708,6 +813,44 @@ void __specpriv_worker_perform_checkpoint(int isFinalCheckpoint)
   );
 
   worker_last_committed = chkpt;
+
+  TRACE_EVENT(TRACE_CHECKPOINT_END, effectiveIter);
+}
+
+// Pooled checkpoints keep their shm objects and every
+// process's mappings of them; only their memory goes.
+// The first few keep what the next invocation of the loop
+// is likely to touch again.  Only the main process calls
+// this, while no worker runs.
+static void trim_checkpoint_pool(CheckpointManager *mgr)
+{
+  unsigned n = 0;
+  for(Checkpoint *i=stack_top(mgr->free.head); i; i=i->next, ++n)
+  {
+    if( n < CHECKPOINT_POOL )
+    {
+      // Beyond the footprint.  Shadows stay: the touched
+      // range and dirty pages track which of them to reset.
+      heap_punch( &i->heap_priv, __specpriv_sizeof_private() );
+      heap_punch( &i->heap_killpriv, __specpriv_sizeof_killprivate() );
+      heap_punch( &i->heap_sharepriv, __specpriv_sizeof_shareprivate() );
+      heap_punch( &i->heap_redux, __specpriv_sizeof_redux() );
+      continue;
+    }
+
+    // All of it; a zero shadow (and dirty map) is LIVE_IN.
+    heap_punch( &i->heap_priv, 0 );
+    heap_punch( &i->heap_killpriv, 0 );
+    heap_punch( &i->heap_sharepriv, 0 );
+    heap_punch( &i->heap_shadow, 0 );
+    heap_punch( &i->heap_shareshadow, 0 );
+    heap_punch( &i->heap_redux, 0 );
+
+    i->shadow_lowest_inclusive = (uint8_t*) (SHADOW_ADDR + (1UL<<POINTER_BITS));
+    i->shadow_highest_exclusive = (uint8_t*) (SHADOW_ADDR);
+    i->shareshadow_lowest_inclusive = (uint8_t*) (SHARESHADOW_ADDR + (1UL<<POINTER_BITS));
+    i->shareshadow_highest_exclusive = (uint8_t*) (SHARESHADOW_ADDR);
+  }
 }
 
 void __specpriv_distill_checkpoints_into_liveout(CheckpointManager *mgr)
@@ -736,12 +879,12 @@ void __specpriv_distill_checkpoints_into_liveout(CheckpointManager *mgr)
     mapped_heap_init( &commit_killpriv );
     mapped_heap_init( &commit_sharepriv );
 
-    heap_map_anywhere( &chkpt->heap_priv, &commit_priv );
-    heap_map_anywhere( &chkpt->heap_killpriv, &commit_killpriv );
-    heap_map_anywhere( &chkpt->heap_sharepriv, &commit_sharepriv );
-    heap_map_anywhere( &chkpt->heap_shadow, &commit_shadow );
-    heap_map_anywhere( &chkpt->heap_shareshadow, &commit_shareshadow );
-    heap_map_anywhere( &chkpt->heap_redux, &commit_redux );
+    heap_map_cached( &chkpt->heap_priv, &commit_priv );
+    heap_map_cached( &chkpt->heap_killpriv, &commit_killpriv );
+    heap_map_cached( &chkpt->heap_sharepriv, &commit_sharepriv );
+    heap_map_cached( &chkpt->heap_shadow, &commit_shadow );
+    heap_map_cached( &chkpt->heap_shareshadow, &commit_shareshadow );
+    heap_map_cached( &chkpt->heap_redux, &commit_redux );
 
     __specpriv_commit_io( &chkpt->io_events, &commit_redux );
     __specpriv_distill_committed_private_into_main( chkpt, &commit_priv, &commit_shadow );
@@ -754,16 +897,16 @@ void __specpriv_distill_checkpoints_into_liveout(CheckpointManager *mgr)
                                                  chkpt->lastUpdateIteration);
     mgr->main_checkpoint->iteration = chkpt->iteration;
 
-    heap_unmap( &commit_redux );
-    heap_unmap( &commit_shadow );
-    heap_unmap( &commit_shareshadow );
-    heap_unmap( &commit_killpriv );
-    heap_unmap( &commit_sharepriv );
-    heap_unmap( &commit_priv );
+    heap_release( &commit_redux );
+    heap_release( &commit_shadow );
+    heap_release( &commit_shareshadow );
+    heap_release( &commit_killpriv );
+    heap_release( &commit_sharepriv );
+    heap_release( &commit_priv );
 
     // Free this checkpoint.
     chkpt->type = CL_Free;
-    push_back( &mgr->free, chkpt );
+    stack_push( &mgr->free, chkpt );
   }
 
   // All remaining checkpoints should be squashed.
@@ -772,8 +915,10 @@ void __specpriv_distill_checkpoints_into_liveout(CheckpointManager *mgr)
     Checkpoint *squash = pop_front( &mgr->used );
     DEBUG(printf(" * squashing checkpoint %d\n", squash->iteration));
     squash->type = CL_Free;
-    push_back( &mgr->free, squash );
+    stack_push( &mgr->free, squash );
   }
+
+  trim_checkpoint_pool(mgr);
 }
 
 
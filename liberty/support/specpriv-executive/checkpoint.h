@@ -62,7 +62,9 @@ struct s_checkpoint
   IOEvtSet        io_events;
 
   // List structure: guarded by
-  // the list's lock.
+  // the list's lock.  While the
+  // checkpoint is free, next links
+  // the free stack instead.
   Checkpoint      *prev, *next;
 };
 
@@ -73,24 +75,43 @@ struct s_checkpoint_list
   Checkpoint      *first, *last;
 };
 
+// A lock-free stack of free checkpoints.
+// The head packs the top checkpoint's offset
+// in the meta heap with a counter which
+// changes on every push, so that a pop cannot
+// be fooled by a checkpoint which was popped
+// and pushed again in the meantime (ABA).
+typedef struct s_checkpoint_stack CheckpointStack;
+struct s_checkpoint_stack
+{
+  volatile uint64_t head;
+};
+
 // A checkpoint manager maintains a list of
 // partial checkpoints, in order by time.
 // It also holds a set of free()d checkpoints
-// to save allocation time.  The list contains
+// to save allocation time.  The manager contains
 // a lock, which must be acquired before changing
-// list structure (which members in which order).
+// the structure of the used list (which members
+// in which order).  The free stack needs no lock.
 typedef struct s_checkpoint_manager CheckpointManager;
 struct s_checkpoint_manager
 {
   unsigned        lock;
   unsigned        total_checkpoint_objects;
 
+  // Held by whichever process is combining
+  // complete checkpoints at the head of the
+  // used list.  Others do not wait for it.
+  volatile unsigned committing;
+
   // There are many checkpoints.
   // At any given time, this is the version
   // mapped by the main process.
   Checkpoint *    main_checkpoint;
 
-  CheckpointList  used, free;
+  CheckpointList  used;
+  CheckpointStack free;
 };
 
 void __specpriv_destroy_checkpoint(Checkpoint *chkpt);
@@ -111,6 +132,11 @@ void __specpriv_worker_perform_checkpoint(int isFinalCheckpoint);
 
 void __specpriv_distill_checkpoints_into_liveout(CheckpointManager *mgr);
 
+// Combine complete checkpoints at the head of the used
+// list, for as long as there are two.  Does nothing if
+// another process is already doing so.  Returns 1 upon
+// misspeculation (only in the main process; a worker
+// does not return).
 Bool __specpriv_commit_zero_or_more_checkpoints(CheckpointManager *mgr);
 
 // hopefully the checkpoint doesn't get repurposed/destroyed before this is called
@@ -10,6 +10,11 @@
 #define TIMER_PRINT_TIMELINE  (0)
 #define TIMER_PRINT_OVERHEAD  (0)
 
+// Compile in the binary event log (see trace.h)?
+// 0 (off) or 1 (on).  If on, it is still off unless
+// SPECPRIV_TRACE names where to write it.
+#define TRACE             (1)
+
 // Enable debug messages? 0 (off) or 1 (on)
 #define DEBUGGING         (0)
 #define DEBUG_ON          DEBUGGING
@@ -20,23 +25,67 @@
 // Simulate misspeculation?
 #define SIMULATE_MISSPEC  (0)
 
-// Affinity policy: see constants.h
+// Affinity policy: see constants.h.  Which processor
+// each worker gets is up to the SPECPRIV_PLACEMENT
+// environment variable (see ../topology/topology.h).
 #define AFFINITY          ( SLEEP0 | RRPUNT0 | FIX | MP0STARTUP )
 
 // Reduction method: VECTOR or NATIVE.
 // NATIVE may be vectorized at the whim of your compiler.
 #define REDUCTION         VECTOR
 
-// Private memory method: VECTOR or NATIVE
-#define SHADOW_MEM        NATIVE
+// Private memory method: VECTOR or NATIVE.
+// VECTOR uses SSE2, AVX2 or AVX-512 kernels (see shadow.h),
+// chosen at startup by cpuid, or by the SPECPRIV_SHADOW_ISA
+// environment variable ("scalar", "sse2", "avx2", "avx512").
+// NATIVE uses the 64-bit scalar loops.
+#define SHADOW_MEM        VECTOR
 
 // How do I join my workers? WAITPID or SPIN
 #define JOIN              SPIN
 
-
-
-// Number of processors; used to schedule affinities.
-#define NUM_PROCS         (28)
+// How many times do workers (waiting for an invocation)
+// and the main process (waiting for workers) poll
+// before sleeping on a futex?
+#define SPIN_BEFORE_BLOCK (4096)
+
+// Signal the other workers of a pipeline when one
+// misspeculates?  0 (off) or 1 (on).  Those past
+// the misspeculated iteration and blocked on a
+// queue stop within QUEUE_POLL_NS, rather than when
+// the queue moves.  Single-stage loops are never
+// signalled; they stop at their next iteration.
+#define ABORT_BROADCAST   (1)
+#define ABORT_SIGNAL      SIGUSR1
+
+
+// Default iteration schedule: STATIC or DYNAMIC.
+// May be overridden with the SPECPRIV_SCHEDULE
+// environment variable ("static", "dynamic" or
+// "dynamic,<chunk>").
+#define SCHEDULE          STATIC
+
+// Default number of iterations a worker claims
+// at once under the DYNAMIC schedule.
+#define SCHEDULE_CHUNK    (1)
+
+// Choose the checkpoint granularity of each loop from
+// the checkpoint cost and misspeculation rate measured
+// in its earlier invocations?  0 (off) or 1 (on)
+// If off, always checkpoint as rarely as possible.
+#define ADAPTIVE_GRANULARITY  (1)
+
+// Weight of the newest invocation in those
+// measurements: 1/2^ADAPT_SHIFT
+#define ADAPT_SHIFT       (1)
+
+// Track which pages of the private shadow were touched,
+// so that distillation skips clean pages?  0 (off) or 1 (on)
+// If off, distillation scans the whole touched range.
+#define DIRTY_PAGES       (1)
+
+// Dirty pages are 2^DIRTY_PAGE_SHIFT bytes.
+#define DIRTY_PAGE_SHIFT  (12)
 
 // For deferred IO, assume that written string is shorter
 // than this.  If wrong, we will need to try again.
@@ -51,10 +100,34 @@
 // space for the used portion.
 #define HEAP_SIZE         (16ULL*GB)
 
+// How many checkpoint heaps may each process keep
+// mapped (see heap_map_cached)?  Each mapping costs
+// HEAP_SIZE bytes of address space.
+#define HEAP_CACHE_ENTRIES  (256)
+
+// NUMA placement of each class of heap: NUMA_FIRST_TOUCH
+// (the kernel's default), NUMA_LOCAL (the node of the
+// process which maps it) or NUMA_INTERLEAVE (all nodes).
+// Ignored on machines with a single node.
+//   NUMA_PRIVATE: private, killprivate, shareprivate,
+//     local, shadow and redux, as mapped by each worker.
+//   NUMA_SHARED: shared and ro, set by the main process.
+//   NUMA_CHECKPOINT: checkpoint objects, set by the
+//     first worker to write into each one.
+#define NUMA_PRIVATE      NUMA_LOCAL
+#define NUMA_SHARED       NUMA_INTERLEAVE
+#define NUMA_CHECKPOINT   NUMA_LOCAL
+
 // Maximum number of bytes of checkpoint state
 // that we will allocate at any time.
 #define MAX_CHECKPOINT    (128ULL*GB)
 
+// Free checkpoint objects are pooled and reused.  After
+// each invocation, the first CHECKPOINT_POOL of them keep
+// their pages up to the loop's footprint; the rest give
+// all their memory back (see trim_checkpoint_pool).
+#define CHECKPOINT_POOL   (8)
+
 // Who tries to combine checkpoints?
 
 // If SLOWEST_WORKER, this means that a worker will
@@ -68,14 +141,24 @@
 // distribute checkpoint combination costs among
 // workers who are making progress.
 
-// These two options are NOT mutually
-// exclusive.
+// If MAIN_COMMITTER, the main process combines
+// checkpoints while it waits for the workers, so
+// that no worker is slowed down by it.
+
+// These options are NOT mutually exclusive.
+// Only one process combines at a time; the
+// others do not wait for it.
 
-// In either case, we will ALWAYS try to combine
+// In any case, we will ALWAYS try to combine
 // checkpoints if (1) the checkpoint manager has
 // saturated, and (2) at worker-join.
 #define WHO_DOES_CHECKPOINTS  (SLOWEST_WORKER)
 
+// If MAIN_COMMITTER, how often (in nanoseconds)
+// does the main process look for checkpoints
+// to combine?
+#define COMMITTER_POLL_NS (50000)
+
 #if DEBUGGING != 0
 #define DEBUG(...)        do { __VA_ARGS__ ; } while(0)
 #else
@@ -7,6 +7,10 @@
 #define WAITPID           (0)
 #define SPIN              (1)
 
+// config choices for SCHEDULE
+#define STATIC            (0)
+#define DYNAMIC           (1)
+
 // config choices for REDUCTION
 #define NAIVE             (0)
 #define VECTOR            (1)
@@ -35,13 +39,15 @@
 #define MP0STARTUP        (1<<6)
 #define MP0INVOC          (1<<7)
 
-// Affinity assignments should use
-// a os_cpu_id -> physical_cpu_id map.
-#define OS2PHYS           (1<<8)
+// NUMA placement of a heap (see heap_set_numa)
+#define NUMA_FIRST_TOUCH  (0)
+#define NUMA_LOCAL        (1)
+#define NUMA_INTERLEAVE   (2)
 
 // Options for WHO_DOES_CHECKPOINTS
 #define FASTEST_WORKER    (1<<0)
 #define SLOWEST_WORKER    (1<<1)
+#define MAIN_COMMITTER    (1<<2)
 
 // Pointer coding
 #define POINTER_BITS      (43)
@@ -0,0 +1,125 @@
+#ifndef LLVM_LIBERTY_SPEC_PRIV_EXECUTIVE_DIRTY_H
+#define LLVM_LIBERTY_SPEC_PRIV_EXECUTIVE_DIRTY_H
+
+#include <stdint.h>
+
+#include "types.h"
+#include "config.h"
+
+// Per-page dirty bitmaps over a shadow heap.
+// Bit p is set if any shadow byte in page p
+// (of DIRTY_PAGE_SIZE bytes) may be other than
+// LIVE_IN.  Distillation walks only those pages.
+//
+// The bitmap lives at the end of the shadow heap
+// it describes, so that worker shadows and the
+// checkpoint shadows (in shm) carry their own.
+// All offsets are relative to the heap's base.
+
+#define DIRTY_PAGE_SIZE   (1ULL << DIRTY_PAGE_SHIFT)
+#define DIRTY_MAP_BYTES   (HEAP_SIZE >> (DIRTY_PAGE_SHIFT + 3))
+#define DIRTY_MAP_OFFSET  (HEAP_SIZE - DIRTY_MAP_BYTES)
+
+static inline uint64_t *dirty_map(uint64_t shadow_base)
+{
+  return (uint64_t*) (shadow_base + DIRTY_MAP_OFFSET);
+}
+
+// Mark the pages which overlap [low,high).
+static inline void dirty_mark(uint64_t *map, uint64_t low, uint64_t high)
+{
+#if DIRTY_PAGES != 0
+  if( low >= high )
+    return;
+  const uint64_t last = (high - 1) >> DIRTY_PAGE_SHIFT;
+  for(uint64_t p = low >> DIRTY_PAGE_SHIFT; p <= last; ++p)
+    map[ p / 64 ] |= 1ULL << (p % 64);
+#endif
+}
+
+// map |= other, over the pages of [low,high).
+static inline void dirty_merge(uint64_t *map, const uint64_t *other, uint64_t low, uint64_t high)
+{
+#if DIRTY_PAGES != 0
+  if( low >= high )
+    return;
+  const uint64_t last = ((high - 1) >> DIRTY_PAGE_SHIFT) / 64;
+  for(uint64_t w = (low >> DIRTY_PAGE_SHIFT) / 64; w <= last; ++w)
+    map[w] |= other[w];
+#endif
+}
+
+// Forget the pages of [low,high).
+static inline void dirty_clear(uint64_t *map, uint64_t low, uint64_t high)
+{
+#if DIRTY_PAGES != 0
+  if( low >= high )
+    return;
+  const uint64_t last = ((high - 1) >> DIRTY_PAGE_SHIFT) / 64;
+  for(uint64_t w = (low >> DIRTY_PAGE_SHIFT) / 64; w <= last; ++w)
+    map[w] = 0;
+#endif
+}
+
+// Find the next run of dirty bytes [*from,*to)
+// at or after *cursor and before high, and
+// advance *cursor past it.  Returns 0 if there
+// are no more.  Use as:
+//
+//   uint64_t cursor = low, from, to;
+//   while( dirty_next_range(map, &cursor, high, &from, &to) )
+//     ... visit [from,to) ...
+static inline Bool dirty_next_range(const uint64_t *map,
+  uint64_t *cursor, uint64_t high, uint64_t *from, uint64_t *to)
+{
+  const uint64_t low = *cursor;
+  if( low >= high )
+    return 0;
+
+#if DIRTY_PAGES != 0
+  const uint64_t end = ((high - 1) >> DIRTY_PAGE_SHIFT) + 1;
+  uint64_t p = low >> DIRTY_PAGE_SHIFT;
+
+  // First dirty page.
+  while( p < end )
+  {
+    const uint64_t bits = map[ p / 64 ] >> (p % 64);
+    if( bits )
+    {
+      p += __builtin_ctzll(bits);
+      break;
+    }
+    p = (p | 63) + 1;
+  }
+  if( p >= end )
+  {
+    *cursor = high;
+    return 0;
+  }
+  const uint64_t first = p;
+
+  // First clean page after it.
+  while( p < end )
+  {
+    const uint64_t bits = ~map[ p / 64 ] >> (p % 64);
+    if( bits )
+    {
+      p += __builtin_ctzll(bits);
+      break;
+    }
+    p = (p | 63) + 1;
+  }
+
+  *from = (first << DIRTY_PAGE_SHIFT) > low ? (first << DIRTY_PAGE_SHIFT) : low;
+  *to = (p < end) ? (p << DIRTY_PAGE_SHIFT) : high;
+#else
+  *from = low;
+  *to = high;
+#endif
+
+  *cursor = *to;
+  return 1;
+}
+
+#endif
+
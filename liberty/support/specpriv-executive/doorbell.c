@@ -0,0 +1,118 @@
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <xmmintrin.h>
+
+#include "doorbell.h"
+#include "config.h"
+
+// Not FUTEX_PRIVATE_FLAG: the words are in a
+// MAP_SHARED heap and the waiters are other
+// processes.
+static void futex_wait(volatile uint32_t *addr, uint32_t val, const struct timespec *timeout)
+{
+  syscall(SYS_futex, (uint32_t*) addr, FUTEX_WAIT, val, timeout, 0, 0);
+}
+
+static void futex_wake(volatile uint32_t *addr)
+{
+  syscall(SYS_futex, (uint32_t*) addr, FUTEX_WAKE, INT_MAX, 0, 0, 0);
+}
+
+static uint64_t now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void doorbell_init(Doorbell *bell)
+{
+  bell->generation = 0;
+  bell->sleepers = 0;
+}
+
+void doorbell_ring(Doorbell *bell)
+{
+  // Both atomics are full barriers: either we
+  // see the sleeper, or the sleeper sees the
+  // new generation before it blocks.
+  __sync_fetch_and_add( &bell->generation, 1 );
+  if( bell->sleepers )
+    futex_wake( &bell->generation );
+}
+
+uint32_t doorbell_wait(Doorbell *bell, uint32_t seen)
+{
+  for(unsigned i=0; i<SPIN_BEFORE_BLOCK; ++i)
+  {
+    if( bell->generation != seen )
+      return bell->generation;
+    _mm_pause();
+  }
+
+  __sync_fetch_and_add( &bell->sleepers, 1 );
+  while( bell->generation == seen )
+    futex_wait( &bell->generation, seen, 0 );
+  __sync_fetch_and_sub( &bell->sleepers, 1 );
+
+  return bell->generation;
+}
+
+void completion_reset(Completion *done)
+{
+  done->count = 0;
+  done->waiters = 0;
+}
+
+void completion_signal(Completion *done)
+{
+  __sync_fetch_and_add( &done->count, 1 );
+  if( done->waiters )
+    futex_wake( &done->count );
+}
+
+Bool completion_wait(Completion *done, uint32_t target, uint64_t timeout_ns)
+{
+  for(unsigned i=0; i<SPIN_BEFORE_BLOCK; ++i)
+  {
+    if( done->count >= target )
+      return 1;
+    _mm_pause();
+  }
+
+  const uint64_t deadline = timeout_ns ? now_ns() + timeout_ns : 0;
+
+  __sync_fetch_and_add( &done->waiters, 1 );
+  Bool reached = 0;
+  for(;;)
+  {
+    const uint32_t count = done->count;
+    if( count >= target )
+    {
+      reached = 1;
+      break;
+    }
+
+    if( !timeout_ns )
+    {
+      futex_wait( &done->count, count, 0 );
+      continue;
+    }
+
+    const uint64_t t = now_ns();
+    if( t >= deadline )
+      break;
+
+    struct timespec wt;
+    wt.tv_sec = (deadline - t) / 1000000000ULL;
+    wt.tv_nsec = (deadline - t) % 1000000000ULL;
+    futex_wait( &done->count, count, &wt );
+  }
+  __sync_fetch_and_sub( &done->waiters, 1 );
+
+  return reached;
+}
+
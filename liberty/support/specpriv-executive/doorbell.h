@@ -0,0 +1,50 @@
+#ifndef LLVM_LIBERTY_SPEC_PRIV_EXECUTIVE_DOORBELL_H
+#define LLVM_LIBERTY_SPEC_PRIV_EXECUTIVE_DOORBELL_H
+
+#include <stdint.h>
+
+#include "types.h"
+
+// Cross-process wakeups for the persistent workers.
+// Both objects live in the shared meta heap and
+// use (non-private) futexes, so they work across
+// the forked processes.  Waiters spin briefly
+// before sleeping in the kernel; the waker only
+// makes a syscall if someone is actually asleep.
+
+// The main process rings the doorbell to start
+// an invocation.  Each ring bumps the generation;
+// a worker waits until the generation differs
+// from the last one it saw.
+typedef struct s_doorbell Doorbell;
+struct s_doorbell
+{
+  volatile uint32_t   generation;
+  volatile uint32_t   sleepers;
+};
+
+void doorbell_init(Doorbell *bell);
+void doorbell_ring(Doorbell *bell);
+uint32_t doorbell_wait(Doorbell *bell, uint32_t seen);
+
+// Workers signal a completion when they are
+// done with an invocation; the main process
+// waits until the count reaches the number
+// of workers.
+typedef struct s_completion Completion;
+struct s_completion
+{
+  volatile uint32_t   count;
+  volatile uint32_t   waiters;
+};
+
+void completion_reset(Completion *done);
+void completion_signal(Completion *done);
+
+// Wait until done->count >= target.  If timeout_ns
+// is non-zero, give up after roughly that long.
+// Returns 1 if the target was reached.
+Bool completion_wait(Completion *done, uint32_t target, uint64_t timeout_ns);
+
+#endif
+
@@ -53,6 +53,12 @@ static Len sizeof_private, sizeof_killprivate, sizeof_shareprivate, sizeof_redux
 static Len sizeof_ro;
 static Len sizeof_local;
 
+// A worker keeps its mappings from one invocation to
+// the next: is mro its read-only mapping yet, and how
+// much of it has been faulted in?
+static int roReadOnly;
+static Len roFaulted;
+
 void __specpriv_reset_reduction()
 {
   first_reduction_info = last_reduction_info = 0;
@@ -110,6 +116,10 @@ void __specpriv_initialize_main_heaps(void)
   heap_map_shared(&ro,     &mro);
   //heap_map_cow(&ro,     &mro);
 
+  // Every worker reads these; spread them out.
+  heap_set_numa(&mshared, NUMA_SHARED);
+  heap_set_numa(&mro, NUMA_SHARED);
+
   // local heap needs to be shared until invocation
   heap_map_shared(&local,  &myLocal);
 
@@ -165,15 +175,31 @@ void __specpriv_worker_unmap_ro(void)
 {
   if( mro.heap )
     heap_unmap( &mro );
+  roReadOnly = 0;
+  roFaulted = 0;
 }
 
 void __specpriv_worker_remap_ro(void)
 {
-  __specpriv_worker_unmap_ro();
+  // A shared mapping sees whatever the main process
+  // has written since the last invocation, so keep it;
+  // only what the heap grew by still needs faulting in.
+  if( !roReadOnly )
+  {
+    __specpriv_worker_unmap_ro();
+    heap_map_read_only( &ro, &mro );
+    roReadOnly = 1;
+  }
+  else
+    heap_reset( &mro );
 
-  heap_map_read_only( &ro, &mro );
   if( sizeof_ro )
-    heap_alloc( &mro, sizeof_ro );
+    heap_reserve( &mro, sizeof_ro );
+  if( sizeof_ro > roFaulted )
+  {
+    heap_prefault( &mro, roFaulted, sizeof_ro );
+    roFaulted = sizeof_ro;
+  }
 }
 
 void __specpriv_worker_unmap_local(void)
@@ -185,12 +211,12 @@ void __specpriv_worker_unmap_local(void)
 void __specpriv_worker_remap_local(void)
 {
   Wid myWid = __specpriv_my_worker_id();
-  __specpriv_worker_unmap_local();
 
-  heap_map_cow( &local, &myLocal );
+  if( heap_remap_cow( &local, &myLocal ) )
+    heap_set_numa( &myLocal, NUMA_PRIVATE );
   if ( sizeof_local )
   {
-    heap_alloc( &myLocal, sizeof_local );
+    heap_reserve( &myLocal, sizeof_local );
     DEBUG(printf("Worker %u preserving %u bytes from previous map in local\n", myWid, sizeof_local););
     DEBUG(printf("Local heap is now %u bytes\n", heap_used(&myLocal)););
     DEBUG(printf("Next alloc to local heap should return %p\n", myLocal.next); fflush(stdout););
@@ -205,12 +231,11 @@ void __specpriv_worker_unmap_private(void)
 
 void __specpriv_worker_remap_private(void)
 {
-  __specpriv_worker_unmap_private();
-
   ParallelControlBlock *pcb = __specpriv_get_pcb();
-  heap_map_cow( &pcb->checkpoints.main_checkpoint->heap_priv, &mpriv0 );
+  if( heap_remap_cow( &pcb->checkpoints.main_checkpoint->heap_priv, &mpriv0 ) )
+    heap_set_numa( &mpriv0, NUMA_PRIVATE );
   if( sizeof_private )
-    heap_alloc( &mpriv0, sizeof_private );
+    heap_reserve( &mpriv0, sizeof_private );
 }
 
 void __specpriv_worker_unmap_killprivate( void )
@@ -221,12 +246,11 @@ void __specpriv_worker_unmap_killprivate( void )
 
 void __specpriv_worker_remap_killprivate( void )
 {
-  __specpriv_worker_unmap_killprivate();
-
   ParallelControlBlock *pcb = __specpriv_get_pcb();
-  heap_map_cow( &pcb->checkpoints.main_checkpoint->heap_killpriv, &mkillpriv0 );
+  if( heap_remap_cow( &pcb->checkpoints.main_checkpoint->heap_killpriv, &mkillpriv0 ) )
+    heap_set_numa( &mkillpriv0, NUMA_PRIVATE );
   if ( sizeof_killprivate )
-    heap_alloc( &mkillpriv0, sizeof_killprivate );
+    heap_reserve( &mkillpriv0, sizeof_killprivate );
 }
 
 void __specpriv_worker_unmap_shareprivate( void )
@@ -237,12 +261,11 @@ void __specpriv_worker_unmap_shareprivate( void )
 
 void __specpriv_worker_remap_shareprivate( void )
 {
-  __specpriv_worker_unmap_shareprivate();
-
   ParallelControlBlock *pcb = __specpriv_get_pcb();
-  heap_map_cow( &pcb->checkpoints.main_checkpoint->heap_sharepriv, &msharepriv0 );
+  if( heap_remap_cow( &pcb->checkpoints.main_checkpoint->heap_sharepriv, &msharepriv0 ) )
+    heap_set_numa( &msharepriv0, NUMA_PRIVATE );
   if ( sizeof_shareprivate )
-    heap_alloc( &msharepriv0, sizeof_shareprivate );
+    heap_reserve( &msharepriv0, sizeof_shareprivate );
 }
 
 void __specpriv_fiveheaps_begin_invocation(void)
@@ -275,25 +298,51 @@ void __specpriv_initialize_worker_heaps(void)
 
    const Wid myWorkerId = __specpriv_my_worker_id();
 
-  // re-map my a new independent heap as my 'redux' heap.
-  if (mredux0.heap)
-    heap_unmap(&mredux0);
-  mapped_heap_init(&myRedux);
-  heap_map_shared(&redux[myWorkerId], &myRedux);
+  // My copies of private data, my reduction heap
+  // (which the main process reads only when it
+  // distills) and shadows stay on my node.
+
+  // map my independent heap as my 'redux' heap; it
+  // stays mapped from one invocation to the next.
+  if( myRedux.heap != &redux[myWorkerId] )
+  {
+    mapped_heap_init(&myRedux);
+    heap_map_shared(&redux[myWorkerId], &myRedux);
+    heap_set_numa(&myRedux, NUMA_PRIVATE);
+  }
+  else
+    heap_reset(&myRedux);
   ParallelControlBlock *pcb = __specpriv_get_pcb();
-  heap_map_cow( &pcb->checkpoints.main_checkpoint->heap_redux, &mredux0 );
+  if( heap_remap_cow( &pcb->checkpoints.main_checkpoint->heap_redux, &mredux0 ) )
+    heap_set_numa(&mredux0, NUMA_PRIVATE);
   if( sizeof_redux )
-    heap_alloc(&myRedux, sizeof_redux);
-    //heap_alloc(&mredux0, sizeof_redux);
-
-  // map my 'shadow', and 'local' heaps
-  mapped_heap_init(&myShadow);
-  /* mapped_heap_init(&myLocal); */
-  heap_map_anon(HEAP_SIZE, (void*) (SHADOW_ADDR), &myShadow);
-  /* heap_map_anon(HEAP_SIZE, (void*) (LOCAL_ADDR ), &myLocal); */
-  mapped_heap_init(&myShareShadow);
-  /* mapped_heap_init(&myLocal); */
-  heap_map_anon(HEAP_SIZE, (void*) (SHARESHADOW_ADDR), &myShareShadow);
+  {
+    heap_reserve(&myRedux, sizeof_redux);
+    //heap_reserve(&mredux0, sizeof_redux);
+
+    // Start each reduction from its identity; for
+    // min, mul, and, etc, that is not zero.
+    for(ReductionInfo *info = first_reduction_info; info; info = info->next)
+      if( !info->depSize )
+        __specpriv_initialize_reductions(info->au, info);
+  }
+
+  // map my 'shadow' heaps, the first time; since then,
+  // __specpriv_destroy_worker_heaps has zeroed them.
+  // (An anonymous mapping has no heap; next is 0
+  // until it is mapped.)
+  if( !myShadow.next )
+  {
+    mapped_heap_init(&myShadow);
+    heap_map_anon(HEAP_SIZE, (void*) (SHADOW_ADDR), &myShadow);
+    heap_set_numa(&myShadow, NUMA_PRIVATE);
+  }
+  if( !myShareShadow.next )
+  {
+    mapped_heap_init(&myShareShadow);
+    heap_map_anon(HEAP_SIZE, (void*) (SHARESHADOW_ADDR), &myShareShadow);
+    heap_set_numa(&myShareShadow, NUMA_PRIVATE);
+  }
 
   // initialize shadow memory of share-privs with the original data at loop
   // invocation
@@ -311,9 +360,13 @@ void __specpriv_destroy_worker_heaps(void)
   //heap_unmap(&mro);
 
   //heap_unmap(&myLocal);
-  heap_unmap(&myRedux);
-  heap_unmap(&myShadow);
-  heap_unmap(&myShareShadow);
+
+  // Keep the mappings for the next invocation, but
+  // give back the shadow pages now.
+  if( myShadow.next )
+    heap_discard(&myShadow);
+  if( myShareShadow.next )
+    heap_discard(&myShareShadow);
 }
 
 //------------------------------------------------------------------
@@ -462,6 +515,23 @@ void *__specpriv_alloc_worker_redux(Len size)
 void __specpriv_free_redux(void *ptr)
 {
   assert( __specpriv_i_am_main_process() );
+
+  // Forget its info, lest the AU be recycled
+  // for another reduction and reduced twice.
+  ReductionInfo *prev = 0;
+  for(ReductionInfo *info = first_reduction_info; info; prev = info, info = info->next)
+    if( info->au == ptr )
+    {
+      if( prev )
+        prev->next = info->next;
+      else
+        first_reduction_info = info->next;
+      if( last_reduction_info == info )
+        last_reduction_info = prev;
+      __specpriv_free_meta(info);
+      break;
+    }
+
   heap_free(&mredux0, ptr);
 }
 
@@ -0,0 +1,176 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "granularity.h"
+#include "constants.h"
+#include "config.h"
+
+// What we have learned about one loop
+// from its earlier invocations.  The
+// averages decay, so that the choice
+// follows phase changes of the program.
+typedef struct s_loop_history LoopHistory;
+struct s_loop_history
+{
+  Iteration   granularity;
+
+  // Cycles per checkpoint, per worker.
+  uint64_t    checkpoint_cycles;
+
+  // Cycles per iteration, excluding
+  // checkpoints (wall-clock, i.e. as
+  // seen by every worker).
+  uint64_t    iteration_cycles;
+
+  // Decayed counts of iterations executed
+  // and misspeculations observed; the latter
+  // in units of 1/MISSPEC_ONE.
+  uint64_t    iterations;
+  uint64_t    misspecs;
+};
+
+#define MISSPEC_ONE   (1ULL << 16)
+
+static LoopHistory *history;
+static unsigned numHistory;
+
+static LoopHistory *get_history(int loopID)
+{
+  if( loopID < 0 )
+    return 0;
+
+  if( (unsigned) loopID >= numHistory )
+  {
+    unsigned n = numHistory ? numHistory : 8;
+    while( n <= (unsigned) loopID )
+      n *= 2;
+
+    history = (LoopHistory*) realloc(history, n * sizeof(LoopHistory));
+    memset(history + numHistory, 0, (n - numHistory) * sizeof(LoopHistory));
+    numHistory = n;
+  }
+
+  return &history[ loopID ];
+}
+
+static Iteration largest_granularity(Wid numWorkers)
+{
+  return MAX_CHECKPOINT_GRANULARITY - (MAX_CHECKPOINT_GRANULARITY % numWorkers);
+}
+
+static Iteration clamp_granularity(uint64_t g, Wid numWorkers)
+{
+  const Iteration largest = largest_granularity(numWorkers);
+  if( g >= (uint64_t) largest )
+    return largest;
+  if( g < numWorkers )
+    return numWorkers;
+  return (Iteration) (g - (g % numWorkers));
+}
+
+static uint64_t isqrt(uint64_t x)
+{
+  uint64_t r = 0;
+  for(uint64_t bit = 1ULL << 62; bit; bit >>= 2)
+    if( x >= r + bit )
+    {
+      x -= r + bit;
+      r = (r >> 1) + bit;
+    }
+    else
+      r >>= 1;
+  return r;
+}
+
+// new = old + (sample - old) / 2^ADAPT_SHIFT
+static uint64_t smooth(uint64_t old, uint64_t sample)
+{
+  if( old == 0 )
+    return sample;
+  return old - (old >> ADAPT_SHIFT) + (sample >> ADAPT_SHIFT);
+}
+
+void __specpriv_reset_invocation_stats(InvocationStats *stats)
+{
+  stats->checkpoint_cycles = 0;
+  stats->num_checkpoints = 0;
+  stats->last_iteration = 0;
+}
+
+void __specpriv_record_checkpoint(InvocationStats *stats, uint64_t cycles)
+{
+  __sync_fetch_and_add( &stats->checkpoint_cycles, cycles );
+  __sync_fetch_and_add( &stats->num_checkpoints, 1 );
+}
+
+Iteration __specpriv_choose_granularity(int loopID, Wid numWorkers)
+{
+  LoopHistory *h = get_history(loopID);
+
+#if ADAPTIVE_GRANULARITY != 0
+  // Each checkpoint costs c cycles; each misspeculation
+  // replays half a checkpoint interval on average.  With
+  // misspeculation probability p per iteration, and w
+  // cycles per iteration, the overhead per iteration is
+  //   c/g + p*w*g/2
+  // which is smallest at g = sqrt( 2c / (p*w) ).
+  if( h && h->misspecs && h->iterations )
+  {
+    Iteration g;
+    if( h->checkpoint_cycles && h->iteration_cycles )
+    {
+      const double p = (double) h->misspecs / MISSPEC_ONE / h->iterations;
+      const double best = 2.0 * h->checkpoint_cycles / (p * h->iteration_cycles);
+      g = clamp_granularity( best < 1e18 ? isqrt( (uint64_t) best ) : ~0ULL, numWorkers );
+    }
+    else
+      // No cost estimate yet; back off.
+      g = clamp_granularity( (h->granularity ? h->granularity : largest_granularity(numWorkers)) / 2,
+        numWorkers);
+
+    DEBUG(printf("Loop %d: checkpoint every %d iterations "
+      "(%lu cycles/checkpoint, %lu cycles/iteration, %.2f misspecs in %lu iterations)\n",
+      loopID, g, h->checkpoint_cycles, h->iteration_cycles,
+      (double) h->misspecs / MISSPEC_ONE, h->iterations));
+
+    h->granularity = g;
+    return g;
+  }
+#endif
+
+  // Never misspeculated (or not adaptive):
+  // checkpoint as rarely as possible.
+  const Iteration g = largest_granularity(numWorkers);
+  if( h )
+    h->granularity = g;
+  return g;
+}
+
+void __specpriv_update_granularity(int loopID, const InvocationStats *stats,
+  Iteration firstIter, uint64_t invocationCycles, Wid numWorkers,
+  Bool misspeculated, Iteration misspecIter)
+{
+  LoopHistory *h = get_history(loopID);
+  if( !h )
+    return;
+
+  const Iteration end = misspeculated ? misspecIter : stats->last_iteration;
+  const uint64_t iters = (end > firstIter) ? (uint64_t) (end - firstIter) : 0;
+
+  if( stats->num_checkpoints )
+    h->checkpoint_cycles = smooth(h->checkpoint_cycles,
+      stats->checkpoint_cycles / stats->num_checkpoints);
+
+  // Workers checkpoint in parallel, so charge
+  // each one's share against the wall clock.
+  const uint64_t ckpt = stats->checkpoint_cycles / numWorkers;
+  if( iters && invocationCycles > ckpt )
+    h->iteration_cycles = smooth(h->iteration_cycles, (invocationCycles - ckpt) / iters);
+
+  // Decay the history, so that a loop which stops
+  // misspeculating returns to coarse checkpoints.
+  h->iterations = h->iterations - (h->iterations >> ADAPT_SHIFT) + iters;
+  h->misspecs = h->misspecs - (h->misspecs >> ADAPT_SHIFT) + (misspeculated ? MISSPEC_ONE : 0);
+}
+
@@ -0,0 +1,44 @@
+#ifndef LLVM_LIBERTY_SPEC_PRIV_EXECUTIVE_GRANULARITY_H
+#define LLVM_LIBERTY_SPEC_PRIV_EXECUTIVE_GRANULARITY_H
+
+#include <stdint.h>
+
+#include "types.h"
+
+// Measurements of one parallel invocation,
+// gathered by the workers in the PCB.
+typedef struct s_invocation_stats InvocationStats;
+struct s_invocation_stats
+{
+  // Summed over all workers and all
+  // intermediate checkpoints.
+  volatile uint64_t   checkpoint_cycles;
+  volatile uint32_t   num_checkpoints;
+
+  // The iteration at which the
+  // workers left the loop.
+  Iteration           last_iteration;
+};
+
+void __specpriv_reset_invocation_stats(InvocationStats *stats);
+
+// Called by a worker after each intermediate checkpoint.
+void __specpriv_record_checkpoint(InvocationStats *stats, uint64_t cycles);
+
+// Called by the main process before an invocation
+// of loop loopID: how many iterations between
+// checkpoints?  Always a multiple of numWorkers
+// and at most MAX_CHECKPOINT_GRANULARITY, since
+// shadow bytes hold the iteration modulo the
+// granularity.
+Iteration __specpriv_choose_granularity(int loopID, Wid numWorkers);
+
+// Called by the main process after the invocation
+// joins, to feed the measurements back into the
+// next choice for this loop.
+void __specpriv_update_granularity(int loopID, const InvocationStats *stats,
+  Iteration firstIter, uint64_t invocationCycles, Wid numWorkers,
+  Bool misspeculated, Iteration misspecIter);
+
+#endif
+
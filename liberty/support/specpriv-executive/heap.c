@@ -3,6 +3,9 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/types.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -11,10 +14,44 @@
 #include "heap.h"
 #include "constants.h"
 #include "config.h"
+#include "topology.h"
 
 void mapped_heap_init(MappedHeap *mh)
 {
   mh->heap = 0;
+  mh->cow = 0;
+}
+
+// Precedes every block of heap_alloc.
+typedef struct s_block_header BlockHeader;
+struct s_block_header
+{
+  // bytes in the block, after this header
+  uint64_t  size;
+  uint64_t  pad;
+};
+
+static void forget_free(MappedHeap *mh)
+{
+  for(unsigned c=0; c<HEAP_NUM_CLASSES; ++c)
+    mh->free_class[c] = 0;
+  mh->free_large = 0;
+}
+
+// Size class of a block of sz bytes (a multiple
+// of 16), or HEAP_NUM_CLASSES if it is large.
+// Rounds *sz up to the size of that class.
+static unsigned size_class(uint64_t *sz)
+{
+  if( *sz <= HEAP_SMALL_MAX )
+    return *sz / 16 - 1;
+
+  if( *sz > HEAP_MEDIUM_MAX )
+    return HEAP_NUM_CLASSES;
+
+  const unsigned lg = 64 - __builtin_clzll(*sz - 1);
+  *sz = 1ULL << lg;
+  return HEAP_SMALL_MAX/16 + lg - 11;
 }
 
 void heap_init(Heap *h, const char *desc, uint64_t len, void *forceAddress, uint64_t nonce)
@@ -24,6 +61,11 @@ void heap_init(Heap *h, const char *desc, uint64_t len, void *forceAddress, uint
 
   snprintf(h->name,HNMAX, "/specpriv-%d-%lx-%ld-%s", getpid(), (uint64_t)forceAddress, nonce, desc);
 
+  // FNV-1a
+  h->id = 14695981039346656037ULL;
+  for(const char *c = h->name; *c; ++c)
+    h->id = (h->id ^ (uint8_t) *c) * 1099511628211ULL;
+
   const int fd = shm_open(h->name, O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
   if( fd < 0 )
   {
@@ -38,6 +80,7 @@ void heap_init(Heap *h, const char *desc, uint64_t len, void *forceAddress, uint
 
 void heap_fini(Heap *h)
 {
+  heap_uncache(h);
   shm_unlink(h->name);
 }
 
@@ -61,6 +104,7 @@ void heap_map_shared(Heap *h, MappedHeap *mh)
 
   mh->size = h->size;
   mh->next = mh->base = mmap(h->base, h->size, PROT_READ|PROT_WRITE, flags, fd, 0);
+  forget_free(mh);
   if( mh->base == MAP_FAILED )
   {
     perror("mmap failed for map-shared");
@@ -91,6 +135,7 @@ void heap_map_read_only( Heap *h, MappedHeap *mh )
 
   mh->size = h->size;
   mh->next = mh->base = mmap(h->base, h->size, PROT_READ, flags, fd, 0);
+  forget_free(mh);
   if( mh->base == MAP_FAILED )
   {
     perror("mmap failed for map-read-only");
@@ -116,6 +161,7 @@ void heap_map_anywhere(Heap *h, MappedHeap *mh)
 
   mh->size = h->size;
   mh->next = mh->base = mmap(0, h->size, PROT_READ|PROT_WRITE, MAP_NORESERVE|MAP_SHARED, fd, 0);
+  forget_free(mh);
   if( mh->base == MAP_FAILED )
   {
     perror("mmap failed for map-anywhere");
@@ -127,31 +173,209 @@ void heap_map_anywhere(Heap *h, MappedHeap *mh)
   DEBUG(printf(" ==> mapped to 0x%lx\n", (uint64_t) mh->base));
 }
 
+// The mapping cache: a direct-mapped table keyed by
+// heap address.  Entries with users == 0 are idle
+// and may be evicted by a conflicting heap.
+typedef struct s_cached_mapping CachedMapping;
+struct s_cached_mapping
+{
+  Heap    * heap;
+  uint64_t  id;
+  void    * base;
+  uint64_t  size;
+  unsigned  users;
+};
+
+static CachedMapping mappingCache[ HEAP_CACHE_ENTRIES ];
+
+static CachedMapping *cache_slot(Heap *h)
+{
+  uint64_t k = (uint64_t) h;
+  k ^= k >> 17;
+  k *= 0x9e3779b97f4a7c15ULL;
+  return &mappingCache[ (k >> 32) % HEAP_CACHE_ENTRIES ];
+}
+
+static void cache_evict(CachedMapping *cm)
+{
+  DEBUG(printf("Evicting cached mapping of heap %p\n", (void*) cm->heap));
+  munmap( cm->base, cm->size );
+  cm->heap = 0;
+  cm->users = 0;
+}
+
+void heap_map_cached(Heap *h, MappedHeap *mh)
+{
+  CachedMapping *cm = cache_slot(h);
+
+  // Stale: the heap was destroyed and its
+  // descriptor reused for another heap.
+  if( cm->heap == h && cm->id != h->id && cm->users == 0 )
+    cache_evict(cm);
+
+  if( cm->heap == h && cm->id == h->id )
+  {
+    assert( mh->heap == 0 && "Already mapped!");
+    mh->heap = h;
+    mh->size = cm->size;
+    mh->next = mh->base = cm->base;
+    forget_free(mh);
+    ++cm->users;
+    return;
+  }
+
+  // Conflict with a busy entry: fall back to
+  // an uncached mapping.
+  if( cm->heap && cm->users > 0 )
+  {
+    heap_map_anywhere(h, mh);
+    return;
+  }
+
+  if( cm->heap )
+    cache_evict(cm);
+
+  heap_map_anywhere(h, mh);
+  cm->heap = h;
+  cm->id = h->id;
+  cm->base = mh->base;
+  cm->size = mh->size;
+  cm->users = 1;
+}
+
+void heap_release(MappedHeap *mh)
+{
+  CachedMapping *cm = mh->heap ? cache_slot(mh->heap) : 0;
+  if( cm && cm->heap == mh->heap && cm->base == mh->base )
+  {
+    assert( cm->users > 0 );
+    --cm->users;
+    mh->next = 0;
+    mh->heap = 0;
+    return;
+  }
+
+  heap_unmap(mh);
+}
+
+void heap_uncache(Heap *h)
+{
+  CachedMapping *cm = cache_slot(h);
+  if( cm->heap == h )
+  {
+    assert( cm->users == 0 && "Destroying a heap which is still mapped");
+    cache_evict(cm);
+  }
+}
+
+void heap_punch(Heap *h, uint64_t from)
+{
+  from = ROUND_UP(from, (uint64_t) sysconf(_SC_PAGESIZE));
+  if( from >= h->size )
+    return;
+
+  DEBUG(printf("Punching heap \"%s\" from %lu.\n", h->name, from));
+
+  const int fd = shm_open(h->name, O_RDWR, S_IRUSR | S_IWUSR);
+  if( fd < 0 )
+  {
+    perror("can't reopen shm");
+    return;
+  }
+
+  if( fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, from, h->size - from) )
+    DEBUG(perror("fallocate"));
+
+  close(fd);
+}
+
 void heap_map_cow(Heap *h, MappedHeap *mh)
+{
+  heap_map_cow_at(h, h->base, mh);
+}
+
+void heap_map_cow_at(Heap *h, void *address, MappedHeap *mh)
 {
   assert( mh->heap == 0 && "Already mapped!");
   mh->heap = h;
 
-  DEBUG(printf("Mapping heap \"%s\" copy-on-write.\n", h->name));
+  DEBUG(printf("Mapping heap \"%s\" copy-on-write at %p.\n", h->name, address));
 
   const int fd = shm_open(h->name, O_RDWR, S_IRUSR | S_IWUSR);
   assert( fd >= 0 );
 
   int flags = MAP_NORESERVE | MAP_PRIVATE;
-  if( h->base )
+  if( address )
     flags |= MAP_FIXED;
 
   mh->size = h->size;
-  mh->next = mh->base = mmap(h->base, h->size, PROT_READ|PROT_WRITE, flags, fd, 0);
+  mh->next = mh->base = mmap(address, h->size, PROT_READ|PROT_WRITE, flags, fd, 0);
+  forget_free(mh);
   if( mh->base == MAP_FAILED )
   {
     perror("mmap failed for map-cow");
     exit(0);
   }
+  mh->cow = 1;
 
   close(fd);
 }
 
+int heap_remap_cow(Heap *h, MappedHeap *mh)
+{
+  return heap_remap_cow_at(h, h->base, mh);
+}
+
+int heap_remap_cow_at(Heap *h, void *address, MappedHeap *mh)
+{
+  // MADV_DONTNEED on a private file mapping drops our
+  // copies; the pages fault in from the file again.
+  // Untouched parts of the range cost next to nothing.
+  if( mh->heap == h && mh->cow && (!address || mh->base == address) )
+  {
+    DEBUG(printf("Re-using copy-on-write mapping of heap \"%s\".\n", h->name));
+    if( madvise(mh->base, mh->size, MADV_DONTNEED) == 0 )
+    {
+      heap_reset(mh);
+      return 0;
+    }
+    perror("madvise failed for remap-cow");
+  }
+
+  if( mh->heap )
+    heap_unmap(mh);
+  heap_map_cow_at(h, address, mh);
+  return 1;
+}
+
+void heap_discard(MappedHeap *mh)
+{
+  assert( mh->heap == 0 && "Not anonymous");
+  if( madvise(mh->base, mh->size, MADV_DONTNEED) )
+    perror("madvise failed for discard");
+  heap_reset(mh);
+}
+
+void heap_prefault(MappedHeap *mh, uint64_t from, uint64_t to)
+{
+  const uint64_t page = sysconf(_SC_PAGESIZE);
+  from &= ~(page - 1);
+  to = ROUND_UP(to, page);
+  if( to > mh->size )
+    to = mh->size;
+  if( from >= to )
+    return;
+
+  char *start = from + (char*) mh->base;
+#ifdef MADV_POPULATE_READ
+  // Linux 5.14 and later
+  if( madvise(start, to - from, MADV_POPULATE_READ) == 0 )
+    return;
+#endif
+  // Only starts the reads; still one fault per page.
+  madvise(start, to - from, MADV_WILLNEED);
+}
+
 void heap_map_anon(uint64_t len, void *forceAddress, MappedHeap *mh)
 {
   assert( mh->heap == 0 && "Already mapped!");
@@ -165,6 +389,7 @@ void heap_map_anon(uint64_t len, void *forceAddress, MappedHeap *mh)
 
   mh->size = len;
   mh->next = mh->base = mmap(forceAddress, len, PROT_READ|PROT_WRITE, flags, 0, 0);
+  forget_free(mh);
   if( mh->base == MAP_FAILED )
   {
     perror("mmap failed for map-anon");
@@ -175,29 +400,128 @@ void heap_map_anon(uint64_t len, void *forceAddress, MappedHeap *mh)
 }
 
 
+// How many NUMA nodes have memory?  Zero if
+// there is only one, or we cannot tell.
+static int numa_nodes(void)
+{
+  static int nodes = -1;
+  if( nodes < 0 )
+  {
+    // A list like "0" or "0-1" or "0,2-3"; the
+    // last number is the highest node.
+    nodes = 0;
+    FILE *f = fopen("/sys/devices/system/node/has_memory", "r");
+    if( f )
+    {
+      int n, highest = 0;
+      char sep;
+      while( fscanf(f, "%d%c", &n, &sep) >= 1 )
+        highest = n;
+      fclose(f);
+      nodes = (highest > 0) ? highest + 1 : 0;
+    }
+  }
+  return nodes;
+}
+
+void heap_set_numa(MappedHeap *mh, int policy)
+{
+  if( policy == NUMA_FIRST_TOUCH || !numa_nodes() )
+    return;
+
+  // The kernel intersects the mask with the
+  // nodes we may use.
+  unsigned long mask = ~0UL;
+  int mode = MPOL_INTERLEAVE;
+  if( policy == NUMA_LOCAL )
+  {
+    const int cpu = sched_getcpu();
+    mask = 1UL << topology_read_node( cpu < 0 ? 0 : cpu );
+    mode = MPOL_PREFERRED;
+  }
+
+  if( syscall(SYS_mbind, mh->base, mh->size, mode, &mask, 8 * sizeof(mask), 0) )
+    DEBUG(perror("mbind"));
+}
+
 void heap_unmap(MappedHeap *mh)
 {
   DEBUG(printf("Un-mapping heap \"%s\".\n", mh->heap ? mh->heap->name : "<anonymous>" ));
 
   mh->next = 0;
   mh->heap = 0;
+  mh->cow = 0;
   munmap( mh->base, mh->size );
 }
 
 void *heap_alloc(MappedHeap *mh, uint64_t sz)
 {
-  void *p = mh->next;
-
   // round sz up to a multiple of 16
 	sz = ROUND_UP(sz,ALIGNMENT);
+  if( sz == 0 )
+    sz = ALIGNMENT;
 
-  mh->next = (void*) ( sz + (char*)mh->next );
+  // Recycle a freed block
+  const unsigned c = size_class(&sz);
+  if( c < HEAP_NUM_CLASSES )
+  {
+    void *p = mh->free_class[c];
+    if( p )
+    {
+      mh->free_class[c] = *(void**)p;
+      return p;
+    }
+  }
+  else
+  {
+    for(void **prev = &mh->free_large; *prev; prev = (void**) *prev)
+    {
+      void *p = *prev;
+      if( ((BlockHeader*)p)[-1].size >= sz )
+      {
+        *prev = *(void**)p;
+        return p;
+      }
+    }
+  }
+
+  // Bump
+  BlockHeader *hdr = (BlockHeader*) mh->next;
+  hdr->size = sz;
+  void *p = &hdr[1];
+
+  mh->next = (void*) ( sz + (char*)p );
   return p;
 }
 
 void heap_free(MappedHeap *mh, void *ptr)
 {
-  // pfft
+  char *p = (char*) ptr;
+
+  // Not ours: another process allocated it
+  // above our bump pointer.
+  if( p <= (char*)mh->base || p >= (char*)mh->next )
+    return;
+
+  BlockHeader *hdr = &((BlockHeader*)p)[-1];
+  uint64_t sz = hdr->size;
+
+  // The last block: give it back to the bump pointer
+  if( p + sz == (char*)mh->next )
+  {
+    mh->next = (void*) hdr;
+    return;
+  }
+
+  const unsigned c = size_class(&sz);
+  void **list = (c < HEAP_NUM_CLASSES) ? &mh->free_class[c] : &mh->free_large;
+  *(void**)p = *list;
+  *list = p;
+}
+
+void heap_reserve(MappedHeap *mh, uint64_t sz)
+{
+  mh->next = (void*) ( ROUND_UP(sz,ALIGNMENT) + (char*)mh->next );
 }
 
 uint64_t heap_used(MappedHeap *mh)
@@ -208,6 +532,7 @@ uint64_t heap_used(MappedHeap *mh)
 void heap_reset(MappedHeap *mh)
 {
   mh->next = mh->base;
+  forget_free(mh);
 }
 
 
@@ -5,6 +5,18 @@
 
 #define HNMAX   (256)
 
+// Size classes of heap_alloc.  Blocks up to
+// HEAP_SMALL_MAX bytes come in steps of 16 bytes;
+// larger ones up to HEAP_MEDIUM_MAX are rounded up
+// to a power of two.  Freed blocks of a class are
+// recycled by later allocations of that class.
+// Still larger blocks keep their exact size, and
+// are recycled first-fit.
+#define HEAP_SMALL_MAX      (1024)
+#define HEAP_MEDIUM_SHIFT   (20)
+#define HEAP_MEDIUM_MAX     (1ULL << HEAP_MEDIUM_SHIFT)
+#define HEAP_NUM_CLASSES    (HEAP_SMALL_MAX/16 + HEAP_MEDIUM_SHIFT - 10)
+
 typedef struct s_heap Heap;
 typedef struct s_mapped_heap MappedHeap;
 
@@ -16,6 +28,10 @@ struct s_heap
   // extents
   void    * base;
   uint64_t  size;
+
+  // hash of the name; distinguishes this heap
+  // from an earlier one at the same address
+  uint64_t  id;
 };
 
 struct s_mapped_heap
@@ -24,6 +40,15 @@ struct s_mapped_heap
   uint64_t  size;
   void    * base;
   void    * next;
+
+  // Freed blocks, by size class, and larger.
+  // These lists belong to this mapping, i.e.
+  // each worker recycles its own blocks.
+  void    * free_class[HEAP_NUM_CLASSES];
+  void    * free_large;
+
+  // mapped by heap_map_cow
+  int       cow;
 };
 
 // Create an onymous heap
@@ -41,12 +66,67 @@ void heap_map_anon(uint64_t len, void *forceAddress, MappedHeap *mh);
 void heap_unmap(MappedHeap *mh);
 void heap_map_anywhere(Heap *h, MappedHeap *mh);
 
+// Like heap_map_cow, but at another address (anywhere,
+// if zero).  Translate pointers with heap_translate.
+void heap_map_cow_at(Heap *h, void *address, MappedHeap *mh);
+
+// Like heap_map_cow, but if mh already maps h copy-on-
+// write, keep that mapping and only drop this process's
+// copies of its pages; later accesses see the heap's
+// current contents, as after a new mapping.  Returns
+// non-zero if it made a new mapping.
+int heap_remap_cow(Heap *h, MappedHeap *mh);
+int heap_remap_cow_at(Heap *h, void *address, MappedHeap *mh);
+
+// Drop every page of an anonymous mapping (they read as
+// zero again), and reset its allocator.
+void heap_discard(MappedHeap *mh);
+
+// Fault in bytes [from,to) of a mapped heap with one
+// call rather than one fault per page.
+void heap_prefault(MappedHeap *mh, uint64_t from, uint64_t to);
+
+// Like heap_map_anywhere, but keep the mapping in a
+// per-process cache after heap_release(), so that
+// mapping the same heap again costs neither mmap
+// nor page faults.  A heap may be mapped through
+// the cache more than once at a time.
+void heap_map_cached(Heap *h, MappedHeap *mh);
+void heap_release(MappedHeap *mh);
+
+// Drop this process's cached mapping of a heap
+// which is about to be destroyed.
+void heap_uncache(Heap *h);
+
+// Give back the memory behind bytes [from,size) of a
+// heap, which read as zero again in every process that
+// maps it.  The heap keeps its size and its mappings.
+void heap_punch(Heap *h, uint64_t from);
+
+// Place the pages of a mapped heap which are not yet
+// allocated (NUMA_* in constants.h).  For a heap mapped
+// shared, this holds for every process which faults the
+// pages in; for a copy-on-write or anonymous mapping,
+// for this process's copies.  NUMA_LOCAL means the node
+// of the CPU which calls heap_set_numa.
+void heap_set_numa(MappedHeap *mh, int policy);
+
 // allocate
+// Every block is preceded by a 16-byte header,
+// and is 16-byte aligned.  heap_free recycles
+// only blocks which this mapping allocated
+// (i.e. those below its bump pointer); it
+// ignores blocks of other processes.
 void *heap_alloc(MappedHeap *h, uint64_t sz);
 void heap_free(MappedHeap *h, void *ptr);
 uint64_t heap_used(MappedHeap *h);
 void heap_reset(MappedHeap *h);
 
+// Skip the first sz bytes, which another process
+// allocated (e.g. heap_used of the same heap in
+// the main process) before we mapped it.
+void heap_reserve(MappedHeap *h, uint64_t sz);
+
 // Translate pointers
 // Given a pointer which expects a heap at its
 // natural address, translate that pointer to
@@ -3,6 +3,9 @@
 #include <stdlib.h>
 #include <stdarg.h>
 #include <assert.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/uio.h>
 
 #include "config.h"
 #include "api.h"
@@ -11,18 +14,27 @@
 #include "pcb.h"
 #include "heap.h"
 #include "fiveheaps.h"
+#include "trace.h"
 
 // Deferred IO
 
+// Each worker formats its output into one
+// growing buffer, and records its events
+// as offsets into that buffer.
 static IOEvt *worker_io_events = 0;
 static unsigned worker_cap_io_events;
 static unsigned worker_num_io_events;
 
+static char *worker_io_bytes = 0;
+static size_t worker_cap_io_bytes;
+static size_t worker_num_io_bytes;
+
+// Forget my events, but keep
+// the buffers for next time.
 void __specpriv_reset_worker_io(void)
 {
-  worker_cap_io_events = 0;
   worker_num_io_events = 0;
-  worker_io_events = 0;
+  worker_num_io_bytes = 0;
 }
 
 void __specpriv_copy_io_to_redux(IOEvtSet *evtset, MappedHeap *redux)
@@ -33,7 +45,7 @@ void __specpriv_copy_io_to_redux(IOEvtSet *evtset, MappedHeap *redux)
   const Wid myWorkerId = __specpriv_my_worker_id();
 
   evtset->num[ myWorkerId ] = worker_num_io_events;
-  if( worker_num_io_events < 1 || worker_io_events == 0 )
+  if( worker_num_io_events < 1 )
   {
     __specpriv_reset_worker_io();
     return;
@@ -41,125 +53,212 @@ void __specpriv_copy_io_to_redux(IOEvtSet *evtset, MappedHeap *redux)
 
   // The worker produced IO.
   // Copy my IO into the high-half of the
-  // checkpoint's reduction heap (after all of the reductions)
-
-  // First, copy the strings to the redux heap.
-  for(unsigned i=0; i<worker_num_io_events; ++i)
-  {
-    void *old_buffer = worker_io_events[i].buffer;
-    unsigned len = worker_io_events[i].len;
-    void *new_buffer = heap_alloc(redux,len+1);
+  // checkpoint's reduction heap (after all of the reductions):
+  // the formatted bytes, in one piece, and my list of events.
+  char *new_bytes = (char*) heap_alloc(redux, worker_num_io_bytes);
+  memcpy(new_bytes, worker_io_bytes, worker_num_io_bytes);
 
-    memcpy(new_buffer, old_buffer, len);
-
-    worker_io_events[i].buffer = heap_inv_translate(new_buffer,redux);
-    free(old_buffer);
-  }
-
-  // Now copy my list of events.
-  // IMPORTANT NOTE: we are copying pointers
   const unsigned list_size = worker_num_io_events * sizeof(IOEvt);
   IOEvt *new_list = (IOEvt*) heap_alloc(redux, list_size);
   memcpy(new_list, worker_io_events, list_size);
-  free( worker_io_events );
 
-  // And report it in the global parallel control block.
+  // And report it in the checkpoint.
   evtset->lists[ myWorkerId ] = (IOEvt*) heap_inv_translate(new_list,redux);
+  evtset->bytes[ myWorkerId ] = (char*) heap_inv_translate(new_bytes,redux);
 
-  // Free up my IO queue.
-  // Leave my list at its current capacity though.
   __specpriv_reset_worker_io();
 
   TADD(worker_copy_io_to_redux_time, start);
 }
 
-void __specpriv_commit_io(IOEvtSet *evtset, MappedHeap *redux)
+// Gather consecutive writes to the same
+// stream, and issue them with one writev().
+#define IO_BATCH  (IOV_MAX)
+
+typedef struct s_io_batch IOBatch;
+struct s_io_batch
 {
-  uint64_t start;
-  TIME(start);
+  FILE *        stream;
+  int           fd;
+  unsigned      num;
+  struct iovec  iov[ IO_BATCH ];
+};
 
-  const Wid numWorkers = __specpriv_num_workers();
+static void __specpriv_flush_io_batch(IOBatch *batch)
+{
+  if( batch->num == 0 )
+    return;
 
-  // IMPORTANT NOTE:
-  // The IO lists contain pointers to objects within the redux heaps
-  // of each worker.  Since we are remapping the worker heaps to
-  // different locations, we MUST correct the pointers.
+  // Anything the main process has buffered
+  // on this stream was written before.
+  fflush(batch->stream);
 
-  // Perform the deferred IO operations from each worker.
-  unsigned offsets[ MAX_WORKERS ] = {0};
-  for(;;)
+  struct iovec *iov = batch->iov;
+  unsigned num = batch->num;
+  while( num > 0 )
   {
-    // Find the next IO event to issue.
-    Iteration minTime = 0;
-    unsigned minTimeIndex = UINT32_MAX;
-    for(Wid wid=0; wid<numWorkers; ++wid)
+    ssize_t written = writev(batch->fd, iov, num);
+    if( written < 0 && errno == EINTR )
+      continue;
+    assert( written >= 0 && "Can't fix this");
+
+    while( num > 0 && (size_t) written >= iov->iov_len )
     {
-      const unsigned ow = offsets[wid];
+      written -= iov->iov_len;
+      ++iov;
+      --num;
+    }
+    if( num > 0 )
+    {
+      iov->iov_base = written + (char*) iov->iov_base;
+      iov->iov_len -= written;
+    }
+  }
 
-      if( ow >= evtset->num[wid] )
-        continue;
+  batch->num = 0;
+}
 
-      // CORRECT POINTER
-      IOEvt *bad_iolist = evtset->lists[wid];
-      IOEvt *corrected_iolist = (IOEvt*) heap_translate( bad_iolist, redux );
+static void __specpriv_batch_io(IOBatch *batch, FILE *file, char *buffer, size_t len)
+{
+  if( batch->stream != file || batch->num == IO_BATCH )
+  {
+    __specpriv_flush_io_batch(batch);
+    batch->stream = file;
+    batch->fd = fileno(file);
+  }
 
-      const Iteration evtTime = corrected_iolist[ ow ].iter;
+  // Not backed by a file descriptor.
+  if( batch->fd < 0 )
+  {
+    size_t result = fwrite(buffer, 1, len, file);
+    fflush(file);
+    assert( result == len && "Can't fix this");
+    return;
+  }
 
-      if( evtTime < minTime
-      ||  minTimeIndex == UINT32_MAX )
-      {
-        minTimeIndex = wid;
-        minTime = evtTime;
-      }
+  // A worker's events are contiguous in its buffer.
+  if( batch->num > 0 )
+  {
+    struct iovec *last = &batch->iov[ batch->num - 1 ];
+    if( last->iov_len + (char*) last->iov_base == buffer )
+    {
+      last->iov_len += len;
+      return;
     }
+  }
 
-    // No more IO left?
-    if( minTimeIndex == UINT32_MAX )
-      break;
+  batch->iov[ batch->num ].iov_base = buffer;
+  batch->iov[ batch->num ].iov_len = len;
+  ++batch->num;
+}
 
-    // Perform that IO operation.
+// One worker's remaining events, during the merge.
+typedef struct s_io_cursor IOCursor;
+struct s_io_cursor
+{
+  const IOEvt * next;
+  const IOEvt * end;
+  char *        bytes;
+  Wid           wid;
+};
+
+// Events are issued in order of iteration;
+// ties go to the lower worker id.
+static Bool io_before(const IOCursor *a, const IOCursor *b)
+{
+  if( a->next->iter != b->next->iter )
+    return a->next->iter < b->next->iter;
+  return a->wid < b->wid;
+}
 
-    // CORRECT POINTER
-    IOEvt *bad_iolist = evtset->lists[ minTimeIndex ];
-    IOEvt *corrected_iolist = (IOEvt*) heap_translate( bad_iolist, redux );
+static void io_sift_down(IOCursor *heap, unsigned num, unsigned i)
+{
+  for(;;)
+  {
+    unsigned least = i;
+    const unsigned left = 2*i + 1, right = 2*i + 2;
+    if( left < num && io_before(&heap[left], &heap[least]) )
+      least = left;
+    if( right < num && io_before(&heap[right], &heap[least]) )
+      least = right;
+    if( least == i )
+      return;
+
+    const IOCursor tmp = heap[i];
+    heap[i] = heap[least];
+    heap[least] = tmp;
+    i = least;
+  }
+}
 
-    unsigned ow = offsets[ minTimeIndex ];
+void __specpriv_commit_io(IOEvtSet *evtset, MappedHeap *redux)
+{
+  uint64_t start;
+  TIME(start);
+  TRACE_EVENT(TRACE_IO_BEGIN, 0);
 
-    for(const Iteration iter = corrected_iolist[ ow ].iter; corrected_iolist[ ow ].iter == iter; ++ow)
-    {
-      IOEvt *evt = & corrected_iolist[ ow ];
+  const Wid numWorkers = __specpriv_num_workers();
 
-      // CORRECT POINTER
-      void *bad_buffer = evt->buffer;
-      void *corrected_buffer = heap_translate(bad_buffer, redux );
+  // IMPORTANT NOTE:
+  // The IO lists point to objects within the redux heap
+  // of the checkpoint.  Since we are remapping that heap
+  // to a different location, we MUST correct the pointers;
+  // once per worker, before the merge.
+  IOCursor heap[ MAX_WORKERS ];
+  unsigned num = 0;
+  for(Wid wid=0; wid<numWorkers; ++wid)
+  {
+    if( evtset->num[wid] == 0 )
+      continue;
+
+    IOCursor *cursor = &heap[ num++ ];
+    cursor->next = (const IOEvt*) heap_translate( evtset->lists[wid], redux );
+    cursor->end = cursor->next + evtset->num[wid];
+    cursor->bytes = (char*) heap_translate( evtset->bytes[wid], redux );
+    cursor->wid = wid;
+  }
 
-//      printf("Process io event #%u from worker %u at time %d\n", ow, minTimeIndex, evt->iter);
+  for(unsigned i=num/2; i-- > 0; )
+    io_sift_down(heap, num, i);
 
-      // Perform the operation.
-      FILE *file = evt->stream;
-      const unsigned len = evt->len;
-      int result = fwrite(corrected_buffer, 1, len, file);
-      fflush(file);
-      heap_free(redux, corrected_buffer);
+  // Perform the deferred IO operations from each
+  // worker, merged by iteration (k-way merge).
+  static IOBatch batch;
+  batch.stream = 0;
+  batch.num = 0;
+  while( num > 0 )
+  {
+    IOCursor *first = &heap[0];
 
-      assert( result >= 0 && ((unsigned)result) == len && "Can't fix this");
-    }
+    // Issue all of its events from this iteration.
+    const Iteration iter = first->next->iter;
+    do
+    {
+      const IOEvt *evt = first->next++;
+      __specpriv_batch_io(&batch, evt->stream, first->bytes + evt->offset, evt->len);
+    } while( first->next < first->end && first->next->iter == iter );
 
-    offsets[ minTimeIndex ] = ow;
+    if( first->next == first->end )
+      heap[0] = heap[ --num ];
+    io_sift_down(heap, num, 0);
   }
+  __specpriv_flush_io_batch(&batch);
 
   // Free empty the set.
   for(Wid wid=0; wid<numWorkers; ++wid)
   {
-    evtset->num[wid] = 0;
-
-    void *bad_list = evtset->lists[wid];
-    void *corrected_list = heap_translate(bad_list, redux);
-    heap_free(redux, corrected_list);
+    if( evtset->num[wid] > 0 )
+    {
+      heap_free(redux, heap_translate( evtset->bytes[wid], redux ));
+      heap_free(redux, heap_translate( evtset->lists[wid], redux ));
+    }
 
+    evtset->num[wid] = 0;
     evtset->lists[wid] = 0;
+    evtset->bytes[wid] = 0;
   }
 
+  TRACE_EVENT(TRACE_IO_END, 0);
   TADD(worker_commit_io_time, start);
 }
 
@@ -182,14 +281,35 @@ static IOEvt *__specpriv_grow_io(void)
   return &worker_io_events[ worker_num_io_events++ ];
 }
 
-static void __specpriv_issue_io(void *buffer, size_t len, FILE *file)
+// Room for len more bytes at the
+// end of the worker's buffer.
+static char *__specpriv_reserve_io_bytes(size_t len)
+{
+  if( worker_num_io_bytes + len > worker_cap_io_bytes )
+  {
+    worker_cap_io_bytes *= 2;
+    if( 4096 > worker_cap_io_bytes )
+      worker_cap_io_bytes = 4096;
+    while( worker_num_io_bytes + len > worker_cap_io_bytes )
+      worker_cap_io_bytes *= 2;
+
+    worker_io_bytes = (char*) realloc(worker_io_bytes, worker_cap_io_bytes);
+  }
+
+  return &worker_io_bytes[ worker_num_io_bytes ];
+}
+
+// The len bytes just reserved become an event.
+static void __specpriv_issue_io(size_t len, FILE *file)
 {
   IOEvt *evt = __specpriv_grow_io();
 
   evt->iter = __specpriv_current_iter();
   evt->stream = file;
   evt->len = len;
-  evt->buffer = buffer;
+  evt->offset = worker_num_io_bytes;
+
+  worker_num_io_bytes += len;
 }
 
 
@@ -203,9 +323,8 @@ int __specpriv_io_fwrite(void *buffer, size_t size, size_t nmemb, FILE *file)
   TIME(start);
 
   const size_t len = size * nmemb;
-  void *buff = malloc( len );
-  memcpy(buff, buffer, len);
-  __specpriv_issue_io(buff, len, file);
+  memcpy(__specpriv_reserve_io_bytes(len), buffer, len);
+  __specpriv_issue_io(len, file);
 
   TADD(worker_intermediate_io_time,start);
   TIME(worker_pause_time);
@@ -221,19 +340,22 @@ int __specpriv_io_vfprintf(FILE *file, const char *fmt, va_list ap)
   uint64_t start;
   TIME(start);
 
-  char *buffer = (char*) malloc( BUFFER_SIZE * sizeof(char) );
+  // Format directly into my buffer.
+  va_list again;
+  va_copy(again, ap);
+
+  char *buffer = __specpriv_reserve_io_bytes( BUFFER_SIZE );
   int len = vsnprintf(buffer, BUFFER_SIZE, fmt, ap);
   if( len >= BUFFER_SIZE )
   {
-    buffer = (char*) realloc( buffer,  (1+len) * sizeof(char) );
-    len = vsnprintf(buffer, len+1, fmt, ap);
+    buffer = __specpriv_reserve_io_bytes( len+1 );
+    len = vsnprintf(buffer, len+1, fmt, again);
   }
+  va_end(again);
   va_end(ap);
 
   if( len > 0 )
-    __specpriv_issue_io(buffer, len, file);
-  else
-    free(buffer);
+    __specpriv_issue_io(len, file);
 
   TADD(worker_intermediate_io_time,start);
   TIME(worker_pause_time);
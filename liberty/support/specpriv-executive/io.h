@@ -7,22 +7,27 @@
 #include "types.h"
 #include "heap.h"
 
-// A single deferred IO operation
+// A single deferred IO operation.
+// Its bytes are at 'offset' within the
+// worker's buffer of formatted output.
 struct s_io_evt
 {
   Iteration   iter;
   FILE *      stream;
   size_t      len;
-  void *      buffer;
+  size_t      offset;
 };
 typedef struct s_io_evt IOEvt;
 
 // A set of events, divided by
 // workers and ordered by time, ascending.
+// Each worker's list and buffer are in
+// the redux heap of the checkpoint.
 struct s_io_evt_set
 {
   IOEvt *     lists[ MAX_WORKERS ];
   unsigned    num[ MAX_WORKERS ];
+  char *      bytes[ MAX_WORKERS ];
 };
 typedef struct s_io_evt_set IOEvtSet;
 
@@ -9,6 +9,12 @@ static void __specpriv_init_pcb(void)
   the_pcb = (ParallelControlBlock*) __specpriv_alloc_meta( sizeof(ParallelControlBlock) );
 
   __specpriv_init_checkpoint_manager( &the_pcb->checkpoints );
+
+  the_pcb->shutdown = 0;
+  doorbell_init( &the_pcb->dispatch );
+#if JOIN == SPIN
+  completion_reset( &the_pcb->workersDone );
+#endif
 }
 
 ParallelControlBlock *__specpriv_get_pcb(void)
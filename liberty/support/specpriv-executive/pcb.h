@@ -1,11 +1,39 @@
 #ifndef LLVM_LIBERTY_SPEC_PRIV_EXECUTIVE_PCB_H
 #define LLVM_LIBERTY_SPEC_PRIV_EXECUTIVE_PCB_H
 
+#include <sys/types.h>
+
 #include "constants.h"
 #include "types.h"
 #include "io.h"
 #include "config.h"
 #include "checkpoint.h"
+#include "doorbell.h"
+#include "granularity.h"
+
+struct s_reduction_info;
+
+// Everything a worker needs to start an invocation.
+// Written by the main process before it rings
+// the doorbell; read by the workers after.
+typedef struct s_worker_args WorkerArgs;
+struct s_worker_args
+{
+  Iteration firstIter;
+  void (*callback)(void *, int64_t, int64_t, int64_t);
+  void *user;
+  int64_t numCores;
+  int64_t chunkSize;
+  unsigned sizeof_private;
+  unsigned sizeof_killprivate;
+  unsigned sizeof_shareprivate;
+  unsigned sizeof_redux;
+  unsigned sizeof_ro;
+  unsigned sizeof_local;
+  struct s_reduction_info *first_reduction_info;
+  int loopID;
+  Iteration checkpointGranularity;
+};
 
 // Shared state for the parallel region (to be allocated in shared heap)
 struct s_parallel_control_block
@@ -16,26 +44,52 @@ struct s_parallel_control_block
 
   // Has misspeculation occurred?
   // If so, who, when, and why?
+  // Written under misspec_lock.
+  volatile uint32_t   misspec_lock;
   Bool                misspeculation_happened;
   Wid                 misspeculated_worker;
   Iteration           misspeculated_iteration;
   const char *        misspeculation_reason;
 
-  // in case of misspeculataion, what was the last checkpoint committed
-  Checkpoint *        last_committed;
+  // Bumped on every misspeculation, before the
+  // other workers are signalled (see ABORT_BROADCAST).
+  volatile uint32_t   abort_epoch;
+  pid_t               workerPid[ MAX_WORKERS ];
 
   char padding1[128];
 
   // The checkpoints...
   CheckpointManager   checkpoints;
 
-#if JOIN == SPIN
   char padding2[128];
 
+  // Arguments of the current invocation, and
+  // the doorbell which announces them.  When
+  // shutdown is set, the workers exit instead.
+  WorkerArgs          invocation;
+  Bool                shutdown;
+  Doorbell            dispatch;
+
+  char padding3[128];
+
+  // Under the DYNAMIC schedule, the first
+  // iteration which no worker has claimed yet.
+  volatile Iteration  nextUnclaimed;
+
+  // Measurements of the current invocation,
+  // used to choose the checkpoint granularity
+  // of the next one.
+  InvocationStats     stats;
+
+#if JOIN == SPIN
+  char padding4[128];
+
   // Workers from the last invocation
-  // will set these flags when they die.
+  // will set these flags when they finish,
+  // and count up the completion.
   // Faster than calling waitpid()...
   Bool workerDoneFlags[ MAX_WORKERS ];
+  Completion workersDone;
 #endif
 
 };
@@ -8,13 +8,15 @@
 #include "private.h"
 #include "checkpoint.h"
 #include "fiveheaps.h"
+#include "dirty.h"
+#include "shadow.h"
 
 // First iteration of this invocation.
 // May be >0 after recovery from misspeculation.
 static Iteration firstIteration;
 
-// The checkpoint granularity:
-// == The greatest multiple of numWorkers <= MIN_CHECKPOINT_GRANULARITY
+// The checkpoint granularity, chosen before
+// each invocation by __specpriv_choose_granularity().
 static Iteration checkpointGranularity;
 
 // Range [low,high) of bytes which have been defined in the shadow heap.
@@ -33,10 +35,6 @@ static uint16_t code16 = 0;
 static uint32_t code32 = 0;
 static uint64_t code64 = 0;
 
-#if SHADOW_MEM == VECTOR
-static __m128i code128;
-#endif
-
 uint64_t last_read_live_in_ptr_start;
 uint64_t last_read_live_in_ptr_end;
 
@@ -56,6 +54,24 @@ static void update_shadow_range(uint8_t *shadow, uint64_t len)
     shadow_lowest_inclusive = shadow;
   if (shadow_highest_exclusive < shadow + len)
     shadow_highest_exclusive = shadow + len;
+
+  const uint64_t offset = (uint64_t) shadow - SHADOW_ADDR;
+  dirty_mark( dirty_map(SHADOW_ADDR), offset, offset + len );
+}
+
+// Mark the pages touched by a strided access.  If the gaps
+// between strides are shorter than a page, no page in the
+// extent is skipped; otherwise, mark each stride.
+static void mark_shadow_strides(uint8_t *cbase, uint64_t nStrides, uint64_t strideWidth, uint64_t lenPerStride)
+{
+  uint64_t *map = dirty_map(SHADOW_ADDR);
+  const uint64_t low = (uint64_t) cbase - SHADOW_ADDR;
+
+  if( strideWidth - lenPerStride < DIRTY_PAGE_SIZE )
+    dirty_mark(map, low, low + (nStrides-1)*strideWidth + lenPerStride);
+  else
+    for(uint64_t i=0; i<nStrides; ++i)
+      dirty_mark(map, low + i*strideWidth, low + i*strideWidth + lenPerStride);
 }
 
 static void __specpriv_reset_shareshadow_range(void)
@@ -76,14 +92,6 @@ static void update_shareshadow_range(uint8_t *shareshadow, uint64_t len)
 // Called once at beginning of invocation, before workers are spawned.
 void __specpriv_init_private(void)
 {
-  // Determine the checkpoint granularity.
-  // round the MAX_CHECKPOINT_GRANULARITY down to a multiple
-  // of numWorkers.
-  const Wid numWorkers = __specpriv_num_workers();
-  checkpointGranularity = MAX_CHECKPOINT_GRANULARITY - (MAX_CHECKPOINT_GRANULARITY % numWorkers);
-
-  //DEBUG( checkpointGranularity = 10 );
-
   __specpriv_reset_shadow_range();
   __specpriv_reset_shareshadow_range();
 }
@@ -96,15 +104,17 @@ static void __specpriv_set_iter(Iteration i)
   code16 =  code8 | (( (uint16_t)  code8 ) <<  8);
   code32 = code16 | (( (uint32_t) code16 ) << 16);
   code64 = code32 | (( (uint64_t) code32 ) << 32);
+}
 
-#if SHADOW_MEM == VECTOR
-  const __m128i _code8  = _mm_cvtsi32_si128( code8 );
-  const __m128i _code16 = _mm_or_si128( _mm_slli_si128( _code8, 1), _code8 );
-  const __m128i _code32 = _mm_or_si128( _mm_slli_si128(_code16, 2), _code16 );
-  const __m128i _code64 = _mm_or_si128( _mm_slli_si128(_code32, 4), _code32 );
+void __specpriv_set_checkpoint_granularity(Iteration g)
+{
+  assert( 0 < g && g <= MAX_CHECKPOINT_GRANULARITY );
+  checkpointGranularity = g;
+}
 
-  code128 = _mm_or_si128( _mm_slli_si128(_code64, 8), _code64 );
-#endif
+Iteration __specpriv_checkpoint_granularity(void)
+{
+  return checkpointGranularity;
 }
 
 void __specpriv_set_first_iter(Iteration i)
@@ -180,10 +190,15 @@ void __specpriv_private_write_range(void *ptr, uint64_t len)
   if( ! __specpriv_i_am_main_process() ) // shadow is only mapped in worker processes
   {
     uint8_t *shadow = (uint8_t*) ( SHADOW_ADDR | (uint64_t)ptr );
-    // TODO: speed this up.
+#if SHADOW_MEM == VECTOR
+    if( __specpriv_shadow_kernels->write_range(shadow, &shadow[len], code8) )
+      __specpriv_misspec("misspec during private write range (1)");
+#endif
+#if SHADOW_MEM == NATIVE
     if( memchr(shadow, READ_LIVE_IN, len) )
       __specpriv_misspec("misspec during private write range (1)");
     memset(shadow, code8, len);
+#endif
 
     update_shadow_range(shadow, len);
 
@@ -225,77 +240,8 @@ void __specpriv_shareprivate_write_range(void *ptr, uint64_t len)
 static inline void __specpriv_private_read_range_internal(uint8_t *start, uint8_t *stop, const char *name)
 {
 #if SHADOW_MEM == VECTOR
-  uint8_t *lo4  = (uint8_t*) ROUND_UP( start, sizeof(uint32_t) );
-  uint8_t *lo16 = (uint8_t*) ROUND_UP( start, sizeof(__m128i) );
-  uint8_t *hi16 = (uint8_t*) ROUND_DOWN( stop, sizeof(__m128i) );
-  uint8_t *hi4  = (uint8_t*) ROUND_DOWN( stop, sizeof(uint32_t) );
-
-  // First check unaligned bytes
-  for(uint8_t *i=start; i<lo4; ++i)
-  {
-    const uint8_t meta = *i;
-    if( meta == LIVE_IN )
-      *i = READ_LIVE_IN;
-    else if( meta != code8 && meta != READ_LIVE_IN )
-      __specpriv_misspec(name);
-  }
-
-  // Check 4-byte aligned words
-  if( lo4 < hi4 )
-  {
-    for(uint32_t *i=(uint32_t*)lo4; i<(uint32_t*)lo16; ++i)
-    {
-      const uint32_t meta = *i;
-      if( meta == V32(LIVE_IN) )
-        *i = V32( READ_LIVE_IN );
-      else if( meta != code32 && meta != V32(READ_LIVE_IN) )
-        __specpriv_misspec(name);
-    }
-
-    // Check the 16-byte aligned vectors in the middle
-    // (hopefully the bulk of the operation)
-    if( lo16 < hi16 )
-    {
-      const __m128i zero = _mm_setzero_si128();
-      const __m128i _code128 = _mm_load_si128(&code128);
-
-      for(__m128i *i=(__m128i*)lo16; i<(__m128i*)hi16; ++i)
-      {
-        const __m128i meta = _mm_load_si128(i);
-
-        const __m128i cmp_code = (__m128i) _mm_cmpeq_epi8(meta, _code128);
-        const uint16_t eq_code = _mm_movemask_epi8(cmp_code);
-
-        if( eq_code != 0xffffu )
-        {
-          const __m128i cmp_0 = (__m128i) _mm_cmpeq_epi8(meta, zero);
-          const uint16_t eq_zero = _mm_movemask_epi8(cmp_0);
-TODO: make sure that bytes marked LIVE_IN become READ_LIVE_IN
-          if( (eq_zero | eq_code) != 0xffffu )
-            __specpriv_misspec(name);
-        }
-      }
-    }
-
-    for(uint32_t *i=(uint32_t*)hi16; i<(uint32_t*)hi4; ++i)
-    {
-      const uint32_t meta = *i;
-      if( meta == V32(LIVE_IN) )
-        *i = V32(READ_LIVE_IN);
-      else if( meta != code32 && meta != V32(READ_LIVE_IN) )
-        __specpriv_misspec(name);
-    }
-  }
-
-  // Finally, check unaligned bytes
-  for(uint8_t *i=hi4; i<stop; ++i)
-  {
-    const uint8_t meta = *i;
-    if( meta == LIVE_IN )
-      *i = READ_LIVE_IN;
-    else if( meta != code8 && meta != READ_LIVE_IN )
-      __specpriv_misspec(name);
-  }
+  if( __specpriv_shadow_kernels->read_range(start, stop, code8) )
+    __specpriv_misspec(name);
 #endif
 
 #if SHADOW_MEM == NATIVE
@@ -350,10 +296,7 @@ void __specpriv_private_read_range(void *ptr, uint64_t len, const char *name)
 
     __specpriv_private_read_range_internal(shadow, &shadow[len], name);
 
-    if( shadow < shadow_lowest_inclusive )
-      shadow_lowest_inclusive = shadow;
-    if( shadow_highest_exclusive < shadow + len )
-      shadow_highest_exclusive = shadow + len;
+    update_shadow_range(shadow, len);
 
     DEBUG( assert( ((uint64_t)shadow_highest_exclusive) <= SHADOW_ADDR + __specpriv_sizeof_private() ) );
 
@@ -780,6 +723,8 @@ void __specpriv_private_write_range_stride(void *base, uint64_t nStrides, uint64
       if( shadow_highest_exclusive < high )
         shadow_highest_exclusive = high;
 
+      mark_shadow_strides(cbase, nStrides, strideWidth, lenPerStride);
+
       DEBUG( assert( ((uint64_t)shadow_highest_exclusive) <= SHADOW_ADDR + __specpriv_sizeof_private() ) );
 
       switch( lenPerStride )
@@ -859,10 +804,15 @@ void __specpriv_private_write_range_stride(void *base, uint64_t nStrides, uint64
         {
           for(uint64_t i=0; i<nStrides; ++i, cbase += strideWidth)
           {
-            // TODO: optimize this.
+#if SHADOW_MEM == VECTOR
+            if( __specpriv_shadow_kernels->write_range(cbase, &cbase[lenPerStride], code8) )
+              __specpriv_misspec("misspec during private_write_range_stride, lenPerStride=x");
+#endif
+#if SHADOW_MEM == NATIVE
             if( memchr(cbase, READ_LIVE_IN, lenPerStride) )
               __specpriv_misspec("misspec during private_write_range_stride, lenPerStride=x");
             memset(cbase, code8, lenPerStride);
+#endif
           }
         }
         break;
@@ -898,6 +848,8 @@ void __specpriv_private_read_range_stride(void *base, uint64_t nStrides, uint64_
       if( shadow_highest_exclusive < high )
         shadow_highest_exclusive = high;
 
+      mark_shadow_strides(cbase, nStrides, strideWidth, lenPerStride);
+
       DEBUG( assert( ((uint64_t)shadow_highest_exclusive) <= SHADOW_ADDR + __specpriv_sizeof_private() ) );
     }
 
@@ -937,7 +889,7 @@ void __specpriv_private_read_range_stride(void *base, uint64_t nStrides, uint64_
 
           const uint64_t meta1 = ibase[1];
           if( meta1 == V64(LIVE_IN) )
-            ibase[2] = V64(READ_LIVE_IN);
+            ibase[1] = V64(READ_LIVE_IN);
           else if( meta1 != code64 && meta1 != V64(READ_LIVE_IN) )
             __specpriv_misspec(message);
         }
@@ -984,54 +936,76 @@ Bool __specpriv_distill_worker_private_into_partial(
     const unsigned low  = ROUND_DOWN( shadow_lowest_inclusive - src_s, bytesPerWord ),
                    high = ROUND_UP( shadow_highest_exclusive - src_s, bytesPerWord );
 
-    // TODO: vectorize this.
-    for(unsigned i=low; i<high; i += bytesPerWord )
-    {
-      uint64_t *many = (uint64_t*) &src_s[i];
-      if( V64(LIVE_IN) == *many )
-        continue;
+    DEBUG( assert( len <= DIRTY_MAP_OFFSET ) );
 
-      // ss != LIVE_IN
-
-      for(unsigned j=0; j<bytesPerWord; ++j)
+    // Only visit pages which this worker touched.
+    const uint64_t *dirty = dirty_map(SHADOW_ADDR);
+    uint64_t cursor = low, from, to;
+    while( dirty_next_range(dirty, &cursor, high, &from, &to) )
+    {
+#if SHADOW_MEM == VECTOR
+      if( __specpriv_shadow_kernels->worker_into_partial(src_p, src_s, dst_p, dst_s, from, to) )
+        // Misspeculate!
+        return 1;
+#endif
+#if SHADOW_MEM == NATIVE
+      for(unsigned i=from; i<to; i += bytesPerWord )
       {
-        const unsigned k = i+j;
-        const uint8_t ss = src_s[k], ds = dst_s[k];
+        uint64_t *many = (uint64_t*) &src_s[i];
+        if( V64(LIVE_IN) == *many )
+          continue;
 
-        if( ss == READ_LIVE_IN )
+        // ss != LIVE_IN
+
+        for(unsigned j=0; j<bytesPerWord; ++j)
         {
-          if( ds == LIVE_IN )
-          {
-            dst_s[k] = READ_LIVE_IN;
-            continue;
-          }
-          else if( ds == READ_LIVE_IN )
+          const unsigned k = i+j;
+          const uint8_t ss = src_s[k], ds = dst_s[k];
+
+          if( ss == READ_LIVE_IN )
           {
-            continue;
+            if( ds == LIVE_IN )
+            {
+              dst_s[k] = READ_LIVE_IN;
+              continue;
+            }
+            else if( ds == READ_LIVE_IN )
+            {
+              continue;
+            }
+            else
+            {
+              // Misspeculate!
+              return 1;
+            }
           }
-          else
+          else if( /* ss != LIVE_IN, READ_LIVE_IN and */ ds == READ_LIVE_IN )
           {
             // Misspeculate!
             return 1;
           }
-        }
-        else if( /* ss != LIVE_IN, READ_LIVE_IN and */ ds == READ_LIVE_IN )
-        {
-          // Misspeculate!
-          return 1;
-        }
 
-        // My copy is newer than the partial.
-        if( ss > ds )
-        {
-          dst_p[k] = src_p[k];
-          dst_s[k] = ss;
+          // My copy is newer than the partial.
+          if( ss > ds )
+          {
+            dst_p[k] = src_p[k];
+            dst_s[k] = ss;
+          }
         }
       }
+#endif
     }
   }
 
-  // Update [low,high) ranges.
+  // Update [low,high) ranges and dirty pages.
+  if( shadow_lowest_inclusive < shadow_highest_exclusive )
+  {
+    const uint64_t low  = shadow_lowest_inclusive - (uint8_t*)SHADOW_ADDR,
+                   high = shadow_highest_exclusive - (uint8_t*)SHADOW_ADDR;
+    dirty_merge( dirty_map( (uint64_t)partial_shadow->base ), dirty_map(SHADOW_ADDR), low, high );
+    dirty_clear( dirty_map(SHADOW_ADDR), low, high );
+  }
+
   if( shadow_lowest_inclusive < partial->shadow_lowest_inclusive )
     partial->shadow_lowest_inclusive = shadow_lowest_inclusive;
   if( partial->shadow_highest_exclusive < shadow_highest_exclusive )
@@ -1163,32 +1137,49 @@ Bool __specpriv_distill_committed_private_into_partial(
     const unsigned low  = commit->shadow_lowest_inclusive - (uint8_t*)SHADOW_ADDR,
                    high = commit->shadow_highest_exclusive - (uint8_t*)SHADOW_ADDR;
 
-    // TODO make this faster; vectorize?
-    for(unsigned i=low; i<high; ++i)
+    // Only visit pages which the committed checkpoint touched.
+    const uint64_t *dirty = dirty_map( (uint64_t)commit_shadow->base );
+    uint64_t cursor = low, from, to;
+    while( dirty_next_range(dirty, &cursor, high, &from, &to) )
     {
-      const uint8_t ds = dst_s[i];
-
-      if( ds == LIVE_IN )
+#if SHADOW_MEM == VECTOR
+      if( __specpriv_shadow_kernels->committed_into_partial(src_p, src_s, dst_p, dst_s, from, to) )
+        // Misspeculate!
+        return 1;
+#endif
+#if SHADOW_MEM == NATIVE
+      for(unsigned i=from; i<to; ++i)
       {
-        if( WAS_WRITTEN_EVER( src_s[i] ) )
+        const uint8_t ds = dst_s[i];
+
+        if( ds == LIVE_IN )
         {
-          dst_p[i] = src_p[i];
-          dst_s[i] = OLD_ITERATION;
+          if( WAS_WRITTEN_EVER( src_s[i] ) )
+          {
+            dst_p[i] = src_p[i];
+            dst_s[i] = OLD_ITERATION;
+          }
         }
-      }
 
-      else if( ds == READ_LIVE_IN )
-      {
-        if( WAS_WRITTEN_EVER( src_s[i] ) )
+        else if( ds == READ_LIVE_IN )
         {
-          // Misspeculate!
-          return 1;
+          if( WAS_WRITTEN_EVER( src_s[i] ) )
+          {
+            // Misspeculate!
+            return 1;
+          }
         }
       }
+#endif
     }
   }
 
-  // Update [low,high) ranges.
+  // Update [low,high) ranges and dirty pages.
+  if( commit->shadow_lowest_inclusive < commit->shadow_highest_exclusive )
+    dirty_merge( dirty_map( (uint64_t)partial_shadow->base ), dirty_map( (uint64_t)commit_shadow->base ),
+      commit->shadow_lowest_inclusive - (uint8_t*)SHADOW_ADDR,
+      commit->shadow_highest_exclusive - (uint8_t*)SHADOW_ADDR );
+
   if( commit->shadow_lowest_inclusive < partial->shadow_lowest_inclusive )
     partial->shadow_lowest_inclusive = commit->shadow_lowest_inclusive;
   if( partial->shadow_highest_exclusive < commit->shadow_highest_exclusive )
@@ -1287,10 +1278,19 @@ Bool __specpriv_distill_committed_private_into_main(Checkpoint *commit, MappedHe
     const unsigned low = commit->shadow_lowest_inclusive - (uint8_t*)SHADOW_ADDR,
                    high = commit->shadow_highest_exclusive - (uint8_t*)SHADOW_ADDR;
 
-    // TODO: vectorize this.
-    for(unsigned i=low; i<high; ++i)
-      if( WAS_WRITTEN_EVER( src_s[i] ) )
-        dst_p[i] = src_p[i];
+    const uint64_t *dirty = dirty_map( (uint64_t)commit_shadow->base );
+    uint64_t cursor = low, from, to;
+    while( dirty_next_range(dirty, &cursor, high, &from, &to) )
+    {
+#if SHADOW_MEM == VECTOR
+      __specpriv_shadow_kernels->committed_into_main(src_p, src_s, dst_p, from, to);
+#endif
+#if SHADOW_MEM == NATIVE
+      for(unsigned i=from; i<to; ++i)
+        if( WAS_WRITTEN_EVER( src_s[i] ) )
+          dst_p[i] = src_p[i];
+#endif
+    }
   }
 
   return 0;
@@ -7,6 +7,11 @@
 
 void __specpriv_init_private(void);
 
+// Set/get the number of iterations between checkpoints.
+// Set before __specpriv_set_first_iter().
+void __specpriv_set_checkpoint_granularity(Iteration);
+Iteration __specpriv_checkpoint_granularity(void);
+
 // Set first iteration number
 void __specpriv_set_first_iter(Iteration);
 
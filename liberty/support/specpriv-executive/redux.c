@@ -1,5 +1,5 @@
 #include <stdint.h>
-#include <xmmintrin.h>
+#include <immintrin.h>
 #include <assert.h>
 #include <string.h>
 #include <stdio.h>
@@ -584,6 +584,278 @@ static void __specpriv_reduce_f64_max(double *src_au, double *dst_au, uint32_t s
 #endif
 }
 
+// The remaining reduction types share one shape:
+// dst <- op(dst,src) element-wise, then src <- identity.
+// Each has a scalar loop and an AVX2 loop; the AVX2
+// loop is used if this CPU supports it.
+
+#define AVX2 __attribute__((target("avx2")))
+
+typedef void (*ReduxCombine)(void *src_au, void *dst_au, uint32_t size_bytes);
+typedef void (*ReduxIdentity)(void *au, uint32_t size_bytes);
+
+#define OP_ADD(d,s)   ((d) + (s))
+#define OP_MUL(d,s)   ((d) * (s))
+#define OP_MAX(d,s)   ((s) > (d) ? (s) : (d))
+#define OP_MIN(d,s)   ((s) < (d) ? (s) : (d))
+#define OP_AND(d,s)   ((d) & (s))
+#define OP_OR(d,s)    ((d) | (s))
+#define OP_XOR(d,s)   ((d) ^ (s))
+
+#define LOADI(p)      _mm256_loadu_si256( (const __m256i*) (p) )
+#define STOREI(p,v)   _mm256_storeu_si256( (__m256i*) (p), (v) )
+
+// AVX2 lacks these.
+static inline AVX2 __m256i mm256_mullo_epi8(__m256i a, __m256i b)
+{
+  const __m256i even = _mm256_mullo_epi16(a, b);
+  const __m256i odd = _mm256_mullo_epi16( _mm256_srli_epi16(a,8), _mm256_srli_epi16(b,8) );
+  return _mm256_or_si256( _mm256_slli_epi16(odd,8),
+    _mm256_and_si256(even, _mm256_set1_epi16(0xff)) );
+}
+
+static inline AVX2 __m256i mm256_mullo_epi64(__m256i a, __m256i b)
+{
+  const __m256i lo = _mm256_mul_epu32(a, b);
+  const __m256i cross = _mm256_add_epi64(
+    _mm256_mul_epu32( _mm256_srli_epi64(a,32), b ),
+    _mm256_mul_epu32( a, _mm256_srli_epi64(b,32) ) );
+  return _mm256_add_epi64(lo, _mm256_slli_epi64(cross,32));
+}
+
+static inline AVX2 __m256i mm256_max_epi64(__m256i a, __m256i b)
+{
+  return _mm256_blendv_epi8(b, a, _mm256_cmpgt_epi64(a,b));
+}
+
+static inline AVX2 __m256i mm256_min_epi64(__m256i a, __m256i b)
+{
+  return _mm256_blendv_epi8(a, b, _mm256_cmpgt_epi64(a,b));
+}
+
+static inline AVX2 __m256i mm256_min_epu64(__m256i a, __m256i b)
+{
+  const __m256i flip = _mm256_set1_epi64x(INT64_MIN);
+  const __m256i gt = _mm256_cmpgt_epi64( _mm256_xor_si256(a,flip), _mm256_xor_si256(b,flip) );
+  return _mm256_blendv_epi8(a, b, gt);
+}
+
+// Define __specpriv_reduce_<name> and __specpriv_identity_<name>
+// over elements of type T.  VT, VLOAD, VSTORE, VSET1 and VOP
+// are the AVX2 vector type, load, store, broadcast and op(d,s).
+#define REDUX_KERNEL(name, T, IDENT, OP, VT, VLOAD, VSTORE, VSET1, VOP)   \
+  static void __specpriv_reduce_##name##_scalar(T *src, T *dst,           \
+    uint32_t i, uint32_t n)                                               \
+  {                                                                       \
+    for(; i<n; ++i)                                                       \
+    {                                                                     \
+      const T s = src[i], d = dst[i];                                     \
+      dst[i] = OP(d,s);                                                   \
+      src[i] = (IDENT);                                                   \
+    }                                                                     \
+  }                                                                       \
+                                                                          \
+  static AVX2 void __specpriv_reduce_##name##_avx2(T *src, T *dst,        \
+    uint32_t n)                                                           \
+  {                                                                       \
+    const uint32_t perVec = sizeof(VT) / sizeof(T);                       \
+    const VT identity = VSET1(IDENT);                                     \
+    uint32_t i;                                                           \
+    for(i=0; i+perVec <= n; i += perVec)                                  \
+    {                                                                     \
+      const VT s = VLOAD( &src[i] );                                      \
+      const VT d = VLOAD( &dst[i] );                                      \
+      VSTORE( &dst[i], VOP(d,s) );                                        \
+      VSTORE( &src[i], identity );                                        \
+    }                                                                     \
+    __specpriv_reduce_##name##_scalar(src, dst, i, n);                    \
+  }                                                                       \
+                                                                          \
+  static void __specpriv_reduce_##name(void *src_au, void *dst_au,        \
+    uint32_t size_bytes)                                                  \
+  {                                                                       \
+    const uint32_t n = size_bytes / sizeof(T);                            \
+    if( REDUCTION == VECTOR && __builtin_cpu_supports("avx2") )           \
+      __specpriv_reduce_##name##_avx2( (T*)src_au, (T*)dst_au, n);        \
+    else                                                                  \
+      __specpriv_reduce_##name##_scalar( (T*)src_au, (T*)dst_au, 0, n);   \
+  }                                                                       \
+                                                                          \
+  static void __specpriv_identity_##name(void *au, uint32_t size_bytes)   \
+  {                                                                       \
+    T *elts = (T*) au;                                                    \
+    const uint32_t n = size_bytes / sizeof(T);                            \
+    for(uint32_t i=0; i<n; ++i)                                           \
+      elts[i] = (IDENT);                                                  \
+  }
+
+#define REDUX_INT(name, T, IDENT, OP, SET1, VOP) \
+  REDUX_KERNEL(name, T, IDENT, OP, __m256i, LOADI, STOREI, SET1, VOP)
+
+#define SET1_8(x)     _mm256_set1_epi8( (char) (x) )
+#define SET1_16(x)    _mm256_set1_epi16( (short) (x) )
+#define SET1_32(x)    _mm256_set1_epi32( (int) (x) )
+#define SET1_64(x)    _mm256_set1_epi64x( (long long) (x) )
+
+#define ADD8(d,s)     _mm256_add_epi8(d,s)
+#define ADD16(d,s)    _mm256_add_epi16(d,s)
+#define ADD64(d,s)    _mm256_add_epi64(d,s)
+#define MUL8(d,s)     mm256_mullo_epi8(d,s)
+#define MUL16(d,s)    _mm256_mullo_epi16(d,s)
+#define MUL32(d,s)    _mm256_mullo_epi32(d,s)
+#define MUL64(d,s)    mm256_mullo_epi64(d,s)
+#define AND(d,s)      _mm256_and_si256(d,s)
+#define OR(d,s)       _mm256_or_si256(d,s)
+#define XOR(d,s)      _mm256_xor_si256(d,s)
+
+// Integer sum (Add_i32 is above)
+REDUX_INT(add_i8,   uint8_t,  0, OP_ADD, SET1_8,  ADD8)
+REDUX_INT(add_i16,  uint16_t, 0, OP_ADD, SET1_16, ADD16)
+REDUX_INT(add_i64,  uint64_t, 0, OP_ADD, SET1_64, ADD64)
+
+// Integer product
+REDUX_INT(mul_i8,   uint8_t,  1, OP_MUL, SET1_8,  MUL8)
+REDUX_INT(mul_i16,  uint16_t, 1, OP_MUL, SET1_16, MUL16)
+REDUX_INT(mul_i32,  uint32_t, 1, OP_MUL, SET1_32, MUL32)
+REDUX_INT(mul_i64,  uint64_t, 1, OP_MUL, SET1_64, MUL64)
+
+// Signed integer max, min
+#define MAXI8(d,s)    _mm256_max_epi8(d,s)
+#define MAXI16(d,s)   _mm256_max_epi16(d,s)
+#define MAXI32(d,s)   _mm256_max_epi32(d,s)
+#define MAXI64(d,s)   mm256_max_epi64(d,s)
+#define MINI8(d,s)    _mm256_min_epi8(d,s)
+#define MINI16(d,s)   _mm256_min_epi16(d,s)
+#define MINI32(d,s)   _mm256_min_epi32(d,s)
+#define MINI64(d,s)   mm256_min_epi64(d,s)
+REDUX_INT(max_i8,   int8_t,   INT8_MIN,  OP_MAX, SET1_8,  MAXI8)
+REDUX_INT(max_i16,  int16_t,  INT16_MIN, OP_MAX, SET1_16, MAXI16)
+REDUX_INT(max_i32,  int32_t,  INT32_MIN, OP_MAX, SET1_32, MAXI32)
+REDUX_INT(max_i64,  int64_t,  INT64_MIN, OP_MAX, SET1_64, MAXI64)
+REDUX_INT(min_i8,   int8_t,   INT8_MAX,  OP_MIN, SET1_8,  MINI8)
+REDUX_INT(min_i16,  int16_t,  INT16_MAX, OP_MIN, SET1_16, MINI16)
+REDUX_INT(min_i32,  int32_t,  INT32_MAX, OP_MIN, SET1_32, MINI32)
+REDUX_INT(min_i64,  int64_t,  INT64_MAX, OP_MIN, SET1_64, MINI64)
+
+// Unsigned integer max (Max_u64 is above), min
+#define MAXU8(d,s)    _mm256_max_epu8(d,s)
+#define MAXU16(d,s)   _mm256_max_epu16(d,s)
+#define MAXU32(d,s)   _mm256_max_epu32(d,s)
+#define MINU8(d,s)    _mm256_min_epu8(d,s)
+#define MINU16(d,s)   _mm256_min_epu16(d,s)
+#define MINU32(d,s)   _mm256_min_epu32(d,s)
+#define MINU64(d,s)   mm256_min_epu64(d,s)
+REDUX_INT(max_u8,   uint8_t,  0,          OP_MAX, SET1_8,  MAXU8)
+REDUX_INT(max_u16,  uint16_t, 0,          OP_MAX, SET1_16, MAXU16)
+REDUX_INT(max_u32,  uint32_t, 0,          OP_MAX, SET1_32, MAXU32)
+REDUX_INT(min_u8,   uint8_t,  UINT8_MAX,  OP_MIN, SET1_8,  MINU8)
+REDUX_INT(min_u16,  uint16_t, UINT16_MAX, OP_MIN, SET1_16, MINU16)
+REDUX_INT(min_u32,  uint32_t, UINT32_MAX, OP_MIN, SET1_32, MINU32)
+REDUX_INT(min_u64,  uint64_t, UINT64_MAX, OP_MIN, SET1_64, MINU64)
+
+// Bitwise; the same for every width.
+REDUX_INT(and,      uint8_t,  UINT8_MAX,  OP_AND, SET1_8,  AND)
+REDUX_INT(or,       uint8_t,  0,          OP_OR,  SET1_8,  OR)
+REDUX_INT(xor,      uint8_t,  0,          OP_XOR, SET1_8,  XOR)
+
+// Floating point min, product.  Like Max_f32, the
+// identity of min is the largest finite value.
+// _mm256_min_ps(s,d) is (s < d ? s : d), as OP_MIN.
+#define MINPS(d,s)    _mm256_min_ps(s,d)
+#define MINPD(d,s)    _mm256_min_pd(s,d)
+#define MULPS(d,s)    _mm256_mul_ps(d,s)
+#define MULPD(d,s)    _mm256_mul_pd(d,s)
+REDUX_KERNEL(min_f32, float,  FLT_MAX, OP_MIN, __m256,  _mm256_loadu_ps, _mm256_storeu_ps, _mm256_set1_ps, MINPS)
+REDUX_KERNEL(min_f64, double, DBL_MAX, OP_MIN, __m256d, _mm256_loadu_pd, _mm256_storeu_pd, _mm256_set1_pd, MINPD)
+REDUX_KERNEL(mul_f32, float,  1.0f,    OP_MUL, __m256,  _mm256_loadu_ps, _mm256_storeu_ps, _mm256_set1_ps, MULPS)
+REDUX_KERNEL(mul_f64, double, 1.0,     OP_MUL, __m256d, _mm256_loadu_pd, _mm256_storeu_pd, _mm256_set1_pd, MULPD)
+
+typedef struct s_redux_kernel ReduxKernel;
+struct s_redux_kernel
+{
+  ReduxCombine  combine;
+  ReduxIdentity identity;
+
+  // Is it a min/max?  Then a reduction of one element
+  // also tracks the iteration of the last update.
+  Bool          minmax;
+};
+
+#define KERNEL(name, minmax) { __specpriv_reduce_##name, __specpriv_identity_##name, minmax }
+
+static const ReduxKernel redux_kernels[ NUM_REDUCTION_TYPES ] =
+{
+  [Add_i8]  = KERNEL(add_i8, 0),  [Add_i16] = KERNEL(add_i16, 0), [Add_i64] = KERNEL(add_i64, 0),
+
+  [Max_i8]  = KERNEL(max_i8, 1),  [Max_i16] = KERNEL(max_i16, 1),
+  [Max_i32] = KERNEL(max_i32, 1), [Max_i64] = KERNEL(max_i64, 1),
+  [Max_u8]  = KERNEL(max_u8, 1),  [Max_u16] = KERNEL(max_u16, 1), [Max_u32] = KERNEL(max_u32, 1),
+
+  [Min_i8]  = KERNEL(min_i8, 1),  [Min_i16] = KERNEL(min_i16, 1),
+  [Min_i32] = KERNEL(min_i32, 1), [Min_i64] = KERNEL(min_i64, 1),
+  [Min_u8]  = KERNEL(min_u8, 1),  [Min_u16] = KERNEL(min_u16, 1),
+  [Min_u32] = KERNEL(min_u32, 1), [Min_u64] = KERNEL(min_u64, 1),
+  [Min_f32] = KERNEL(min_f32, 1), [Min_f64] = KERNEL(min_f64, 1),
+
+  [Mul_i8]  = KERNEL(mul_i8, 0),  [Mul_i16] = KERNEL(mul_i16, 0),
+  [Mul_i32] = KERNEL(mul_i32, 0), [Mul_i64] = KERNEL(mul_i64, 0),
+  [Mul_f32] = KERNEL(mul_f32, 0), [Mul_f64] = KERNEL(mul_f64, 0),
+
+  [And_i8]  = KERNEL(and, 0), [And_i16] = KERNEL(and, 0), [And_i32] = KERNEL(and, 0), [And_i64] = KERNEL(and, 0),
+  [Or_i8]   = KERNEL(or, 0),  [Or_i16]  = KERNEL(or, 0),  [Or_i32]  = KERNEL(or, 0),  [Or_i64]  = KERNEL(or, 0),
+  [Xor_i8]  = KERNEL(xor, 0), [Xor_i16] = KERNEL(xor, 0), [Xor_i32] = KERNEL(xor, 0), [Xor_i64] = KERNEL(xor, 0),
+};
+
+static const ReduxKernel *__specpriv_redux_kernel(ReductionType type)
+{
+  if( type >= NUM_REDUCTION_TYPES || !redux_kernels[type].combine )
+    return 0;
+  return &redux_kernels[type];
+}
+
+// The width of the elements of a min/max reduction.
+static unsigned __specpriv_redux_elt_size(ReductionType type)
+{
+  switch(type)
+  {
+    case Max_i8:  case Max_u8:  case Min_i8:  case Min_u8:
+      return 1;
+    case Max_i16: case Max_u16: case Min_i16: case Min_u16:
+      return 2;
+    case Max_i32: case Max_u32: case Min_i32: case Min_u32: case Min_f32:
+      return 4;
+    default:
+      return 8;
+  }
+}
+
+// A min/max reduction of a single element, which, like
+// __specpriv_reduce_f32_max, reports whether the source
+// was the newer extremum, for dependent reductions.
+static void __specpriv_reduce_generic(const ReduxKernel *k, void *src_au,
+                                      void *dst_au, uint32_t size_bytes,
+                                      ReductionType type,
+                                      Iteration srcLastUpIter,
+                                      Iteration *dstLastUpIter) {
+  const unsigned elt = __specpriv_redux_elt_size(type);
+  if( !k->minmax || size_bytes != elt )
+  {
+    k->combine(src_au, dst_au, size_bytes);
+    return;
+  }
+
+  uint64_t before = 0, after = 0, source = 0;
+  memcpy(&before, dst_au, elt);
+  memcpy(&source, src_au, elt);
+  k->combine(src_au, dst_au, size_bytes);
+  memcpy(&after, dst_au, elt);
+
+  if( after != before )
+    *dstLastUpIter = srcLastUpIter;
+  else if( source == before && srcLastUpIter < *dstLastUpIter )
+    *dstLastUpIter = srcLastUpIter;
+}
+
 static void __specpriv_initialize_set_zero(void *au, uint32_t size_bytes) {
   memset(au, 0, size_bytes);
 }
@@ -677,29 +949,15 @@ static void __specpriv_initialize_f64_max(double *au, uint32_t size_bytes) {
 void __specpriv_initialize_reductions(void *au, ReductionInfo *info) {
   switch(info->type)
   {
-    // Signed/unsigned integer sum, Floating point sum and nsigned integer max
+    // Signed/unsigned integer sum, Floating point sum and unsigned integer max
     // do not need special initialization (zeroing out is fine)
-    case Add_i8:
-    case Add_i16:
-    case Add_i64:
     case Add_i32:
     case Add_f32:
     case Add_f64:
-    case Max_u8:
-    case Max_u16:
-    case Max_u32:
     case Max_u64:
       __specpriv_initialize_set_zero(au, info->size);
       break;
 
-// Signed integer max
-    case Max_i8:
-    case Max_i16:
-    case Max_i32:
-    case Max_i64:
-      assert(0 && "Not yet implemented");
-      break;
-
 // Floating point max
     case Max_f32:
       __specpriv_initialize_f32_max((float *)au, info->size);
@@ -709,30 +967,14 @@ void __specpriv_initialize_reductions(void *au, ReductionInfo *info) {
       __specpriv_initialize_f64_max((double *)au, info->size);
       break;
 
-// Signed integer min
-    case Min_i8:
-    case Min_i16:
-    case Min_i32:
-    case Min_i64:
-      assert(0 && "Not yet implemented");
-      break;
-
-// Unsigned integer min
-    case Min_u8:
-    case Min_u16:
-    case Min_u32:
-    case Min_u64:
-      assert(0 && "Not yet implemented");
-      break;
-
-// Floating point min
-    case Min_f32:
-    case Min_f64:
-      assert(0 && "Not yet implemented");
-      break;
-
+// Everything else: see redux_kernels.
     default:
+    {
+      const ReduxKernel *k = __specpriv_redux_kernel(info->type);
+      if( k )
+        k->identity(au, info->size);
       break;
+    }
   }
 }
 
@@ -745,12 +987,6 @@ static void __specpriv_do_reduction_pp(void *src_au, void *dst_au,
   {
 
 // Signed/unsigned integer sum
-    case Add_i8:
-    case Add_i16:
-    case Add_i64:
-      assert(0 && "Not yet implemented");
-      break;
-
     case Add_i32:
       __specpriv_reduce_i32_add( (int32_t*)src_au, (int32_t*)dst_au, info->size);
       break;
@@ -766,20 +1002,7 @@ static void __specpriv_do_reduction_pp(void *src_au, void *dst_au,
       __specpriv_reduce_f64_add( (double*)src_au, (double*)dst_au, info->size);
       break;
 
-// Signed integer max
-    case Max_i8:
-    case Max_i16:
-    case Max_i32:
-    case Max_i64:
-      assert(0 && "Not yet implemented");
-      break;
-
 // Unsigned integer max
-    case Max_u8:
-    case Max_u16:
-    case Max_u32:
-      assert(0 && "Not yet implemented");
-      break;
     case Max_u64:
       DEBUG(printf("Performing a u64-max reduction on address 0x%lx\n",
                    (uint64_t)src_au));
@@ -803,30 +1026,18 @@ static void __specpriv_do_reduction_pp(void *src_au, void *dst_au,
       __specpriv_reduce_f64_max((double*)src_au, (double*)dst_au, info->size);
       break;
 
-// Signed integer min
-    case Min_i8:
-    case Min_i16:
-    case Min_i32:
-    case Min_i64:
-      assert(0 && "Not yet implemented");
-      break;
-
-// Unsigned integer min
-    case Min_u8:
-    case Min_u16:
-    case Min_u32:
-    case Min_u64:
-      assert(0 && "Not yet implemented");
-      break;
-
-// Floating point min
-    case Min_f32:
-    case Min_f64:
-      assert(0 && "Not yet implemented");
-      break;
-
+// Everything else: see redux_kernels.
     default:
+    {
+      const ReduxKernel *k = __specpriv_redux_kernel(info->type);
+      if( !k )
+        break;
+      assert(info->depSize == 0 && "Not yet implemented");
+      DEBUG(printf("Performing a type-%u reduction on address 0x%lx\n", info->type, (uint64_t)src_au));
+      __specpriv_reduce_generic(k, src_au, dst_au, info->size, info->type,
+                                srcLastUpIter, dstLastUpIter);
       break;
+    }
   }
 }
 
@@ -7,6 +7,8 @@
 // This must perfectly match the
 // reduction types listed in
 // include/liberty/SpecPriv/Reduction.h
+// Types from Mul_i8 on extend that list, and are
+// only emitted once Reduction::Type names them.
 #define NotReduction  (0)
 
 // Signed/unsigned integer sum
@@ -51,6 +53,32 @@
 #define Min_f32       (25)
 #define Min_f64       (26)
 
+// Signed/unsigned integer product
+#define Mul_i8        (27)
+#define Mul_i16       (28)
+#define Mul_i32       (29)
+#define Mul_i64       (30)
+
+// Floating point product
+#define Mul_f32       (31)
+#define Mul_f64       (32)
+
+// Bitwise and, or, xor
+#define And_i8        (33)
+#define And_i16       (34)
+#define And_i32       (35)
+#define And_i64       (36)
+#define Or_i8         (37)
+#define Or_i16        (38)
+#define Or_i32        (39)
+#define Or_i64        (40)
+#define Xor_i8        (41)
+#define Xor_i16       (42)
+#define Xor_i32       (43)
+#define Xor_i64       (44)
+
+#define NUM_REDUCTION_TYPES (45)
+
 typedef struct s_reduction_info ReductionInfo;
 struct s_reduction_info
 {
@@ -0,0 +1,653 @@
+#include <stdio.h>
+#include <string.h>
+#include <immintrin.h>
+
+#include "shadow.h"
+#include "config.h"
+
+//------------------------------------------------------------------
+// Scalar: one byte at a time.  These define the
+// semantics; the vector kernels use them for the
+// bytes which do not fill a whole vector.
+
+static inline Bool read_byte(uint8_t *p, uint8_t code)
+{
+  const uint8_t meta = *p;
+  if( meta == LIVE_IN )
+    *p = READ_LIVE_IN;
+  else if( meta != code && meta != READ_LIVE_IN )
+    return 1;
+  return 0;
+}
+
+static inline Bool write_byte(uint8_t *p, uint8_t code)
+{
+  if( *p == READ_LIVE_IN )
+    return 1;
+  *p = code;
+  return 0;
+}
+
+static inline Bool worker_byte(const uint8_t *src_p, const uint8_t *src_s,
+  uint8_t *dst_p, uint8_t *dst_s, uint64_t k)
+{
+  const uint8_t ss = src_s[k], ds = dst_s[k];
+
+  if( ss == LIVE_IN )
+    return 0;
+
+  if( ss == READ_LIVE_IN )
+  {
+    if( ds == LIVE_IN )
+      dst_s[k] = READ_LIVE_IN;
+    else if( ds != READ_LIVE_IN )
+      return 1;
+    return 0;
+  }
+
+  if( ds == READ_LIVE_IN )
+    return 1;
+
+  // My copy is newer than the partial.
+  if( ss > ds )
+  {
+    dst_p[k] = src_p[k];
+    dst_s[k] = ss;
+  }
+  return 0;
+}
+
+static inline Bool committed_byte(const uint8_t *src_p, const uint8_t *src_s,
+  uint8_t *dst_p, uint8_t *dst_s, uint64_t k)
+{
+  const uint8_t ds = dst_s[k];
+
+  if( ds == LIVE_IN )
+  {
+    if( WAS_WRITTEN_EVER( src_s[k] ) )
+    {
+      dst_p[k] = src_p[k];
+      dst_s[k] = OLD_ITERATION;
+    }
+  }
+  else if( ds == READ_LIVE_IN )
+  {
+    if( WAS_WRITTEN_EVER( src_s[k] ) )
+      return 1;
+  }
+  return 0;
+}
+
+static Bool scalar_read_range(uint8_t *start, uint8_t *stop, uint8_t code)
+{
+  for(uint8_t *i=start; i<stop; ++i)
+    if( read_byte(i, code) )
+      return 1;
+  return 0;
+}
+
+static Bool scalar_write_range(uint8_t *start, uint8_t *stop, uint8_t code)
+{
+  for(uint8_t *i=start; i<stop; ++i)
+    if( write_byte(i, code) )
+      return 1;
+  return 0;
+}
+
+static Bool scalar_worker_into_partial(const uint8_t *src_p, const uint8_t *src_s,
+  uint8_t *dst_p, uint8_t *dst_s, uint64_t from, uint64_t to)
+{
+  for(uint64_t k=from; k<to; ++k)
+    if( worker_byte(src_p, src_s, dst_p, dst_s, k) )
+      return 1;
+  return 0;
+}
+
+static Bool scalar_committed_into_partial(const uint8_t *src_p, const uint8_t *src_s,
+  uint8_t *dst_p, uint8_t *dst_s, uint64_t from, uint64_t to)
+{
+  for(uint64_t k=from; k<to; ++k)
+    if( committed_byte(src_p, src_s, dst_p, dst_s, k) )
+      return 1;
+  return 0;
+}
+
+static void scalar_committed_into_main(const uint8_t *src_p, const uint8_t *src_s,
+  uint8_t *dst_p, uint64_t from, uint64_t to)
+{
+  for(uint64_t k=from; k<to; ++k)
+    if( WAS_WRITTEN_EVER( src_s[k] ) )
+      dst_p[k] = src_p[k];
+}
+
+static const ShadowKernels scalar_kernels =
+{
+  "scalar",
+  scalar_read_range,
+  scalar_write_range,
+  scalar_worker_into_partial,
+  scalar_committed_into_partial,
+  scalar_committed_into_main
+};
+
+//------------------------------------------------------------------
+// SSE2: 16 bytes at a time.  Part of x86-64,
+// so always available.
+
+static Bool sse2_read_range(uint8_t *start, uint8_t *stop, uint8_t code)
+{
+  const __m128i vcode = _mm_set1_epi8( (char) code );
+  const __m128i vlive = _mm_set1_epi8( LIVE_IN );
+  const __m128i vread = _mm_set1_epi8( READ_LIVE_IN );
+
+  uint8_t *i = start;
+  for(; i + 16 <= stop; i += 16)
+  {
+    const __m128i meta = _mm_loadu_si128( (__m128i*) i );
+    const __m128i c = _mm_cmpeq_epi8(meta, vcode);
+    if( _mm_movemask_epi8(c) == 0xffff )
+      continue;
+
+    const __m128i z = _mm_cmpeq_epi8(meta, vlive);
+    const __m128i r = _mm_cmpeq_epi8(meta, vread);
+    if( _mm_movemask_epi8( _mm_or_si128(_mm_or_si128(c, z), r) ) != 0xffff )
+      return 1;
+
+    // LIVE_IN is zero: OR in READ_LIVE_IN where it was.
+    if( _mm_movemask_epi8(z) )
+      _mm_storeu_si128( (__m128i*) i, _mm_or_si128(meta, _mm_and_si128(z, vread)) );
+  }
+
+  return scalar_read_range(i, stop, code);
+}
+
+static Bool sse2_write_range(uint8_t *start, uint8_t *stop, uint8_t code)
+{
+  const __m128i vcode = _mm_set1_epi8( (char) code );
+  const __m128i vread = _mm_set1_epi8( READ_LIVE_IN );
+
+  uint8_t *i = start;
+  for(; i + 16 <= stop; i += 16)
+  {
+    const __m128i meta = _mm_loadu_si128( (__m128i*) i );
+    if( _mm_movemask_epi8( _mm_cmpeq_epi8(meta, vread) ) )
+      return 1;
+    _mm_storeu_si128( (__m128i*) i, vcode );
+  }
+
+  return scalar_write_range(i, stop, code);
+}
+
+static inline __m128i sse2_select(__m128i mask, __m128i a, __m128i b)
+{
+  return _mm_or_si128( _mm_and_si128(mask, a), _mm_andnot_si128(mask, b) );
+}
+
+static Bool sse2_worker_into_partial(const uint8_t *src_p, const uint8_t *src_s,
+  uint8_t *dst_p, uint8_t *dst_s, uint64_t from, uint64_t to)
+{
+  const __m128i vlive = _mm_set1_epi8( LIVE_IN );
+  const __m128i vread = _mm_set1_epi8( READ_LIVE_IN );
+
+  uint64_t k = from;
+  for(; k + 16 <= to; k += 16)
+  {
+    const __m128i ss = _mm_loadu_si128( (const __m128i*) &src_s[k] );
+    const __m128i s0 = _mm_cmpeq_epi8(ss, vlive);
+    if( _mm_movemask_epi8(s0) == 0xffff )
+      continue;
+
+    const __m128i ds = _mm_loadu_si128( (const __m128i*) &dst_s[k] );
+    const __m128i s1 = _mm_cmpeq_epi8(ss, vread);
+    const __m128i d0 = _mm_cmpeq_epi8(ds, vlive);
+    const __m128i d1 = _mm_cmpeq_epi8(ds, vread);
+
+    // I read a live-in which someone else wrote, or
+    // I wrote a value which someone else read as live-in.
+    const __m128i written = _mm_andnot_si128( _mm_or_si128(s0, s1), _mm_set1_epi8(-1) );
+    const __m128i bad = _mm_or_si128(
+      _mm_andnot_si128( _mm_or_si128(d0, d1), s1 ),
+      _mm_and_si128(written, d1) );
+    if( _mm_movemask_epi8(bad) )
+      return 1;
+
+    // ss > ds (unsigned): either my write is newer, or
+    // I read a live-in which the partial has not seen.
+    const __m128i newer = _mm_andnot_si128( _mm_cmpeq_epi8( _mm_max_epu8(ds, ss), ds ), _mm_set1_epi8(-1) );
+    if( !_mm_movemask_epi8(newer) )
+      continue;
+
+    _mm_storeu_si128( (__m128i*) &dst_s[k], sse2_select(newer, ss, ds) );
+
+    const __m128i copy = _mm_andnot_si128(s1, newer);
+    if( _mm_movemask_epi8(copy) )
+    {
+      const __m128i sp = _mm_loadu_si128( (const __m128i*) &src_p[k] );
+      const __m128i dp = _mm_loadu_si128( (const __m128i*) &dst_p[k] );
+      _mm_storeu_si128( (__m128i*) &dst_p[k], sse2_select(copy, sp, dp) );
+    }
+  }
+
+  return scalar_worker_into_partial(src_p, src_s, dst_p, dst_s, k, to);
+}
+
+static Bool sse2_committed_into_partial(const uint8_t *src_p, const uint8_t *src_s,
+  uint8_t *dst_p, uint8_t *dst_s, uint64_t from, uint64_t to)
+{
+  const __m128i vlive = _mm_set1_epi8( LIVE_IN );
+  const __m128i vread = _mm_set1_epi8( READ_LIVE_IN );
+  const __m128i vold  = _mm_set1_epi8( OLD_ITERATION );
+
+  uint64_t k = from;
+  for(; k + 16 <= to; k += 16)
+  {
+    const __m128i ss = _mm_loadu_si128( (const __m128i*) &src_s[k] );
+    const __m128i written = _mm_cmpeq_epi8( _mm_max_epu8(ss, vold), ss );
+    if( !_mm_movemask_epi8(written) )
+      continue;
+
+    const __m128i ds = _mm_loadu_si128( (const __m128i*) &dst_s[k] );
+    if( _mm_movemask_epi8( _mm_and_si128(written, _mm_cmpeq_epi8(ds, vread)) ) )
+      return 1;
+
+    const __m128i copy = _mm_and_si128(written, _mm_cmpeq_epi8(ds, vlive));
+    if( !_mm_movemask_epi8(copy) )
+      continue;
+
+    const __m128i sp = _mm_loadu_si128( (const __m128i*) &src_p[k] );
+    const __m128i dp = _mm_loadu_si128( (const __m128i*) &dst_p[k] );
+    _mm_storeu_si128( (__m128i*) &dst_p[k], sse2_select(copy, sp, dp) );
+    _mm_storeu_si128( (__m128i*) &dst_s[k], sse2_select(copy, vold, ds) );
+  }
+
+  return scalar_committed_into_partial(src_p, src_s, dst_p, dst_s, k, to);
+}
+
+static void sse2_committed_into_main(const uint8_t *src_p, const uint8_t *src_s,
+  uint8_t *dst_p, uint64_t from, uint64_t to)
+{
+  const __m128i vold = _mm_set1_epi8( OLD_ITERATION );
+
+  uint64_t k = from;
+  for(; k + 16 <= to; k += 16)
+  {
+    const __m128i ss = _mm_loadu_si128( (const __m128i*) &src_s[k] );
+    const __m128i written = _mm_cmpeq_epi8( _mm_max_epu8(ss, vold), ss );
+    const int mask = _mm_movemask_epi8(written);
+    if( !mask )
+      continue;
+
+    const __m128i sp = _mm_loadu_si128( (const __m128i*) &src_p[k] );
+    if( mask == 0xffff )
+      _mm_storeu_si128( (__m128i*) &dst_p[k], sp );
+    else
+    {
+      const __m128i dp = _mm_loadu_si128( (const __m128i*) &dst_p[k] );
+      _mm_storeu_si128( (__m128i*) &dst_p[k], sse2_select(written, sp, dp) );
+    }
+  }
+
+  scalar_committed_into_main(src_p, src_s, dst_p, k, to);
+}
+
+static const ShadowKernels sse2_kernels =
+{
+  "sse2",
+  sse2_read_range,
+  sse2_write_range,
+  sse2_worker_into_partial,
+  sse2_committed_into_partial,
+  sse2_committed_into_main
+};
+
+//------------------------------------------------------------------
+// AVX2: 32 bytes at a time.
+
+#define AVX2 __attribute__((target("avx2")))
+
+static AVX2 Bool avx2_read_range(uint8_t *start, uint8_t *stop, uint8_t code)
+{
+  const __m256i vcode = _mm256_set1_epi8( (char) code );
+  const __m256i vlive = _mm256_set1_epi8( LIVE_IN );
+  const __m256i vread = _mm256_set1_epi8( READ_LIVE_IN );
+
+  uint8_t *i = start;
+  for(; i + 32 <= stop; i += 32)
+  {
+    const __m256i meta = _mm256_loadu_si256( (__m256i*) i );
+    const __m256i c = _mm256_cmpeq_epi8(meta, vcode);
+    if( _mm256_movemask_epi8(c) == -1 )
+      continue;
+
+    const __m256i z = _mm256_cmpeq_epi8(meta, vlive);
+    const __m256i r = _mm256_cmpeq_epi8(meta, vread);
+    if( _mm256_movemask_epi8( _mm256_or_si256(_mm256_or_si256(c, z), r) ) != -1 )
+      return 1;
+
+    if( _mm256_movemask_epi8(z) )
+      _mm256_storeu_si256( (__m256i*) i, _mm256_or_si256(meta, _mm256_and_si256(z, vread)) );
+  }
+
+  return sse2_read_range(i, stop, code);
+}
+
+static AVX2 Bool avx2_write_range(uint8_t *start, uint8_t *stop, uint8_t code)
+{
+  const __m256i vcode = _mm256_set1_epi8( (char) code );
+  const __m256i vread = _mm256_set1_epi8( READ_LIVE_IN );
+
+  uint8_t *i = start;
+  for(; i + 32 <= stop; i += 32)
+  {
+    const __m256i meta = _mm256_loadu_si256( (__m256i*) i );
+    if( _mm256_movemask_epi8( _mm256_cmpeq_epi8(meta, vread) ) )
+      return 1;
+    _mm256_storeu_si256( (__m256i*) i, vcode );
+  }
+
+  return sse2_write_range(i, stop, code);
+}
+
+static AVX2 Bool avx2_worker_into_partial(const uint8_t *src_p, const uint8_t *src_s,
+  uint8_t *dst_p, uint8_t *dst_s, uint64_t from, uint64_t to)
+{
+  const __m256i vlive = _mm256_set1_epi8( LIVE_IN );
+  const __m256i vread = _mm256_set1_epi8( READ_LIVE_IN );
+  const __m256i ones  = _mm256_set1_epi8( -1 );
+
+  uint64_t k = from;
+  for(; k + 32 <= to; k += 32)
+  {
+    const __m256i ss = _mm256_loadu_si256( (const __m256i*) &src_s[k] );
+    const __m256i s0 = _mm256_cmpeq_epi8(ss, vlive);
+    if( _mm256_movemask_epi8(s0) == -1 )
+      continue;
+
+    const __m256i ds = _mm256_loadu_si256( (const __m256i*) &dst_s[k] );
+    const __m256i s1 = _mm256_cmpeq_epi8(ss, vread);
+    const __m256i d0 = _mm256_cmpeq_epi8(ds, vlive);
+    const __m256i d1 = _mm256_cmpeq_epi8(ds, vread);
+
+    const __m256i written = _mm256_andnot_si256( _mm256_or_si256(s0, s1), ones );
+    const __m256i bad = _mm256_or_si256(
+      _mm256_andnot_si256( _mm256_or_si256(d0, d1), s1 ),
+      _mm256_and_si256(written, d1) );
+    if( _mm256_movemask_epi8(bad) )
+      return 1;
+
+    const __m256i newer = _mm256_andnot_si256( _mm256_cmpeq_epi8( _mm256_max_epu8(ds, ss), ds ), ones );
+    if( !_mm256_movemask_epi8(newer) )
+      continue;
+
+    _mm256_storeu_si256( (__m256i*) &dst_s[k], _mm256_blendv_epi8(ds, ss, newer) );
+
+    const __m256i copy = _mm256_andnot_si256(s1, newer);
+    if( _mm256_movemask_epi8(copy) )
+    {
+      const __m256i sp = _mm256_loadu_si256( (const __m256i*) &src_p[k] );
+      const __m256i dp = _mm256_loadu_si256( (const __m256i*) &dst_p[k] );
+      _mm256_storeu_si256( (__m256i*) &dst_p[k], _mm256_blendv_epi8(dp, sp, copy) );
+    }
+  }
+
+  return sse2_worker_into_partial(src_p, src_s, dst_p, dst_s, k, to);
+}
+
+static AVX2 Bool avx2_committed_into_partial(const uint8_t *src_p, const uint8_t *src_s,
+  uint8_t *dst_p, uint8_t *dst_s, uint64_t from, uint64_t to)
+{
+  const __m256i vlive = _mm256_set1_epi8( LIVE_IN );
+  const __m256i vread = _mm256_set1_epi8( READ_LIVE_IN );
+  const __m256i vold  = _mm256_set1_epi8( OLD_ITERATION );
+
+  uint64_t k = from;
+  for(; k + 32 <= to; k += 32)
+  {
+    const __m256i ss = _mm256_loadu_si256( (const __m256i*) &src_s[k] );
+    const __m256i written = _mm256_cmpeq_epi8( _mm256_max_epu8(ss, vold), ss );
+    if( !_mm256_movemask_epi8(written) )
+      continue;
+
+    const __m256i ds = _mm256_loadu_si256( (const __m256i*) &dst_s[k] );
+    if( _mm256_movemask_epi8( _mm256_and_si256(written, _mm256_cmpeq_epi8(ds, vread)) ) )
+      return 1;
+
+    const __m256i copy = _mm256_and_si256(written, _mm256_cmpeq_epi8(ds, vlive));
+    if( !_mm256_movemask_epi8(copy) )
+      continue;
+
+    const __m256i sp = _mm256_loadu_si256( (const __m256i*) &src_p[k] );
+    const __m256i dp = _mm256_loadu_si256( (const __m256i*) &dst_p[k] );
+    _mm256_storeu_si256( (__m256i*) &dst_p[k], _mm256_blendv_epi8(dp, sp, copy) );
+    _mm256_storeu_si256( (__m256i*) &dst_s[k], _mm256_blendv_epi8(ds, vold, copy) );
+  }
+
+  return sse2_committed_into_partial(src_p, src_s, dst_p, dst_s, k, to);
+}
+
+static AVX2 void avx2_committed_into_main(const uint8_t *src_p, const uint8_t *src_s,
+  uint8_t *dst_p, uint64_t from, uint64_t to)
+{
+  const __m256i vold = _mm256_set1_epi8( OLD_ITERATION );
+
+  uint64_t k = from;
+  for(; k + 32 <= to; k += 32)
+  {
+    const __m256i ss = _mm256_loadu_si256( (const __m256i*) &src_s[k] );
+    const __m256i written = _mm256_cmpeq_epi8( _mm256_max_epu8(ss, vold), ss );
+    const int mask = _mm256_movemask_epi8(written);
+    if( !mask )
+      continue;
+
+    const __m256i sp = _mm256_loadu_si256( (const __m256i*) &src_p[k] );
+    if( mask == -1 )
+      _mm256_storeu_si256( (__m256i*) &dst_p[k], sp );
+    else
+    {
+      const __m256i dp = _mm256_loadu_si256( (const __m256i*) &dst_p[k] );
+      _mm256_storeu_si256( (__m256i*) &dst_p[k], _mm256_blendv_epi8(dp, sp, written) );
+    }
+  }
+
+  sse2_committed_into_main(src_p, src_s, dst_p, k, to);
+}
+
+static const ShadowKernels avx2_kernels =
+{
+  "avx2",
+  avx2_read_range,
+  avx2_write_range,
+  avx2_worker_into_partial,
+  avx2_committed_into_partial,
+  avx2_committed_into_main
+};
+
+//------------------------------------------------------------------
+// AVX-512 (BW): 64 bytes at a time.  Masked
+// stores touch only the bytes which change.
+
+#define AVX512 __attribute__((target("avx512f,avx512bw")))
+
+static AVX512 Bool avx512_read_range(uint8_t *start, uint8_t *stop, uint8_t code)
+{
+  const __m512i vcode = _mm512_set1_epi8( (char) code );
+  const __m512i vlive = _mm512_set1_epi8( LIVE_IN );
+  const __m512i vread = _mm512_set1_epi8( READ_LIVE_IN );
+
+  uint8_t *i = start;
+  for(; i + 64 <= stop; i += 64)
+  {
+    const __m512i meta = _mm512_loadu_si512( (void*) i );
+    const __mmask64 c = _mm512_cmpeq_epi8_mask(meta, vcode);
+    if( c == ~0ULL )
+      continue;
+
+    const __mmask64 z = _mm512_cmpeq_epi8_mask(meta, vlive);
+    const __mmask64 r = _mm512_cmpeq_epi8_mask(meta, vread);
+    if( (c | z | r) != ~0ULL )
+      return 1;
+
+    if( z )
+      _mm512_mask_storeu_epi8( (void*) i, z, vread );
+  }
+
+  return avx2_read_range(i, stop, code);
+}
+
+static AVX512 Bool avx512_write_range(uint8_t *start, uint8_t *stop, uint8_t code)
+{
+  const __m512i vcode = _mm512_set1_epi8( (char) code );
+  const __m512i vread = _mm512_set1_epi8( READ_LIVE_IN );
+
+  uint8_t *i = start;
+  for(; i + 64 <= stop; i += 64)
+  {
+    const __m512i meta = _mm512_loadu_si512( (void*) i );
+    if( _mm512_cmpeq_epi8_mask(meta, vread) )
+      return 1;
+    _mm512_storeu_si512( (void*) i, vcode );
+  }
+
+  return avx2_write_range(i, stop, code);
+}
+
+static AVX512 Bool avx512_worker_into_partial(const uint8_t *src_p, const uint8_t *src_s,
+  uint8_t *dst_p, uint8_t *dst_s, uint64_t from, uint64_t to)
+{
+  const __m512i vlive = _mm512_set1_epi8( LIVE_IN );
+  const __m512i vread = _mm512_set1_epi8( READ_LIVE_IN );
+
+  uint64_t k = from;
+  for(; k + 64 <= to; k += 64)
+  {
+    const __m512i ss = _mm512_loadu_si512( (const void*) &src_s[k] );
+    const __mmask64 s0 = _mm512_cmpeq_epi8_mask(ss, vlive);
+    if( s0 == ~0ULL )
+      continue;
+
+    const __m512i ds = _mm512_loadu_si512( (const void*) &dst_s[k] );
+    const __mmask64 s1 = _mm512_cmpeq_epi8_mask(ss, vread);
+    const __mmask64 d0 = _mm512_cmpeq_epi8_mask(ds, vlive);
+    const __mmask64 d1 = _mm512_cmpeq_epi8_mask(ds, vread);
+
+    const __mmask64 written = ~(s0 | s1);
+    if( (s1 & ~(d0 | d1)) | (written & d1) )
+      return 1;
+
+    const __mmask64 newer = _mm512_cmpgt_epu8_mask(ss, ds);
+    if( !newer )
+      continue;
+
+    _mm512_mask_storeu_epi8( (void*) &dst_s[k], newer, ss );
+
+    const __mmask64 copy = newer & ~s1;
+    if( copy )
+      _mm512_mask_storeu_epi8( (void*) &dst_p[k], copy,
+        _mm512_maskz_loadu_epi8(copy, (const void*) &src_p[k]) );
+  }
+
+  return avx2_worker_into_partial(src_p, src_s, dst_p, dst_s, k, to);
+}
+
+static AVX512 Bool avx512_committed_into_partial(const uint8_t *src_p, const uint8_t *src_s,
+  uint8_t *dst_p, uint8_t *dst_s, uint64_t from, uint64_t to)
+{
+  const __m512i vlive = _mm512_set1_epi8( LIVE_IN );
+  const __m512i vread = _mm512_set1_epi8( READ_LIVE_IN );
+  const __m512i vold  = _mm512_set1_epi8( OLD_ITERATION );
+
+  uint64_t k = from;
+  for(; k + 64 <= to; k += 64)
+  {
+    const __m512i ss = _mm512_loadu_si512( (const void*) &src_s[k] );
+    const __mmask64 written = _mm512_cmpge_epu8_mask(ss, vold);
+    if( !written )
+      continue;
+
+    const __m512i ds = _mm512_loadu_si512( (const void*) &dst_s[k] );
+    if( written & _mm512_cmpeq_epi8_mask(ds, vread) )
+      return 1;
+
+    const __mmask64 copy = written & _mm512_cmpeq_epi8_mask(ds, vlive);
+    if( !copy )
+      continue;
+
+    _mm512_mask_storeu_epi8( (void*) &dst_p[k], copy,
+      _mm512_maskz_loadu_epi8(copy, (const void*) &src_p[k]) );
+    _mm512_mask_storeu_epi8( (void*) &dst_s[k], copy, vold );
+  }
+
+  return avx2_committed_into_partial(src_p, src_s, dst_p, dst_s, k, to);
+}
+
+static AVX512 void avx512_committed_into_main(const uint8_t *src_p, const uint8_t *src_s,
+  uint8_t *dst_p, uint64_t from, uint64_t to)
+{
+  const __m512i vold = _mm512_set1_epi8( OLD_ITERATION );
+
+  uint64_t k = from;
+  for(; k + 64 <= to; k += 64)
+  {
+    const __m512i ss = _mm512_loadu_si512( (const void*) &src_s[k] );
+    const __mmask64 written = _mm512_cmpge_epu8_mask(ss, vold);
+    if( written )
+      _mm512_mask_storeu_epi8( (void*) &dst_p[k], written,
+        _mm512_maskz_loadu_epi8(written, (const void*) &src_p[k]) );
+  }
+
+  avx2_committed_into_main(src_p, src_s, dst_p, k, to);
+}
+
+static const ShadowKernels avx512_kernels =
+{
+  "avx512",
+  avx512_read_range,
+  avx512_write_range,
+  avx512_worker_into_partial,
+  avx512_committed_into_partial,
+  avx512_committed_into_main
+};
+
+//------------------------------------------------------------------
+// Dispatch
+
+const ShadowKernels *__specpriv_shadow_kernels = &sse2_kernels;
+
+const ShadowKernels *__specpriv_get_shadow_kernels(const char *isa)
+{
+  __builtin_cpu_init();
+
+  if( !strcmp(isa, "scalar") )
+    return &scalar_kernels;
+  if( !strcmp(isa, "sse2") )
+    return &sse2_kernels;
+  if( !strcmp(isa, "avx2") && __builtin_cpu_supports("avx2") )
+    return &avx2_kernels;
+  if( !strcmp(isa, "avx512") && __builtin_cpu_supports("avx512bw") )
+    return &avx512_kernels;
+  return 0;
+}
+
+const ShadowKernels *__specpriv_select_shadow_kernels(const char *isa)
+{
+  const ShadowKernels *k = 0;
+
+  if( isa )
+  {
+    k = __specpriv_get_shadow_kernels(isa);
+    if( !k )
+      fprintf(stderr, "Shadow kernels \"%s\" are unknown or unsupported; using default\n", isa);
+  }
+
+  if( !k )
+    k = __specpriv_get_shadow_kernels("avx512");
+  if( !k )
+    k = __specpriv_get_shadow_kernels("avx2");
+  if( !k )
+    k = &sse2_kernels;
+
+  DEBUG(printf("Shadow kernels: %s\n", k->name));
+  __specpriv_shadow_kernels = k;
+  return k;
+}
+
@@ -0,0 +1,55 @@
+#ifndef LLVM_LIBERTY_SPEC_PRIV_EXECUTIVE_SHADOW_H
+#define LLVM_LIBERTY_SPEC_PRIV_EXECUTIVE_SHADOW_H
+
+#include <stdint.h>
+
+#include "types.h"
+
+// Loops over the shadow bytes of the private heap,
+// in several instruction sets.  One set is chosen
+// at startup, according to cpuid; every process
+// inherits that choice across fork.
+//
+// The kernels never misspeculate themselves; they
+// return 1 and leave that to the caller.
+
+typedef struct s_shadow_kernels ShadowKernels;
+struct s_shadow_kernels
+{
+  const char *name;
+
+  // A read of [start,stop) during the iteration whose
+  // shadow code is 'code'.  LIVE_IN bytes become
+  // READ_LIVE_IN.  Returns 1 if some byte was written
+  // by another iteration.
+  Bool (*read_range)(uint8_t *start, uint8_t *stop, uint8_t code);
+
+  // A write of [start,stop).  Returns 1 if some byte
+  // was READ_LIVE_IN; otherwise, the bytes become 'code'.
+  Bool (*write_range)(uint8_t *start, uint8_t *stop, uint8_t code);
+
+  // The per-byte loops of distillation, over bytes
+  // [from,to) of the private/shadow heaps.  The
+  // first two return 1 upon a conflict.
+  Bool (*worker_into_partial)(const uint8_t *src_p, const uint8_t *src_s,
+    uint8_t *dst_p, uint8_t *dst_s, uint64_t from, uint64_t to);
+  Bool (*committed_into_partial)(const uint8_t *src_p, const uint8_t *src_s,
+    uint8_t *dst_p, uint8_t *dst_s, uint64_t from, uint64_t to);
+  void (*committed_into_main)(const uint8_t *src_p, const uint8_t *src_s,
+    uint8_t *dst_p, uint64_t from, uint64_t to);
+};
+
+// The chosen kernels.
+extern const ShadowKernels *__specpriv_shadow_kernels;
+
+// Choose kernels by name: "scalar", "sse2", "avx2" or
+// "avx512"; or, if isa is null or unsupported by this
+// CPU, the widest which the CPU supports.
+const ShadowKernels *__specpriv_select_shadow_kernels(const char *isa);
+
+// The kernels named isa, or null if this
+// CPU cannot run them.
+const ShadowKernels *__specpriv_get_shadow_kernels(const char *isa);
+
+#endif
+
@@ -156,6 +156,62 @@ int64_t __specpriv_consume_replicated(__specpriv_queue* specpriv_queue)
   return ret;
 }
 
+// Records: all values which one block of a stage
+// sends over one queue, with a single publish.
+
+void __specpriv_produce_record(__specpriv_queue* specpriv_queue, const int64_t *values, uint32_t n)
+{
+  uint64_t start;
+  TIME(start);
+  DBG("__specpriv_produce_record %p: %u values\n", specpriv_queue, n);
+
+  __sw_queue_produce_record( get_queue(specpriv_queue), values, n );
+  TADD(produce_time, start);
+  DEBUG(total_produces += n);
+}
+
+void __specpriv_produce_record_replicated(__specpriv_queue* specpriv_queue, const int64_t *values, uint32_t n)
+{
+  uint64_t start;
+  TIME(start);
+  DBG("__specpriv_produce_record_replicated %p: %u values\n", specpriv_queue, n);
+
+  unsigned i = 0;
+  for ( ; i < specpriv_queue->n_queues ; i++)
+    __sw_queue_produce_record( specpriv_queue->queues[i], values, n );
+
+  TADD(produce_time, start);
+  DEBUG(total_produces += n * specpriv_queue->n_queues);
+}
+
+void __specpriv_consume_record(__specpriv_queue* specpriv_queue, int64_t *values, uint32_t n)
+{
+  uint64_t start;
+  TIME(start);
+  DBG("__specpriv_consume_record %p: %u values\n", specpriv_queue, n);
+
+  __sw_queue_consume_record( get_queue(specpriv_queue), values, n );
+
+  TADD(consume_time, start);
+  DEBUG(total_consumes += n);
+}
+
+void __specpriv_consume_record_replicated(__specpriv_queue* specpriv_queue, int64_t *values, uint32_t n)
+{
+  uint64_t start;
+  TIME(start);
+  DBG("__specpriv_consume_record_replicated %p: %u values\n", specpriv_queue, n);
+
+  Wid      wid = __specpriv_my_worker_id();
+  unsigned my_stage = GET_MY_STAGE(wid);
+  Wid      index = wid - GET_FIRST_WID_OF_STAGE(my_stage);
+
+  __sw_queue_consume_record( specpriv_queue->queues[index], values, n );
+
+  TADD(consume_time, start);
+  DEBUG(total_consumes += n);
+}
+
 void __specpriv_flush(__specpriv_queue* specpriv_queue)
 {
   unsigned i = 0;
@@ -1,22 +1,191 @@
 #include <assert.h>
+#include <limits.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <sys/file.h>
 #include <sys/mman.h>
+#include <sys/syscall.h>
 #include <sys/wait.h>
+#include <linux/futex.h>
+#include <xmmintrin.h>
 
+#include "api.h"
 #include "debug.h"
 #include "sw_queue.h"
 #include "timer.h"
 
-#define SW_QUEUE_OCCUPIED 1   // b'01
-#define SW_QUEUE_NULL 0
-
 #define SYNC_FINISHED 1
 #define SYNC_NOT_FINISHED 0
 
+#define QUEUE_MASK  (QUEUE_SIZE - 1)
+
+// Queues to which this thread has produced values
+// it has not yet published.  A queue may appear more
+// than once, or after it was published.  Per thread,
+// since specpriv-executive-threads shares this file.
+#define MAX_UNPUBLISHED (64)
+static _Thread_local queue_t *unpublished[ MAX_UNPUBLISHED ];
+static _Thread_local unsigned numUnpublished;
+
+// Not FUTEX_PRIVATE_FLAG: queues are MAP_SHARED
+// between the worker processes.  The abort signal
+// does not interrupt a FUTEX_WAIT (SA_RESTART), so
+// sleep at most QUEUE_POLL_NS and let the caller poll.
+static void futex_wait(volatile uint32_t *addr, uint32_t val)
+{
+  const struct timespec timeout = { 0, QUEUE_POLL_NS };
+  syscall(SYS_futex, (uint32_t*) addr, FUTEX_WAIT, val, &timeout, 0, 0);
+}
+
+static void futex_wake(volatile uint32_t *addr)
+{
+  syscall(SYS_futex, (uint32_t*) addr, FUTEX_WAKE, INT_MAX, 0, 0, 0);
+}
+
+// Is there room for slots [.., end)?
+static inline int has_room(uint32_t tail, uint32_t end)
+{
+  return (uint32_t)(end - tail) <= QUEUE_SIZE;
+}
+
+// Are slots [.., end) full?
+static inline int has_values(uint32_t head, uint32_t end)
+{
+  return (int32_t)(head - end) >= 0;
+}
+
+// Publish the head; wake the consumer if it sleeps.
+// The fence orders our store before the load of
+// consumer_sleeping: either we see the sleeper, or
+// it sees the new head before it blocks.
+static inline void publish_head(queue_t* queue)
+{
+  __atomic_store_n(&queue->head, queue->head_local, __ATOMIC_RELEASE);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if( queue->consumer_sleeping )
+    futex_wake(&queue->head);
+}
+
+// Publish every queue which this thread holds back,
+// before it waits: whoever is at the other end may
+// be what we wait for.
+static void publish_all(void)
+{
+  for(unsigned i=0; i<numUnpublished; ++i)
+    if( unpublished[i]->head != unpublished[i]->head_local )
+      publish_head( unpublished[i] );
+  numUnpublished = 0;
+}
+
+// Slots [.., head_local) are full; publish
+// them once there are enough of them.
+static inline void hold_head(queue_t* queue, uint32_t old_head_local)
+{
+  if( queue->head_local - queue->head >= QUEUE_PUBLISH )
+    publish_head(queue);
+
+  else if( old_head_local == queue->head )
+  {
+    // First value held back since the last publish.
+    if( numUnpublished == MAX_UNPUBLISHED )
+      publish_all();
+    unpublished[ numUnpublished++ ] = queue;
+  }
+}
+
+static inline void publish_tail(queue_t* queue)
+{
+  __atomic_store_n(&queue->tail, queue->tail_local, __ATOMIC_RELEASE);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if( queue->producer_sleeping )
+    futex_wake(&queue->tail);
+}
+
+// Wait until slots [.., end) are free.
+static void wait_for_room(queue_t* queue, uint32_t end)
+{
+  if( has_room(queue->tail_cache, end) )
+    return;
+
+  uint64_t start;
+  TIME(start);
+  publish_all();
+  queue->tail_cache = __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
+  for(unsigned i=0; i<QUEUE_SPIN && !has_room(queue->tail_cache, end); ++i)
+  {
+    _mm_pause();
+    queue->tail_cache = __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
+  }
+
+  if( !has_room(queue->tail_cache, end) )
+  {
+    __atomic_store_n(&queue->producer_sleeping, 1, __ATOMIC_SEQ_CST);
+    uint32_t tail;
+    while( !has_room(tail = __atomic_load_n(&queue->tail, __ATOMIC_SEQ_CST), end) )
+    {
+      // Don't leave a stale sleeping flag behind if we abort.
+      queue->producer_sleeping = 0;
+      __specpriv_poll_abort();
+      __atomic_store_n(&queue->producer_sleeping, 1, __ATOMIC_SEQ_CST);
+      futex_wait(&queue->tail, tail);
+    }
+    queue->producer_sleeping = 0;
+    queue->tail_cache = tail;
+  }
+  TADD(produce_wait_time, start);
+}
+
+// Wait until slots [.., end) are full.
+static void wait_for_values(queue_t* queue, uint32_t end)
+{
+  if( has_values(queue->head_cache, end) )
+    return;
+
+  uint64_t start;
+  TIME(start);
+  queue->head_cache = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+  if( !has_values(queue->head_cache, end) )
+  {
+    // Don't keep the producer waiting on our batch,
+    // nor the consumers of whatever we produce.
+    if( queue->tail != queue->tail_local )
+      publish_tail(queue);
+    publish_all();
+
+    for(unsigned i=0; i<QUEUE_SPIN && !has_values(queue->head_cache, end); ++i)
+    {
+      _mm_pause();
+      queue->head_cache = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+    }
+  }
+
+  if( !has_values(queue->head_cache, end) )
+  {
+    __atomic_store_n(&queue->consumer_sleeping, 1, __ATOMIC_SEQ_CST);
+    uint32_t head;
+    while( !has_values(head = __atomic_load_n(&queue->head, __ATOMIC_SEQ_CST), end) )
+    {
+      queue->consumer_sleeping = 0;
+      __specpriv_poll_abort();
+      __atomic_store_n(&queue->consumer_sleeping, 1, __ATOMIC_SEQ_CST);
+      futex_wait(&queue->head, head);
+    }
+    queue->consumer_sleeping = 0;
+    queue->head_cache = head;
+  }
+  TADD(consume_wait_time, start);
+}
+
+// Free slots up to tail_local, in batches.
+static inline void release_slots(queue_t* queue)
+{
+  if( queue->tail_local - queue->tail >= QUEUE_PUBLISH )
+    publish_tail(queue);
+}
+
 queue_t* __sw_queue_create(void)
 {
   queue_t* queue = (queue_t*)mmap(0, sizeof(queue_t),
@@ -30,88 +199,125 @@ queue_t* __sw_queue_create(void)
 void __sw_queue_produce(queue_t* queue, void* value)
 {
   //DBG("\t\tsw_queue_produce, queue %p\n", queue);
-  uint64_t start;
-  TIME(start);
-  while (*(queue->head) != (void*) SW_QUEUE_NULL);
-  TADD(produce_wait_time, start);
+  const uint32_t h = queue->head_local;
+  wait_for_room(queue, h + 1);
 
+  uint64_t start;
   TIME(start);
-  *(queue->head+1) = (void*)value;
-
-  *queue->head = (void *) SW_QUEUE_OCCUPIED;
-
-  queue->head+=2;
-  if ( queue->head >= &(queue->data[QUEUE_SIZE]) )
-    queue->head = &queue->data[0];
-
+  queue->data[ h & QUEUE_MASK ] = value;
+  queue->head_local = h + 1;
+  hold_head(queue, h);
   TADD(produce_actual_time, start);
 }
 
 void* __sw_queue_consume(queue_t* queue)
 {
-  void *value;
+  const uint32_t t = queue->tail_local;
+  wait_for_values(queue, t + 1);
+
   uint64_t start;
   TIME(start);
-  while ((*queue->tail) == (void*) SW_QUEUE_NULL);
-  TADD(consume_wait_time, start);
-  TIME(start);
+  void *value = queue->data[ t & QUEUE_MASK ];
+  queue->tail_local = t + 1;
+  release_slots(queue);
+  TADD(consume_actual_time, start);
+
+  return value;
+}
+
+// Records start on a cache line.
+static inline uint32_t record_start(uint32_t index)
+{
+  return (index + SW_QUEUE_LINE_SLOTS - 1) & ~(uint32_t)(SW_QUEUE_LINE_SLOTS - 1);
+}
 
-  value = *( (queue->tail)+1 );
-  *( (queue->tail)+1 ) = (void*) SW_QUEUE_NULL;
-  *(queue->tail) = (void*) *( (queue->tail)+1 );
+static void produce_record(queue_t* queue, const int64_t *values, uint32_t n)
+{
+  const uint32_t old = queue->head_local;
+  const uint32_t first = record_start(old);
+  wait_for_room(queue, first + n);
 
-  //DBG("\t\tsw_queue_consume, from tail %p\n", queue->tail);
+  uint64_t start;
+  TIME(start);
+  for(uint32_t j=0; j<n; ++j)
+    queue->data[ (first + j) & QUEUE_MASK ] = (void*) values[j];
+  queue->head_local = first + n;
+  hold_head(queue, old);
+  TADD(produce_actual_time, start);
+}
 
-  queue->tail+=2;
-  if ( queue->tail >= &(queue->data[QUEUE_SIZE]) )
-    queue->tail = &(queue->data[0]);
+static void consume_record(queue_t* queue, int64_t *values, uint32_t n)
+{
+  const uint32_t first = record_start(queue->tail_local);
+  wait_for_values(queue, first + n);
 
+  uint64_t start;
+  TIME(start);
+  for(uint32_t j=0; j<n; ++j)
+    values[j] = (int64_t) queue->data[ (first + j) & QUEUE_MASK ];
+  queue->tail_local = first + n;
+  release_slots(queue);
   TADD(consume_actual_time, start);
+}
 
-  return value;
+void __sw_queue_produce_record(queue_t* queue, const int64_t *values, uint32_t n)
+{
+  for( ; n > SW_QUEUE_RECORD_VALUES; values += SW_QUEUE_RECORD_VALUES, n -= SW_QUEUE_RECORD_VALUES)
+    produce_record(queue, values, SW_QUEUE_RECORD_VALUES);
+  if( n > 0 )
+    produce_record(queue, values, n);
+}
+
+void __sw_queue_consume_record(queue_t* queue, int64_t *values, uint32_t n)
+{
+  for( ; n > SW_QUEUE_RECORD_VALUES; values += SW_QUEUE_RECORD_VALUES, n -= SW_QUEUE_RECORD_VALUES)
+    consume_record(queue, values, SW_QUEUE_RECORD_VALUES);
+  if( n > 0 )
+    consume_record(queue, values, n);
 }
 
 void __sw_queue_flush(queue_t* queue)
 {
-  // As the queue does not have a buffer, nothing to do with flush
-  /*
-  while((*queue->tail) != (void*) SW_QUEUE_NULL)
-  {
-    (*queue->tail) = (void*) SW_QUEUE_NULL;
-    queue->tail+=2;
-    if ( queue->tail >= &(queue->data[QUEUE_SIZE]) )
-      queue->tail = &queue->data[0];
-  }
-  */
+  if( queue->head != queue->head_local )
+    publish_head(queue);
+}
+
+// Called before this thread waits on
+// anything other than a queue.
+void __sw_queue_flush_all(void)
+{
+  publish_all();
 }
 
 void __sw_queue_clear(queue_t* queue)
 {
-  while((*queue->tail) != (void*) SW_QUEUE_NULL)
-  {
-    (*queue->tail) = (void*) SW_QUEUE_NULL;
-    queue->tail+=2;
-    if ( queue->tail >= &(queue->data[QUEUE_SIZE]) )
-      queue->tail = &queue->data[0];
-  }
+  // Drop whatever the producer has published.
+  queue->tail_local = queue->head_cache = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+  publish_tail(queue);
 }
 
 void __sw_queue_reset(queue_t* queue)
 {
-  int i;
-  queue->head = &(queue->data[0]);
-  queue->tail = &(queue->data[0]);
+  // No need to touch data[]: only the
+  // indices say which slots are full.
+  queue->head = queue->head_local = queue->tail_cache = 0;
+  queue->tail = queue->tail_local = queue->head_cache = 0;
+  queue->consumer_sleeping = queue->producer_sleeping = 0;
   *(queue->finished) = SYNC_NOT_FINISHED;
-  for(i=0 ; i<QUEUE_SIZE ; i++)
-    queue->data[i] = (void*) SW_QUEUE_NULL;
 }
 
 void __sw_queue_free(queue_t* queue)
 {
+  unsigned j = 0;
+  for(unsigned i=0; i<numUnpublished; ++i)
+    if( unpublished[i] != queue )
+      unpublished[j++] = unpublished[i];
+  numUnpublished = j;
+
   munmap(queue, sizeof(queue_t));
 }
 
 uint8_t __sw_queue_empty(queue_t* queue)
 {
-  return ( (*queue->tail) == SW_QUEUE_NULL ) ? 1 : 0;
+  return ( __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE) == queue->tail_local ) ? 1 : 0;
 }
@@ -9,21 +9,63 @@
 #define QUEUE_SIZE 8192*2 /* // 65536 // 128 // 16384 // 8192*/
 // #define QUEUE_SIZE 8192*8 /* // 65536 // 128 // 16384 // 8192*/
 
+// A single-producer, single-consumer ring (Lamport).
+// head and tail count slots, and wrap at 2^32; each
+// is written by one side only, on its own cache line.
+// Each side keeps a cached copy of the other's index,
+// and reads the real one only when the cached copy
+// says that the ring is full (or empty).  So, while
+// the ring is neither, the two sides do not share
+// any cache line but those of data[].
+//
+// Each side publishes its index in batches of
+// QUEUE_PUBLISH slots, and publishes what it holds
+// back before it waits, or when the producer
+// flushes.  A side which waits spins QUEUE_SPIN
+// times, then sleeps on the other side's index
+// (a futex), waking every QUEUE_POLL_NS to see
+// whether a misspeculation has aborted it.
+#define QUEUE_PUBLISH   (64)
+#define QUEUE_SPIN      (4096)
+#define QUEUE_POLL_NS   (1000000)
+
 typedef struct {
-    void * volatile *head;
-    void * volatile *prealloc;
-    PAD(1, sizeof(void *)*2);
-    void * volatile *tail;
-    void * volatile *prealloc_tail;
+    // producer's
+    volatile uint32_t head;
+    uint32_t head_local;
+    uint32_t tail_cache;
+    PAD(1, sizeof(uint32_t)*3);
+
+    // consumer's
+    volatile uint32_t tail;
+    uint32_t tail_local;
+    uint32_t head_cache;
     int volatile finished[1];
-    PAD(2, sizeof(void *)*2+sizeof(int*));
-    void *data[QUEUE_SIZE];
+    PAD(2, sizeof(uint32_t)*3+sizeof(int));
+
+    // written only by a side which goes to sleep
+    volatile uint32_t consumer_sleeping;
+    volatile uint32_t producer_sleeping;
+    PAD(3, sizeof(uint32_t)*2);
+
+    void *data[QUEUE_SIZE] __attribute__((aligned(PADDING)));
 } queue_t;
 
+// Records carry many values, published at once.
+// Each starts on a cache line of data[].  Records
+// longer than SW_QUEUE_RECORD_VALUES are split;
+// the consumer must ask for the same number of
+// values as the producer sent.
+#define SW_QUEUE_LINE_SLOTS     (8)
+#define SW_QUEUE_RECORD_VALUES  (512)
+
 queue_t* __sw_queue_create(void);
 void     __sw_queue_produce(queue_t* queue, void* value);
 void*    __sw_queue_consume(queue_t* queue);
+void     __sw_queue_produce_record(queue_t* queue, const int64_t *values, uint32_t n);
+void     __sw_queue_consume_record(queue_t* queue, int64_t *values, uint32_t n);
 void     __sw_queue_flush(queue_t* queue);
+void     __sw_queue_flush_all(void);
 void     __sw_queue_clear(queue_t* queue);
 void     __sw_queue_reset(queue_t* queue);
 void     __sw_queue_free(queue_t*);
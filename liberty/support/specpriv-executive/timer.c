@@ -41,13 +41,13 @@ uint64_t worker_setup_time = 0; // done
 
 //////// PER-INVOCATION TIMES ////////
 /******************************************************************************
- * Writing/reading from pipe time
+ * Ringing/waiting for the dispatch doorbell time
  */
-uint64_t main_write_pipe_time = 0;
-uint64_t worker_read_pipe_time = 0;
+uint64_t main_dispatch_time = 0;
+uint64_t worker_wait_dispatch_time = 0;
 
 /******************************************************************************
- * Worker total invocation time (after reading from pipe)
+ * Worker total invocation time (after the doorbell rings)
  */
 uint64_t worker_total_invocation_time = 0;
 
@@ -155,7 +155,7 @@ void __specpriv_reset_timers(void)
 {
     ++InvocationNumber;
     numCheckpoints = 0;
-    worker_read_pipe_time = 0;
+    worker_wait_dispatch_time = 0;
     worker_setup_invocation_time = 0;
     worker_on_iteration_time = 0;
     worker_off_iteration_time = 0;
@@ -215,7 +215,7 @@ void __specpriv_print_percentages( void )
 
   printf("Complete worker invocation time:          %15lu\n", worker_end_invocation - worker_begin_invocation);
   printf("Worker cpu set setup time:                %15lu\n", worker_setup_time);
-  printf("Worker read pipe time:                    %15lu\n", worker_read_pipe_time);
+  printf("Worker wait for dispatch time:            %15lu\n", worker_wait_dispatch_time);
   printf("Worker invocation time:                   %15lu\n", total_invocation_time);
   printf("-- Worker invocation setup time:          %15lu\n", worker_setup_invocation_time);
   printf("-- Worker total iteration time:           %15lu\n", total_iteration_time);
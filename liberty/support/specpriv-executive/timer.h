@@ -74,13 +74,13 @@ extern uint64_t worker_setup_time;
 
 //////// PER-INVOCATION TIMES ////////
 /******************************************************************************
- * Writing/reading from pipe time
+ * Ringing/waiting for the dispatch doorbell time
  */
-extern uint64_t main_write_pipe_time;
-extern uint64_t worker_read_pipe_time;
+extern uint64_t main_dispatch_time;
+extern uint64_t worker_wait_dispatch_time;
 
 /******************************************************************************
- * Worker total invocation time (after reading from pipe)
+ * Worker total invocation time (after the doorbell rings)
  */
 extern uint64_t worker_total_invocation_time;
 
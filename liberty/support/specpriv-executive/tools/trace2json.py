@@ -0,0 +1,112 @@
+#!/usr/bin/env python3
+"""Convert specpriv-executive event logs (see ../trace.h) to a
+Chrome trace, for chrome://tracing or ui.perfetto.dev.
+
+    SPECPRIV_TRACE=/tmp/run ./program
+    trace2json.py /tmp/run > run.json
+
+Reads /tmp/run.main and /tmp/run.<worker> (or the files named
+on the command line); each process becomes a track.
+"""
+
+import glob
+import json
+import struct
+import sys
+
+MAGIC = 0x3145434152545053
+HEADER = struct.Struct('<QiiQQQQQ')
+RECORD = struct.Struct('<QIi')
+
+# Same order as TraceEvent in trace.h.  Spans come in
+# BEGIN/END pairs; the rest are instants.
+SPANS = ['invocation', 'dispatch wait', 'iteration', 'checkpoint',
+         'lock wait', 'stall', 'combine', 'io', 'join', 'distill']
+INSTANTS = ['misspec', 'abort', 'recovered']
+
+
+def event_name(e):
+    """(name, phase) of an event number."""
+    if e < 2 * len(SPANS):
+        return SPANS[e // 2], 'BE'[e % 2]
+    return INSTANTS[e - 2 * len(SPANS)], 'i'
+
+
+def read_log(path):
+    with open(path, 'rb') as f:
+        data = f.read()
+    magic, worker, pid, tsc0, ns0, tsc1, ns1, records = HEADER.unpack_from(data)
+    if magic != MAGIC:
+        raise ValueError('%s: not a specpriv trace' % path)
+
+    # A process killed before it closed its log has no
+    # second clock reading; assume a 1 GHz counter.
+    rate = (ns1 - ns0) / float(tsc1 - tsc0) if tsc1 > tsc0 else 1.0
+
+    events = []
+    offset = HEADER.size
+    while offset + RECORD.size <= len(data):
+        tsc, e, it = RECORD.unpack_from(data, offset)
+        offset += RECORD.size
+        ns = ns0 + (tsc - tsc0) * rate
+        events.append((ns, e, it))
+    return worker, pid, events
+
+
+def convert(paths):
+    logs = [read_log(p) for p in paths]
+    origin = min((ev[0][0] for _, _, ev in logs if ev), default=0)
+
+    trace = []
+    for worker, pid, events in logs:
+        tid = 0 if worker < 0 else worker + 1
+        trace.append({'name': 'thread_name', 'ph': 'M', 'pid': 1, 'tid': tid,
+                      'args': {'name': 'main' if worker < 0 else 'worker %d' % worker}})
+
+        # A misspeculating worker unwinds out of whatever
+        # it was doing; close those spans.
+        open_spans = []
+        for ns, e, it in events:
+            name, ph = event_name(e)
+            ts = (ns - origin) / 1000.0
+            if ph == 'B':
+                open_spans.append(name)
+            elif ph == 'E':
+                if name not in open_spans:
+                    continue
+                while open_spans:
+                    closed = open_spans.pop()
+                    if closed == name:
+                        break
+                    trace.append({'name': closed, 'ph': 'E', 'ts': ts, 'pid': 1, 'tid': tid})
+            elif name in ('misspec', 'abort'):
+                while open_spans:
+                    trace.append({'name': open_spans.pop(), 'ph': 'E', 'ts': ts,
+                                  'pid': 1, 'tid': tid})
+
+            ev = {'name': name, 'ph': ph, 'ts': ts, 'pid': 1, 'tid': tid,
+                  'args': {'iteration': it}}
+            if ph == 'i':
+                ev['s'] = 't'
+            trace.append(ev)
+
+    return {'traceEvents': trace, 'displayTimeUnit': 'ns'}
+
+
+def main(argv):
+    if len(argv) < 2:
+        sys.stderr.write(__doc__)
+        return 1
+
+    paths = argv[1:]
+    if len(paths) == 1 and not paths[0].endswith(('.main',)) and glob.glob(paths[0] + '.*'):
+        paths = sorted(glob.glob(paths[0] + '.main')) + \
+            sorted(glob.glob(paths[0] + '.[0-9]*'), key=lambda p: int(p.rsplit('.', 1)[1]))
+
+    json.dump(convert(paths), sys.stdout)
+    sys.stdout.write('\n')
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
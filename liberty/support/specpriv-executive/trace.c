@@ -0,0 +1,105 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "constants.h"
+#include "trace.h"
+
+int __specpriv_tracing;
+uint32_t __specpriv_trace_next;
+TraceRecord __specpriv_trace_ring[ TRACE_RING ];
+
+static int trace_fd = -1;
+static TraceHeader header;
+
+static uint64_t monotonic_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void write_all(const void *buffer, size_t len)
+{
+  const char *p = (const char*) buffer;
+  while( len > 0 )
+  {
+    const ssize_t n = write(trace_fd, p, len);
+    if( n <= 0 )
+    {
+      perror("specpriv trace");
+      __specpriv_tracing = 0;
+      return;
+    }
+    p += n;
+    len -= n;
+  }
+}
+
+// Called by the main process at startup, and by
+// each worker after the fork; a worker starts with
+// the main process' ring, which it drops.
+void __specpriv_trace_open(Wid wid)
+{
+  __specpriv_trace_next = 0;
+  __specpriv_tracing = 0;
+  trace_fd = -1;
+
+  const char *path = getenv("SPECPRIV_TRACE");
+  if( !path || !*path )
+    return;
+
+  char name[4096];
+  if( wid == MAIN_PROCESS )
+    snprintf(name, sizeof(name), "%s.main", path);
+  else
+    snprintf(name, sizeof(name), "%s.%u", path, wid);
+
+  trace_fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if( trace_fd < 0 )
+  {
+    perror(name);
+    return;
+  }
+
+  header.magic = TRACE_MAGIC;
+  header.worker = (wid == MAIN_PROCESS) ? -1 : (int32_t) wid;
+  header.pid = getpid();
+  header.ns0 = monotonic_ns();
+  header.tsc0 = __rdtsc();
+  header.tsc1 = header.ns1 = 0;
+  header.records = 0;
+
+  __specpriv_tracing = 1;
+  write_all(&header, sizeof(header));
+}
+
+void __specpriv_trace_spill(void)
+{
+  if( __specpriv_tracing )
+  {
+    write_all(__specpriv_trace_ring, __specpriv_trace_next * sizeof(TraceRecord));
+    header.records += __specpriv_trace_next;
+  }
+  __specpriv_trace_next = 0;
+}
+
+// Write what is left, and the final clock
+// reading into the header.
+void __specpriv_trace_close(void)
+{
+  if( !__specpriv_tracing )
+    return;
+
+  __specpriv_trace_spill();
+  header.tsc1 = __rdtsc();
+  header.ns1 = monotonic_ns();
+  if( pwrite(trace_fd, &header, sizeof(header), 0) != sizeof(header) )
+    perror("specpriv trace");
+
+  close(trace_fd);
+  trace_fd = -1;
+  __specpriv_tracing = 0;
+}
@@ -0,0 +1,102 @@
+#ifndef LIBERTY_SPECPRIV_EXECUTIVE_TRACE_H
+#define LIBERTY_SPECPRIV_EXECUTIVE_TRACE_H
+
+#include <stdint.h>
+#include <x86intrin.h>
+
+#include "config.h"
+#include "types.h"
+
+// Binary event log.
+//
+// If compiled in (TRACE in config.h) and the SPECPRIV_TRACE
+// environment variable names a path, every process keeps a
+// ring of (tsc, event, iteration) records, and appends it
+// to <path>.main or <path>.<worker id> whenever it fills,
+// and at exit.  tools/trace2json.py turns those files into
+// a Chrome trace (chrome://tracing, ui.perfetto.dev).
+// Otherwise, each event costs one untaken branch.
+
+// Events come in BEGIN/END pairs, except those marked
+// instant.  Keep tools/trace2json.py in sync.
+typedef enum
+{
+  TRACE_INVOCATION_BEGIN = 0,
+  TRACE_INVOCATION_END,
+  TRACE_DISPATCH_WAIT_BEGIN,
+  TRACE_DISPATCH_WAIT_END,
+  TRACE_ITER_BEGIN,
+  TRACE_ITER_END,
+  TRACE_CHECKPOINT_BEGIN,
+  TRACE_CHECKPOINT_END,
+  TRACE_LOCK_WAIT_BEGIN,
+  TRACE_LOCK_WAIT_END,
+  TRACE_STALL_BEGIN,
+  TRACE_STALL_END,
+  TRACE_COMBINE_BEGIN,
+  TRACE_COMBINE_END,
+  TRACE_IO_BEGIN,
+  TRACE_IO_END,
+  TRACE_JOIN_BEGIN,
+  TRACE_JOIN_END,
+  TRACE_DISTILL_BEGIN,
+  TRACE_DISTILL_END,
+
+  // instant
+  TRACE_MISSPEC,
+  TRACE_ABORT,
+  TRACE_RECOVERED,
+
+  TRACE_NUM_EVENTS
+} TraceEvent;
+
+typedef struct s_trace_record TraceRecord;
+struct s_trace_record
+{
+  uint64_t  tsc;
+  uint32_t  event;
+  int32_t   iter;
+};
+
+// Each file starts with this header.  The two clock
+// readings relate tsc to CLOCK_MONOTONIC nanoseconds.
+#define TRACE_MAGIC     (0x3145434152545053ULL)   // "SPTRACE1"
+
+typedef struct s_trace_header TraceHeader;
+struct s_trace_header
+{
+  uint64_t  magic;
+  int32_t   worker;   // -1 for the main process
+  int32_t   pid;
+  uint64_t  tsc0, ns0;
+  uint64_t  tsc1, ns1;
+  uint64_t  records;
+};
+
+#define TRACE_RING      (1U << 14)
+
+extern int __specpriv_tracing;
+extern uint32_t __specpriv_trace_next;
+extern TraceRecord __specpriv_trace_ring[ TRACE_RING ];
+
+void __specpriv_trace_open(Wid wid);
+void __specpriv_trace_spill(void);
+void __specpriv_trace_close(void);
+
+static inline void __specpriv_trace(TraceEvent e, Iteration iter)
+{
+  TraceRecord *r = &__specpriv_trace_ring[ __specpriv_trace_next ];
+  r->tsc = __rdtsc();
+  r->event = e;
+  r->iter = iter;
+  if( ++__specpriv_trace_next == TRACE_RING )
+    __specpriv_trace_spill();
+}
+
+#if TRACE != 0
+#define TRACE_EVENT(e,i)  do { if( __specpriv_tracing ) __specpriv_trace(e,i); } while(0)
+#else
+#define TRACE_EVENT(e,i)  do { } while(0)
+#endif
+
+#endif
@@ -1,3 +1,4 @@
+#include <dlfcn.h>
 #include <string.h>
 #include <sys/types.h>
 #include <sys/wait.h>
@@ -20,44 +21,202 @@ extern "C"
 {
 #include "sw_queue_astream.h"
 
-//static sw_queue_t queue;
-static SW_Queue the_queue;
+// Each thread of the program under test sends its events over
+// its own queue, which a dedicated consumer thread drains in the
+// profiler process.  All queues, and this registry, are mapped
+// before the profiler process is forked.
+enum QueueState { QUEUE_FREE=0, QUEUE_CLAIMED, QUEUE_CONSUMING };
 
-#define CONSUME         sq_consume(the_queue);
-#define PRODUCE(x)      sq_produce(the_queue,(uint64_t)x);
+struct ThreadRegistry
+{
+  SW_Queue queues;
+
+  // A producer claims a FREE queue; consumer zero notices (via
+  // claims) and starts a consumer thread for it; that consumer
+  // frees the queue again after the producer thread exits.
+  volatile uint32_t state[ PROF_MAX_THREADS ];
+  volatile uint32_t claims;
+
+  // Heap events (malloc, free, realloc) from different threads
+  // are applied to the shared live-object table in this order.
+  // Until the program starts a second thread (threaded), they
+  // need no order beyond their queue's, and go unsequenced.
+  volatile uint64_t heap_seq;
+  volatile uint32_t threaded;
+};
+
+#define UNSEQUENCED   (~0ULL)
+
+static ThreadRegistry *registry;
+
+// One state byte per value-prediction site; non-zero once the
+// profiler no longer needs samples from it.  The instrumented
+// code checks it inline before calling __prof_predict_*.  Until
+// __prof_begin maps the shared table, every site is live.
+static uint8_t initial_site_states[ PROF_MAX_SITES ];
+uint8_t *__prof_site_states = initial_site_states;
+
+// Producer: the calling thread's queue.
+// Consumer: the queue which the calling thread drains.
+static thread_local SW_Queue the_queue;
+
+static SW_Queue my_queue();
+
+#define CONSUME         consume();
+#define PRODUCE(x)      sq_produce(my_queue(),(uint64_t)x);
+#define FLUSH           sq_flushQueue(my_queue());
 
 #define PRODUCE_2(x,y)  PRODUCE( (((uint64_t)x)<<32) | (uint32_t)(y) )
+
+// Value-prediction messages carry their site number
+// in the upper bits of the message code.
+#define SITE_CODE(code,site)  ((code) | ((site) << 8))
 #define CONSUME_2(x,y)  do { uint64_t tmp = CONSUME; x = (uint32_t)(tmp>>32); y = (uint32_t) tmp; } while(0)
 
+// ---------------------------------------------------------------
+// Consumer side
+
+// Thrown out of consume() when the program under test is over
+// and this queue will never deliver the rest of its message.
+struct QueueClosed {};
+
+static volatile bool program_over = false;
+static volatile uint64_t applied_heap_seq = 0;
+
+// Consumer zero drains the main thread's queue, and
+// starts a consumer thread for every other queue.
+static thread_local bool is_consumer_zero = false;
+
+// Set in the profiler process, whose
+// threads are not the program's.
+static bool in_profiler = false;
+
+static uint32_t seen_claims = 1;
+static std::vector<pthread_t> consumers;
+
+static void *consumer_thread(void *arg);
+
+static void spawn_consumers()
+{
+  const uint32_t claims = registry->claims;
+  if( claims == seen_claims )
+    return;
+  seen_claims = claims;
+
+  for(unsigned i=1; i<PROF_MAX_THREADS; ++i)
+    if( __sync_bool_compare_and_swap(&registry->state[i], QUEUE_CLAIMED, QUEUE_CONSUMING) )
+    {
+      // Consumer zero holds no references between messages,
+      // so it is safe to switch on synchronization here.
+      Concurrency::enable();
+
+      pthread_t tid;
+      if( pthread_create(&tid, 0, consumer_thread, (void*)(uintptr_t)i) )
+      {
+        perror("specpriv-profile: pthread_create");
+        _exit(1);
+      }
+      consumers.push_back(tid);
+    }
+}
+
+// Called whenever this consumer would block.
+static void idle()
+{
+  if( is_consumer_zero )
+    spawn_consumers();
+
+  if( program_over )
+    throw QueueClosed();
+
+  usleep(10);
+}
+
+static uint64_t consume()
+{
+  SW_Queue q = the_queue;
+  if( q->c_inx == q->c_margin )
+    while( *q->ptr_p_glb_inx == q->c_inx )
+      idle();
+
+  return sq_consume(q);
+}
+
+// Wait until all heap events before seq have been applied.
+static void begin_heap_event(uint64_t seq)
+{
+  if( seq == UNSEQUENCED )
+    return;
+
+  unsigned spins = 0, waits_after_exit = 0;
+  while( __atomic_load_n(&applied_heap_seq, __ATOMIC_ACQUIRE) < seq )
+  {
+    if( is_consumer_zero )
+      spawn_consumers();
+
+    // If the thread which owns an earlier event died
+    // before sending it, give up on ordering.
+    if( program_over && ++waits_after_exit > 100000 )
+      break;
+
+    if( ++spins < 1024 )
+      __asm__ volatile("pause");
+    else
+      usleep(10);
+  }
+}
+
+static void end_heap_event(uint64_t seq)
+{
+  if( seq == UNSEQUENCED )
+    return;
+
+  uint64_t applied = __atomic_load_n(&applied_heap_seq, __ATOMIC_RELAXED);
+  while( applied <= seq
+  &&     !__atomic_compare_exchange_n(&applied_heap_seq, &applied, seq+1, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED) )
+    {}
+}
+
+enum MessageResult { MORE_MESSAGES=0, THREAD_OVER, PROGRAM_OVER };
 
 // Consume and execute one message from the queue.
-// Return false if program is over.
-static bool process_message()
+static MessageResult process_message(Profiler &prof)
 {
-  static const char *last_loop=0;
-  Profiler &prof = Profiler::getInstance();
+  static thread_local const char *last_loop=0;
 
   uint32_t code,second;
   CONSUME_2(code, second);
 
   const char *name=0;
   void *ptr=0, *ptr2=0;
-  uint64_t size=0;
+  uint64_t size=0, seq=0;
+  const uint32_t site = code >> 8;
 
-  switch(code)
+  switch(code & 0xffu)
   {
     case 0:
       // malloc
       name = (const char*) CONSUME;
       ptr = (void*) CONSUME;
+      seq = CONSUME;
       size = second;
+      begin_heap_event(seq);
       prof.malloc(name,ptr,size);
+      end_heap_event(seq);
       break;
     case 1:
       // free
       name = (const char*) CONSUME;
       ptr = (void*) CONSUME;
-      prof.free(name,ptr, (second==1) );
+      if( second == 1 )
+        prof.free(name,ptr,true);
+      else
+      {
+        seq = CONSUME;
+        begin_heap_event(seq);
+        prof.free(name,ptr,false);
+        end_heap_event(seq);
+      }
       break;
     case 2:
       // report constant
@@ -108,24 +267,27 @@ static bool process_message()
       // predict int
       name = (const char*) CONSUME;
       size = CONSUME;
-      prof.predict_int(name,size);
+      prof.predict_int(name,size,site);
       break;
     case 11:
       // predict ptr
       name = (const char*) CONSUME;
       ptr = (void*) CONSUME;
-      prof.predict_ptr(name,ptr);
+      prof.predict_ptr(name,ptr,site);
       break;
     case 12:
       // end
-      return true;
+      return PROGRAM_OVER;
     case 13:
       // realloc
       name = (const char*) CONSUME;
       ptr = (void*) CONSUME;
       ptr2 = (void*) CONSUME;
+      seq = CONSUME;
       size = second;
+      begin_heap_event(seq);
       prof.realloc(name,ptr,ptr2,size);
+      end_heap_event(seq);
       break;
     case 14:
       // assert in-bounds
@@ -149,17 +311,78 @@ static bool process_message()
       // predict integer (with 32-bit value)
       name = (const char *) CONSUME;
       size = (uint64_t)second;
-      prof.predict_int(name,size);
+      prof.predict_int(name,size,site);
       break;
     case 18:
       // begin iteration (with same loop name)
       prof.begin_iter(last_loop);
       break;
+    case 19:
+      // this thread of the program under test exited.
+      return THREAD_OVER;
+    case 20:
+      // heap barrier: a new thread is starting, and
+      // heap events are sequenced from now on.
+      seq = CONSUME;
+      begin_heap_event(seq);
+      end_heap_event(seq);
+      break;
 
     default:
       break;
   }
-  return false;
+  return MORE_MESSAGES;
+}
+
+// Drain one queue until its producer or the program is over.
+static MessageResult drain_queue(Profiler &prof)
+{
+#if TIMER
+  unsigned nEvents = 0;
+#endif
+
+  try
+  {
+    for(;;)
+    {
+      if( is_consumer_zero )
+        spawn_consumers();
+
+      MessageResult result = process_message(prof);
+      if( result != MORE_MESSAGES )
+        return result;
+
+#if TIMER
+      ++nEvents;
+      if( nEvents == 200000000 )
+      {
+        prof.timing_stats( std::cout );
+        nEvents = 0;
+      }
+#endif
+    }
+  }
+  catch( const QueueClosed & )
+  {
+    return PROGRAM_OVER;
+  }
+}
+
+static void *consumer_thread(void *arg)
+{
+  const unsigned idx = (unsigned)(uintptr_t)arg;
+  the_queue = &registry->queues[idx];
+
+  Profiler &prof = Profiler::getInstance();
+  if( drain_queue(prof) == PROGRAM_OVER )
+    program_over = true;
+
+  prof.end_thread();
+
+  // Let another thread of the program under test use this queue.
+  sq_reverseFlush(the_queue);
+  __atomic_store_n(&registry->state[idx], QUEUE_FREE, __ATOMIC_RELEASE);
+  return 0;
 }
 
 #define PIDFILE   "specpriv.profile.trailing.thread.pid"
@@ -180,37 +403,116 @@ static void *thread_loop(void)
   }
   atexit( &remove_pid );
 
+  in_profiler = true;
+  is_consumer_zero = true;
+  the_queue = &registry->queues[0];
+
   Profiler &prof = Profiler::getInstance();
 
   prof.begin();
 
-#if TIMER
-  unsigned nEvents = 0;
-#endif
+  drain_queue(prof);
+
+  // Let the other consumers drain what remains.
+  program_over = true;
+  for(unsigned i=0; i<consumers.size(); ++i)
+    pthread_join(consumers[i], 0);
+
+  prof.end();
+  exit(0);
+}
+
+// ---------------------------------------------------------------
+// Producer side
 
-  while( !process_message() )
+// Tells the profiler when a thread of the program under test exits.
+struct QueueReleaser
+{
+  QueueReleaser() : claimed(false) {}
+  ~QueueReleaser()
   {
-    //printf("Processed a message.\n");
+    if( claimed )
+    {
+      PRODUCE_2(19,0);
+      FLUSH;
+    }
+  }
 
+  bool claimed;
+};
 
-#if TIMER
-    ++nEvents;
-    if( nEvents == 200000000 )
+static thread_local QueueReleaser releaser;
+
+static void claim_queue()
+{
+  for(unsigned i=1; i<PROF_MAX_THREADS; ++i)
+    if( __sync_bool_compare_and_swap(&registry->state[i], QUEUE_FREE, QUEUE_CLAIMED) )
     {
-      prof.timing_stats( std::cout );
-      nEvents = 0;
+      the_queue = &registry->queues[i];
+      releaser.claimed = true;
+      __sync_fetch_and_add(&registry->claims, 1);
+      return;
     }
-#endif
+
+  fprintf(stderr, "specpriv-profile: more than %u live threads; raise PROF_MAX_THREADS\n",
+    PROF_MAX_THREADS);
+  _exit(1);
+}
+
+static SW_Queue my_queue()
+{
+  if( !the_queue )
+    claim_queue();
+  return the_queue;
+}
+
+static uint64_t next_heap_seq()
+{
+  return __sync_fetch_and_add(&registry->heap_seq, 1);
+}
+
+// The sequence number of a heap event.  Once sequenced, heap
+// events must reach the profiler promptly, since another
+// thread's consumer may be waiting on them.  A single-threaded
+// program pays for neither the atomic nor the flush.
+#define PRODUCE_HEAP_SEQ \
+  do { \
+    if( __atomic_load_n(&registry->threaded, __ATOMIC_ACQUIRE) ) \
+    { \
+      PRODUCE(next_heap_seq()); \
+      FLUSH; \
+    } \
+    else \
+      PRODUCE(UNSEQUENCED); \
+  } while(0)
+
+// Every new thread of the program under test starts here.
+// The creating thread sends a sequenced barrier behind its
+// unsequenced heap events, and flushes them; the new
+// thread's heap events are sequenced after that barrier.
+int pthread_create(pthread_t *thread, const pthread_attr_t *attr,
+                   void *(*start_routine)(void *), void *arg)
+{
+  typedef int (*CreateFn)(pthread_t *, const pthread_attr_t *, void *(*)(void *), void *);
+  static CreateFn real_create = 0;
+  if( !real_create )
+    real_create = (CreateFn) dlsym(RTLD_NEXT, "pthread_create");
+
+  if( registry && !in_profiler )
+  {
+    __atomic_store_n(&registry->threaded, 1, __ATOMIC_SEQ_CST);
+    PRODUCE_2(20,0);
+    PRODUCE(next_heap_seq());
+    FLUSH;
   }
 
-  prof.end();
-  exit(0);
+  return real_create(thread, attr, start_routine, arg);
 }
 
 static void end_helper()
 {
   PRODUCE_2(12,0);
-  sq_flushQueue(the_queue);
+  FLUSH;
 }
 
 static void signal_helper(int signum)
@@ -226,7 +528,7 @@ static void signal_helper(int signum)
   PRODUCE_2(12,0);
   PRODUCE_2(12,0);
   PRODUCE_2(12,0);
-  sq_flushQueue(the_queue);
+  FLUSH;
 
   _exit(128+signum);
 }
@@ -236,7 +538,31 @@ static void signal_helper(int signum)
 // who in turn executes them off the critical path.
 void __prof_begin()
 {
-  the_queue = sq_createQueue();
+  registry = (ThreadRegistry *) mmap(0, sizeof(ThreadRegistry),
+    PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if( registry == MAP_FAILED )
+  {
+    perror("specpriv-profile: mmap");
+    exit(1);
+  }
+
+  registry->queues = sq_createQueueBlock(PROF_MAX_THREADS);
+  for(unsigned i=0; i<PROF_MAX_THREADS; ++i)
+    sq_initQueue( &registry->queues[i] );
+
+  uint8_t *site_states = (uint8_t *) mmap(0, PROF_MAX_SITES,
+    PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if( site_states == MAP_FAILED )
+  {
+    perror("specpriv-profile: mmap");
+    exit(1);
+  }
+  __prof_site_states = site_states;
+
+  // The main thread always uses queue zero.
+  registry->state[0] = QUEUE_CONSUMING;
+  registry->claims = 1;
+  the_queue = &registry->queues[0];
 
   __prof_capture_leading_thread_pid();
 
@@ -288,6 +614,7 @@ void __prof_malloc(const char *name, void *ptr, uint64_t size)
     PRODUCE_2(0,size);
     PRODUCE(name);
     PRODUCE(ptr);
+    PRODUCE_HEAP_SEQ;
   }
 }
 
@@ -298,6 +625,7 @@ void __prof_free(const char *name, void *ptr)
     PRODUCE_2(1,0);
     PRODUCE(name);
     PRODUCE(ptr);
+    PRODUCE_HEAP_SEQ;
   }
 }
 
@@ -373,7 +701,7 @@ void __prof_unmanage_argv(uint32_t, const char **argv)
 
 void __prof_begin_iter(const char *name)
 {
-  static const char *last_loop_sent = 0;
+  static thread_local const char *last_loop_sent = 0;
 
   if( name == last_loop_sent )
   {
@@ -400,26 +728,26 @@ void __prof_find_underlying_object(const char *name, void *ptr)
   PRODUCE(ptr);
 }
 
-void __prof_predict_int(const char *name, uint64_t value)
+void __prof_predict_int(const char *name, uint64_t value, uint32_t site)
 {
   uint32_t truncate = (uint32_t)value;
   if( truncate == value )
   {
     // special case for predicting 32-bit values
-    PRODUCE_2(17,truncate);
+    PRODUCE_2(SITE_CODE(17,site),truncate);
     PRODUCE(name);
   }
   else
   {
-    PRODUCE_2(10,0);
+    PRODUCE_2(SITE_CODE(10,site),0);
     PRODUCE(name);
     PRODUCE(value);
   }
 }
 
-void __prof_predict_ptr(const char *name, void *ptr)
+void __prof_predict_ptr(const char *name, void *ptr, uint32_t site)
 {
-  PRODUCE_2(11,0);
+  PRODUCE_2(SITE_CODE(11,site),0);
   PRODUCE(name);
   PRODUCE(ptr);
 }
@@ -448,7 +776,14 @@ uint64_t __prof_unsafe_load(void *ptr, unsigned size_bytes)
   // Not portable, since most systems make no guarantee about
   // system state after a segmentation fault.
   // However, this works on linux and is much faster.
-  static sigjmp_buf __prof_return_from_segfault_handler;
+  //
+  // The handler is process-wide, but several threads may be
+  // probing at once; it stays installed while any of them is,
+  // and each jumps back to its own buffer.
+  static thread_local sigjmp_buf __prof_return_from_segfault_handler;
+  static thread_local bool __prof_in_safe_load = false;
+  static pthread_mutex_t __prof_safe_load_lock = PTHREAD_MUTEX_INITIALIZER;
+  static unsigned __prof_safe_loads_in_flight = 0;
   static struct sigaction old_handler;
   static struct sigaction new_handler;
 
@@ -456,31 +791,60 @@ uint64_t __prof_unsafe_load(void *ptr, unsigned size_bytes)
   {
     // We reached this point because loading the pointer
     // caused a segfault.
-    siglongjmp(__prof_return_from_segfault_handler,1);
+    if( __prof_in_safe_load )
+      siglongjmp(__prof_return_from_segfault_handler,1);
+
+    // Some other thread faulted for real.
+    if( old_handler.sa_handler != SIG_DFL && old_handler.sa_handler != SIG_IGN )
+      old_handler.sa_handler(d);
+    signal(SIGSEGV, SIG_DFL);
+    raise(SIGSEGV);
   }
 
-  static bool __prof_safe_load(void *ptr, uint64_t *value_out, unsigned size_bytes)
+  static void __prof_begin_safe_load()
   {
-    if( sigsetjmp(__prof_return_from_segfault_handler, 1) == 0 )
+    pthread_mutex_lock(&__prof_safe_load_lock);
+    if( 0 == __prof_safe_loads_in_flight++ )
     {
       // Install a custom segfault (SIGSEGV) handler.
       new_handler.sa_handler = __prof_segfault_handler;
       sigemptyset( & new_handler.sa_mask );
       new_handler.sa_flags = 0;
       sigaction(SIGSEGV, &new_handler, &old_handler);
+    }
+    pthread_mutex_unlock(&__prof_safe_load_lock);
+  }
+
+  static void __prof_end_safe_load()
+  {
+    __prof_in_safe_load = false;
+
+    pthread_mutex_lock(&__prof_safe_load_lock);
+    if( 0 == --__prof_safe_loads_in_flight )
+      sigaction(SIGSEGV, &old_handler, 0);
+    pthread_mutex_unlock(&__prof_safe_load_lock);
+  }
+
+  static bool __prof_safe_load(void *ptr, uint64_t *value_out, unsigned size_bytes)
+  {
+    __prof_begin_safe_load();
+
+    if( sigsetjmp(__prof_return_from_segfault_handler, 1) == 0 )
+    {
+      __prof_in_safe_load = true;
 
       // This operation may segfault:
       uint64_t value = __prof_unsafe_load(ptr, size_bytes);
 
       // If we reached this point, then no segfault occurred.
-      sigaction(SIGSEGV, &old_handler, 0);
+      __prof_end_safe_load();
       *value_out = value;
       return true;
     }
     else
     {
       // segfault handler returns to here.
-      sigaction(SIGSEGV, &old_handler, 0);
+      __prof_end_safe_load();
       return false;
     }
   }
@@ -519,22 +883,22 @@ uint64_t __prof_unsafe_load(void *ptr, unsigned size_bytes)
   }
 #endif
 
-void __prof_predict_int_load(const char *name, void *ptr, uint32_t size)
+void __prof_predict_int_load(const char *name, void *ptr, uint32_t size, uint32_t site)
 {
   if( size > sizeof(uint64_t) )
     return; // Ignore.
 
   uint64_t load;
   if( __prof_safe_load(ptr, &load, size) )
-    __prof_predict_int(name, load);
+    __prof_predict_int(name, load, site);
 //  else
 //    fprintf(stderr, "Warning: __prof_predict_int_load(name=%s, ptr=%p, size=%d) segfault\n", name, ptr, size);
 }
-void __prof_predict_ptr_load(const char *name, void *ptr)
+void __prof_predict_ptr_load(const char *name, void *ptr, uint32_t site)
 {
   uint64_t load;
   if( __prof_safe_load(ptr, &load, sizeof(void*) ) )
-    __prof_predict_ptr(name, (void*)load);
+    __prof_predict_ptr(name, (void*)load, site);
 //  else
 //    fprintf(stderr, "Warning: __prof_predict_ptr_load(name=%s, ptr=%p, size=%ld) segfault\n", name, ptr, sizeof(void*));
 }
@@ -554,6 +918,7 @@ void __prof_realloc(const char *name, void *old_ptr, void *new_ptr, uint64_t siz
   PRODUCE(name);
   PRODUCE(old_ptr);
   PRODUCE(new_ptr);
+  PRODUCE_HEAP_SEQ;
 }
 
 // This is only emitted by the profiler if we are in sanity checking mode.
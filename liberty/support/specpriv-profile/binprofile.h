@@ -0,0 +1,699 @@
+#ifndef SPECPRIV_BINPROFILE_H
+#define SPECPRIV_BINPROFILE_H
+
+// A binary, mergeable form of the SpecPriv profile.
+//
+// Everything in it is symbolic: values, allocation units and
+// contexts are stored as their textual names in a string
+// table, never as addresses, so profiles from different runs
+// (and different inputs) describe the same things with the same
+// strings.  Counts add, sample sets take the union of their
+// values, and residue sets take the union of their members;
+// each of these is associative and commutative, so runs may be
+// folded together in any grouping.
+//
+// This header is shared by the profiler runtime, which writes
+// it, the specpriv-profile-merge tool, and the compiler's
+// profile loader (PointsToProfiler/Parse.cpp), so it depends
+// on nothing but the standard library.
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <map>
+#include <ostream>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#define SPECPRIV_BINPROFILE_MAGIC     "SPPROFB\n"
+#define SPECPRIV_BINPROFILE_MAGIC_LEN (8U)
+#define SPECPRIV_BINPROFILE_VERSION   (1U)
+
+struct BinaryProfile
+{
+  typedef uint32_t StrId;
+
+  // Order of the event histogram; matches Profiler::print.
+  enum Event
+  {
+    EVT_MALLOC = 0, EVT_REALLOC, EVT_FREE, EVT_CONSTANT, EVT_GLOBAL,
+    EVT_STACK, EVT_BEGIN_FCN, EVT_END_FCN, EVT_BEGIN_ITER, EVT_END_ITER,
+    EVT_FUO, EVT_PRED_INT, EVT_PRED_PTR, EVT_PTR_RESIDUE,
+    NUM_EVENTS
+  };
+
+  // Records are keyed by an item within a context.  The item
+  // is an allocation unit for escape and local objects, and the
+  // name of an instrumented value for predictions and residues.
+  struct Key
+  {
+    Key(StrId i=0, StrId c=0) : item(i), ctx(c) {}
+    StrId item, ctx;
+
+    bool operator<(const Key &other) const
+    {
+      return item < other.item || (item == other.item && ctx < other.ctx);
+    }
+  };
+
+  struct IntSamples
+  {
+    IntSamples() : bottom(false), num_samples(0) {}
+
+    bool                          bottom;
+    uint64_t                      num_samples;
+    // value -> frequency
+    std::map<uint64_t,uint64_t>   values;
+  };
+
+  struct PtrSamples
+  {
+    PtrSamples() : bottom(false), num_samples(0) {}
+
+    typedef std::pair<StrId,uint64_t> Base;
+
+    bool                          bottom;
+    uint64_t                      num_samples;
+    // (au, offset) -> frequency
+    std::map<Base,uint64_t>       values;
+  };
+
+  struct Residues
+  {
+    Residues() : num_samples(0), members(0) {}
+
+    uint64_t                      num_samples;
+    uint16_t                      members;
+  };
+
+  typedef std::map<Key,uint64_t>      ObjectMap;
+  typedef std::map<Key,IntSamples>    IntSiteMap;
+  typedef std::map<Key,PtrSamples>    PtrSiteMap;
+  typedef std::map<Key,Residues>      ResidueMap;
+
+  BinaryProfile()
+    : num_runs(1), max_int_observations(0),
+      max_ptr_observations(0), max_obj_observations(0)
+  {
+    for(unsigned i=0; i<NUM_EVENTS; ++i)
+      events[i] = 0;
+  }
+
+  // Number of profiled runs folded into this one.
+  uint64_t              num_runs;
+
+  // Capacity of the sample sets; a site which
+  // observes more distinct values is unpredictable.
+  uint32_t              max_int_observations;
+  uint32_t              max_ptr_observations;
+  uint32_t              max_obj_observations;
+
+  uint64_t              events[NUM_EVENTS];
+
+  std::vector<std::string> strings;
+
+  // Names of allocators whose allocations we could not
+  // track.  The profile is complete iff this is empty.
+  std::set<StrId>       incomplete;
+
+  ObjectMap             escapes, locals;
+  IntSiteMap            ints;
+  PtrSiteMap            ptrs, objs;
+  ResidueMap            residues;
+
+  // Intern a string, collapsing runs of whitespace
+  // so that equal token sequences share one id.
+  StrId intern(const std::string &str)
+  {
+    std::string norm;
+    norm.reserve( str.size() );
+    for(std::string::size_type i=0; i<str.size(); ++i)
+    {
+      const bool space = is_space( str[i] );
+      if( space && (norm.empty() || norm[ norm.size()-1 ] == ' ') )
+        continue;
+      norm.push_back( space ? ' ' : str[i] );
+    }
+    if( !norm.empty() && norm[ norm.size()-1 ] == ' ' )
+      norm.resize( norm.size()-1 );
+
+    std::map<std::string,StrId>::iterator i = index.find(norm);
+    if( i != index.end() )
+      return i->second;
+
+    const StrId id = strings.size();
+    strings.push_back(norm);
+    index[norm] = id;
+    return id;
+  }
+
+  const std::string &str(StrId id) const { return strings[id]; }
+
+  // Fold another profile into this one.
+  void merge(const BinaryProfile &other)
+  {
+    num_runs += other.num_runs;
+
+    max_int_observations = merge_capacity(max_int_observations, other.max_int_observations);
+    max_ptr_observations = merge_capacity(max_ptr_observations, other.max_ptr_observations);
+    max_obj_observations = merge_capacity(max_obj_observations, other.max_obj_observations);
+
+    for(unsigned i=0; i<NUM_EVENTS; ++i)
+      events[i] += other.events[i];
+
+    std::vector<StrId> remap( other.strings.size() );
+    for(StrId i=0; i<other.strings.size(); ++i)
+      remap[i] = intern( other.strings[i] );
+
+    for(std::set<StrId>::const_iterator i=other.incomplete.begin(), e=other.incomplete.end(); i!=e; ++i)
+      incomplete.insert( remap[*i] );
+
+    merge_objects(escapes, other.escapes, remap);
+    merge_objects(locals, other.locals, remap);
+
+    for(IntSiteMap::const_iterator i=other.ints.begin(), e=other.ints.end(); i!=e; ++i)
+      merge_samples(ints[ remap_key(i->first,remap) ], i->second, max_int_observations);
+
+    for(PtrSiteMap::const_iterator i=other.ptrs.begin(), e=other.ptrs.end(); i!=e; ++i)
+      merge_samples(ptrs[ remap_key(i->first,remap) ], i->second, remap, max_ptr_observations);
+
+    for(PtrSiteMap::const_iterator i=other.objs.begin(), e=other.objs.end(); i!=e; ++i)
+      merge_samples(objs[ remap_key(i->first,remap) ], i->second, remap, max_obj_observations);
+
+    for(ResidueMap::const_iterator i=other.residues.begin(), e=other.residues.end(); i!=e; ++i)
+    {
+      Residues &mine = residues[ remap_key(i->first,remap) ];
+      mine.num_samples += i->second.num_samples;
+      mine.members |= i->second.members;
+    }
+  }
+
+  // Add one sample-set observation from the runtime.
+  static void receive(IntSamples &set, uint64_t value, uint64_t freq, uint32_t capacity)
+  {
+    if( set.bottom )
+      return;
+    set.values[value] += freq;
+    saturate(set, capacity);
+  }
+
+  static void receive(PtrSamples &set, StrId au, uint64_t offset, uint64_t freq, uint32_t capacity)
+  {
+    if( set.bottom )
+      return;
+    set.values[ PtrSamples::Base(au,offset) ] += freq;
+    saturate(set, capacity);
+  }
+
+  // Serialization.  Files are written in host byte order.
+  bool write(const char *filename) const
+  {
+    std::string buf;
+    buf.append(SPECPRIV_BINPROFILE_MAGIC, SPECPRIV_BINPROFILE_MAGIC_LEN);
+    put32(buf, SPECPRIV_BINPROFILE_VERSION);
+    put64(buf, num_runs);
+    put32(buf, max_int_observations);
+    put32(buf, max_ptr_observations);
+    put32(buf, max_obj_observations);
+    for(unsigned i=0; i<NUM_EVENTS; ++i)
+      put64(buf, events[i]);
+
+    put32(buf, strings.size());
+    for(StrId i=0; i<strings.size(); ++i)
+    {
+      put32(buf, strings[i].size());
+      buf.append(strings[i]);
+    }
+
+    put32(buf, incomplete.size());
+    for(std::set<StrId>::const_iterator i=incomplete.begin(), e=incomplete.end(); i!=e; ++i)
+      put32(buf, *i);
+
+    put_objects(buf, escapes);
+    put_objects(buf, locals);
+
+    put32(buf, ints.size());
+    for(IntSiteMap::const_iterator i=ints.begin(), e=ints.end(); i!=e; ++i)
+    {
+      put_key(buf, i->first);
+      buf.push_back( i->second.bottom );
+      put64(buf, i->second.num_samples);
+      put32(buf, i->second.values.size());
+      for(std::map<uint64_t,uint64_t>::const_iterator j=i->second.values.begin(), z=i->second.values.end(); j!=z; ++j)
+      {
+        put64(buf, j->first);
+        put64(buf, j->second);
+      }
+    }
+
+    put_ptr_sites(buf, ptrs);
+    put_ptr_sites(buf, objs);
+
+    put32(buf, residues.size());
+    for(ResidueMap::const_iterator i=residues.begin(), e=residues.end(); i!=e; ++i)
+    {
+      put_key(buf, i->first);
+      put64(buf, i->second.num_samples);
+      put32(buf, i->second.members);
+    }
+
+    FILE *fout = fopen(filename, "wb");
+    if( !fout )
+      return false;
+    const bool ok = fwrite(buf.data(), 1, buf.size(), fout) == buf.size();
+    return (fclose(fout) == 0) && ok;
+  }
+
+  // Does this file start with the binary magic?
+  static bool is_binary(const char *filename)
+  {
+    FILE *fin = fopen(filename, "rb");
+    if( !fin )
+      return false;
+    char magic[ SPECPRIV_BINPROFILE_MAGIC_LEN ];
+    const bool ok = fread(magic, 1, sizeof(magic), fin) == sizeof(magic)
+                 && std::equal(magic, magic + sizeof(magic), SPECPRIV_BINPROFILE_MAGIC);
+    fclose(fin);
+    return ok;
+  }
+
+  // Replace this profile with the one in filename.
+  // Returns false if the file is missing, truncated, or
+  // in the wrong format.
+  bool read(const char *filename)
+  {
+    *this = BinaryProfile();
+
+    std::vector<char> buf;
+    if( !slurp(filename, buf) )
+      return false;
+
+    Cursor in(buf);
+    if( !in.magic() )
+      return false;
+
+    uint32_t version = 0;
+    if( !in.get(version) || version != SPECPRIV_BINPROFILE_VERSION )
+      return false;
+
+    if( !in.get(num_runs)
+    ||  !in.get(max_int_observations)
+    ||  !in.get(max_ptr_observations)
+    ||  !in.get(max_obj_observations) )
+      return false;
+    for(unsigned i=0; i<NUM_EVENTS; ++i)
+      if( !in.get(events[i]) )
+        return false;
+
+    uint32_t n = 0;
+    if( !in.get(n) )
+      return false;
+    strings.reserve(n);
+    for(uint32_t i=0; i<n; ++i)
+    {
+      std::string s;
+      if( !in.get(s) )
+        return false;
+      index[s] = strings.size();
+      strings.push_back(s);
+    }
+
+    if( !in.get(n) )
+      return false;
+    for(uint32_t i=0; i<n; ++i)
+    {
+      StrId id = 0;
+      if( !in.get_str(id, strings) )
+        return false;
+      incomplete.insert(id);
+    }
+
+    if( !get_objects(in, escapes) || !get_objects(in, locals) )
+      return false;
+
+    if( !in.get(n) )
+      return false;
+    for(uint32_t i=0; i<n; ++i)
+    {
+      Key key;
+      uint8_t bottom = 0;
+      uint32_t nvalues = 0;
+      if( !get_key(in, key) )
+        return false;
+      IntSamples &set = ints[key];
+      if( !in.get(bottom) || !in.get(set.num_samples) || !in.get(nvalues) )
+        return false;
+      set.bottom = bottom;
+      for(uint32_t j=0; j<nvalues; ++j)
+      {
+        uint64_t value = 0, freq = 0;
+        if( !in.get(value) || !in.get(freq) )
+          return false;
+        set.values[value] += freq;
+      }
+    }
+
+    if( !get_ptr_sites(in, ptrs) || !get_ptr_sites(in, objs) )
+      return false;
+
+    if( !in.get(n) )
+      return false;
+    for(uint32_t i=0; i<n; ++i)
+    {
+      Key key;
+      uint32_t members = 0;
+      if( !get_key(in, key) )
+        return false;
+      Residues &res = residues[key];
+      if( !in.get(res.num_samples) || !in.get(members) )
+        return false;
+      res.members = members;
+    }
+
+    return in.at_end();
+  }
+
+  // Print in the textual profile format.
+  void print(std::ostream &fout) const
+  {
+    static const char *names[NUM_EVENTS] = {
+      " malloc", "realloc", "   free", "  const", " global", "  stack",
+      "   +fcn", "   -fcn", "  +iter", "  -iter",
+      "    fuo", "  p int", "  p ptr", "residue" };
+
+    fout << "BEGIN SPEC PRIV PROFILE\n";
+    fout << "# Merged from " << num_runs << " runs\n";
+    fout << "# Event histogram:\n";
+    for(unsigned i=0; i<NUM_EVENTS; ++i)
+      fout << "# " << names[i] << ' ' << events[i] << '\n';
+    fout << "#\n";
+
+    if( incomplete.empty() )
+      fout << "COMPLETE ALLOCATION INFO ;\n";
+    for(std::set<StrId>::const_iterator i=incomplete.begin(), e=incomplete.end(); i!=e; ++i)
+      fout << "INCOMPLETE ALLOCATION INFO " << str(*i) << " ;\n";
+
+    for(ObjectMap::const_iterator i=escapes.begin(), e=escapes.end(); i!=e; ++i)
+      fout << "ESCAPE OBJECT " << str(i->first.item)
+           << " ESCAPES " << str(i->first.ctx)
+           << " COUNT " << i->second << " ;\n";
+
+    for(ObjectMap::const_iterator i=locals.begin(), e=locals.end(); i!=e; ++i)
+      if( !escapes.count(i->first) )
+        fout << "LOCAL OBJECT " << str(i->first.item)
+             << " IS LOCAL TO " << str(i->first.ctx)
+             << " COUNT " << i->second << " ;\n";
+
+    for(IntSiteMap::const_iterator i=ints.begin(), e=ints.end(); i!=e; ++i)
+    {
+      const IntSamples &set = i->second;
+      print_site(fout, "PRED INT", i->first, set.bottom, set.num_samples, set.values.size());
+      bool first = true;
+      for(std::map<uint64_t,uint64_t>::const_iterator j=set.values.begin(), z=set.values.end(); j!=z; ++j)
+      {
+        if( !first )
+          fout << " , ";
+        first = false;
+        fout << " ( INT " << j->first << " COUNT " << j->second << " ) ";
+      }
+      fout << " } ;\n";
+    }
+
+    print_ptr_sites(fout, "PRED PTR", ptrs);
+    print_ptr_sites(fout, "PRED OBJ", objs);
+
+    for(ResidueMap::const_iterator i=residues.begin(), e=residues.end(); i!=e; ++i)
+    {
+      const Residues &res = i->second;
+      unsigned pop_count = 0;
+      for(unsigned j=0; j<16; ++j)
+        if( res.members & (1u << j) )
+          ++pop_count;
+
+      fout << "PTR RESIDUES " << str(i->first.item) << " AT " << str(i->first.ctx)
+           << " AS RESTRICTED " << res.num_samples
+           << " SAMPLES OVER " << pop_count << " MEMBERS { ";
+      bool first = true;
+      for(unsigned j=0; j<16; ++j)
+        if( res.members & (1u << j) )
+        {
+          if( !first )
+            fout << " , ";
+          first = false;
+          fout << j;
+        }
+      fout << " } ;\n";
+    }
+
+    fout << "END SPEC PRIV PROFILE\n";
+  }
+
+private:
+  std::map<std::string,StrId> index;
+
+  static bool is_space(char c)
+  {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+  }
+
+  static uint32_t merge_capacity(uint32_t a, uint32_t b)
+  {
+    if( a == 0 )
+      return b;
+    if( b == 0 )
+      return a;
+    return std::min(a,b);
+  }
+
+  // Once a set has seen more distinct values than its capacity
+  // it is unpredictable, and we keep only its sample count.
+  template <class SetTy>
+  static void saturate(SetTy &set, uint32_t capacity)
+  {
+    if( capacity > 0 && set.values.size() > capacity )
+      set.bottom = true;
+    if( set.bottom )
+      set.values.clear();
+  }
+
+  static Key remap_key(const Key &key, const std::vector<StrId> &remap)
+  {
+    return Key( remap[key.item], remap[key.ctx] );
+  }
+
+  static void merge_objects(ObjectMap &mine, const ObjectMap &theirs, const std::vector<StrId> &remap)
+  {
+    for(ObjectMap::const_iterator i=theirs.begin(), e=theirs.end(); i!=e; ++i)
+      mine[ remap_key(i->first,remap) ] += i->second;
+  }
+
+  static void merge_samples(IntSamples &mine, const IntSamples &theirs, uint32_t capacity)
+  {
+    mine.num_samples += theirs.num_samples;
+    mine.bottom = mine.bottom || theirs.bottom;
+    for(std::map<uint64_t,uint64_t>::const_iterator i=theirs.values.begin(), e=theirs.values.end(); i!=e && !mine.bottom; ++i)
+      mine.values[ i->first ] += i->second;
+    saturate(mine, capacity);
+  }
+
+  static void merge_samples(PtrSamples &mine, const PtrSamples &theirs, const std::vector<StrId> &remap, uint32_t capacity)
+  {
+    mine.num_samples += theirs.num_samples;
+    mine.bottom = mine.bottom || theirs.bottom;
+    for(std::map<PtrSamples::Base,uint64_t>::const_iterator i=theirs.values.begin(), e=theirs.values.end(); i!=e && !mine.bottom; ++i)
+      mine.values[ PtrSamples::Base(remap[i->first.first], i->first.second) ] += i->second;
+    saturate(mine, capacity);
+  }
+
+  void print_site(std::ostream &fout, const char *kind, const Key &key, bool bottom, uint64_t num_samples, unsigned num_values) const
+  {
+    // Comment-out bottom samples
+    if( bottom )
+      fout << '#';
+    fout << kind << ' ' << str(key.item) << " AT " << str(key.ctx)
+         << " AS " << (bottom ? "UNPREDICTABLE " : "PREDICTABLE ")
+         << num_samples << " SAMPLES OVER " << num_values << " VALUES { ";
+  }
+
+  void print_ptr_sites(std::ostream &fout, const char *kind, const PtrSiteMap &sites) const
+  {
+    for(PtrSiteMap::const_iterator i=sites.begin(), e=sites.end(); i!=e; ++i)
+    {
+      const PtrSamples &set = i->second;
+      print_site(fout, kind, i->first, set.bottom, set.num_samples, set.values.size());
+      bool first = true;
+      for(std::map<PtrSamples::Base,uint64_t>::const_iterator j=set.values.begin(), z=set.values.end(); j!=z; ++j)
+      {
+        if( !first )
+          fout << " , ";
+        first = false;
+        fout << " ( OFFSET " << j->first.second << " BASE " << str(j->first.first)
+             << " COUNT " << j->second << " ) ";
+      }
+      fout << " } ;\n";
+    }
+  }
+
+  // Encoding helpers
+  static void put32(std::string &buf, uint32_t v)
+  {
+    buf.append( (const char *) &v, sizeof(v) );
+  }
+
+  static void put64(std::string &buf, uint64_t v)
+  {
+    buf.append( (const char *) &v, sizeof(v) );
+  }
+
+  static void put_key(std::string &buf, const Key &key)
+  {
+    put32(buf, key.item);
+    put32(buf, key.ctx);
+  }
+
+  static void put_objects(std::string &buf, const ObjectMap &objects)
+  {
+    put32(buf, objects.size());
+    for(ObjectMap::const_iterator i=objects.begin(), e=objects.end(); i!=e; ++i)
+    {
+      put_key(buf, i->first);
+      put64(buf, i->second);
+    }
+  }
+
+  static void put_ptr_sites(std::string &buf, const PtrSiteMap &sites)
+  {
+    put32(buf, sites.size());
+    for(PtrSiteMap::const_iterator i=sites.begin(), e=sites.end(); i!=e; ++i)
+    {
+      put_key(buf, i->first);
+      buf.push_back( i->second.bottom );
+      put64(buf, i->second.num_samples);
+      put32(buf, i->second.values.size());
+      for(std::map<PtrSamples::Base,uint64_t>::const_iterator j=i->second.values.begin(), z=i->second.values.end(); j!=z; ++j)
+      {
+        put32(buf, j->first.first);
+        put64(buf, j->first.second);
+        put64(buf, j->second);
+      }
+    }
+  }
+
+  // Decoding helpers; every read is bounds-checked.
+  struct Cursor
+  {
+    Cursor(const std::vector<char> &b) : buf(b), pos(0) {}
+
+    const std::vector<char> &buf;
+    size_t pos;
+
+    bool raw(void *out, size_t n)
+    {
+      if( buf.size() - pos < n )
+        return false;
+      std::copy(buf.begin() + pos, buf.begin() + pos + n, (char *) out);
+      pos += n;
+      return true;
+    }
+
+    template <class Int>
+    bool get(Int &out) { return raw(&out, sizeof(out)); }
+
+    bool get(std::string &out)
+    {
+      uint32_t len = 0;
+      if( !get(len) || buf.size() - pos < len )
+        return false;
+      out.assign( buf.begin() + pos, buf.begin() + pos + len );
+      pos += len;
+      return true;
+    }
+
+    // A string id, which must name an entry of the string table.
+    bool get_str(StrId &out, const std::vector<std::string> &strings)
+    {
+      return get(out) && out < strings.size();
+    }
+
+    bool magic()
+    {
+      char m[ SPECPRIV_BINPROFILE_MAGIC_LEN ];
+      return raw(m, sizeof(m)) && std::equal(m, m + sizeof(m), SPECPRIV_BINPROFILE_MAGIC);
+    }
+
+    bool at_end() const { return pos == buf.size(); }
+  };
+
+  static bool slurp(const char *filename, std::vector<char> &buf)
+  {
+    FILE *fin = fopen(filename, "rb");
+    if( !fin )
+      return false;
+
+    bool ok = fseek(fin, 0, SEEK_END) == 0;
+    const long size = ok ? ftell(fin) : -1;
+    ok = ok && size >= 0 && fseek(fin, 0, SEEK_SET) == 0;
+    if( ok )
+    {
+      buf.resize(size);
+      ok = fread(buf.data(), 1, size, fin) == (size_t) size;
+    }
+
+    fclose(fin);
+    return ok;
+  }
+
+  bool get_key(Cursor &in, Key &key) const
+  {
+    return in.get_str(key.item, strings) && in.get_str(key.ctx, strings);
+  }
+
+  bool get_objects(Cursor &in, ObjectMap &objects) const
+  {
+    uint32_t n = 0;
+    if( !in.get(n) )
+      return false;
+    for(uint32_t i=0; i<n; ++i)
+    {
+      Key key;
+      uint64_t count = 0;
+      if( !get_key(in, key) || !in.get(count) )
+        return false;
+      objects[key] += count;
+    }
+    return true;
+  }
+
+  bool get_ptr_sites(Cursor &in, PtrSiteMap &sites) const
+  {
+    uint32_t n = 0;
+    if( !in.get(n) )
+      return false;
+    for(uint32_t i=0; i<n; ++i)
+    {
+      Key key;
+      uint8_t bottom = 0;
+      uint32_t nvalues = 0;
+      if( !get_key(in, key) )
+        return false;
+      PtrSamples &set = sites[key];
+      if( !in.get(bottom) || !in.get(set.num_samples) || !in.get(nvalues) )
+        return false;
+      set.bottom = bottom;
+      for(uint32_t j=0; j<nvalues; ++j)
+      {
+        StrId au = 0;
+        uint64_t offset = 0, freq = 0;
+        if( !in.get_str(au, strings) || !in.get(offset) || !in.get(freq) )
+          return false;
+        set.values[ PtrSamples::Base(au,offset) ] += freq;
+      }
+    }
+    return true;
+  }
+};
+
+#endif
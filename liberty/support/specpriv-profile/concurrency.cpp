@@ -0,0 +1,5 @@
+
+#include "concurrency.h"
+
+bool Concurrency::on = false;
+
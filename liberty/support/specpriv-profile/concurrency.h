@@ -0,0 +1,53 @@
+#ifndef SPECPRIV_CONCURRENCY_H
+#define SPECPRIV_CONCURRENCY_H
+
+#include <pthread.h>
+
+// The profiler drains one queue per thread of the program under
+// test, each in its own consumer thread.  Until the program spawns
+// its second thread, there is only one consumer and we skip all
+// synchronization.  The first consumer flips this switch at a
+// point where it holds no references, just before it starts the
+// second consumer; it is never switched back off.
+struct Concurrency
+{
+  static bool enabled() { return on; }
+  static void enable() { on = true; }
+
+private:
+  static bool on;
+};
+
+// A mutex which is only taken once the profiler is concurrent.
+struct ProfLock
+{
+  ProfLock() { pthread_mutex_init(&mutex, 0); }
+  ~ProfLock() { pthread_mutex_destroy(&mutex); }
+
+  void lock() { pthread_mutex_lock(&mutex); }
+  void unlock() { pthread_mutex_unlock(&mutex); }
+
+private:
+  pthread_mutex_t mutex;
+};
+
+struct ScopedProfLock
+{
+  ScopedProfLock(ProfLock &l) : lock( Concurrency::enabled() ? &l : 0 )
+  {
+    if( lock )
+      lock->lock();
+  }
+
+  ~ScopedProfLock()
+  {
+    if( lock )
+      lock->unlock();
+  }
+
+private:
+  ProfLock *lock;
+};
+
+#endif
+
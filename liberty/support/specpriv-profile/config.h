@@ -24,5 +24,20 @@
 
 #define TIMER                               (0)
 
+// The live-object page directory maps each 2^PAGE_DIR_PAGE_BITS
+// byte page to at most PAGE_DIR_WAYS allocation units which
+// overlap it.  Pages shared by more objects than that, and
+// objects which span more than PAGE_DIR_MAX_PAGES pages, are
+// resolved by the interval maps instead.
+#define PAGE_DIR_PAGE_BITS                  (12U)
+#define PAGE_DIR_WAYS                       (4U)
+#define PAGE_DIR_MAX_PAGES                  (1U << 18)
+
+// The maximum number of simultaneously live threads in
+// the program under test.  Each needs its own queue.
+#define PROF_MAX_THREADS                    (32U)
+
+#include "sites.h"
+
 #endif
 
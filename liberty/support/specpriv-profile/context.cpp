@@ -1,13 +1,55 @@
+
 #include "context.h"
+#include "concurrency.h"
+
+// Contexts are shared among consumer threads through
+// the allocation units which reference them.
+static ProfLock contextsLock;
 
-static void flatten(CtxHolder ctx, std::vector<CtxHolder> &result)
+static std::vector<Context *> &allContexts()
 {
-  if( ctx.is_null() )
-    return;
+  static std::vector<Context *> contexts;
+  return contexts;
+}
 
-  result.push_back( ctx );
+Context::Context(CtxType t)
+  : RefCount(), type(t), name(0), name_id(0), parent(0), depth(0), lastChild(0)
+{
+  ScopedProfLock guard(contextsLock);
+  id = allContexts().size();
+  allContexts().push_back(this);
+}
 
-  flatten(ctx->parent, result);
+Context *Context::lookup(CtxId id)
+{
+  ScopedProfLock guard(contextsLock);
+  return allContexts()[id];
+}
+
+Context *Context::child(CtxType t, const char *n, bool *created)
+{
+  if( lastChild && lastChild->name == n && lastChild->type == t )
+    return lastChild;
+
+  const NameId nid = NameTable::intern(n);
+  CtxHolder &slot = children[ (((uint64_t)nid) << 2) | t ];
+  if( slot.is_null() )
+  {
+    Context *c = new Context(t);
+    c->name = n;
+    c->name_id = nid;
+    c->parent = this;
+    c->depth = depth + 1;
+
+    // The child table keeps this context alive
+    // for the remainder of the run.
+    slot = c;
+
+    if( created )
+      *created = true;
+  }
+
+  return lastChild = *slot;
 }
 
 CtxHolder Context::innermostFunction()
@@ -21,52 +63,31 @@ CtxHolder Context::innermostFunction()
 
 CtxHolder Context::findCommon(const CtxHolder &other)
 {
-  std::vector<CtxHolder> a, b;
-  flatten(this,a);
-  flatten(other,b);
+  Context *a = this;
+  const Context *b = *other;
 
-  const unsigned N=a.size(), M=b.size();
-  unsigned lastGood = 0;
-  for(unsigned i=1; i<=std::min(N,M); ++i)
+  while( a->depth > b->depth )
+    a = *a->parent;
+  while( b->depth > a->depth )
+    b = *b->parent;
+
+  // Each consumer thread has its own context tree; contexts
+  // from different threads only share the implicit TOP.
+  while( a != b && a->depth > 0 )
   {
-    if( a[N-i] == b[M-i] )
-      lastGood = i;
-    else
-      return a[N-lastGood];
+    a = *a->parent;
+    b = *b->parent;
   }
 
-  return a[N-lastGood];
+  return a;
 }
 
-bool Context::operator==(const Context &other) const
+Context *Context::translate(Context *root)
 {
-  if( type != other.type )
-    return false;
-  else if( name != other.name )
-    return false;
-  else
-    return parent == other.parent;
-}
+  if( depth == 0 )
+    return root;
 
-bool Context::operator<(const Context &other) const
-{
-  if( type < other.type )
-    return true;
-  else if( type > other.type )
-    return false;
-
-  else if( name < other.name )
-    return true;
-  else if( name > other.name )
-    return false;
-
-  else if( parent.is_null() && !other.parent.is_null() )
-    return true;
-  else if( !parent.is_null() && other.parent.is_null() )
-    return false;
-
-  else
-    return parent < other.parent;
+  return parent->translate(root)->child(type,name);
 }
 
 void Context::print(std::ostream &fout) const
@@ -95,6 +116,3 @@ std::ostream &operator<<(std::ostream &fout, const CtxHolder &ctx)
 
   return fout;
 }
-
-
-
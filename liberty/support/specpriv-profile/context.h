@@ -7,25 +7,53 @@
 #include <vector>
 
 #include "holder.h"
+#include "intern.h"
+#include "flatmap.h"
 
 // The active caller/loop context.
 struct Context;
 typedef Holder<Context> CtxHolder;
 
+typedef uint32_t CtxId;
+
 enum CtxType { Top=0, Function, Loop };
+
+// Contexts are hash-consed: there is exactly one Context object
+// for each (type, name, parent) path.  Thus, contexts can be
+// compared by identity, and entering a context which we have
+// seen before is a lookup in the parent's child table rather
+// than an allocation.
 struct Context : public RefCount
 {
-  Context(CtxType t = Top) : RefCount(), type(t), name(0), parent(0) {}
+  Context(CtxType t = Top);
 
   CtxType type;
   const char *name;
+  NameId name_id;
   CtxHolder parent;
 
+  // Dense identifier, unique among all contexts.
+  CtxId id;
+  unsigned depth;
+
+  // Find or create the child context (t, n) of this context;
+  // sets *created if it is new.
+  Context *child(CtxType t, const char *n, bool *created = 0);
+
+  static Context *lookup(CtxId id);
+
+  // Find or create the context with the same path as
+  // this one, but within the context tree under root.
+  Context *translate(Context *root);
+
   CtxHolder innermostFunction();
+
+  // Innermost common ancestor, or this context's
+  // root if the contexts belong to different threads.
   CtxHolder findCommon(const CtxHolder &other);
 
-  bool operator==(const Context &other) const;
-  bool operator<(const Context &other) const;
+  bool operator==(const Context &other) const { return this == &other; }
+  bool operator<(const Context &other) const { return id < other.id; }
 
   void print(std::ostream &fout) const;
 
@@ -33,6 +61,14 @@ struct Context : public RefCount
   // However, that creates a static cycle among types :(
   typedef std::vector<Holder< RefCount > > AUs;
   AUs aus;
+
+private:
+  typedef FlatMap<uint64_t, CtxHolder, U64Hash> Children;
+  Children children;
+
+  // Most recently entered child; loops re-enter
+  // the same iteration context over and over.
+  Context *lastChild;
 };
 
 std::ostream &operator<<(std::ostream &fout, const CtxHolder &ctx);
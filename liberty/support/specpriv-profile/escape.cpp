@@ -1,49 +1,108 @@
+
 #include "escape.h"
 
-void EscapeTable::report_escape(const AUHolder &au, const CtxHolder &ctx)
+#include <sstream>
+
+Escape::Escape(const AUHolder &au, const CtxHolder &cc)
+  : type(au->type), name(au->name_id),
+    creation( au->creation.is_null() ? ~0u : au->creation->id ),
+    ctx( cc->id )
 {
-  Escape key(au,ctx);
-  ++escapeFrequencies[key];
 }
 
-void EscapeTable::report_local(const AUHolder &au, const CtxHolder &ctx)
+void EscapeTable::count(EscapeMap &map, const AUHolder &au, const CtxHolder &ctx, unsigned n)
+{
+  EscapeCount &entry = map[ Escape(au,ctx) ];
+  if( entry.au.is_null() )
+  {
+    entry.au = au;
+    entry.ctx = ctx;
+  }
+  entry.count += n;
+}
+
+void EscapeTable::merge(EscapeMap &map, const EscapeMap &other, Context *root)
 {
-  for(CtxHolder cc=ctx; !cc.is_null(); cc=cc->parent)
+  for(EscapeMap::const_slot_iterator i=other.slot_begin(), e=other.slot_end(); i!=e; ++i)
   {
-    Escape key(au,cc);
-    ++localFrequencies[key];
+    if( !i->used )
+      continue;
+
+    const EscapeCount &entry = i->value;
+    Context *ctx = (Context*) *entry.ctx;
+    count(map, translate(entry.au,root), ctx->translate(root), entry.count);
   }
 }
+
+void EscapeTable::merge(const EscapeTable &other, Context *root)
+{
+  merge(escapeFrequencies, other.escapeFrequencies, root);
+  merge(localFrequencies, other.localFrequencies, root);
+}
+
+void EscapeTable::report_escape(const AUHolder &au, const CtxHolder &ctx)
+{
+  count(escapeFrequencies, au, ctx);
+}
+
+void EscapeTable::report_local(const AUHolder &au, const CtxHolder &ctx)
+{
+  for(Context *cc=(Context*)*ctx; cc; cc=(Context*)*cc->parent)
+    count(localFrequencies, au, cc);
+}
 void EscapeTable::print(std::ostream &fout) const
 {
-  for(EscapeMap::const_iterator i=escapeFrequencies.begin(), e=escapeFrequencies.end(); i!=e; ++i)
+  for(EscapeMap::const_slot_iterator i=escapeFrequencies.slot_begin(), e=escapeFrequencies.slot_end(); i!=e; ++i)
   {
-    AUHolder au = i->first.first;
-    CtxHolder ctx = i->first.second;
-    unsigned count = i->second;
+    if( !i->used )
+      continue;
 
-    fout << "ESCAPE OBJECT " << au << " ESCAPES " << ctx << " COUNT " << count << " ;\n";
+    const EscapeCount &entry = i->value;
+
+    fout << "ESCAPE OBJECT " << entry.au << " ESCAPES " << entry.ctx << " COUNT " << entry.count << " ;\n";
   }
 
-  for(EscapeMap::const_iterator i=localFrequencies.begin(), e=localFrequencies.end(); i!=e; ++i)
+  for(EscapeMap::const_slot_iterator i=localFrequencies.slot_begin(), e=localFrequencies.slot_end(); i!=e; ++i)
   {
-    Escape key = i->first;
+    if( !i->used )
+      continue;
 
-    if( escapeFrequencies.count(key) )
+    if( escapeFrequencies.find(i->key) )
       continue;
 
-    unsigned count = i->second;
+    const EscapeCount &entry = i->value;
 
-    fout << "LOCAL OBJECT " << key.first << " IS LOCAL TO " << key.second << " COUNT " << count << " ;\n";
+    fout << "LOCAL OBJECT " << entry.au << " IS LOCAL TO " << entry.ctx << " COUNT " << entry.count << " ;\n";
   }
 
 
 }
 
+void EscapeTable::serialize(BinaryProfile &out, BinaryProfile::ObjectMap &objects, const EscapeMap &map)
+{
+  for(EscapeMap::const_slot_iterator i=map.slot_begin(), e=map.slot_end(); i!=e; ++i)
+  {
+    if( !i->used )
+      continue;
+
+    const EscapeCount &entry = i->value;
+
+    std::ostringstream au, ctx;
+    au << entry.au;
+    ctx << entry.ctx;
+
+    objects[ BinaryProfile::Key( out.intern(au.str()), out.intern(ctx.str()) ) ] += entry.count;
+  }
+}
+
+void EscapeTable::serialize(BinaryProfile &out) const
+{
+  serialize(out, out.escapes, escapeFrequencies);
+  serialize(out, out.locals, localFrequencies);
+}
+
 std::ostream &operator<<(std::ostream &fout, const EscapeTable &et)
 {
   et.print(fout);
   return fout;
 }
-
-
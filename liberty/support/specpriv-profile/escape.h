@@ -4,21 +4,71 @@
 #include "holder.h"
 #include "live.h"
 #include "context.h"
+#include "flatmap.h"
+#include "binprofile.h"
 
 #include <ostream>
 
-typedef std::pair<AUHolder, CtxHolder> Escape;
+// Allocation units are tabulated by their equivalence
+// class (type, name, creation context); see
+// AllocationUnit::operator==.
+struct Escape
+{
+  Escape() : type(AU_Null), name(0), creation(0), ctx(0) {}
+  Escape(const AUHolder &, const CtxHolder &);
+
+  AUType type;
+  NameId name;
+  CtxId  creation;
+  CtxId  ctx;
+
+  bool operator==(const Escape &other) const
+  {
+    return type == other.type
+    &&     name == other.name
+    &&     creation == other.creation
+    &&     ctx == other.ctx;
+  }
+};
+
+struct EscapeHash
+{
+  uint64_t operator()(const Escape &key) const
+  {
+    return flatmap_mix( ((((uint64_t)key.name) << 32) | key.creation)
+                      ^ ((((uint64_t)key.ctx) << 8) | key.type) * 0x9e3779b97f4a7c15ull );
+  }
+};
+
+struct EscapeCount
+{
+  EscapeCount() : au(0), ctx(0), count(0) {}
+
+  // A representative of the equivalence class, for printing.
+  AUHolder  au;
+  CtxHolder ctx;
+  unsigned  count;
+};
 
 struct EscapeTable
 {
   void report_escape(const AUHolder &, const CtxHolder &);
   void report_local(const AUHolder &, const CtxHolder &);
 
+  // Fold another thread's table into this one,
+  // translating contexts into the tree under root.
+  void merge(const EscapeTable &other, Context *root);
+
   void print(std::ostream &fout) const;
+  void serialize(BinaryProfile &out) const;
 
 private:
-  typedef std::map<Escape,unsigned> EscapeMap;
+  typedef FlatMap<Escape,EscapeCount,EscapeHash> EscapeMap;
   EscapeMap escapeFrequencies, localFrequencies;
+
+  static void count(EscapeMap &map, const AUHolder &, const CtxHolder &, unsigned n=1);
+  static void merge(EscapeMap &map, const EscapeMap &other, Context *root);
+  static void serialize(BinaryProfile &out, BinaryProfile::ObjectMap &objects, const EscapeMap &map);
 };
 
 std::ostream &operator<<(std::ostream &fout, const EscapeTable &et);
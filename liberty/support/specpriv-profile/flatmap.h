@@ -0,0 +1,113 @@
+#ifndef SPECPRIV_FLATMAP_H
+#define SPECPRIV_FLATMAP_H
+
+#include <stdint.h>
+#include <vector>
+
+// A small open-addressing hash map with linear probing.
+// Entries live in one contiguous array, so a lookup touches
+// one or two cache lines instead of walking a tree.
+//
+// Key must support ==, and Hash must map a Key to uint64_t.
+// There is no erase(); profile tables only ever grow.
+template <class Key, class Value, class Hash>
+struct FlatMap
+{
+  struct Slot
+  {
+    Slot() : used(false), key(), value() {}
+
+    bool  used;
+    Key   key;
+    Value value;
+  };
+
+  typedef Value mapped_type;
+  typedef std::vector<Slot> Slots;
+  typedef typename Slots::const_iterator const_slot_iterator;
+
+  FlatMap() : slots(16), num_entries(0) {}
+
+  Value &operator[](const Key &key)
+  {
+    Slot &slot = probe(slots, key);
+    if( slot.used )
+      return slot.value;
+
+    if( 2 * (num_entries + 1) > slots.size() )
+    {
+      grow();
+      return insert(key);
+    }
+
+    ++num_entries;
+    slot.used = true;
+    slot.key = key;
+    return slot.value;
+  }
+
+  const Value *find(const Key &key) const
+  {
+    const Slot &slot = probe(const_cast<Slots &>(slots), key);
+    return slot.used ? &slot.value : 0;
+  }
+
+  unsigned size() const { return num_entries; }
+
+  // Iterate over all slots; skip those which are not .used
+  const_slot_iterator slot_begin() const { return slots.begin(); }
+  const_slot_iterator slot_end() const { return slots.end(); }
+
+private:
+  Slots    slots;
+  unsigned num_entries;
+
+  static Slot &probe(Slots &table, const Key &key)
+  {
+    const uint64_t mask = table.size() - 1;
+    for(uint64_t i = Hash()(key) & mask; ; i = (i+1) & mask)
+    {
+      Slot &slot = table[i];
+      if( !slot.used || slot.key == key )
+        return slot;
+    }
+  }
+
+  Value &insert(const Key &key)
+  {
+    Slot &slot = probe(slots, key);
+    ++num_entries;
+    slot.used = true;
+    slot.key = key;
+    return slot.value;
+  }
+
+  void grow()
+  {
+    Slots bigger( 2 * slots.size() );
+    for(unsigned i=0, N=slots.size(); i<N; ++i)
+      if( slots[i].used )
+      {
+        Slot &slot = probe(bigger, slots[i].key);
+        slot = slots[i];
+      }
+    slots.swap(bigger);
+  }
+};
+
+// A good-enough mixer for 64-bit keys.
+static inline uint64_t flatmap_mix(uint64_t x)
+{
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdull;
+  x ^= x >> 33;
+  return x;
+}
+
+struct U64Hash
+{
+  uint64_t operator()(uint64_t key) const { return flatmap_mix(key); }
+};
+
+#endif
+
@@ -1,5 +1,22 @@
 #include "holder.h"
+#include "concurrency.h"
 
-void RefCount::incref() { ++refcount; }
-void RefCount::decref() { if( 1 > --refcount ) delete this; }
+void RefCount::incref()
+{
+  if( Concurrency::enabled() )
+    __atomic_add_fetch(&refcount, 1, __ATOMIC_RELAXED);
+  else
+    ++refcount;
+}
+
+void RefCount::decref()
+{
+  if( Concurrency::enabled() )
+  {
+    if( 1 > __atomic_sub_fetch(&refcount, 1, __ATOMIC_ACQ_REL) )
+      delete this;
+  }
+  else if( 1 > --refcount )
+    delete this;
+}
 
@@ -0,0 +1,69 @@
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "intern.h"
+#include "flatmap.h"
+#include "concurrency.h"
+
+namespace
+{
+  typedef FlatMap<uint64_t, NameId, U64Hash> PointerCache;
+
+  struct Names
+  {
+    Names() : byId(1, (const char*)0) {}
+
+    // Different pointers to equal strings.
+    std::unordered_map<std::string, NameId> byString;
+    std::vector<const char *> byId;
+
+    ProfLock lock;
+  };
+
+  // Fast path: the same call site always passes the same pointer.
+  // Each consumer thread keeps its own cache, so the fast path
+  // needs no synchronization.
+  thread_local PointerCache byPointer;
+
+  Names &names()
+  {
+    static Names theNames;
+    return theNames;
+  }
+}
+
+NameId NameTable::intern(const char *name)
+{
+  if( !name )
+    return 0;
+
+  const NameId *known = byPointer.find( (uint64_t)name );
+  if( known )
+    return *known;
+
+  Names &table = names();
+  ScopedProfLock guard(table.lock);
+
+  NameId id;
+  std::unordered_map<std::string, NameId>::iterator j = table.byString.find(name);
+  if( j != table.byString.end() )
+    id = j->second;
+  else
+  {
+    id = table.byId.size();
+    table.byId.push_back(name);
+    table.byString[name] = id;
+  }
+
+  byPointer[ (uint64_t)name ] = id;
+  return id;
+}
+
+const char *NameTable::lookup(NameId id)
+{
+  Names &table = names();
+  ScopedProfLock guard(table.lock);
+  return table.byId[id];
+}
+
@@ -0,0 +1,19 @@
+#ifndef SPECPRIV_INTERN_H
+#define SPECPRIV_INTERN_H
+
+#include <stdint.h>
+
+// Instrumentation passes names as pointers to constant
+// strings.  Distinct pointers may name the same string, so
+// we intern them into dense ids which are cheap to hash and
+// compare.  Id 0 is reserved for the null name.
+typedef uint32_t NameId;
+
+struct NameTable
+{
+  static NameId intern(const char *name);
+  static const char *lookup(NameId id);
+};
+
+#endif
+
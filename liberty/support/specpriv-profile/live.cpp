@@ -27,9 +27,9 @@ bool AllocationUnit::operator<(const AllocationUnit &other) const
   else if( type > other.type )
     return false;
 
-  else if( name < other.name )
+  else if( name_id < other.name_id )
     return true;
-  else if( name > other.name )
+  else if( name_id > other.name_id )
     return false;
 
   else
@@ -73,8 +73,24 @@ uint64_t operator-(void *ptr, const AUHolder &au)
   return addr - interval.low;
 }
 
+AUHolder translate(const AUHolder &au, Context *root)
+{
+  if( au.is_null() || au->creation.is_null() )
+    return au;
+
+  Context *creation = (Context*) *au->creation;
+  Context *translated = creation->translate(root);
+  if( translated == creation )
+    return au;
+
+  AUHolder copy = new AllocationUnit(au->type, au->extents, au->name, translated);
+  copy->attrs.realloc_shrink_excess = au->attrs.realloc_shrink_excess;
+  return copy;
+}
+
 bool AllocationUnitTable::count(const right_open_interval &key) const
 {
+  ScopedProfLock guard(lock);
   return temporaries.count(key) || permanents.count(key);
 }
 
@@ -83,10 +99,18 @@ AUHolder AllocationUnitTable::lookupPointer(void *ptr)
   if( !ptr )
     return AllocationUnit::Null();
 
+  ScopedProfLock guard(lock);
+
   if( ! mostRecentlyUsed.is_null() )
     if( mostRecentlyUsed->extents.includes(ptr) )
       return mostRecentlyUsed;
 
+  // Common case: the page directory knows
+  // every object which overlaps this page.
+  AllocationUnit *page_hit = pages.lookup(ptr);
+  if( page_hit )
+    return mostRecentlyUsed = page_hit;
+
   right_open_interval key(ptr);
 
   // First look for proper inclusion in temporary AUs...
@@ -146,6 +170,8 @@ AUHolder AllocationUnitTable::add_temporary(AUType type, const right_open_interv
 
 AUHolder AllocationUnitTable::add_temporary(const AUHolder &au)
 {
+  ScopedProfLock guard(lock);
+
   /* moved to Profiler::add_temporary_au
   AllocationUnitMap::iterator i = temporaries.find( au->extents  );
   if( temporaries.count( au->extents ) )
@@ -168,7 +194,7 @@ AUHolder AllocationUnitTable::add_temporary(const AUHolder &au)
     // the excess after shrinking an object with realloc().
     else if( i->second->attrs.realloc_shrink_excess )
     {
-      temporaries.erase(i);
+      erase(temporaries, i);
     }
 
     else
@@ -190,7 +216,7 @@ AUHolder AllocationUnitTable::add_temporary(const AUHolder &au)
   }
 
   trailing_assert( !permanents.count( au->extents ) && "repeat address t-p" );
-  temporaries[ au->extents ] = au;
+  insert(temporaries, au);
   if( DEBUG )
     fprintf(stderr, "+T [%lx, %lx)   %s\n", au->extents.low, au->extents.high, au->name);
   if( temporaries.size() > peak_temporaries )
@@ -201,6 +227,8 @@ AUHolder AllocationUnitTable::add_temporary(const AUHolder &au)
 AUHolder AllocationUnitTable::add_permanent(AUType type, const right_open_interval &extents, const char *name, const CtxHolder &ctx)
 {
   AUHolder au = new AllocationUnit(type,extents,name,ctx);
+
+  ScopedProfLock guard(lock);
   trailing_assert( !temporaries.count( au->extents ) && "repeat address p-t" );
 
   // Unfortunately, constant variables in llvm
@@ -244,7 +272,7 @@ AUHolder AllocationUnitTable::add_permanent(AUType type, const right_open_interv
       else if( collision->extents.is_wholly_within( au->extents ) )
       {
         // slightly harder; replace old constant with new one.
-        permanents.erase( i );
+        erase(permanents, i);
       }
       else if( au->extents.low < collision->extents.low )
       {
@@ -254,15 +282,15 @@ AUHolder AllocationUnitTable::add_permanent(AUType type, const right_open_interv
       else
       {
         // Update the old AU's extents so it doesn't collide.
-        permanents.erase( i );
+        erase(permanents, i);
         collision->extents.high = au->extents.low;
-        permanents[ collision->extents ] = collision;
+        insert(permanents, collision);
       }
     }
   }
 
   trailing_assert( !permanents.count( au->extents ) && "repeat address p-p" );
-  permanents[ au->extents ] = au;
+  insert(permanents, au);
   if( DEBUG )
     fprintf(stderr, "+P [%lx, %lx)   %s\n", au->extents.low, au->extents.high, au->name);
   if( permanents.size() > peak_permanents )
@@ -272,22 +300,38 @@ AUHolder AllocationUnitTable::add_permanent(AUType type, const right_open_interv
 
 void AllocationUnitTable::remove(const AUHolder &au)
 {
+  ScopedProfLock guard(lock);
   AllocationUnitMap::iterator i = temporaries.find( au->extents );
   trailing_assert( i != temporaries.end() && "Can't remove");
 
   if( au == mostRecentlyUsed )
     mostRecentlyUsed = 0;
 
-  temporaries.erase(i);
+  erase(temporaries, i);
   if( DEBUG )
     fprintf(stderr, "-T [%lx, %lx)   %s\n", au->extents.low, au->extents.high, au->name);
 }
 
+void AllocationUnitTable::insert(AllocationUnitMap &map, const AUHolder &au)
+{
+  map[ au->extents ] = au;
+  pages.insert( (AllocationUnit*) *au );
+}
+
+void AllocationUnitTable::erase(AllocationUnitMap &map, AllocationUnitMap::iterator i)
+{
+  // Unindex before the map drops its reference.
+  pages.remove( *i->second );
+  map.erase(i);
+}
+
 void AllocationUnitTable::print(std::ostream &fout) const
 {
   fout << "# Peak temporaries " << peak_temporaries << '\n';
   fout << "# Peak permanents " << peak_permanents << '\n';
   fout << "# Split constants " << num_split_constants << '\n';
+  fout << "# Spilled directory pages " << pages.num_spilled_pages << '\n';
+  fout << "# Unindexed AUs " << pages.num_unindexed_aus << '\n';
 }
 
 std::ostream &operator<<(std::ostream &fout, const right_open_interval &roi)
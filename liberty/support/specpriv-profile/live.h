@@ -9,6 +9,9 @@
 
 #include "holder.h"
 #include "context.h"
+#include "pagedir.h"
+#include "intern.h"
+#include "concurrency.h"
 
 
 // Represents the range [low,hi)
@@ -45,9 +48,14 @@ struct right_open_interval
 enum AUType { AU_Null=0, AU_Unknown, AU_Constant, AU_Global, AU_Stack, AU_Heap };
 struct AUAttributes
 {
-  AUAttributes() : realloc_shrink_excess(false) {}
+  AUAttributes() : realloc_shrink_excess(false), freed_by_other_thread(false) {}
 
   bool                realloc_shrink_excess:1;
+
+  // Set (atomically) by the consumer which processed the free(),
+  // when the object lives in another thread's context list.
+  // The owner drops it from its list lazily.
+  bool                freed_by_other_thread;
 };
 struct AllocationUnit : public RefCount
 {
@@ -55,11 +63,22 @@ struct AllocationUnit : public RefCount
   AUAttributes        attrs;
   right_open_interval extents;
   const char        * name;
+  NameId              name_id;
   CtxHolder           creation;
   CtxHolder           deletion;
 
   AllocationUnit(AUType t=AU_Unknown, const right_open_interval &e=(void*)0, const char *n=0, const CtxHolder &c=0)
-    : RefCount(), type(t), attrs(), extents(e), name(n), creation(c) {}
+    : RefCount(), type(t), attrs(), extents(e), name(n), name_id(NameTable::intern(n)), creation(c) {}
+
+  bool is_freed_by_other_thread() const
+  {
+    return __atomic_load_n(&attrs.freed_by_other_thread, __ATOMIC_ACQUIRE);
+  }
+
+  void set_freed_by_other_thread()
+  {
+    __atomic_store_n(&attrs.freed_by_other_thread, true, __ATOMIC_RELEASE);
+  }
 
   static AllocationUnit *Null() { return new AllocationUnit(AU_Null); }
   static AllocationUnit *Unknown() { return new AllocationUnit(AU_Unknown); }
@@ -67,7 +86,7 @@ struct AllocationUnit : public RefCount
   bool operator==(const AllocationUnit &other) const
   {
     return type == other.type
-    &&     name == other.name
+    &&     name_id == other.name_id
 //    &&     extents == other.extents
     &&     creation == other.creation;
   }
@@ -86,6 +105,10 @@ std::ostream &operator<<(std::ostream &fout, const AUHolder &au);
 // Determine offset of pointer within allocation unit.
 uint64_t operator-(void *, const AUHolder &);
 
+// An equivalent AU whose creation context is
+// translated into the context tree under root.
+AUHolder translate(const AUHolder &au, Context *root);
+
 struct AllocationUnitTable
 {
   AllocationUnitTable()
@@ -110,6 +133,16 @@ private:
   AllocationUnitMap permanents, temporaries;
   AUHolder  mostRecentlyUsed;
 
+  // Constant-time lookup for the common case;
+  // the maps above are the fallback.
+  PageDirectory pages;
+
+  // The table is shared by all consumer threads.
+  mutable ProfLock lock;
+
+  void insert(AllocationUnitMap &map, const AUHolder &au);
+  void erase(AllocationUnitMap &map, AllocationUnitMap::iterator i);
+
   // statistics
   unsigned peak_permanents, peak_temporaries;
   unsigned num_split_constants;
@@ -0,0 +1,138 @@
+// specpriv-profile-merge
+//
+// Fold the binary SpecPriv profiles (result.specpriv.profile.bin)
+// of several runs, e.g. one per input, into a single profile.
+//
+//  usage: specpriv-profile-merge [-j threads] [-text] -o output input...
+//
+// Inputs are split among worker threads, each of which reads and
+// folds its share; the partial results are then folded pairwise.
+// Since merging is associative, the result does not depend on
+// the grouping.  With -text, the output is written in the textual
+// profile format instead.
+
+#include "binprofile.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+  struct Worker
+  {
+    Worker() : ok(true) {}
+
+    std::vector<const char *> inputs;
+    BinaryProfile result;
+    bool ok;
+
+    void run()
+    {
+      for(unsigned i=0; i<inputs.size(); ++i)
+      {
+        BinaryProfile one;
+        if( !one.read(inputs[i]) )
+        {
+          fprintf(stderr, "specpriv-profile-merge: cannot read %s\n", inputs[i]);
+          ok = false;
+          continue;
+        }
+
+        if( i == 0 )
+          result = one;
+        else
+          result.merge(one);
+      }
+    }
+  };
+
+  void usage(const char *argv0)
+  {
+    fprintf(stderr, "usage: %s [-j threads] [-text] -o output input...\n", argv0);
+    exit(1);
+  }
+}
+
+int main(int argc, char **argv)
+{
+  unsigned num_threads = std::thread::hardware_concurrency();
+  bool text = false;
+  const char *output = 0;
+  std::vector<const char *> inputs;
+
+  for(int i=1; i<argc; ++i)
+  {
+    if( !strcmp(argv[i], "-j") && i+1 < argc )
+      num_threads = atoi( argv[++i] );
+    else if( !strcmp(argv[i], "-text") )
+      text = true;
+    else if( !strcmp(argv[i], "-o") && i+1 < argc )
+      output = argv[++i];
+    else if( argv[i][0] == '-' )
+      usage(argv[0]);
+    else
+      inputs.push_back( argv[i] );
+  }
+
+  if( !output || inputs.empty() )
+    usage(argv[0]);
+
+  if( num_threads < 1 )
+    num_threads = 1;
+  if( num_threads > inputs.size() )
+    num_threads = inputs.size();
+
+  // Deal inputs round-robin to workers.
+  std::vector<Worker> workers(num_threads);
+  for(unsigned i=0; i<inputs.size(); ++i)
+    workers[ i % num_threads ].inputs.push_back( inputs[i] );
+
+  std::vector<std::thread> threads;
+  for(unsigned i=1; i<num_threads; ++i)
+    threads.push_back( std::thread(&Worker::run, &workers[i]) );
+  workers[0].run();
+  for(unsigned i=0; i<threads.size(); ++i)
+    threads[i].join();
+
+  bool ok = true;
+  for(unsigned i=0; i<num_threads; ++i)
+    ok = ok && workers[i].ok;
+  if( !ok )
+    return 1;
+
+  // Fold the partial results pairwise.
+  for(unsigned stride=1; stride<num_threads; stride*=2)
+  {
+    threads.clear();
+    for(unsigned i=0; i+stride<num_threads; i+=2*stride)
+      threads.push_back( std::thread(&BinaryProfile::merge, &workers[i].result, std::cref(workers[i+stride].result)) );
+    for(unsigned i=0; i<threads.size(); ++i)
+      threads[i].join();
+  }
+
+  const BinaryProfile &merged = workers[0].result;
+  if( text )
+  {
+    std::ofstream fout(output);
+    merged.print(fout);
+    ok = fout.good();
+  }
+  else
+    ok = merged.write(output);
+
+  if( !ok )
+  {
+    fprintf(stderr, "specpriv-profile-merge: cannot write %s\n", output);
+    return 1;
+  }
+
+  fprintf(stderr, "specpriv-profile-merge: merged %lu runs into %s\n",
+    (unsigned long) merged.num_runs, output);
+  return 0;
+}
@@ -0,0 +1,140 @@
+#include <cstdlib>
+#include <cstring>
+
+#include "pagedir.h"
+#include "live.h"
+
+PageDirectory::PageDirectory()
+  : num_spilled_pages(0), num_unindexed_aus(0)
+{
+  memset(top, 0, sizeof(top));
+}
+
+PageDirectory::~PageDirectory()
+{
+  for(unsigned i=0; i<(1u << TOP_BITS); ++i)
+  {
+    Mid *mid = top[i];
+    if( !mid )
+      continue;
+
+    for(unsigned j=0; j<(1u << MID_BITS); ++j)
+      ::free( mid->leaves[j] );
+    ::free( mid );
+  }
+}
+
+PageDirectory::PageEntry *PageDirectory::find(uint64_t page) const
+{
+  const uint64_t t = page >> (LEAF_BITS + MID_BITS);
+  if( t >= (1u << TOP_BITS) )
+    return 0;
+
+  Mid *mid = top[t];
+  if( !mid )
+    return 0;
+
+  Leaf *leaf = mid->leaves[ (page >> LEAF_BITS) & ((1u << MID_BITS) - 1) ];
+  if( !leaf )
+    return 0;
+
+  return & leaf->pages[ page & ((1u << LEAF_BITS) - 1) ];
+}
+
+PageDirectory::PageEntry &PageDirectory::get(uint64_t page)
+{
+  const uint64_t t = page >> (LEAF_BITS + MID_BITS);
+
+  Mid *&mid = top[t];
+  if( !mid )
+    mid = (Mid*) calloc(1, sizeof(Mid));
+
+  Leaf *&leaf = mid->leaves[ (page >> LEAF_BITS) & ((1u << MID_BITS) - 1) ];
+  if( !leaf )
+    leaf = (Leaf*) calloc(1, sizeof(Leaf));
+
+  return leaf->pages[ page & ((1u << LEAF_BITS) - 1) ];
+}
+
+bool PageDirectory::indexable(AllocationUnit *au, uint64_t &first, uint64_t &last) const
+{
+  const right_open_interval &extents = au->extents;
+  if( extents.high <= extents.low )
+    return false;
+
+  first = extents.low >> PAGE_DIR_PAGE_BITS;
+  last = (extents.high - 1) >> PAGE_DIR_PAGE_BITS;
+
+  // Outside of the 48-bit address space?
+  if( (last >> (LEAF_BITS + MID_BITS)) >= (1u << TOP_BITS) )
+    return false;
+
+  // Huge objects are left to the interval maps.
+  return last - first < PAGE_DIR_MAX_PAGES;
+}
+
+void PageDirectory::insert(AllocationUnit *au)
+{
+  uint64_t first, last;
+  if( !indexable(au, first, last) )
+  {
+    ++num_unindexed_aus;
+    return;
+  }
+
+  for(uint64_t page=first; page<=last; ++page)
+  {
+    PageEntry &entry = get(page);
+
+    unsigned i=0;
+    for(; i<PAGE_DIR_WAYS; ++i)
+      if( !entry.aus[i] )
+      {
+        entry.aus[i] = au;
+        break;
+      }
+
+    // Too many objects share this page; lookups
+    // for this AU on this page will miss.
+    if( i == PAGE_DIR_WAYS )
+      ++num_spilled_pages;
+  }
+}
+
+void PageDirectory::remove(AllocationUnit *au)
+{
+  uint64_t first, last;
+  if( !indexable(au, first, last) )
+    return;
+
+  for(uint64_t page=first; page<=last; ++page)
+  {
+    PageEntry *entry = find(page);
+    if( !entry )
+      continue;
+
+    for(unsigned i=0; i<PAGE_DIR_WAYS; ++i)
+      if( entry->aus[i] == au )
+      {
+        entry->aus[i] = 0;
+        break;
+      }
+  }
+}
+
+AllocationUnit *PageDirectory::lookup(void *ptr) const
+{
+  const PageEntry *entry = find( ((uint64_t)ptr) >> PAGE_DIR_PAGE_BITS );
+  if( !entry )
+    return 0;
+
+  for(unsigned i=0; i<PAGE_DIR_WAYS; ++i)
+  {
+    AllocationUnit *au = entry->aus[i];
+    if( au && au->extents.includes(ptr) )
+      return au;
+  }
+
+  return 0;
+}
+
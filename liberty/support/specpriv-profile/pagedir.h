@@ -0,0 +1,71 @@
+#ifndef SPECPRIV_PAGEDIR_H
+#define SPECPRIV_PAGEDIR_H
+
+#include <stdint.h>
+
+#include "config.h"
+
+struct AllocationUnit;
+
+// A shadow directory which maps each live page to the
+// (few) allocation units which overlap it.  It is organized
+// as a three-level radix tree over the 48-bit virtual address
+// space, so that a lookup is a constant number of loads.
+//
+// The directory does not own its allocation units; it holds
+// raw pointers, and the AllocationUnitTable must remove()
+// an AU before it drops its last reference.
+//
+// The directory is an accelerator, not an authority: a miss
+// means only that the caller must consult the interval maps.
+struct PageDirectory
+{
+  PageDirectory();
+  ~PageDirectory();
+
+  void insert(AllocationUnit *au);
+  void remove(AllocationUnit *au);
+
+  // Find the AU which contains ptr, or null.
+  AllocationUnit *lookup(void *ptr) const;
+
+  // statistics
+  unsigned num_spilled_pages, num_unindexed_aus;
+
+private:
+  enum
+  {
+    LEAF_BITS = 12,
+    MID_BITS  = 12,
+    TOP_BITS  = 48 - PAGE_DIR_PAGE_BITS - LEAF_BITS - MID_BITS
+  };
+
+  struct PageEntry
+  {
+    AllocationUnit *aus[ PAGE_DIR_WAYS ];
+  };
+
+  struct Leaf
+  {
+    PageEntry pages[ 1u << LEAF_BITS ];
+  };
+
+  struct Mid
+  {
+    Leaf *leaves[ 1u << MID_BITS ];
+  };
+
+  Mid *top[ 1u << TOP_BITS ];
+
+  PageEntry *find(uint64_t page) const;
+  PageEntry &get(uint64_t page);
+
+  bool indexable(AllocationUnit *au, uint64_t &first, uint64_t &last) const;
+
+  // Non-copyable
+  PageDirectory(const PageDirectory &);
+  PageDirectory &operator=(const PageDirectory &);
+};
+
+#endif
+
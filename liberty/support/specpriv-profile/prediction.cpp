@@ -1,6 +1,8 @@
 #include "trailing_assert.h"
 #include "prediction.h"
 
+#include <sstream>
+
 void IntSample::receive(const IntSample &other)
 {
 //  trailing_assert( *this == other );
@@ -45,6 +47,12 @@ void PtrResidueSet::receive(void *sample)
   residue_set |= bit_vector;
 }
 
+void PtrResidueSet::merge(const PtrResidueSet &other)
+{
+  num_samples += other.num_samples;
+  residue_set |= other.residue_set;
+}
+
 std::ostream &operator<<(std::ostream &fout, const PtrResidueSet &residues)
 {
   residues.print(fout);
@@ -93,6 +101,13 @@ bool PtrSample::operator==(const PtrSample &other) const
   return offset == other.offset && au == other.au;
 }
 
+PtrSample PtrSample::translate(Context *root) const
+{
+  PtrSample copy(*this);
+  copy.au = ::translate(au, root);
+  return copy;
+}
+
 void PtrSample::receive(const PtrSample &other)
 {
 //  trailing_assert( *this == other );
@@ -105,34 +120,85 @@ std::ostream &operator<<(std::ostream &fout, const PredictionTable &pt)
   return fout;
 }
 
-void PredictionTable::predict_int(const CtxHolder &ctx, const char *name, const IntSample &sample)
+int PredictionTable::predict_int(const CtxHolder &ctx, const char *name, const IntSample &sample)
 {
-  CtxValue key(name,ctx);
-  intPredictions[key].receive(sample);
+  IntegerSamples &set = intPredictions[ key(ctx,name) ];
+
+  const bool fresh = (set.num_samples() == 0);
+  const bool was_decided = set.is_decided();
+  set.receive(sample);
+
+  return (fresh ? 1 : 0) - (!was_decided && set.is_decided() ? 1 : 0);
 }
 
-void PredictionTable::predict_ptr(const CtxHolder &ctx, const char *name, const PtrSample &sample)
+int PredictionTable::predict_ptr(const CtxHolder &ctx, const char *name, const PtrSample &sample)
 {
-  CtxValue key(name,ctx);
-  ptrPredictions[key].receive(sample);
+  const CtxValue k = key(ctx,name);
+  PointerSamples &set = ptrPredictions[k];
+
+  // A diverged pointer site is still worth sampling
+  // for its residues, until those diverge too.
+  const PtrResidueSet *residues = ptrResidues.find(k);
+  const bool residues_bottom = residues && residues->is_bottom();
+
+  const bool fresh = (set.num_samples() == 0);
+  const bool was_decided = set.num_samples() >= PRED_CONFIDENCE_SAMPLES
+                        || (set.is_bottom() && residues_bottom);
+  set.receive(sample);
+  const bool now_decided = set.num_samples() >= PRED_CONFIDENCE_SAMPLES
+                        || (set.is_bottom() && residues_bottom);
+
+  return (fresh ? 1 : 0) - (!was_decided && now_decided ? 1 : 0);
 }
 
 void PredictionTable::find_underlying_object(const CtxHolder &ctx, const char *name, const PtrSample &sample)
 {
-  CtxValue key(name,ctx);
-  objPredictions[key].receive(sample);
+  objPredictions[ key(ctx,name) ].receive(sample);
 }
 
 void PredictionTable::pointer_residue(const CtxHolder &ctx, const char *name, void *sample)
 {
-  CtxValue key(name,ctx);
-  ptrResidues[key].receive(sample);
+  ptrResidues[ key(ctx,name) ].receive(sample);
 }
 
 void PredictionTable::exit_ctx(const CtxHolder &ctx)
 {
 }
 
+namespace
+{
+  struct IdentityTranslation
+  {
+    IntSample operator()(const IntSample &sample) const { return sample; }
+  };
+
+  struct AUTranslation
+  {
+    AUTranslation(Context *r) : root(r) {}
+    PtrSample operator()(const PtrSample &sample) const { return sample.translate(root); }
+    Context *root;
+  };
+}
+
+void PredictionTable::merge(const PredictionTable &other, Context *root)
+{
+  for(IntPredictMap::const_slot_iterator i=other.intPredictions.slot_begin(), e=other.intPredictions.slot_end(); i!=e; ++i)
+    if( i->used )
+      intPredictions[ translate(i->key,root) ].merge(i->value, IdentityTranslation());
+
+  for(PtrPredictMap::const_slot_iterator i=other.ptrPredictions.slot_begin(), e=other.ptrPredictions.slot_end(); i!=e; ++i)
+    if( i->used )
+      ptrPredictions[ translate(i->key,root) ].merge(i->value, AUTranslation(root));
+
+  for(ObjPredictMap::const_slot_iterator i=other.objPredictions.slot_begin(), e=other.objPredictions.slot_end(); i!=e; ++i)
+    if( i->used )
+      objPredictions[ translate(i->key,root) ].merge(i->value, AUTranslation(root));
+
+  for(PtrResidueMap::const_slot_iterator i=other.ptrResidues.slot_begin(), e=other.ptrResidues.slot_end(); i!=e; ++i)
+    if( i->used )
+      ptrResidues[ translate(i->key,root) ].merge(i->value);
+}
+
 template <class SetTy>
 void PredictionTable::print_samples(
   std::ostream &fout,
@@ -141,14 +207,17 @@ void PredictionTable::print_samples(
 {
   fout << "# " << key << " size " << set.size() << '\n';
 
-  for(typename SetTy::const_iterator i=set.begin(), e=set.end(); i!=e; ++i)
+  for(typename SetTy::const_slot_iterator i=set.slot_begin(), e=set.slot_end(); i!=e; ++i)
   {
-    const typename SetTy::mapped_type &samples = i->second;
+    if( !i->used )
+      continue;
+
+    const typename SetTy::mapped_type &samples = i->value;
     if( !samples.is_worth_printing() )
       continue;
 
-    const char *name = i->first.first;
-    CtxHolder ctx = i->first.second;
+    const char *name = NameTable::lookup( i->key >> 32 );
+    CtxHolder ctx = Context::lookup( (CtxId) i->key );
 
     // Comment-out bottom samples
     if( samples.is_bottom() )
@@ -165,14 +234,17 @@ void PredictionTable::print_residues(std::ostream &fout) const
 {
   fout << "# residue map size " << ptrResidues.size() << '\n';
 
-  for(PtrResidueMap::const_iterator i=ptrResidues.begin(), e=ptrResidues.end(); i!=e; ++i)
+  for(PtrResidueMap::const_slot_iterator i=ptrResidues.slot_begin(), e=ptrResidues.slot_end(); i!=e; ++i)
   {
-    const PtrResidueSet &residues = i->second;
+    if( !i->used )
+      continue;
+
+    const PtrResidueSet &residues = i->value;
     if( !residues.is_worth_printing() )
       continue;
 
-    const char *name = i->first.first;
-    CtxHolder ctx = i->first.second;
+    const char *name = NameTable::lookup( i->key >> 32 );
+    CtxHolder ctx = Context::lookup( (CtxId) i->key );
 
     fout << "PTR RESIDUES "
          << name
@@ -189,4 +261,83 @@ void PredictionTable::print(std::ostream &fout) const
   print_residues(fout);
 }
 
+namespace
+{
+  template <class T>
+  std::string to_text(const T &x)
+  {
+    std::ostringstream sout;
+    sout << x;
+    return sout.str();
+  }
+
+  void add_sample(BinaryProfile &out, BinaryProfile::IntSamples &set, const IntSample &sample, unsigned capacity)
+  {
+    BinaryProfile::receive(set, sample.value, sample.frequency, capacity);
+  }
+
+  void add_sample(BinaryProfile &out, BinaryProfile::PtrSamples &set, const PtrSample &sample, unsigned capacity)
+  {
+    BinaryProfile::receive(set, out.intern( to_text(sample.au) ), sample.offset, sample.frequency, capacity);
+  }
+}
+
+template <class SetTy, class OutTy>
+void PredictionTable::serialize_samples(
+  BinaryProfile &out,
+  OutTy &sites,
+  const SetTy &set)
+{
+  for(typename SetTy::const_slot_iterator i=set.slot_begin(), e=set.slot_end(); i!=e; ++i)
+  {
+    if( !i->used )
+      continue;
 
+    const typename SetTy::mapped_type &samples = i->value;
+    if( !samples.is_worth_printing() )
+      continue;
+
+    CtxHolder ctx = Context::lookup( (CtxId) i->key );
+    BinaryProfile::Key key(
+      out.intern( NameTable::lookup( i->key >> 32 ) ),
+      out.intern( to_text(ctx) ) );
+
+    typename OutTy::mapped_type &site = sites[key];
+    site.num_samples += samples.num_samples();
+    if( samples.is_bottom() )
+      site.bottom = true;
+
+    for(unsigned j=0; j<samples.capacity(); ++j)
+      if( !samples.observation(j).empty() )
+        add_sample(out, site, samples.observation(j), samples.capacity());
+
+    if( site.bottom )
+      site.values.clear();
+  }
+}
+
+void PredictionTable::serialize(BinaryProfile &out) const
+{
+  out.max_int_observations = IntegerSamples::capacity();
+  out.max_ptr_observations = PointerSamples::capacity();
+  out.max_obj_observations = UnderlyingObjectSamples::capacity();
+
+  serialize_samples(out, out.ints, intPredictions);
+  serialize_samples(out, out.ptrs, ptrPredictions);
+  serialize_samples(out, out.objs, objPredictions);
+
+  for(PtrResidueMap::const_slot_iterator i=ptrResidues.slot_begin(), e=ptrResidues.slot_end(); i!=e; ++i)
+  {
+    if( !i->used )
+      continue;
+
+    CtxHolder ctx = Context::lookup( (CtxId) i->key );
+    BinaryProfile::Key key(
+      out.intern( NameTable::lookup( i->key >> 32 ) ),
+      out.intern( to_text(ctx) ) );
+
+    BinaryProfile::Residues &residues = out.residues[key];
+    residues.num_samples += i->value.samples();
+    residues.members |= i->value.members();
+  }
+}
@@ -4,6 +4,8 @@
 #include "config.h"
 #include "context.h"
 #include "live.h"
+#include "flatmap.h"
+#include "binprofile.h"
 
 #include <ostream>
 
@@ -32,6 +34,10 @@ struct PtrSample
   PtrSample();
   PtrSample(const AUHolder &, uint64_t offs=0);
 
+  // The same sample, with its AU's creation
+  // context translated into the tree under root.
+  PtrSample translate(Context *root) const;
+
   AUHolder      au;
   uint64_t      offset;
 
@@ -112,7 +118,30 @@ struct SampleSet
     }
   }
 
+  // Fold another sample set into this one.
+  // Translate maps the other set's samples into our terms.
+  template <class Translate>
+  void merge(const SampleSet<SampleType,N> &other, Translate translate)
+  {
+    const unsigned total = numSamples + other.numSamples;
+    for(unsigned i=0; i<N; ++i)
+      if( !other.observations[i].empty() )
+        receive( translate( other.observations[i] ) );
+
+    numSamples = total;
+    if( other.bottom )
+      bottom = true;
+  }
+
   bool is_bottom() const { return bottom; }
+  unsigned num_samples() const { return numSamples; }
+
+  // Further samples cannot change our prediction
+  // (diverged), or are unlikely to (confident).
+  bool is_decided() const { return bottom || numSamples >= PRED_CONFIDENCE_SAMPLES; }
+
+  static unsigned capacity() { return N; }
+  const SampleType &observation(unsigned i) const { return observations[i]; }
 
   bool is_worth_printing() const
   {
@@ -148,10 +177,14 @@ struct PtrResidueSet
   void print(std::ostream &fout) const;
 
   void receive(void *sample);
+  void merge(const PtrResidueSet &other);
 
   bool is_bottom() const { return (residue_set == 0x0ffffu); }
   bool is_worth_printing() const { return true; }
 
+  unsigned samples() const { return num_samples; }
+  uint16_t members() const { return residue_set; }
+
 private:
   unsigned       num_samples;
   uint16_t       residue_set;
@@ -163,8 +196,11 @@ struct PredictionTable
 {
   void print(std::ostream &fout) const;
 
-  void predict_int(const CtxHolder &ctx, const char *name, const IntSample &sample);
-  void predict_ptr(const CtxHolder &ctx, const char *name, const PtrSample &sample);
+  // The value predictors return +1 when they open a new set,
+  // -1 when a set becomes decided, and 0 otherwise.  Summed
+  // over contexts, this is the number of undecided sets of a site.
+  int predict_int(const CtxHolder &ctx, const char *name, const IntSample &sample);
+  int predict_ptr(const CtxHolder &ctx, const char *name, const PtrSample &sample);
 
   void find_underlying_object(const CtxHolder &ctx, const char *name, const PtrSample &sample);
 
@@ -172,12 +208,30 @@ struct PredictionTable
 
   void exit_ctx(const CtxHolder &ctx);
 
+  // Fold another thread's table into this one,
+  // translating contexts into the tree under root.
+  void merge(const PredictionTable &other, Context *root);
+
+  void serialize(BinaryProfile &out) const;
+
 private:
-  typedef std::pair<const char *, CtxHolder>          CtxValue;
-  typedef std::map<CtxValue, IntegerSamples>          IntPredictMap;
-  typedef std::map<CtxValue, PointerSamples>          PtrPredictMap;
-  typedef std::map<CtxValue, UnderlyingObjectSamples> ObjPredictMap;
-  typedef std::map<CtxValue, PtrResidueSet>           PtrResidueMap;
+  // Keyed by (name-id << 32) | ctx-id
+  typedef uint64_t                                              CtxValue;
+  typedef FlatMap<CtxValue, IntegerSamples, U64Hash>            IntPredictMap;
+  typedef FlatMap<CtxValue, PointerSamples, U64Hash>            PtrPredictMap;
+  typedef FlatMap<CtxValue, UnderlyingObjectSamples, U64Hash>   ObjPredictMap;
+  typedef FlatMap<CtxValue, PtrResidueSet, U64Hash>             PtrResidueMap;
+
+  static CtxValue key(const CtxHolder &ctx, const char *name)
+  {
+    return (((uint64_t)NameTable::intern(name)) << 32) | ctx->id;
+  }
+
+  static CtxValue translate(CtxValue key, Context *root)
+  {
+    Context *ctx = Context::lookup( (CtxId) key )->translate(root);
+    return (key & ~0xffffffffull) | ctx->id;
+  }
 
   IntPredictMap intPredictions;
   PtrPredictMap ptrPredictions;
@@ -191,6 +245,12 @@ private:
     const SetTy &set) const;
 
   void print_residues(std::ostream &fout) const;
+
+  template <class SetTy, class OutTy>
+  static void serialize_samples(
+    BinaryProfile &out,
+    OutTy &sites,
+    const SetTy &set);
 };
 
 std::ostream &operator<<(std::ostream &fout, const PredictionTable &pt);
@@ -4,20 +4,98 @@
 
 #include <cstdio>
 
+int32_t Profiler::undecidedSites[ PROF_MAX_SITES ];
+std::vector<uint32_t> Profiler::closedSites;
+ProfLock Profiler::closedSitesLock;
+
 void Profiler::begin()
 {
 }
 
+void Profiler::settle(uint32_t site, int delta)
+{
+  if( site == 0 || site >= PROF_MAX_SITES )
+    return;
+
+  int32_t undecided;
+  if( delta == 0 )
+    undecided = __atomic_load_n(&undecidedSites[site], __ATOMIC_RELAXED);
+  else if( Concurrency::enabled() )
+    undecided = __atomic_add_fetch(&undecidedSites[site], delta, __ATOMIC_RELAXED);
+  else
+    undecided = (undecidedSites[site] += delta);
+
+  // Every context which has seen this site has decided.  After
+  // reopen_sites(), a sample from one of those contexts (delta
+  // == 0) closes the site again.
+  if( undecided == 0 && __atomic_load_n(&__prof_site_states[site], __ATOMIC_RELAXED) == 0 )
+    close_site(site);
+}
+
+void Profiler::close_site(uint32_t site)
+{
+  ScopedProfLock guard(closedSitesLock);
+  if( __prof_site_states[site] == 0 )
+  {
+    __atomic_store_n(&__prof_site_states[site], 1, __ATOMIC_RELAXED);
+    closedSites.push_back(site);
+  }
+}
+
+// Contexts which first reach a site after it closed would
+// otherwise see no samples from it.  Context creation is rare
+// next to sampling, so this is cheap.
+void Profiler::reopen_sites()
+{
+  ScopedProfLock guard(closedSitesLock);
+  for(std::vector<uint32_t>::const_iterator i=closedSites.begin(), e=closedSites.end(); i!=e; ++i)
+    __atomic_store_n(&__prof_site_states[*i], 0, __ATOMIC_RELAXED);
+  closedSites.clear();
+}
+
 void Profiler::write_results() const
 {
   std::ofstream log("result.specpriv.profile.txt.tmp");
   print(log);
   log.close();
 
+  // The mergeable form is written first, so that it is
+  // in place once the text form appears.
+  BinaryProfile bin;
+  serialize(bin);
+  if( bin.write("result.specpriv.profile.bin.tmp") )
+    rename("result.specpriv.profile.bin.tmp", "result.specpriv.profile.bin");
+  else
+    perror("specpriv-profile: result.specpriv.profile.bin");
+
   // Rename is an atomic operation
   rename("result.specpriv.profile.txt.tmp", "result.specpriv.profile.txt");
 }
 
+void Profiler::serialize(BinaryProfile &out) const
+{
+  out.events[ BinaryProfile::EVT_MALLOC ] = evt_malloc;
+  out.events[ BinaryProfile::EVT_REALLOC ] = evt_realloc;
+  out.events[ BinaryProfile::EVT_FREE ] = evt_free;
+  out.events[ BinaryProfile::EVT_CONSTANT ] = evt_constant;
+  out.events[ BinaryProfile::EVT_GLOBAL ] = evt_global;
+  out.events[ BinaryProfile::EVT_STACK ] = evt_stack;
+  out.events[ BinaryProfile::EVT_BEGIN_FCN ] = evt_begin_fcn;
+  out.events[ BinaryProfile::EVT_END_FCN ] = evt_end_fcn;
+  out.events[ BinaryProfile::EVT_BEGIN_ITER ] = evt_begin_iter;
+  out.events[ BinaryProfile::EVT_END_ITER ] = evt_end_iter;
+  out.events[ BinaryProfile::EVT_FUO ] = evt_fuo;
+  out.events[ BinaryProfile::EVT_PRED_INT ] = evt_pred_int;
+  out.events[ BinaryProfile::EVT_PRED_PTR ] = evt_pred_ptr;
+  out.events[ BinaryProfile::EVT_PTR_RESIDUE ] = evt_ptr_residue;
+
+  for(FcnNameList::iterator i=possibleAllocationLeaks.begin(), e=possibleAllocationLeaks.end(); i!=e; ++i)
+    out.incomplete.insert( out.intern(*i) );
+
+  escapes.serialize(out);
+  predictions.serialize(out);
+}
+
 void Profiler::timing_stats(std::ostream &log) const
 {
 #if TIMER
@@ -51,6 +129,7 @@ void Profiler::print(std::ostream &log) const
       << "#   p int " << evt_pred_int << '\n'
       << "#   p ptr " << evt_pred_ptr << '\n'
       << "# residue " << evt_ptr_residue << '\n'
+      << "# saturated sites " << closedSites.size() << '\n'
       << "#\n";
 
   // Can we guarantee that the profile was COMPLETE
@@ -182,7 +261,10 @@ void Profiler::free(AUHolder &au, bool isAlloca)
 
   liveObjects.remove( au );
 
-  remove_from_context( au );
+  // If another thread allocated it, that thread
+  // will drop it from its context stack lazily.
+  if( !remove_from_context( au ) )
+    au->set_freed_by_other_thread();
 }
 
 void Profiler::report_constant(const char *name, void *base, uint64_t size)
@@ -276,7 +358,7 @@ void Profiler::find_underlying_object(const char *name, void *ptr)
 #endif
 }
 
-void Profiler::predict_int(const char *name, uint64_t value)
+void Profiler::predict_int(const char *name, uint64_t value, uint32_t site)
 {
   ++evt_pred_int;
 
@@ -284,14 +366,14 @@ void Profiler::predict_int(const char *name, uint64_t value)
   const uint64_t start = rdtsc();
 #endif
   IntSample sample(value);
-  predictions.predict_int(currentContext,name,sample);
+  settle(site, predictions.predict_int(currentContext,name,sample) );
 #if TIMER
   total_time_predict_int += rdtsc() - start;
   ++num_predict_int;
 #endif
 }
 
-void Profiler::predict_ptr(const char *name, void *ptr)
+void Profiler::predict_ptr(const char *name, void *ptr, uint32_t site)
 {
   ++evt_pred_ptr;
 
@@ -306,22 +388,23 @@ void Profiler::predict_ptr(const char *name, void *ptr)
 #endif
 
 
-  uint64_t offset = ptr - au;
-  PtrSample sample = PtrSample(au,offset);
-  predictions.predict_ptr(currentContext,name,sample);
+  // Also predict pointer residues.  These go first,
+  // since predict_ptr considers them when settling the site.
+  predictions.pointer_residue(currentContext,name,ptr);
 
 #if TIMER
   const uint64_t middle2 = rdtsc();
-  total_time_predict_ptr += middle2 - middle1;
-  ++num_predict_ptr;
+  total_time_pointer_residue += middle2 - middle1;
+  ++num_pointer_residue;
 #endif
 
-  // Also predict pointer residues
-  predictions.pointer_residue(currentContext,name,ptr);
+  uint64_t offset = ptr - au;
+  PtrSample sample = PtrSample(au,offset);
+  settle(site, predictions.predict_ptr(currentContext,name,sample) );
 
 #if TIMER
-  total_time_pointer_residue += rdtsc() - middle2;
-  ++num_pointer_residue;
+  total_time_predict_ptr += rdtsc() - middle2;
+  ++num_predict_ptr;
 #endif
 }
 
@@ -387,8 +470,9 @@ void Profiler::add_permanent_au(AUType type, const char *name, void *base, uint6
 }
 
 // An AU is in the live-aus list of exactly one
-// live context.  Find and delete it.
-void Profiler::remove_from_context(const AUHolder &au)
+// live context.  Find and delete it.  Returns false
+// if that context belongs to another thread.
+bool Profiler::remove_from_context(const AUHolder &au)
 {
   // Remove this au from the live objects list.
   for(CtxHolder ctx = currentContext; !ctx.is_null(); ctx = ctx->parent)
@@ -400,29 +484,40 @@ void Profiler::remove_from_context(const AUHolder &au)
       {
         ctx->aus[i] = ctx->aus.back();
         ctx->aus.pop_back();
-        return;
+        return true;
       }
     }
   }
+
+  return false;
 }
 
 void Profiler::enter_ctx(CtxType type, const char *name)
 {
-  Context *f = new Context(type);
-  f->name = name;
-  f->parent = currentContext;
-  currentContext = f;
+  bool created = false;
+  currentContext = currentContext->child(type,name,&created);
+  if( created )
+    reopen_sites();
 }
 
 void Profiler::exit_ctx(CtxType type, const char *name)
 {
   trailing_assert( currentContext->type == type
-  &&               currentContext->name == name );
+  &&               ( currentContext->name == name
+  ||                 currentContext->name_id == NameTable::intern(name) ) );
 
   // All live aus in this context escape.
-  for(unsigned i=0, N=currentContext->aus.size(); i<N; ++i)
+  for(unsigned i=0; i<currentContext->aus.size(); ++i)
   {
     AUHolder au = (AllocationUnit*) *currentContext->aus[i];
+    if( au->is_freed_by_other_thread() )
+    {
+      currentContext->aus[i] = currentContext->aus.back();
+      currentContext->aus.pop_back();
+      --i;
+      continue;
+    }
+
     escapes.report_escape( au, currentContext );
   }
 
@@ -473,6 +568,35 @@ void Profiler::free_one_stack(CtxHolder ctx, unsigned idx)
 }
 
 void Profiler::end()
+{
+  end_thread();
+
+  // Fold every other thread's results into ours.
+  unsigned unfinished = 0;
+  {
+    ScopedProfLock guard(instancesLock);
+    for(unsigned i=0; i<allInstances.size(); ++i)
+    {
+      Profiler *other = allInstances[i];
+      if( other == this )
+        continue;
+
+      // A thread which was still running when the program
+      // exited may still be mutating its tables.
+      if( __atomic_load_n(&other->finished, __ATOMIC_ACQUIRE) )
+        merge(*other);
+      else
+        ++unfinished;
+    }
+  }
+
+  if( unfinished )
+    fprintf(stderr, "Warning: dropped results of %u unfinished threads.\n", unfinished);
+
+  write_results();
+}
+
+void Profiler::end_thread()
 {
   // We model a call to exit() as repeatedly returning
   // from all active functions.
@@ -489,12 +613,54 @@ void Profiler::end()
     AUHolder au = (AllocationUnit*) * currentContext->aus.back();
     currentContext->aus.pop_back();
 
+    if( au->is_freed_by_other_thread() )
+      continue;
+
     // Globals, constants always escape, we don't care about those.
     if( au->type != AU_Global && au->type != AU_Constant )
       escapes.report_escape(au, currentContext);
   }
 
-  write_results();
+  __atomic_store_n(&finished, true, __ATOMIC_RELEASE);
+}
+
+void Profiler::merge(const Profiler &other)
+{
+  Context *root = *currentContext;
+
+  evt_malloc += other.evt_malloc;
+  evt_free += other.evt_free;
+  evt_constant += other.evt_constant;
+  evt_global += other.evt_global;
+  evt_stack += other.evt_stack;
+  evt_begin_fcn += other.evt_begin_fcn;
+  evt_end_fcn += other.evt_end_fcn;
+  evt_begin_iter += other.evt_begin_iter;
+  evt_end_iter += other.evt_end_iter;
+  evt_fuo += other.evt_fuo;
+  evt_pred_int += other.evt_pred_int;
+  evt_pred_ptr += other.evt_pred_ptr;
+  evt_realloc += other.evt_realloc;
+  evt_ptr_residue += other.evt_ptr_residue;
+
+#if TIMER
+  total_time_lookup_pointer += other.total_time_lookup_pointer;
+  num_pointer_lookups += other.num_pointer_lookups;
+  total_time_predict_int += other.total_time_predict_int;
+  num_predict_int += other.num_predict_int;
+  total_time_predict_ptr += other.total_time_predict_ptr;
+  num_predict_ptr += other.num_predict_ptr;
+  total_time_pointer_residue += other.total_time_pointer_residue;
+  num_pointer_residue += other.num_pointer_residue;
+  total_time_find_underlying_object += other.total_time_find_underlying_object;
+  num_find_underlying_object += other.num_find_underlying_object;
+#endif
+
+  possibleAllocationLeaks.insert(
+    other.possibleAllocationLeaks.begin(), other.possibleAllocationLeaks.end() );
+
+  escapes.merge(other.escapes, root);
+  predictions.merge(other.predictions, root);
 }
 
 const char *name_of_last_assert_fail = 0;
@@ -543,7 +709,10 @@ void Profiler::possible_allocation_leak(const char *name)
   possibleAllocationLeaks.insert(name);
 }
 
-Profiler *Profiler::theInstance = 0;
+thread_local Profiler *Profiler::theInstance = 0;
+std::vector<Profiler *> Profiler::allInstances;
+ProfLock Profiler::instancesLock;
+AllocationUnitTable Profiler::liveObjects;
 
 
 
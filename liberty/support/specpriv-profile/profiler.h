@@ -6,6 +6,7 @@
 #include <map>
 #include <set>
 #include <fstream>
+#include <vector>
 
 #include <stdint.h>
 
@@ -14,14 +15,27 @@
 #include "live.h"
 #include "prediction.h"
 #include "escape.h"
+#include "concurrency.h"
 
+// Per-site state bytes, shared with the program under test;
+// see PRED_CONFIDENCE_SAMPLES.
+extern "C" uint8_t *__prof_site_states;
+
+// There is one Profiler per thread of the program under test,
+// each driven by its own consumer thread.  They share the table
+// of live objects, but keep private context stacks and result
+// tables, which are merged into the main thread's profiler at end().
 struct Profiler
 {
   void begin();
   void end();
 
+  // This thread of the program under test has exited.
+  void end_thread();
+
   void write_results() const;
   void print(std::ostream &log) const;
+  void serialize(BinaryProfile &out) const;
   void malloc(const char *name, void *ptr, uint64_t size);
   void realloc(const char *name, void *old_ptr, void *new_ptr, uint64_t size);
   void free(const char *name, void *ptr, bool isAlloca = false);
@@ -33,17 +47,17 @@ struct Profiler
   void end_function(const char *name);
   void begin_iter(const char *name);
   void end_iter(const char *name);
-  void predict_int(const char *name, uint64_t value);
+  void predict_int(const char *name, uint64_t value, uint32_t site = 0);
   void find_underlying_object(const char *name, void *ptr);
 
   // Note: predict_ptr implies pointer_residue
-  void predict_ptr(const char *name, void *ptr);
+  void predict_ptr(const char *name, void *ptr, uint32_t site = 0);
   void pointer_residue(const char *name, void *ptr);
 
   void assert_in_bounds(const char *name, void *base, void *derived);
   void possible_allocation_leak(const char *name);
 
-  // This is a  singleton class.
+  // The profiler for the calling consumer thread.
   static Profiler &getInstance()
   {
     if( !theInstance )
@@ -54,11 +68,20 @@ struct Profiler
   void timing_stats(std::ostream &log) const;
 
 private:
-  // SINGLETON
-  static Profiler *theInstance;
+  // One per consumer thread
+  static thread_local Profiler *theInstance;
+  static std::vector<Profiler *> allInstances;
+  static ProfLock instancesLock;
+
   Profiler()
   {
     currentContext = new Context(Top);
+    finished = false;
+
+    {
+      ScopedProfLock guard(instancesLock);
+      allInstances.push_back(this);
+    }
 
     // statistics
     evt_malloc = 0;
@@ -92,15 +115,29 @@ private:
 
   AUHolder add_temporary_au(AUType type, const char *name, void *base, uint64_t size);
   void add_permanent_au(AUType type, const char *name, void *base, uint64_t size);
-  void remove_from_context(const AUHolder &au);
+  bool remove_from_context(const AUHolder &au);
+  void merge(const Profiler &other);
   void enter_ctx(CtxType type, const char *name);
   void exit_ctx(CtxType type, const char *name);
   void free_stacks();
   void free_one_stack(CtxHolder ctx, unsigned idx);
 
+  // Number of undecided (context, site) sample sets, per site.
+  // Shared by all consumer threads.
+  static int32_t undecidedSites[ PROF_MAX_SITES ];
+  static void settle(uint32_t site, int delta);
+
+  // Sites whose state byte is set.  A new context re-opens
+  // them all, since it may reach any of them.
+  static std::vector<uint32_t> closedSites;
+  static ProfLock closedSitesLock;
+  static void close_site(uint32_t site);
+  static void reopen_sites();
+
   // Runtime information
-  AllocationUnitTable liveObjects;
+  static AllocationUnitTable liveObjects;
   CtxHolder currentContext;
+  bool finished;
 
   // Tabulated results which will be saved
   PredictionTable predictions;
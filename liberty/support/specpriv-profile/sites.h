@@ -0,0 +1,18 @@
+#ifndef SPECPRIV_SITES_H
+#define SPECPRIV_SITES_H
+
+// Value-prediction sites are sampled until each (site, context)
+// is decided: it has diverged (too many distinct values) or it
+// has received PRED_CONFIDENCE_SAMPLES samples.  After that, the
+// profiler sets the site's state byte and the instrumented code
+// skips the call, until a new context re-opens the site.  Sites
+// are numbered 1..PROF_MAX_SITES-1 by the instrumentation pass;
+// site 0 is never skipped.
+//
+// This header is shared by the profiler runtime and the
+// instrumentation pass (PointsToProfiler/Profile.cpp), so it
+// defines nothing else.
+#define PRED_CONFIDENCE_SAMPLES             (8192U)
+#define PROF_MAX_SITES                      (1U << 20)
+
+#endif
@@ -53,9 +53,6 @@
 // alignment
 #define ALIGNMENT (64)
 
-// Number of processors; used to schedule affinities.
-// #define NUM_PROCS (24)
-#define OS2PHYS (0)
 
 // maximum number of stages
 #define MAX_STAGE_NUM (64)
@@ -7,16 +7,45 @@
 #define PAD(suffix, size) char padding ## suffix [PADDING - size]
 
 #define QUEUE_SIZE 8192*2 /* // 65536 // 128 // 16384 // 8192*/
+// #define QUEUE_SIZE 8192*8 /* // 65536 // 128 // 16384 // 8192*/
+
+// A single-producer, single-consumer ring (Lamport).
+// head and tail count slots, and wrap at 2^32; each
+// is written by one side only, on its own cache line.
+// Each side keeps a cached copy of the other's index,
+// and reads the real one only when the cached copy
+// says that the ring is full (or empty).  So, while
+// the ring is neither, the two sides do not share
+// any cache line but those of data[].
+//
+// The consumer publishes its tail in batches of
+// QUEUE_PUBLISH slots; the producer publishes its
+// head after every value, or once per record.  A
+// side which waits spins QUEUE_SPIN times, then
+// sleeps on the other side's index (a futex).
+#define QUEUE_PUBLISH   (64)
+#define QUEUE_SPIN      (4096)
 
 typedef struct {
-    void * volatile *head;
-    void * volatile *prealloc;
-    PAD(1, sizeof(void *)*2);
-    void * volatile *tail;
-    void * volatile *prealloc_tail;
+    // producer's
+    volatile uint32_t head;
+    uint32_t head_local;
+    uint32_t tail_cache;
+    PAD(1, sizeof(uint32_t)*3);
+
+    // consumer's
+    volatile uint32_t tail;
+    uint32_t tail_local;
+    uint32_t head_cache;
     int volatile finished[1];
-    PAD(2, sizeof(void *)*2+sizeof(int*));
-    void *data[QUEUE_SIZE];
+    PAD(2, sizeof(uint32_t)*3+sizeof(int));
+
+    // written only by a side which goes to sleep
+    volatile uint32_t consumer_sleeping;
+    volatile uint32_t producer_sleeping;
+    PAD(3, sizeof(uint32_t)*2);
+
+    void *data[QUEUE_SIZE] __attribute__((aligned(PADDING)));
 } queue_t;
 
 #ifdef __cplusplus
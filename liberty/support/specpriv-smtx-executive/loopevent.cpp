@@ -110,10 +110,7 @@ unsigned PREFIX(begin_invocation)()
 
   sched_getaffinity(0, sizeof(cpu_set_t), &old_affinity);
 
-  cpu_set_t affinity;
-  CPU_ZERO( &affinity );
-  CPU_SET( CORE(0), &affinity );
-  sched_setaffinity(0, sizeof(cpu_set_t), &affinity );
+  topology_pin(0);
 
   //
   // initialize pcb
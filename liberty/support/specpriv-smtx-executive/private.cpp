@@ -56,10 +56,7 @@ void init_worker(Iteration current_iter, Wid wid)
   // First, a policy to make the spawn work better
   sleep(0);
 
-  cpu_set_t affinity;
-  CPU_ZERO(&affinity);
-  CPU_SET( CORE( (wid+1) % num_procs ), &affinity );
-  sched_setaffinity( 0, sizeof(cpu_set_t), &affinity );
+  topology_pin( (int)wid + 1 );
 
   // TODO: handling i/o
 
@@ -335,8 +335,8 @@ static void forward_values_to_commit(Wid wid, packet* buf, unsigned size)
     outgoing_bw[wid] += sizeof(packet);
 #endif
 
-    DBG("\tnew packet %u, commit_queue headptr: %p tailptr: %p, headval: %p, tailval: %p\n", i, commit_queue->head,
-        commit_queue->tail, *(commit_queue->head), *(commit_queue->tail));
+    DBG("\tnew packet %u, commit_queue head: %u tail: %u\n", i, commit_queue->head,
+        commit_queue->tail);
 
     __sw_queue_produce( commit_queue, (void*)new_p );
   }
@@ -1,25 +1,134 @@
 #include <assert.h>
+#include <limits.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <sys/file.h>
 #include <sys/mman.h>
+#include <sys/syscall.h>
 #include <sys/wait.h>
+#include <linux/futex.h>
+#include <xmmintrin.h>
 
 #include "internals/debug.h"
 #include "internals/profile.h"
 #include "internals/sw_queue/sw_queue.h"
 
-#define SW_QUEUE_OCCUPIED 1   // b'01
-#define SW_QUEUE_NULL 0
-
 #define SYNC_FINISHED 1
 #define SYNC_NOT_FINISHED 0
 
+#define QUEUE_MASK  (QUEUE_SIZE - 1)
+
+// Not FUTEX_PRIVATE_FLAG: queues are MAP_SHARED
+// between the worker processes.
+static void futex_wait(volatile uint32_t *addr, uint32_t val)
+{
+  syscall(SYS_futex, (void*)(uintptr_t) addr, FUTEX_WAIT, val, 0, 0, 0);
+}
+
+static void futex_wake(volatile uint32_t *addr)
+{
+  syscall(SYS_futex, (void*)(uintptr_t) addr, FUTEX_WAKE, INT_MAX, 0, 0, 0);
+}
+
+// Is there room for slots [.., end)?
+static inline int has_room(uint32_t tail, uint32_t end)
+{
+  return (uint32_t)(end - tail) <= QUEUE_SIZE;
+}
+
+// Are slots [.., end) full?
+static inline int has_values(uint32_t head, uint32_t end)
+{
+  return (int32_t)(head - end) >= 0;
+}
+
+// Publish the head; wake the consumer if it sleeps.
+// The fence orders our store before the load of
+// consumer_sleeping: either we see the sleeper, or
+// it sees the new head before it blocks.
+static inline void publish_head(queue_t* queue)
+{
+  __atomic_store_n(&queue->head, queue->head_local, __ATOMIC_RELEASE);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if( queue->consumer_sleeping )
+    futex_wake(&queue->head);
+}
+
+static inline void publish_tail(queue_t* queue)
+{
+  __atomic_store_n(&queue->tail, queue->tail_local, __ATOMIC_RELEASE);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if( queue->producer_sleeping )
+    futex_wake(&queue->tail);
+}
+
+// Wait until slots [.., end) are free.
+static void wait_for_room(queue_t* queue, uint32_t end)
+{
+  if( has_room(queue->tail_cache, end) )
+    return;
+
+  queue->tail_cache = __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
+  for(unsigned i=0; i<QUEUE_SPIN && !has_room(queue->tail_cache, end); ++i)
+  {
+    _mm_pause();
+    queue->tail_cache = __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
+  }
+
+  if( !has_room(queue->tail_cache, end) )
+  {
+    __atomic_store_n(&queue->producer_sleeping, 1, __ATOMIC_SEQ_CST);
+    uint32_t tail;
+    while( !has_room(tail = __atomic_load_n(&queue->tail, __ATOMIC_SEQ_CST), end) )
+      futex_wait(&queue->tail, tail);
+    queue->producer_sleeping = 0;
+    queue->tail_cache = tail;
+  }
+}
+
+// Wait until slots [.., end) are full.
+static void wait_for_values(queue_t* queue, uint32_t end)
+{
+  if( has_values(queue->head_cache, end) )
+    return;
+
+  queue->head_cache = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+  if( !has_values(queue->head_cache, end) )
+  {
+    // Don't keep the producer waiting on our batch.
+    if( queue->tail != queue->tail_local )
+      publish_tail(queue);
+
+    for(unsigned i=0; i<QUEUE_SPIN && !has_values(queue->head_cache, end); ++i)
+    {
+      _mm_pause();
+      queue->head_cache = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+    }
+  }
+
+  if( !has_values(queue->head_cache, end) )
+  {
+    __atomic_store_n(&queue->consumer_sleeping, 1, __ATOMIC_SEQ_CST);
+    uint32_t head;
+    while( !has_values(head = __atomic_load_n(&queue->head, __ATOMIC_SEQ_CST), end) )
+      futex_wait(&queue->head, head);
+    queue->consumer_sleeping = 0;
+    queue->head_cache = head;
+  }
+}
+
+// Free slots up to tail_local, in batches.
+static inline void release_slots(queue_t* queue)
+{
+  if( queue->tail_local - queue->tail >= QUEUE_PUBLISH )
+    publish_tail(queue);
+}
+
 queue_t* __sw_queue_create(void)
 {
-  queue_t* queue = (queue_t*)mmap(0, sizeof(queue_t), 
+  queue_t* queue = (queue_t*)mmap(0, sizeof(queue_t),
       PROT_WRITE | PROT_READ, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
 
   __sw_queue_reset(queue);
@@ -30,68 +139,48 @@ queue_t* __sw_queue_create(void)
 void __sw_queue_produce(queue_t* queue, void* value)
 {
   //DBG("\t\tsw_queue_produce, queue %p\n", queue);
-  while (*(queue->head) != (void*) SW_QUEUE_NULL);
-
-  *(queue->head+1) = (void*)value;
-
-  *queue->head = (void *) SW_QUEUE_OCCUPIED;
+  const uint32_t h = queue->head_local;
+  wait_for_room(queue, h + 1);
 
-  queue->head+=2;
-  if ( queue->head >= &(queue->data[QUEUE_SIZE]) )
-    queue->head = &queue->data[0];    
+  queue->data[ h & QUEUE_MASK ] = value;
+  queue->head_local = h + 1;
+  publish_head(queue);
 }
 
-void* __sw_queue_consume(queue_t* queue) 
+void* __sw_queue_consume(queue_t* queue)
 {
-  void *value;
-  while ((*queue->tail) == (void*) SW_QUEUE_NULL);
+  const uint32_t t = queue->tail_local;
+  wait_for_values(queue, t + 1);
 
-  value = *( (queue->tail)+1 );
-  *( (queue->tail)+1 ) = (void*) SW_QUEUE_NULL;
-  *(queue->tail) = (void*) *( (queue->tail)+1 );
-
-  //DBG("\t\tsw_queue_consume, from tail %p\n", queue->tail);
-
-  queue->tail+=2;
-  if ( queue->tail >= &(queue->data[QUEUE_SIZE]) )
-    queue->tail = &(queue->data[0]);
+  void *value = queue->data[ t & QUEUE_MASK ];
+  queue->tail_local = t + 1;
+  release_slots(queue);
 
   return value;
 }
 
 void __sw_queue_flush(queue_t* queue)
 {
-  // As the queue does not have a buffer, nothing to do with flush
-  /*
-  while((*queue->tail) != (void*) SW_QUEUE_NULL)
-  {
-    (*queue->tail) = (void*) SW_QUEUE_NULL;
-    queue->tail+=2;
-    if ( queue->tail >= &(queue->data[QUEUE_SIZE]) )
-      queue->tail = &queue->data[0];
-  }
-  */
+  // The producer publishes after every value;
+  // nothing is left to flush.
+  publish_head(queue);
 }
 
 void __sw_queue_clear(queue_t* queue)
 {
-  while((*queue->tail) != (void*) SW_QUEUE_NULL)
-  {
-    (*queue->tail) = (void*) SW_QUEUE_NULL;
-    queue->tail+=2;
-    if ( queue->tail >= &(queue->data[QUEUE_SIZE]) )
-      queue->tail = &queue->data[0];
-  }
+  // Drop whatever the producer has published.
+  queue->tail_local = queue->head_cache = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+  publish_tail(queue);
 }
 
 void __sw_queue_reset(queue_t* queue)
 {
-  int i;
-  queue->head = &(queue->data[0]);
-  queue->tail = &(queue->data[0]);
+  // No need to touch data[]: only the
+  // indices say which slots are full.
+  queue->head = queue->head_local = queue->tail_cache = 0;
+  queue->tail = queue->tail_local = queue->head_cache = 0;
+  queue->consumer_sleeping = queue->producer_sleeping = 0;
   *(queue->finished) = SYNC_NOT_FINISHED;
-  for(i=0 ; i<QUEUE_SIZE ; i++) 
-    queue->data[i] = (void*) SW_QUEUE_NULL;   
 }
 
 void __sw_queue_free(queue_t* queue)
@@ -101,5 +190,5 @@ void __sw_queue_free(queue_t* queue)
 
 uint8_t __sw_queue_empty(queue_t* queue)
 {
-  return ( (*queue->tail) == SW_QUEUE_NULL ) ? 1 : 0;
+  return ( __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE) == queue->tail_local ) ? 1 : 0;
 }
@@ -0,0 +1,254 @@
+#ifndef LIBERTY_SUPPORT_TOPOLOGY_H
+#define LIBERTY_SUPPORT_TOPOLOGY_H
+
+// Worker placement from the machine's topology.
+//
+// On first use, reads /sys/devices/system/cpu (packages,
+// cores, SMT threads, NUMA nodes) for the CPUs which this
+// process may run on, and orders them into placement slots.
+// The main process takes slot 0, worker i takes slot i+1;
+// slots wrap around when there are more workers than CPUs.
+//
+// The order is chosen by the SPECPRIV_PLACEMENT environment
+// variable:
+//
+//   core     one thread of each core, package by package;
+//            SMT siblings only after every core (default)
+//   compact  every SMT thread of a core, then the next core
+//            of the same package
+//   scatter  one core of each package in turn; SMT
+//            siblings only after every core
+//   numa     like core, but the NUMA node of the main
+//            process first
+//   none     do not set affinity
+//
+// Header-only, so that specpriv-executive, the smtx
+// executive, tpool and ppool share it without another
+// library.  The table itself is a weak symbol: there is one
+// per program, however many places include this header.
+// Initialize it (any call below) before pinning anything,
+// since it only considers the CPUs in our affinity mask.
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <dirent.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TOPOLOGY_MAX_CPUS   (CPU_SETSIZE)
+
+enum
+{
+  TOPOLOGY_NONE,
+  TOPOLOGY_CORE,
+  TOPOLOGY_COMPACT,
+  TOPOLOGY_SCATTER,
+  TOPOLOGY_NUMA
+};
+
+typedef struct
+{
+  int cpu;        // as numbered by the OS
+  int package;
+  int core;       // ordinal of the core within its package
+  int smt;        // ordinal of the thread within its core
+  int node;       // NUMA node
+  long long rank; // sort key under the policy
+} TopologyCpu;
+
+typedef struct
+{
+  int ready;
+  int policy;
+  int num_cpus;
+  TopologyCpu cpus[ TOPOLOGY_MAX_CPUS ];  // in placement order
+} Topology;
+
+__attribute__((weak)) Topology __topology;
+
+static inline int topology_read_int(int cpu, const char *what, int dflt)
+{
+  char path[128];
+  snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/%s", cpu, what);
+
+  int value = dflt;
+  FILE *f = fopen(path, "r");
+  if( f )
+  {
+    if( fscanf(f, "%d", &value) != 1 )
+      value = dflt;
+    fclose(f);
+  }
+  return value;
+}
+
+// The cpuN directory links to its nodeM.
+static inline int topology_read_node(int cpu)
+{
+  char path[128];
+  snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+
+  int node = 0;
+  DIR *dir = opendir(path);
+  if( dir )
+  {
+    struct dirent *e;
+    while( (e = readdir(dir)) )
+      if( sscanf(e->d_name, "node%d", &node) == 1 )
+        break;
+    closedir(dir);
+  }
+  return node;
+}
+
+static inline int topology_policy(const char *name)
+{
+  if( !name || !strcmp(name, "core") )
+    return TOPOLOGY_CORE;
+  if( !strcmp(name, "compact") )
+    return TOPOLOGY_COMPACT;
+  if( !strcmp(name, "scatter") )
+    return TOPOLOGY_SCATTER;
+  if( !strcmp(name, "numa") )
+    return TOPOLOGY_NUMA;
+  if( !strcmp(name, "none") )
+    return TOPOLOGY_NONE;
+
+  fprintf(stderr, "Unknown SPECPRIV_PLACEMENT \"%s\"; using core\n", name);
+  return TOPOLOGY_CORE;
+}
+
+static inline int topology_compare(const void *a, const void *b)
+{
+  const TopologyCpu *x = (const TopologyCpu *) a, *y = (const TopologyCpu *) b;
+  if( x->rank != y->rank )
+    return (x->rank < y->rank) ? -1 : 1;
+  return x->cpu - y->cpu;
+}
+
+// Most significant key first; each key is small.
+static inline long long topology_key(int k0, int k1, int k2, int k3)
+{
+  return (((k0 * 4096LL + k1) * 4096LL + k2) * 4096LL) + k3;
+}
+
+// Runs once per program, and its frame is large
+// (ordinal[]); not worth inlining into every caller.
+static __attribute__((unused)) void topology_init(Topology *t)
+{
+  t->policy = topology_policy( getenv("SPECPRIV_PLACEMENT") );
+
+  cpu_set_t allowed;
+  if( sched_getaffinity(0, sizeof(allowed), &allowed) )
+  {
+    CPU_ZERO(&allowed);
+    CPU_SET(0, &allowed);
+  }
+  const int here = sched_getcpu();
+  const int home = topology_read_node( here < 0 ? 0 : here );
+
+  // Cores are numbered sparsely by the OS;
+  // core holds core_id until it is ranked.
+  int n = 0;
+  for(int cpu=0; cpu<TOPOLOGY_MAX_CPUS; ++cpu)
+  {
+    if( !CPU_ISSET(cpu, &allowed) )
+      continue;
+
+    TopologyCpu *c = &t->cpus[n++];
+    c->cpu = cpu;
+    c->package = topology_read_int(cpu, "topology/physical_package_id", 0);
+    c->core = topology_read_int(cpu, "topology/core_id", cpu);
+    c->node = topology_read_node(cpu);
+  }
+  t->num_cpus = n;
+
+  // SMT siblings are ordered by cpu number.
+  for(int i=0; i<n; ++i)
+  {
+    TopologyCpu *c = &t->cpus[i];
+    c->smt = 0;
+    for(int j=0; j<i; ++j)
+      if( t->cpus[j].package == c->package && t->cpus[j].core == c->core )
+        ++c->smt;
+  }
+
+  // The ordinal of a core counts the distinct
+  // (first-thread) cores below it in its package.
+  int ordinal[ TOPOLOGY_MAX_CPUS ];
+  for(int i=0; i<n; ++i)
+  {
+    ordinal[i] = 0;
+    for(int j=0; j<n; ++j)
+      if( t->cpus[j].smt == 0 && t->cpus[j].package == t->cpus[i].package
+      &&  t->cpus[j].core < t->cpus[i].core )
+        ++ordinal[i];
+  }
+
+  for(int i=0; i<n; ++i)
+  {
+    TopologyCpu *c = &t->cpus[i];
+    c->core = ordinal[i];
+
+    switch( t->policy )
+    {
+      case TOPOLOGY_COMPACT:
+        c->rank = topology_key(0, c->package, c->core, c->smt);
+        break;
+      case TOPOLOGY_SCATTER:
+        c->rank = topology_key(0, c->smt, c->core, c->package);
+        break;
+      case TOPOLOGY_NUMA:
+        c->rank = topology_key(c->node != home, c->smt, c->package, c->core);
+        break;
+      default:
+        c->rank = topology_key(0, c->smt, c->package, c->core);
+        break;
+    }
+  }
+
+  qsort(t->cpus, (size_t) n, sizeof(TopologyCpu), topology_compare);
+  t->ready = 1;
+}
+
+static inline const Topology *topology_get(void)
+{
+  if( !__topology.ready )
+    topology_init(&__topology);
+  return &__topology;
+}
+
+// How many CPUs are there to place on?
+static inline int topology_num_cpus(void)
+{
+  const Topology *t = topology_get();
+  return (t->num_cpus > 0) ? t->num_cpus : 1;
+}
+
+// The OS number of the CPU for this placement
+// slot, or -1 if we do not set affinity.
+static inline int topology_cpu(int slot)
+{
+  const Topology *t = topology_get();
+  if( t->policy == TOPOLOGY_NONE || t->num_cpus == 0 )
+    return -1;
+  return t->cpus[ slot % t->num_cpus ].cpu;
+}
+
+// Bind the calling thread to a placement slot.
+static inline void topology_pin(int slot)
+{
+  const int cpu = topology_cpu(slot);
+  if( cpu < 0 )
+    return;
+
+  cpu_set_t affinity;
+  CPU_ZERO(&affinity);
+  CPU_SET(cpu, &affinity);
+  sched_setaffinity(0, sizeof(cpu_set_t), &affinity);
+}
+
+#endif
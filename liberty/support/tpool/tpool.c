@@ -1,3 +1,7 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <pthread.h>
@@ -11,10 +15,6 @@
 
 #if TPOOL_AFFINITY > 0
 
-#ifndef _GNU_SOURCE
-#define _GNU_SOURCE
-#endif
-
 #define TPOOL_DEBUG
 #undef TPOOL_DEBUG
 
@@ -23,8 +23,9 @@
 #include <sys/types.h>
 #include <sys/syscall.h>
 
+#include "../topology/topology.h"
 
-static pid_t gettid(void)
+static pid_t tpool_gettid(void)
 {
   return (pid_t) syscall(SYS_gettid);
 }
@@ -37,10 +38,12 @@ static void* tpool_worker_loop(void *tp) {
   ThreadPool tpool = thread->tpt_pool;
 
 #if TPOOL_AFFINITY > 0
-  cpu_set_t affinity;
-  CPU_ZERO(&affinity);
-  CPU_SET(thread->tpt_affinity, &affinity);
-  sched_setaffinity(gettid(),sizeof(cpu_set_t), &affinity);
+  if( thread->tpt_affinity >= 0 ) {
+    cpu_set_t affinity;
+    CPU_ZERO(&affinity);
+    CPU_SET(thread->tpt_affinity, &affinity);
+    sched_setaffinity(tpool_gettid(),sizeof(cpu_set_t), &affinity);
+  }
 #endif
 
   for(;;) {
@@ -129,7 +132,8 @@ void tpool_init(ThreadPool tpool, int numWorkers) {
     context->tpt_pool = tpool;
 
 #if TPOOL_AFFINITY > 0
-    context->tpt_affinity = (i+1) % TPOOL_AFFINITY;
+    // Read the topology here, not in the threads.
+    context->tpt_affinity = topology_cpu(i+1);
 #endif
 
     pthread_create(&context->tpt_threadId, 0, tpool_worker_loop, context);
@@ -5,10 +5,10 @@
 
 /* Affinity scheduling.
  * If 0, don't set processor affinity for this thread.
- * If >0, then set affinity in a round-robin fashion
- * along processors 0 ... TPOOL_AFFINITY-1
+ * If >0, then thread i takes placement slot i+1
+ * (see ../topology/topology.h)
  */
-#define TPOOL_AFFINITY      (24)
+#define TPOOL_AFFINITY      (1)
 
 typedef void (*Runnable)(void *);
 typedef void * Argument;
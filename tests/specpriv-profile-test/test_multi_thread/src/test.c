@@ -0,0 +1,60 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define MAX_THREADS 16
+
+typedef struct {
+  int tid;
+  int iters;
+  int *handoff; /* allocated by main, freed by the worker */
+  long sum;
+} task_t;
+
+static void *task(void *arg) {
+  task_t *t = (task_t *)arg;
+
+  for (int i = 0; i < t->iters; i++) {
+    int *tmp = (int *)malloc(4 * sizeof(int));
+    tmp[0] = t->tid;
+    tmp[1] = i;
+    tmp[2] = t->handoff[i % 4];
+    tmp[3] = 7;
+    t->sum += tmp[0] + tmp[1] + tmp[2] + tmp[3];
+    free(tmp);
+  }
+
+  free(t->handoff);
+  t->handoff = NULL;
+  return NULL;
+}
+
+int main(int argc, char *argv[]) {
+  int nthreads = atoi(argv[1]);
+  int iters = atoi(argv[2]);
+  if (nthreads > MAX_THREADS)
+    nthreads = MAX_THREADS;
+
+  pthread_t threads[MAX_THREADS];
+  task_t tasks[MAX_THREADS];
+
+  /* Two rounds, so that queues of exited threads are reused. */
+  long total = 0;
+  for (int round = 0; round < 2; round++) {
+    for (int i = 0; i < nthreads; i++) {
+      tasks[i].tid = i;
+      tasks[i].iters = iters;
+      tasks[i].sum = 0;
+      tasks[i].handoff = (int *)calloc(4, sizeof(int));
+      tasks[i].handoff[i % 4] = round;
+      pthread_create(&threads[i], NULL, task, &tasks[i]);
+    }
+    for (int i = 0; i < nthreads; i++) {
+      pthread_join(threads[i], NULL);
+      total += tasks[i].sum;
+    }
+  }
+
+  printf("%ld\n", total);
+  return 0;
+}